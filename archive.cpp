@@ -0,0 +1,496 @@
+#include <algorithm> // std::min, std::sort
+#include <cstring> // memcpy, memmove, strerror
+#include <cerrno>
+#include <stdexcept> // std::runtime_error, std::invalid_argument
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "archive.hpp"
+#include "byte_io.hpp"
+#include "worker_pool.hpp"
+
+using namespace std;
+
+static const char ARCHIVE_MAGIC[4] = {'S', 'A', 'R', 'C'};
+static const uint8_t ARCHIVE_VERSION = 1;
+
+// member number in the nonce above the segment number, see archive.hpp
+static const unsigned MEMBER_SHIFT = 40;
+static const uint64_t MAX_MEMBERS = (1ull << (64 - MEMBER_SHIFT)) - 1;
+static const uint64_t MAX_SEGMENTS = 1ull << (MEMBER_SHIFT - 1);
+
+static const size_t ENTRY_FIXED_LEN = 1 + 4 + 8 + 8 + 8 + 2;
+
+// plaintext bytes per work unit of packing and extraction
+static const size_t UNIT_BYTES = 1 << 20;
+
+static void encodeHeader(const StreamHeader& header, uint8_t out[ARCHIVE_HEADER_LEN]) {
+    memset(out, 0, ARCHIVE_HEADER_LEN);
+    memcpy(out, ARCHIVE_MAGIC, 4);
+    out[4] = ARCHIVE_VERSION;
+    out[5] = (uint8_t) header.variant;
+    putLE(out+8, header.segment_size, 4);
+    memcpy(out+12, header.salt, STREAM_SALT_LEN);
+}
+
+static StreamHeader decodeHeader(const uint8_t in[ARCHIVE_HEADER_LEN]) {
+    if (memcmp(in, ARCHIVE_MAGIC, 4) != 0)
+        throw runtime_error("not an archive");
+    if (in[4] != ARCHIVE_VERSION || in[5] > (uint8_t) SnuffleVariant::Chacha20)
+        throw runtime_error("unsupported archive version or cipher");
+    if (in[6] != 0 || in[7] != 0)
+        throw runtime_error("reserved bytes of the archive header not 0");
+
+    StreamHeader header;
+    header.variant = (SnuffleVariant) in[5];
+    header.segment_size = getLE(in+8, 4);
+    memcpy(header.salt, in+12, STREAM_SALT_LEN);
+    if (header.segment_size == 0 || header.segment_size > STREAM_MAX_SEGMENT_SIZE)
+        throw runtime_error("invalid segment size in archive header");
+    return header;
+}
+
+static uint64_t nrSegments(uint64_t size, uint32_t segment_size) {
+    return size ? (size + segment_size - 1) / segment_size : 1;
+}
+
+uint64_t archiveSealedSize(uint64_t size, uint32_t segment_size) {
+    return size + nrSegments(size, segment_size) * STREAM_TAG_LEN;
+}
+
+static uint64_t sealedSize(const ArchiveMember& member, uint32_t segment_size) {
+    return member.type == ArchiveMember::DIRECTORY ? 0 : archiveSealedSize(member.size, segment_size);
+}
+
+//  a range of segments of one member, what a worker seals or opens in one go
+struct WorkUnit {
+    size_t member;
+    uint64_t first;
+    size_t count;
+};
+
+static void addUnits(vector<WorkUnit>& units, size_t member, uint64_t size, uint32_t segment_size) {
+    const uint64_t nr_segments = nrSegments(size, segment_size);
+    const size_t per_unit = max<size_t>(1, UNIT_BYTES / segment_size);
+    for (uint64_t first=0; first < nr_segments; first += per_unit)
+        units.push_back({member, first, (size_t) min<uint64_t>(per_unit, nr_segments - first)});
+}
+
+// path as member name: no leading '/' or "./", no trailing '/', "" for the top
+static string memberName(const string& path) {
+    size_t begin = 0, end = path.size();
+    for (;;) {
+        if (begin < end && path[begin] == '/')
+            begin++;
+        else if (path.compare(begin, 2, "./") == 0)
+            begin += 2;
+        else
+            break;
+    }
+    while (end > begin && path[end-1] == '/')
+        end--;
+    string name = path.substr(begin, end - begin);
+    return name == "." ? "" : name;
+}
+
+static void collect(const string& path, const string& name, vector<ArchiveMember>& members, vector<string>& sources) {
+    struct stat st;
+    if (lstat(path.c_str(), &st) != 0)
+        throw runtime_error("could not stat " + path + ": " + strerror(errno));
+    if (!S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode))
+        return;
+    if (name.size() > UINT16_MAX)
+        throw runtime_error("name too long for an archive: " + path);
+
+    if (!name.empty()) {
+        ArchiveMember member;
+        member.name = name;
+        member.type = S_ISDIR(st.st_mode) ? ArchiveMember::DIRECTORY : ArchiveMember::FILE;
+        member.mode = st.st_mode & 07777;
+        member.mtime = st.st_mtime;
+        member.size = S_ISREG(st.st_mode) ? st.st_size : 0;
+        member.offset = 0;
+        members.push_back(member);
+        sources.push_back(path);
+    }
+    if (!S_ISDIR(st.st_mode))
+        return;
+
+    DIR* dir = opendir(path.c_str());
+    if (!dir)
+        throw runtime_error("could not open directory " + path + ": " + strerror(errno));
+    vector<string> entries;
+    while (struct dirent* e = readdir(dir))
+        if (strcmp(e->d_name, ".") != 0 && strcmp(e->d_name, "..") != 0)
+            entries.push_back(e->d_name);
+    closedir(dir);
+    sort(entries.begin(), entries.end());
+
+    const string prefix = path.empty() || path.back() == '/' ? path : path + "/";
+    for (auto& entry : entries)
+        collect(prefix + entry, name.empty() ? entry : name + "/" + entry, members, sources);
+}
+
+//  seal count segments of member from first on into buf (sealed layout), read from fd or, with fd -1,
+//  already in place there
+static size_t sealUnit(const SnuffleKeyContext& key, const StreamHeader& header, const uint8_t* aad,
+                       size_t member_nr, const ArchiveMember& member, int fd, uint64_t first, size_t count,
+                       uint8_t* buf) {
+    const uint32_t seg = header.segment_size;
+    const uint64_t nr_segments = nrSegments(member.size, seg);
+
+    size_t out = 0;
+    for (uint64_t i=first; i < first + count; i++) {
+        const uint64_t pos = i * seg;
+        const size_t len = min<uint64_t>(seg, member.size - pos);
+        if (fd >= 0 && preadFull(fd, buf + out, len, pos) != len)
+            throw runtime_error(member.name + " got shorter while it was packed");
+
+        uint8_t nonce[8];
+        streamSegmentNonce(nonce, (uint64_t) member_nr << MEMBER_SHIFT, i, i + 1 == nr_segments);
+        streamSealSegment(key, nonce, aad, ARCHIVE_HEADER_LEN, buf + out, len, buf + out + len);
+        out += len + STREAM_TAG_LEN;
+    }
+    return out;
+}
+
+vector<ArchiveMember> archivePack(const string& archive_path, const vector<string>& paths,
+                                  const SnuffleKeyContext& long_term_key, const StreamHeader& header, WorkerPool& pool) {
+    if (long_term_key.variant != header.variant)
+        throw invalid_argument("key and archive header are for different ciphers");
+    const SnuffleKeyContext key = streamSubkey(long_term_key, header.salt);
+    const uint32_t seg = header.segment_size;
+    if (seg == 0 || seg > STREAM_MAX_SEGMENT_SIZE)
+        throw invalid_argument("invalid archive segment size");
+
+    vector<ArchiveMember> members;
+    vector<string> sources;
+    for (auto& path : paths)
+        collect(path, memberName(path), members, sources);
+    if (members.size() > MAX_MEMBERS)
+        throw runtime_error("too many files for one archive");
+
+    // layout: members back to back after the header, then the index
+    uint64_t offset = ARCHIVE_HEADER_LEN;
+    vector<uint8_t> index;
+    for (auto& member : members) {
+        if (nrSegments(member.size, seg) > MAX_SEGMENTS)
+            throw runtime_error(member.name + " is too large for the segment size");
+        member.offset = offset;
+        offset += sealedSize(member, seg);
+
+        uint8_t entry[ENTRY_FIXED_LEN];
+        entry[0] = member.type;
+        putLE(entry+1, member.mode, 4);
+        putLE(entry+5, member.mtime, 8);
+        putLE(entry+13, member.size, 8);
+        putLE(entry+21, member.offset, 8);
+        putLE(entry+29, member.name.size(), 2);
+        index.insert(index.end(), entry, entry + sizeof(entry));
+        index.insert(index.end(), member.name.begin(), member.name.end());
+    }
+    const uint64_t index_offset = offset, index_size = index.size();
+    const uint64_t total = index_offset + archiveSealedSize(index_size, seg) + ARCHIVE_TRAILER_LEN;
+
+    int fd = open(archive_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        throw runtime_error("could not create " + archive_path + ": " + strerror(errno));
+    try {
+        // allocated up front, so the workers only fill in their regions
+        if (posix_fallocate(fd, 0, total) != 0 && ftruncate(fd, total) != 0)
+            throw runtime_error("could not allocate " + archive_path + ": " + strerror(errno));
+
+        uint8_t aad[ARCHIVE_HEADER_LEN];
+        encodeHeader(header, aad);
+        pwriteAll(fd, aad, sizeof(aad), 0);
+
+        vector<WorkUnit> units;
+        for (size_t m=0; m < members.size(); m++)
+            if (members[m].type == ArchiveMember::FILE)
+                addUnits(units, m, members[m].size, seg);
+
+        pool.parallelFor(units.size(), [&](size_t u) {
+            const WorkUnit& unit = units[u];
+            const ArchiveMember& member = members[unit.member];
+            int in = -1;
+            if (member.size && (in = open(sources[unit.member].c_str(), O_RDONLY | O_CLOEXEC)) < 0)
+                throw runtime_error("could not open " + sources[unit.member] + ": " + strerror(errno));
+
+            vector<uint8_t> buf(unit.count * ((size_t) seg + STREAM_TAG_LEN));
+            size_t len;
+            try {
+                len = sealUnit(key, header, aad, unit.member + 1, member, in, unit.first, unit.count, buf.data());
+            } catch (...) {
+                if (in >= 0)
+                    close(in);
+                throw;
+            }
+            if (in >= 0)
+                close(in);
+            pwriteAll(fd, buf.data(), len, member.offset + unit.first * (seg + STREAM_TAG_LEN));
+        });
+
+        // the index is member 0, followed by the trailer
+        ArchiveMember index_member = {"", ArchiveMember::FILE, 0, 0, index_size, index_offset};
+        const uint64_t index_segments = nrSegments(index_size, seg);
+        vector<uint8_t> sealed(archiveSealedSize(index_size, seg) + ARCHIVE_TRAILER_LEN);
+        for (uint64_t i=0; i < index_segments; i++)
+            memcpy(sealed.data() + i * (seg + STREAM_TAG_LEN), index.data() + i * seg,
+                   min<uint64_t>(seg, index_size - i * seg));
+        sealUnit(key, header, aad, 0, index_member, -1, 0, index_segments, sealed.data());
+        putLE(sealed.data() + sealed.size() - ARCHIVE_TRAILER_LEN, index_offset, 8);
+        putLE(sealed.data() + sealed.size() - 8, index_size, 8);
+        pwriteAll(fd, sealed.data(), sealed.size(), index_offset);
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+    if (close(fd) != 0)
+        throw runtime_error("could not write " + archive_path + ": " + strerror(errno));
+    return members;
+}
+
+ArchiveReader::ArchiveReader(const string& path, const SnuffleKeyContext& key) {
+    _fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (_fd < 0)
+        throw runtime_error("could not open " + path + ": " + strerror(errno));
+    try {
+        struct stat st;
+        if (fstat(_fd, &st) != 0)
+            throw runtime_error("could not stat " + path + ": " + strerror(errno));
+        if ((uint64_t) st.st_size < ARCHIVE_HEADER_LEN + STREAM_TAG_LEN + ARCHIVE_TRAILER_LEN
+            || preadFull(_fd, _aad, sizeof(_aad), 0) != sizeof(_aad))
+            throw runtime_error(path + " is not an archive");
+        _header = decodeHeader(_aad);
+        if (key.variant != _header.variant)
+            throw invalid_argument("key and archive are for different ciphers");
+        _key = streamSubkey(key, _header.salt);
+        readIndex(st.st_size);
+    } catch (...) {
+        close(_fd);
+        throw;
+    }
+}
+
+ArchiveReader::~ArchiveReader() {
+    close(_fd);
+}
+
+SnuffleVariant ArchiveReader::variant(const string& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        throw runtime_error("could not open " + path + ": " + strerror(errno));
+    uint8_t raw[ARCHIVE_HEADER_LEN];
+    size_t n;
+    try {
+        n = preadFull(fd, raw, sizeof(raw), 0);
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+    close(fd);
+    if (n != sizeof(raw))
+        throw runtime_error(path + " is not an archive");
+    return decodeHeader(raw).variant;
+}
+
+//  verify and decrypt count segments of member (member_nr in the nonces) from first on in buf,
+//  the plaintext ends up at the start of buf
+void ArchiveReader::openSegments(size_t member_nr, const ArchiveMember& member, uint64_t first, size_t count,
+                                 uint8_t* buf) const {
+    const uint32_t seg = _header.segment_size;
+    const uint64_t nr_segments = nrSegments(member.size, seg);
+
+    size_t in = 0, out = 0;
+    for (uint64_t i=first; i < first + count; i++) {
+        const size_t len = min<uint64_t>(seg, member.size - i * seg);
+        uint8_t nonce[8];
+        streamSegmentNonce(nonce, (uint64_t) member_nr << MEMBER_SHIFT, i, i + 1 == nr_segments);
+        if (!streamOpenSegment(_key, nonce, _aad, sizeof(_aad), buf + in, len, buf + in + len))
+            throw runtime_error((member_nr ? member.name : string("archive index")) + ": segment " + to_string(i)
+                                + " failed authentication (wrong key or archive modified)");
+        memmove(buf + out, buf + in, len);
+        in += len + STREAM_TAG_LEN;
+        out += len;
+    }
+}
+
+void ArchiveReader::readIndex(uint64_t file_size) {
+    uint8_t trailer[ARCHIVE_TRAILER_LEN];
+    if (preadFull(_fd, trailer, sizeof(trailer), file_size - sizeof(trailer)) != sizeof(trailer))
+        throw runtime_error("archive truncated");
+    const uint64_t index_offset = getLE(trailer, 8), index_size = getLE(trailer+8, 8);
+    const uint64_t index_end = file_size - sizeof(trailer);
+    // sizes checked before anything is allocated for them
+    if (index_offset < ARCHIVE_HEADER_LEN || index_offset > index_end || index_size > index_end - index_offset
+        || archiveSealedSize(index_size, _header.segment_size) != index_end - index_offset)
+        throw runtime_error("archive truncated or trailer corrupt");
+
+    ArchiveMember index_member = {"", ArchiveMember::FILE, 0, 0, index_size, index_offset};
+    vector<uint8_t> index(index_end - index_offset);
+    if (preadFull(_fd, index.data(), index.size(), index_offset) != index.size())
+        throw runtime_error("archive truncated");
+    openSegments(0, index_member, 0, nrSegments(index_size, _header.segment_size), index.data());
+
+    // the index is authenticated, but a buggy writer shouldn't make us read out of bounds
+    for (size_t pos=0; pos < index_size;) {
+        if (index_size - pos < ENTRY_FIXED_LEN)
+            throw runtime_error("archive index malformed");
+        const uint8_t* e = index.data() + pos;
+        ArchiveMember member;
+        member.type = (ArchiveMember::Type) e[0];
+        member.mode = getLE(e+1, 4);
+        member.mtime = getLE(e+5, 8);
+        member.size = getLE(e+13, 8);
+        member.offset = getLE(e+21, 8);
+        const size_t name_len = getLE(e+29, 2);
+        pos += ENTRY_FIXED_LEN;
+        if (index_size - pos < name_len || name_len == 0 || e[0] > ArchiveMember::DIRECTORY
+            || (member.type == ArchiveMember::DIRECTORY && member.size)
+            || member.size > index_offset || nrSegments(member.size, _header.segment_size) > MAX_SEGMENTS
+            || member.offset < ARCHIVE_HEADER_LEN || member.offset > index_offset
+            || sealedSize(member, _header.segment_size) > index_offset - member.offset
+            || _members.size() == MAX_MEMBERS)
+            throw runtime_error("archive index malformed");
+        member.name.assign((const char*) index.data() + pos, name_len);
+        pos += name_len;
+
+        _byName.emplace(member.name, _members.size());
+        _members.push_back(move(member));
+    }
+}
+
+const ArchiveMember* ArchiveReader::find(const string& name) const {
+    auto it = _byName.find(name);
+    return it == _byName.end() ? nullptr : &_members[it->second];
+}
+
+void ArchiveReader::extract(const ArchiveMember& member, int fd, WorkerPool* pool) const {
+    if (&member < _members.data() || &member >= _members.data() + _members.size())
+        throw invalid_argument("not a member of this archive");
+    if (member.type != ArchiveMember::FILE)
+        return;
+    const size_t member_nr = &member - _members.data() + 1;
+    const uint32_t seg = _header.segment_size;
+    const uint64_t sealed_size = sealedSize(member, seg);
+
+    vector<WorkUnit> units;
+    addUnits(units, member_nr - 1, member.size, seg);
+    // units opened side by side, written in order
+    const size_t batch = pool ? pool->size() * 2 + 2 : 1;
+    vector<vector<uint8_t>> bufs(min(batch, units.size()));
+    for (size_t first=0; first < units.size(); first += batch) {
+        const size_t n = min(batch, units.size() - first);
+        auto open_unit = [&](size_t k) {
+            const WorkUnit& unit = units[first + k];
+            const uint64_t begin = unit.first * (seg + STREAM_TAG_LEN);
+            const size_t len = min<uint64_t>(unit.count * (seg + STREAM_TAG_LEN), sealed_size - begin);
+            bufs[k].resize(len);
+            if (preadFull(_fd, bufs[k].data(), len, member.offset + begin) != len)
+                throw runtime_error("archive truncated");
+            openSegments(member_nr, member, unit.first, unit.count, bufs[k].data());
+            bufs[k].resize(len - unit.count * STREAM_TAG_LEN);
+        };
+        if (pool && n > 1)
+            pool->parallelFor(n, open_unit);
+        else
+            for (size_t k=0; k<n; k++)
+                open_unit(k);
+        for (size_t k=0; k<n; k++)
+            writeAll(fd, bufs[k].data(), bufs[k].size());
+    }
+}
+
+static void checkSafeName(const string& name) {
+    bool bad = name.empty() || name[0] == '/';
+    for (size_t begin=0; !bad && begin <= name.size();) {
+        size_t end = name.find('/', begin);
+        if (end == string::npos)
+            end = name.size();
+        bad = name.compare(begin, end - begin, "..") == 0;
+        begin = end + 1;
+    }
+    if (bad)
+        throw invalid_argument("refusing to extract " + name + " (absolute or contains ..)");
+}
+
+// mkdir -p of the directories above path (below dir, which exists)
+static void makeParents(const string& dir, const string& name) {
+    for (size_t slash = name.find('/'); slash != string::npos; slash = name.find('/', slash + 1)) {
+        const string path = dir + "/" + name.substr(0, slash);
+        if (mkdir(path.c_str(), 0700) != 0 && errno != EEXIST)
+            throw runtime_error("could not create " + path + ": " + strerror(errno));
+    }
+}
+
+void ArchiveReader::extractTo(const string& dir, const vector<string>& names, WorkerPool& pool) const {
+    vector<size_t> selected;
+    if (names.empty())
+        for (size_t m=0; m < _members.size(); m++)
+            selected.push_back(m);
+    for (auto& name : names) {
+        const ArchiveMember* member = find(name);
+        if (!member)
+            throw runtime_error("no member " + name + " in the archive");
+        selected.push_back(member - _members.data());
+    }
+    for (size_t m : selected)
+        checkSafeName(_members[m].name);
+
+    // create everything first, then fill the files in parallel
+    const uint32_t seg = _header.segment_size;
+    vector<WorkUnit> units;
+    for (size_t m : selected) {
+        const ArchiveMember& member = _members[m];
+        const string path = dir + "/" + member.name;
+        makeParents(dir, member.name);
+        if (member.type == ArchiveMember::DIRECTORY) {
+            if (mkdir(path.c_str(), 0700) != 0 && errno != EEXIST)
+                throw runtime_error("could not create " + path + ": " + strerror(errno));
+            continue;
+        }
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd < 0)
+            throw runtime_error("could not create " + path + ": " + strerror(errno));
+        bool ok = ftruncate(fd, member.size) == 0;
+        close(fd);
+        if (!ok)
+            throw runtime_error("could not allocate " + path + ": " + strerror(errno));
+        addUnits(units, m, member.size, seg);
+    }
+
+    pool.parallelFor(units.size(), [&](size_t u) {
+        const WorkUnit& unit = units[u];
+        const ArchiveMember& member = _members[unit.member];
+        const uint64_t begin = unit.first * (seg + STREAM_TAG_LEN);
+        const size_t len = min<uint64_t>(unit.count * (seg + STREAM_TAG_LEN), sealedSize(member, seg) - begin);
+        vector<uint8_t> buf(len);
+        if (preadFull(_fd, buf.data(), len, member.offset + begin) != len)
+            throw runtime_error("archive truncated");
+        openSegments(unit.member + 1, member, unit.first, unit.count, buf.data());
+
+        const string path = dir + "/" + member.name;
+        int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+        if (fd < 0)
+            throw runtime_error("could not open " + path + ": " + strerror(errno));
+        try {
+            pwriteAll(fd, buf.data(), len - unit.count * STREAM_TAG_LEN, unit.first * seg);
+        } catch (...) {
+            close(fd);
+            throw;
+        }
+        close(fd);
+    });
+
+    // permissions (without setuid and the like) and mtimes last, in reverse: directories come before
+    // what is in them in the index and get theirs after it
+    for (size_t k = selected.size(); k-- > 0;) {
+        const ArchiveMember& member = _members[selected[k]];
+        const string path = dir + "/" + member.name;
+        struct timespec times[2] = {{0, UTIME_OMIT}, {(time_t) member.mtime, 0}};
+        if (chmod(path.c_str(), member.mode & 0777) != 0 || utimensat(AT_FDCWD, path.c_str(), times, 0) != 0)
+            throw runtime_error("could not set mode and time of " + path + ": " + strerror(errno));
+    }
+}
@@ -0,0 +1,108 @@
+#ifndef ARCHIVE_HPP
+#define ARCHIVE_HPP
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "snuffle_core.hpp"
+#include "stream_aead.hpp"
+
+class WorkerPool;
+
+/*  Single file encrypted archive with an index at the end
+
+    Every member is a sealed stream (stream_aead.hpp) of its own: segments of segment size,
+    each encrypted and authenticated with Poly1305, the archive header as associated data.
+    All of them use the archive key, derived from the long term key and the random salt in the
+    header like a stream key (streamSubkey(), same limits on archives per key). Member m (from 1
+    on, in index order) uses the nonce base m << 40, the index is member 0. The segment number
+    takes the low 40 bits of the nonce, so no two segments of an archive share one; members
+    can't be swapped, cut short or moved around without failing authentication.
+
+    Sizes are known up front, so packing lays out all members first and then has the workers
+    seal pieces of any member straight into their region of the (preallocated) file. Extracting
+    one member reads the index once and then only that member's segments.
+
+    Format:  header: "SARC" | version u8 | variant u8 | 0 u16 | segment size u32 | salt [16]
+             members: sealed segments (ciphertext [segment size] | tag [16]), the last one shorter
+             index: sealed as member 0, entries of
+                    type u8 | mode u32 | mtime i64 | size u64 | offset u64 | name length u16 | name
+             trailer: index offset u64 | index size u64                    (integers little endian)
+    A file of n bytes takes max(1, ceil(n / segment size)) segments (an empty one a lone tag),
+    a directory none.
+*/
+
+static const size_t ARCHIVE_HEADER_LEN = 28;
+static const size_t ARCHIVE_TRAILER_LEN = 16;
+
+struct ArchiveMember {
+    enum Type : uint8_t { FILE = 0, DIRECTORY = 1 };
+
+    std::string name;   // relative path, '/' separated
+    Type type;
+    uint32_t mode;      // permission bits
+    int64_t mtime;      // seconds since the epoch
+    uint64_t size;      // plaintext bytes
+    uint64_t offset;    // of the first sealed segment in the archive
+};
+
+//  bytes a file of size plaintext bytes takes in the archive
+uint64_t archiveSealedSize(uint64_t size, uint32_t segment_size);
+
+/*  pack the regular files and directories (recursively) of paths into a new archive at archive_path
+    header gives cipher, segment size and the salt (pick it at random), member names are
+    the paths without leading '/'. Symlinks and special files are skipped
+    throws std::runtime_error on I/O errors or a file that got shorter while it was packed,
+    std::invalid_argument if key and header don't match; returns the members packed */
+std::vector<ArchiveMember> archivePack(const std::string& archive_path, const std::vector<std::string>& paths,
+                                       const SnuffleKeyContext& key, const StreamHeader& header, WorkerPool& pool);
+
+class ArchiveReader {
+
+public:
+
+    /*  open an archive and read and authenticate its index
+        throws std::runtime_error if it isn't an archive, the index fails authentication or is
+        malformed; key.variant has to match the header (see variant()) */
+    ArchiveReader(const std::string& path, const SnuffleKeyContext& key);
+    ~ArchiveReader();
+
+    ArchiveReader(const ArchiveReader&) = delete;
+    ArchiveReader& operator=(const ArchiveReader&) = delete;
+
+    //  cipher of the archive at path without the key, to pick the key context
+    static SnuffleVariant variant(const std::string& path);
+
+    const std::vector<ArchiveMember>& members() const { return _members; }
+
+    //  member by name, nullptr if there is none
+    const ArchiveMember* find(const std::string& name) const;
+
+    /*  decrypt member to fd in order (pipes work), segments opened in parallel with a pool
+        throws std::runtime_error on I/O errors or segments failing authentication: what was
+        written to fd before that is only to be trusted once it returned normally */
+    void extract(const ArchiveMember& member, int fd, WorkerPool* pool) const;
+
+    /*  recreate members (all of them if names is empty) below dir with their modes and mtimes
+        throws std::runtime_error as extract() and for unknown names, std::invalid_argument for
+        member names that are absolute or contain ".." */
+    void extractTo(const std::string& dir, const std::vector<std::string>& names, WorkerPool& pool) const;
+
+private:
+
+    int _fd = -1;
+    SnuffleKeyContext _key;             // archive key
+    StreamHeader _header;
+    uint8_t _aad[ARCHIVE_HEADER_LEN];
+    std::vector<ArchiveMember> _members;
+    std::unordered_map<std::string, size_t> _byName;
+
+    void readIndex(uint64_t file_size);
+    void openSegments(size_t member_nr, const ArchiveMember& member, uint64_t first, size_t count,
+                      uint8_t* buf) const;
+};
+
+#endif // ARCHIVE_HPP
@@ -0,0 +1,41 @@
+#ifndef ARX_LANES_HPP
+#define ARX_LANES_HPP
+
+#include <stdint.h>
+
+/*  ARX (add, rotate, xor) building blocks shared by the lane kernels of
+    snuffle_kernels.cpp (Salsa20/Chacha20) and blake.cpp (BLAKE2s/BLAKE3)
+
+    arx_lanes_t holds one 32 bit word for each of ARX_LANES independent lanes
+    (GCC vector extensions, SSE2 or AVX2 depending on the clone that runs).
+    The macros work on plain uint32_t as well as on arx_lanes_t.
+    Internal to the library, not installed with the public headers.
+*/
+
+#define ARX_LANES 8
+
+typedef uint32_t arx_lanes_t __attribute__((vector_size(4*ARX_LANES)));
+
+//  kernels marked with this are compiled for AVX2 and the generic target, picked at load time
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__clang__)
+#define ARX_TARGET_CLONES __attribute__((target_clones("avx2", "default")))
+#define ARX_HAVE_TARGET_CLONES 1
+#else
+#define ARX_TARGET_CLONES
+#define ARX_HAVE_TARGET_CLONES 0
+#endif
+
+#define ARX_ROTL(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+#define ARX_ROTR(v, n) (((v) >> (n)) | ((v) << (32 - (n))))
+
+/*  the quarter round shape shared by Chacha20 and the G function of BLAKE2s/BLAKE3:
+    Chacha20: ARX_QUARTER(ARX_ROTL, a, b, c, d, 0, 0, 16, 12, 8, 7)
+    BLAKE:    ARX_QUARTER(ARX_ROTR, a, b, c, d, m[s0], m[s1], 16, 12, 8, 7)
+    (the message words mx, my are added to a, the constant 0 gets optimized away) */
+#define ARX_QUARTER(ROT, a, b, c, d, mx, my, r0, r1, r2, r3) \
+    a += b + (mx); d = ROT(d ^ a, r0); \
+    c += d;        b = ROT(b ^ c, r1); \
+    a += b + (my); d = ROT(d ^ a, r2); \
+    c += d;        b = ROT(b ^ c, r3);
+
+#endif // ARX_LANES_HPP
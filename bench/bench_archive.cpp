@@ -0,0 +1,81 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include "../archive.hpp"
+#include "../worker_pool.hpp"
+
+using namespace std;
+
+/*  Archive of N files of 1 MiB: packing on 1 thread vs. the pool, then extracting one member
+    (open + index + member, what a tar-like sequential format would pay a full pass for) and
+    extracting everything
+
+    usage: bench_archive [files] [dir]
+*/
+
+static double secsSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char** argv) {
+    size_t nr_files = argc > 1 ? strtoull(argv[1], nullptr, 10) : 256;
+    string dir = argc > 2 ? argv[2] : "bench_archive.tmp";
+    const size_t file_len = 1 << 20, total = nr_files * file_len;
+    const string src = dir + "/src", out = dir + "/out", path = dir + "/bench.sarc";
+
+    mkdir(dir.c_str(), 0700);
+    mkdir(src.c_str(), 0700);
+    mkdir(out.c_str(), 0700);
+    vector<uint8_t> data(file_len);
+    mt19937_64 rng(1);
+    for (size_t f=0; f<nr_files; f++) {
+        for (auto& b : data) b = rng();
+        int fd = open((src + "/f" + to_string(f)).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (write(fd, data.data(), data.size()) != (ssize_t) data.size())
+            return 1;
+        close(fd);
+    }
+
+    uint8_t raw_key[32] = {1};
+    SnuffleKeyContext key;
+    snuffleInitKey(key, SnuffleVariant::Chacha20, raw_key, sizeof(raw_key));
+    StreamHeader header = {SnuffleVariant::Chacha20, STREAM_DEFAULT_SEGMENT_SIZE, {2}};
+
+    WorkerPool one(1), pool;
+    cout << nr_files << " files of 1 MiB, " << pool.size() << " workers" << endl;
+    for (WorkerPool* p : {&one, &pool}) {
+        auto start = chrono::steady_clock::now();
+        archivePack(path, {src}, key, header, *p);
+        cout << "pack, " << setw(2) << p->size() << " threads:   " << fixed << setprecision(1) << setw(8)
+             << total / secsSince(start) / 1e6 << " MB/s" << endl;
+    }
+
+    // member names are the paths without leading '/'
+    const string name_prefix = src.substr(src.find_first_not_of('/'));
+    const size_t nr_lookups = 200;
+    int null_fd = open("/dev/null", O_WRONLY);
+    auto start = chrono::steady_clock::now();
+    for (size_t i=0; i<nr_lookups; i++) {
+        ArchiveReader archive(path, key);
+        archive.extract(*archive.find(name_prefix + "/f" + to_string(rng() % nr_files)), null_fd, nullptr);
+    }
+    cout << "open + extract one member: " << setw(8) << secsSince(start) / nr_lookups * 1e3 << " ms" << endl;
+    close(null_fd);
+
+    start = chrono::steady_clock::now();
+    ArchiveReader(path, key).extractTo(out, {}, pool);
+    cout << "extract all:               " << setw(8) << total / secsSince(start) / 1e6 << " MB/s" << endl;
+
+    string cleanup = "rm -rf '" + dir + "'";
+    return system(cleanup.c_str());
+}
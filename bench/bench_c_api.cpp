@@ -0,0 +1,88 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+#include <cstdlib>
+#include <stdint.h>
+
+#include "../snuffle_c.h"
+#include "../salsa20.hpp"
+
+using namespace std;
+
+/*  Throughput of the C interface against Chacha20::encryptBytes() over the same bytes:
+    snuffle_xor() on one large buffer, then batches of equal sized buffers as one stream
+    (snuffle_xor_buffers), one stream each (snuffle_xor_streams) and one message each
+    (snuffle_xor_messages)
+
+    usage: bench_c_api [MiB]
+*/
+
+template <class Fn>
+static double mbPerSecond(size_t bytes, Fn fn) {
+    const unsigned rounds = 3;
+    fn(); // warm up, fault in the pages
+    auto start = chrono::steady_clock::now();
+    for (unsigned r=0; r<rounds; r++)
+        fn();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count() / rounds;
+    return bytes / seconds / 1e6;
+}
+
+int main(int argc, char** argv) {
+    size_t mib = argc > 1 ? strtoull(argv[1], nullptr, 10) : 64;
+    const size_t len = mib << 20;
+
+    vector<uint8_t> key(32, 0x42);
+    vector<uint8_t> input(len, 0x5a), output(len);
+    Chacha20 cipher(key);
+    snuffle_stream* stream;
+    snuffle_new(&stream, SNUFFLE_CHACHA20, key.data(), key.size(), nullptr);
+
+    double reference = mbPerSecond(len, [&] {
+        cipher.setNonce(0);
+        cipher.encryptBytes(input.data(), output.data(), len);
+    });
+    double single = mbPerSecond(len, [&] {
+        snuffle_seek(stream, 0);
+        snuffle_xor(stream, input.data(), output.data(), len);
+    });
+    cout << fixed << setprecision(0) << "encryptBytes " << reference << " MB/s, snuffle_xor " << single
+         << " MB/s  (" << setprecision(2) << single / reference << "x)" << endl;
+
+    for (size_t size : {100, 1500, 16384}) {
+        size_t count = len / size;
+        vector<const uint8_t*> ins(count);
+        vector<uint8_t*> outs(count);
+        vector<size_t> lens(count, size);
+        vector<uint8_t> nonces(8*count);
+        vector<snuffle_stream*> streams(count);
+        for (size_t i=0; i<count; i++) {
+            ins[i] = input.data() + i*size;
+            outs[i] = output.data() + i*size;
+            nonces[8*i] = i;
+            nonces[8*i + 1] = i >> 8;
+            nonces[8*i + 2] = i >> 16;
+            snuffle_new(&streams[i], SNUFFLE_CHACHA20, key.data(), key.size(), &nonces[8*i]);
+        }
+        const size_t bytes = count * size;
+
+        double buffers = mbPerSecond(bytes, [&] {
+            snuffle_seek(stream, 0);
+            snuffle_xor_buffers(stream, ins.data(), outs.data(), lens.data(), count);
+        });
+        double per_stream = mbPerSecond(bytes, [&] {
+            snuffle_xor_streams(streams.data(), ins.data(), outs.data(), lens.data(), count);
+        });
+        double messages = mbPerSecond(bytes, [&] {
+            snuffle_xor_messages(stream, nonces.data(), ins.data(), outs.data(), lens.data(), count);
+        });
+        cout << setw(6) << size << " byte buffers:  buffers " << setprecision(0) << setw(5) << buffers
+             << " MB/s, streams " << setw(5) << per_stream << " MB/s, messages " << setw(5) << messages << " MB/s" << endl;
+
+        for (auto s : streams) snuffle_free(s);
+    }
+
+    snuffle_free(stream);
+    return 0;
+}
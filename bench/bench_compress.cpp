@@ -0,0 +1,133 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <stdint.h>
+
+#include "../lz.hpp"
+#include "../stream_aead.hpp"
+#include "../worker_pool.hpp"
+
+using namespace std;
+
+/*  Compression ahead of the cipher: LZ on one thread over text like data (words from a small
+    vocabulary) and random data, then sealing and opening N MiB files with and without
+    compression on the pool, and random 4 KiB reads through SealedStreamReader
+
+    usage: bench_compress [MiB] [dir]
+*/
+
+static double secsSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+static void report(const string& what, size_t len, double s) {
+    cout << what << fixed << setprecision(1) << setw(8) << len / s / 1e6 << " MB/s" << endl;
+}
+
+static uint64_t fileSize(const string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 ? st.st_size : 0;
+}
+
+int main(int argc, char** argv) {
+    size_t mib = argc > 1 ? strtoull(argv[1], nullptr, 10) : 128;
+    string dir = argc > 2 ? argv[2] : ".";
+    const size_t len = mib << 20;
+
+    mt19937_64 rng(1);
+    vector<string> words;
+    for (unsigned i=0; i<2000; i++) {
+        string word;
+        for (size_t n = 2 + rng() % 9; n; n--)
+            word += 'a' + rng() % 26;
+        words.push_back(word);
+    }
+    vector<uint8_t> text, random(len);
+    while (text.size() < len) {
+        const string& word = words[rng() % words.size()];
+        text.insert(text.end(), word.begin(), word.end());
+        text.push_back(rng() % 12 ? ' ' : '\n');
+    }
+    text.resize(len);
+    for (auto& b : random) b = rng();
+
+    const size_t block = 64 * 1024;
+    vector<uint8_t> packed(lzCompressBound(block)), unpacked(block);
+    for (auto data : {&text, &random}) {
+        const string name = data == &text ? "text:   " : "random: ";
+        size_t packed_total = 0;
+        auto start = chrono::steady_clock::now();
+        for (size_t off=0; off < len; off += block)
+            packed_total += lzCompress(data->data() + off, block, packed.data(), packed.size());
+        report(name + "LZ compress, 1 thread:   ", len, secsSince(start));
+        cout << "        ratio " << setprecision(2) << (double) len / packed_total << endl;
+
+        size_t n = lzCompress(data->data(), block, packed.data(), packed.size());
+        start = chrono::steady_clock::now();
+        for (size_t off=0; off < len; off += block)
+            lzDecompress(packed.data(), n, unpacked.data(), unpacked.size());
+        report(name + "LZ decompress, 1 thread: ", len, secsSince(start));
+    }
+
+    WorkerPool pool;
+    cout << mib << " MiB, " << pool.size() << " workers" << endl;
+    uint8_t raw_key[32] = {1};
+    SnuffleKeyContext key;
+    snuffleInitKey(key, SnuffleVariant::Chacha20, raw_key, sizeof(raw_key));
+    const string input = dir + "/bench_compress.in", sealed = dir + "/bench_compress.sealed";
+    const string output = dir + "/bench_compress.out";
+
+    for (auto data : {&text, &random}) {
+        int fd = open(input.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (write(fd, data->data(), len) != (ssize_t) len)
+            return 1;
+        close(fd);
+
+        for (bool compressed : {false, true}) {
+            const string name = string(data == &text ? "text, " : "random, ") + (compressed ? "compressed: " : "plain:      ");
+            StreamHeader header = {SnuffleVariant::Chacha20, STREAM_DEFAULT_SEGMENT_SIZE, {2}, compressed};
+            int in_fd = open(input.c_str(), O_RDONLY), out_fd = open(sealed.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            auto start = chrono::steady_clock::now();
+            streamSeal(in_fd, out_fd, key, header, pool);
+            report(name + "seal  ", len, secsSince(start));
+            close(in_fd);
+            close(out_fd);
+            cout << "        " << fileSize(sealed) << " bytes sealed" << endl;
+
+            in_fd = open(sealed.c_str(), O_RDONLY);
+            out_fd = open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            start = chrono::steady_clock::now();
+            streamOpen(in_fd, out_fd, key, streamReadHeader(in_fd), pool);
+            report(name + "open  ", len, secsSince(start));
+            close(in_fd);
+            close(out_fd);
+
+            SealedStreamReader reader(sealed, key);
+            const size_t nr_reads = 2000;
+            uint8_t buf[4096];
+            start = chrono::steady_clock::now();
+            for (size_t i=0; i<nr_reads; i++) {
+                uint64_t offset = rng() % (len - sizeof(buf));
+                if (reader.read(offset, buf, sizeof(buf)) != sizeof(buf) || memcmp(buf, data->data() + offset, sizeof(buf)) != 0) {
+                    cerr << "random read differs" << endl;
+                    return 1;
+                }
+            }
+            cout << name << "random 4 KiB read " << setprecision(1) << setw(6)
+                 << secsSince(start) / nr_reads * 1e6 << " us" << endl;
+        }
+    }
+
+    remove(input.c_str());
+    remove(sealed.c_str());
+    remove(output.c_str());
+    return 0;
+}
@@ -0,0 +1,96 @@
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <stdint.h>
+
+#include "../datagram.hpp"
+#include "../salsa20.hpp"
+
+using namespace std;
+
+/*  Datagram decryption of out of order packets, Chacha20, batches of 64:
+    a Chacha20 object with setNonce(hex string) per packet (the old way), DatagramCipher::open()
+    per packet and DatagramCipher::openBatch(), unauthenticated and with Poly1305
+
+    usage: bench_datagram [packet bytes] [packets]
+*/
+
+static double mppsSince(chrono::steady_clock::time_point start, size_t packets) {
+    return packets / chrono::duration<double>(chrono::steady_clock::now() - start).count() / 1e6;
+}
+
+int main(int argc, char** argv) {
+    size_t packet_len = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1200;
+    size_t nr_packets = argc > 2 ? strtoull(argv[2], nullptr, 10) : 200000;
+    const size_t batch = 64;
+
+    const string key_hex = "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f";
+    Chacha20 cipher(key_hex, true);
+    const uint8_t base_nonce[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+
+    // one batch of packets, sequence numbers shuffled
+    vector<vector<uint8_t>> bufs(batch, vector<uint8_t>(packet_len + DatagramCipher::TAG_LEN, 0x5a));
+    vector<uint64_t> seqs(batch);
+    for (size_t i=0; i<batch; i++)
+        seqs[i] = 1000 + i;
+    shuffle(seqs.begin(), seqs.end(), mt19937(1));
+
+    cout << packet_len << " byte packets, batches of " << batch << endl;
+
+    for (bool authenticated : {false, true}) {
+        DatagramCipher dc(cipher.keyContext(), base_nonce, authenticated);
+        cout << (authenticated ? "with Poly1305 (rounds include resealing the batch):" : "unauthenticated:") << endl;
+
+        if (!authenticated) {
+            auto start = chrono::steady_clock::now();
+            for (size_t p=0; p<nr_packets; p++) {
+                uint8_t nonce[8];
+                char nonce_hex[17];
+                dc.packetNonce(seqs[p % batch], nonce);
+                for (int i=0; i<8; i++)
+                    snprintf(nonce_hex + 2*i, 3, "%02x", nonce[i]);
+                Chacha20 c(key_hex, true);
+                c.setNonce(nonce_hex);
+                c.encryptBytes(bufs[p % batch].data(), bufs[p % batch].data(), packet_len);
+            }
+            cout << "  Chacha20 + setNonce per packet: " << fixed << setprecision(2) << setw(7)
+                 << mppsSince(start, nr_packets) << " Mpps" << endl;
+        }
+
+        // sealed packets to open, opened again after every round
+        vector<DatagramPacket> packets(batch);
+        auto reseal = [&] {
+            for (size_t i=0; i<batch; i++)
+                packets[i] = {seqs[i], bufs[i].data(), packet_len, false};
+            dc.sealBatch(packets.data(), batch);
+        };
+
+        reseal();
+        auto start = chrono::steady_clock::now();
+        size_t done = 0;
+        for (; done < nr_packets; done += batch) {
+            for (size_t i=0; i<batch; i++)
+                dc.open(packets[i].seq, packets[i].data, packets[i].len);
+            if (authenticated)
+                reseal();
+        }
+        cout << "  open() per packet:              " << setw(7) << mppsSince(start, done) << " Mpps" << endl;
+
+        reseal();
+        start = chrono::steady_clock::now();
+        for (done=0; done < nr_packets; done += batch) {
+            dc.openBatch(packets.data(), batch);
+            if (authenticated)
+                reseal();
+        }
+        double mpps = mppsSince(start, done);
+        cout << "  openBatch():                    " << setw(7) << mpps << " Mpps, "
+             << setw(6) << mpps * packet_len * 8 / 1e3 << " Gbit/s" << endl;
+    }
+    return 0;
+}
@@ -0,0 +1,104 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include "../dedup_store.hpp"
+#include "../snuffle_core.hpp"
+#include "../snuffle_kernels.hpp"
+#include "../worker_pool.hpp"
+
+using namespace std;
+
+/*  DedupStore ingest of an N MiB file of random data vs. plain Chacha20 over it (in memory,
+    one thread): boundary scan alone, ingest of new data (chunk, derive, encrypt, write) and
+    of the same file again (everything a duplicate), then restore
+
+    usage: bench_dedup [MiB] [store dir]
+*/
+
+static double secsSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+static void report(const string& what, size_t len, double s) {
+    cout << what << fixed << setprecision(1) << setw(8) << len / s / 1e6 << " MB/s" << endl;
+}
+
+int main(int argc, char** argv) {
+    size_t mib = argc > 1 ? strtoull(argv[1], nullptr, 10) : 256;
+    string dir = argc > 2 ? argv[2] : "bench_dedup.store";
+    const size_t len = mib << 20;
+    const string input_path = dir + ".input";
+
+    vector<uint8_t> data(len), out(len);
+    mt19937_64 rng(1);
+    for (size_t i=0; i+8 <= len; i += 8) {
+        uint64_t r = rng();
+        memcpy(data.data() + i, &r, 8);
+    }
+    {
+        int fd = open(input_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (write(fd, data.data(), len) != (ssize_t) len)
+            return 1;
+        close(fd);
+    }
+
+    WorkerPool pool;
+    cout << mib << " MiB, " << pool.size() << " workers" << endl;
+
+    uint8_t key[32] = {1}, nonce[8] = {2};
+    SnuffleKeyContext ctx;
+    snuffleInitKey(ctx, SnuffleVariant::Chacha20, key, sizeof(key));
+    auto start = chrono::steady_clock::now();
+    snuffleXorKeystream(ctx, nonce, 0, data.data(), out.data(), len);
+    report("Chacha20, 1 thread:      ", len, secsSince(start));
+
+    vector<size_t> cuts, pool_cuts;
+    start = chrono::steady_clock::now();
+    cdcCut(data.data(), len, true, CdcParams(), cuts);
+    report("chunk boundaries:        ", len, secsSince(start));
+    start = chrono::steady_clock::now();
+    cdcCut(data.data(), len, true, CdcParams(), pool_cuts, &pool);
+    report("chunk boundaries, pool:  ", len, secsSince(start));
+    if (cuts != pool_cuts) {
+        cerr << "boundaries differ with the pool" << endl;
+        return 1;
+    }
+    cout << cuts.size() << " chunks, " << len / cuts.size() << " bytes on average" << endl;
+
+    const uint8_t store_secret[32] = {3};
+    vector<DedupStore::ChunkRef> recipe;
+    for (bool again : {false, true}) {
+        DedupStore store(dir, store_secret);
+        int fd = open(input_path.c_str(), O_RDONLY);
+        start = chrono::steady_clock::now();
+        recipe = store.ingest(fd, &pool);
+        report(again ? "ingest, all duplicates:  " : "ingest, all new:         ", len, secsSince(start));
+        close(fd);
+        cout << "  " << store.newChunks() << " of " << store.ingestedChunks() << " chunks stored" << endl;
+    }
+
+    {
+        DedupStore store(dir, store_secret);
+        int fd = open(input_path.c_str(), O_WRONLY | O_TRUNC);
+        start = chrono::steady_clock::now();
+        store.restore(recipe, fd, &pool);
+        report("restore:                 ", len, secsSince(start));
+        close(fd);
+    }
+
+    remove((dir + "/chunks.dat").c_str());
+    remove((dir + "/chunks.idx").c_str());
+    remove((dir + "/recipes").c_str());
+    remove(dir.c_str());
+    remove(input_path.c_str());
+    return 0;
+}
@@ -0,0 +1,133 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include "../encrypted_socket.hpp"
+#include "../salsa20.hpp"
+
+using namespace std;
+
+/*  Encrypted TCP over loopback, messages of 64 KiB:
+    what applications do around encryptBytes (copy the message, encrypt the copy, send it,
+    receive into a buffer and decrypt into another) vs. EncryptedSocket (encrypt into its
+    send buffers, MSG_ZEROCOPY where it pays off, decrypt in the receive buffer)
+
+    usage: bench_encrypted_socket [MiB] [message bytes]
+*/
+
+static void connectedPair(int& client, int& server) {
+    int listener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (bind(listener, (sockaddr*) &addr, len) != 0 || listen(listener, 1) != 0
+        || getsockname(listener, (sockaddr*) &addr, &len) != 0) {
+        perror("listen");
+        exit(1);
+    }
+    client = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (connect(client, (sockaddr*) &addr, len) != 0) {
+        perror("connect");
+        exit(1);
+    }
+    server = accept(listener, nullptr, nullptr);
+    close(listener);
+}
+
+static bool sendAll(int fd, const uint8_t* buf, size_t len) {
+    while (len) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n <= 0)
+            return false;
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    size_t mib = argc > 1 ? strtoull(argv[1], nullptr, 10) : 512;
+    size_t msg_len = argc > 2 ? strtoull(argv[2], nullptr, 10) : 64 * 1024;
+    const uint64_t total = (uint64_t) mib << 20;
+
+    const string key_hex = "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f";
+    const string nonce_hex = "0102030405060708";
+    const uint8_t nonce[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+    Chacha20 probe(key_hex, true);
+    const SnuffleKeyContext key = probe.keyContext();
+
+    vector<uint8_t> message(msg_len, 0x5a);
+    cout << mib << " MiB in " << msg_len << " byte messages over loopback TCP, Chacha20" << endl;
+
+    // encryptBytes around plain send and recv
+    {
+        int client, server;
+        connectedPair(client, server);
+        auto start = chrono::steady_clock::now();
+        thread receiver([&] {
+            Chacha20 cipher(key_hex, true);
+            cipher.setNonce(nonce_hex);
+            vector<uint8_t> in(msg_len), out(msg_len);
+            for (uint64_t got=0; got < total;) {
+                ssize_t n = recv(server, in.data(), in.size(), 0);
+                if (n <= 0)
+                    break;
+                cipher.encryptBytes(in.data(), out.data(), n);
+                got += n;
+            }
+        });
+        Chacha20 cipher(key_hex, true);
+        cipher.setNonce(nonce_hex);
+        for (uint64_t sent=0; sent < total; sent += msg_len) {
+            vector<uint8_t> copy(message);
+            cipher.encryptBytes(copy);
+            if (!sendAll(client, copy.data(), copy.size()))
+                return 1;
+        }
+        receiver.join();
+        double s = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << "encryptBytes + send/recv: " << fixed << setprecision(2) << setw(6) << total * 8 / s / 1e9 << " Gbit/s" << endl;
+        close(client);
+        close(server);
+    }
+
+    // EncryptedSocket on both ends
+    {
+        int client, server;
+        connectedPair(client, server);
+        auto start = chrono::steady_clock::now();
+        thread receiver([&] {
+            EncryptedSocket sock(server, key, nonce, nonce);
+            vector<uint8_t> buf(msg_len);
+            for (uint64_t got=0; got < total;) {
+                size_t n = sock.recv(buf.data(), buf.size());
+                if (n == 0)
+                    break;
+                got += n;
+            }
+        });
+        EncryptedSocket sock(client, key, nonce, nonce);
+        for (uint64_t sent=0; sent < total; sent += msg_len)
+            sock.write(message.data(), msg_len);
+        sock.drain();
+        receiver.join();
+        double s = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << "EncryptedSocket:          " << setw(6) << total * 8 / s / 1e9 << " Gbit/s, "
+             << sock.zerocopySends() << " zerocopy sends, " << sock.copiedCompletions() << " copied by the kernel"
+             << (sock.zerocopy() ? "" : ", zerocopy off") << endl;
+        close(client);
+        close(server);
+    }
+    return 0;
+}
@@ -0,0 +1,59 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+#include <cstdlib>
+#include <stdint.h>
+
+#include "../snuffle_kernels.hpp"
+
+using namespace std;
+
+/*  One input for N recipients: snuffleFanOut() vs. N separate snuffleXorKeystream() calls
+    (the input read N times), Chacha20, buffers larger than the caches
+
+    usage: bench_fanout [MiB] [max recipients]
+*/
+
+template <class Fn>
+static double seconds(unsigned rounds, Fn fn) {
+    fn(); // warm up, fault in the pages
+    auto start = chrono::steady_clock::now();
+    for (unsigned r=0; r<rounds; r++)
+        fn();
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count() / rounds;
+}
+
+int main(int argc, char** argv) {
+    size_t mib = argc > 1 ? strtoull(argv[1], nullptr, 10) : 16;
+    size_t max_recipients = argc > 2 ? strtoull(argv[2], nullptr, 10) : 16;
+    const size_t len = mib << 20;
+    const unsigned rounds = 3;
+
+    vector<uint8_t> input(len, 0x5a);
+    cout << "kernel: " << snuffleKernelName() << ", " << mib << " MiB" << endl;
+
+    for (size_t n=1; n <= max_recipients; n *= 2) {
+        vector<SnuffleKeyContext> keys(n);
+        vector<uint8_t> nonces(8*n);
+        vector<vector<uint8_t>> outputs(n, vector<uint8_t>(len));
+        vector<uint8_t*> output_ptrs;
+        for (size_t r=0; r<n; r++) {
+            uint8_t key[32] = {(uint8_t) r, 1};
+            snuffleInitKey(keys[r], SnuffleVariant::Chacha20, key, sizeof(key));
+            nonces[8*r] = r;
+            output_ptrs.push_back(outputs[r].data());
+        }
+
+        double separate = seconds(rounds, [&] {
+            for (size_t r=0; r<n; r++)
+                snuffleXorKeystream(keys[r], &nonces[8*r], 0, input.data(), output_ptrs[r], len);
+        });
+        double fan_out = seconds(rounds, [&] {
+            snuffleFanOut(keys.data(), nonces.data(), n, 0, input.data(), output_ptrs.data(), len);
+        });
+        cout << setw(3) << n << " recipients:  separate " << fixed << setprecision(3) << separate
+             << " s, fan-out " << fan_out << " s  (" << setprecision(2) << separate / fan_out << "x)" << endl;
+    }
+    return 0;
+}
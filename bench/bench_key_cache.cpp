@@ -0,0 +1,89 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <stdint.h>
+
+#include "../key_cache.hpp"
+#include "../salsa20.hpp"
+
+using namespace std;
+
+/*  Per request key setup for many tenants: a Chacha20 built from the tenant's hex key string
+    plus setNonce(), against a KeyContextCache lookup plus snuffleInitState(), single threaded
+    and with several threads looking up at once, and with fewer slots than tenants (evictions)
+
+    usage: bench_key_cache [tenants] [requests]
+*/
+
+static volatile uint32_t sink;
+
+static string tenantKeyHex(uint64_t tenant) {
+    char hex[65];
+    for (int i=0; i<64; i++)
+        hex[i] = "0123456789abcdef"[(tenant * 2654435761u >> (i % 28)) & 15];
+    hex[64] = 0;
+    return hex;
+}
+
+int main(int argc, char** argv) {
+    size_t tenants = argc > 1 ? strtoull(argv[1], nullptr, 10) : 10000;
+    size_t requests = argc > 2 ? strtoull(argv[2], nullptr, 10) : 2000000;
+
+    vector<string> keys(tenants);
+    for (size_t t=0; t<tenants; t++)
+        keys[t] = tenantKeyHex(t);
+    auto loader = [&](uint64_t id, SnuffleKeyContext& ctx) {
+        if (id >= tenants)
+            return false;
+        ctx = Chacha20(keys[id], true).keyContext();
+        return true;
+    };
+    const uint8_t nonce[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+    cout << tenants << " tenants, " << requests << " requests" << endl;
+
+    // rebuild per request
+    {
+        size_t n = requests / 20;
+        mt19937_64 rng(1);
+        auto start = chrono::steady_clock::now();
+        for (size_t i=0; i<n; i++) {
+            Chacha20 cipher(keys[rng() % tenants], true);
+            cipher.setNonce("0102030405060708");
+            sink = cipher.keyContext().matrix[4];
+        }
+        double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / n;
+        cout << "cipher from hex key:       " << fixed << setprecision(1) << setw(8) << ns << " ns/request" << endl;
+    }
+
+    for (size_t capacity : {2 * tenants, tenants / 4}) {
+        for (unsigned nr_threads : {1u, 2u, 4u}) {
+            KeyContextCache cache(capacity, loader);
+            vector<thread> threads;
+            auto start = chrono::steady_clock::now();
+            for (unsigned t=0; t<nr_threads; t++)
+                threads.emplace_back([&, t] {
+                    mt19937_64 rng(t + 1);
+                    SnuffleKeyContext ctx;
+                    uint32_t state[16];
+                    for (size_t i=0; i < requests / nr_threads; i++) {
+                        cache.get(rng() % tenants, ctx);
+                        snuffleInitState(state, ctx, nonce, 0);
+                        sink = state[4];
+                    }
+                });
+            for (auto& t : threads)
+                t.join();
+            double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            cout << "cache " << setw(6) << cache.capacity() << " slots, " << nr_threads << " threads: "
+                 << setw(8) << secs * 1e9 / requests << " ns/request, "
+                 << setw(5) << 100.0 * cache.hits() / (cache.hits() + cache.misses()) << "% hits, "
+                 << cache.evictions() << " evictions" << endl;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,109 @@
+#include <iostream>
+#include <iomanip>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+#include "../key_rotation.hpp"
+#include "../snuffle_kernels.hpp"
+
+using namespace std;
+
+/*  Encryption throughput of reader threads (4 KiB messages under one of 1024 tenant keys)
+    while a writer keeps rotating keys at a fixed rate: keys in an RcuKeyTable against the same
+    table of shared_ptrs behind a mutex, and the RCU table without rotations
+
+    usage: bench_key_rotation [seconds per run] [reader threads] [rotations per second]
+*/
+
+static volatile uint8_t sink;
+
+// the baseline: a lock per lookup, the shared_ptr keeps the old key alive for readers
+class MutexKeyTable {
+    mutex _mutex;
+    vector<shared_ptr<const RcuKeyTable::KeyVersion>> _keys;
+public:
+    MutexKeyTable(size_t n, const SnuffleKeyContext& ctx) : _keys(n, make_shared<RcuKeyTable::KeyVersion>(RcuKeyTable::KeyVersion{ctx, 0})) {}
+    shared_ptr<const RcuKeyTable::KeyVersion> get(size_t i) {
+        lock_guard<mutex> lock(_mutex);
+        return _keys[i];
+    }
+    void rotate(size_t i, const SnuffleKeyContext& ctx) {
+        auto next = make_shared<RcuKeyTable::KeyVersion>(RcuKeyTable::KeyVersion{ctx, 0});
+        lock_guard<mutex> lock(_mutex);
+        _keys[i] = next;
+    }
+};
+
+int main(int argc, char** argv) {
+    double seconds = argc > 1 ? atof(argv[1]) : 1;
+    unsigned nr_readers = argc > 2 ? strtoul(argv[2], nullptr, 10) : max(1u, thread::hardware_concurrency());
+    double rate = argc > 3 ? atof(argv[3]) : 20000;
+    const size_t nr_keys = 1024;
+
+    uint8_t key[32] = {1};
+    SnuffleKeyContext ctx;
+    snuffleInitKey(ctx, SnuffleVariant::Chacha20, key, sizeof(key));
+    cout << nr_readers << " reader threads, " << nr_keys << " keys, 4 KiB messages, "
+         << rate << " rotations/s" << endl;
+
+    RcuKeyTable rcu(nr_keys, ctx);
+    MutexKeyTable locked(nr_keys, ctx);
+
+    for (int mode=0; mode<3; mode++) {
+        static const char* names[] = {"rcu, no rotation:   ", "rcu, rotating:      ", "mutex, rotating:    "};
+        atomic<bool> stop(false);
+        atomic<uint64_t> messages(0), rotations(0);
+
+        vector<thread> threads;
+        for (unsigned t=0; t<nr_readers; t++)
+            threads.emplace_back([&, t] {
+                EpochDomain::Reader reader = rcu.registerReader();
+                mt19937_64 rng(t);
+                uint8_t msg[4096] = {}, nonce[8] = {};
+                uint64_t n = 0;
+                for (; !stop.load(memory_order_relaxed); n++) {
+                    size_t i = rng() % nr_keys;
+                    if (mode < 2) {
+                        EpochDomain::Section section(reader);
+                        snuffleXorKeystream(rcu.get(i)->ctx, nonce, 0, msg, msg, sizeof(msg));
+                    } else {
+                        auto version = locked.get(i);
+                        snuffleXorKeystream(version->ctx, nonce, 0, msg, msg, sizeof(msg));
+                    }
+                }
+                sink = msg[0];
+                messages += n;
+            });
+        if (mode > 0)
+            threads.emplace_back([&] {
+                mt19937_64 rng(99);
+                SnuffleKeyContext next = ctx;
+                auto due = chrono::steady_clock::now();
+                for (; !stop.load(memory_order_relaxed); rotations++) {
+                    due += chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(1 / rate));
+                    this_thread::sleep_until(due);
+                    next.matrix[4]++;
+                    if (mode == 1)
+                        rcu.rotate(rng() % nr_keys, next);
+                    else
+                        locked.rotate(rng() % nr_keys, next);
+                }
+            });
+
+        this_thread::sleep_for(chrono::duration<double>(seconds));
+        stop = true;
+        for (auto& t : threads)
+            t.join();
+
+        cout << names[mode] << fixed << setprecision(1) << setw(8) << messages * 4096 / seconds / 1e6 << " MB/s, "
+             << setw(8) << rotations / seconds << " rotations/s" << endl;
+    }
+    cout << "retired versions left: " << rcu.domain().reclaim() << endl;
+    return 0;
+}
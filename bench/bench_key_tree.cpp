@@ -0,0 +1,88 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+
+#include "../key_tree.hpp"
+#include "../blake.hpp"
+
+using namespace std;
+
+/*  Derived chunk keys per second: BLAKE3 derive_key of every key from the master key (the way
+    without a tree), the tree walked from the master for every key (cache too small to help),
+    one key at a time with the volume and file nodes cached, and whole files of chunks per
+    chunkKeys() call (lane batches)
+
+    usage: bench_key_tree [keys] [chunks per file]
+*/
+
+static double secsSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+static uint64_t sink = 0;
+
+static void report(const string& what, size_t nr_keys, double s) {
+    cout << what << fixed << setprecision(2) << setw(8) << nr_keys / s / 1e6 << " M keys/s" << endl;
+}
+
+int main(int argc, char** argv) {
+    size_t nr_keys = argc > 1 ? strtoull(argv[1], nullptr, 10) : 2000000;
+    size_t per_file = argc > 2 ? strtoull(argv[2], nullptr, 10) : 64;
+    const size_t nr_files = nr_keys / per_file;
+    nr_keys = nr_files * per_file;
+    const uint8_t master[32] = {1};
+    uint8_t key[32];
+
+    cout << nr_files << " files of " << per_file << " chunks" << endl;
+    auto start = chrono::steady_clock::now();
+    for (size_t f=0; f<nr_files; f++)
+        for (size_t c=0; c<per_file; c++) {
+            uint8_t material[48];
+            memcpy(material, master, 32);
+            uint64_t path[2] = {f, c};
+            memcpy(material + 32, path, 16);
+            blake3DeriveKey(key, sizeof(key), "bench key tree chunk", material, sizeof(material));
+            sink += key[0];
+        }
+    report("BLAKE3 derive_key per key:    ", nr_keys, secsSince(start));
+
+    vector<uint64_t> chunks(per_file);
+    for (size_t c=0; c<per_file; c++)
+        chunks[c] = c;
+    vector<uint8_t> keys(32 * per_file);
+
+    for (SnuffleVariant variant : {SnuffleVariant::Salsa20, SnuffleVariant::Chacha20}) {
+        const string name = variant == SnuffleVariant::Salsa20 ? "HSalsa20" : "HChacha20";
+        // a one set cache with files visited round robin: every key misses for file and volume
+        KeyTree uncached(master, variant, 1), tree(master, variant);
+        start = chrono::steady_clock::now();
+        for (size_t c=0; c<per_file; c++)
+            for (size_t f=0; f<nr_files; f++) {
+                uncached.chunkKey(f % 64, f, c, key);
+                sink += key[0];
+            }
+        report(name + " tree, from the master:", nr_keys, secsSince(start));
+
+        start = chrono::steady_clock::now();
+        for (size_t f=0; f<nr_files; f++)
+            for (size_t c=0; c<per_file; c++) {
+                tree.chunkKey(f % 64, f, c, key);
+                sink += key[0];
+            }
+        report(name + " tree, cached nodes:   ", nr_keys, secsSince(start));
+
+        start = chrono::steady_clock::now();
+        for (size_t f=0; f<nr_files; f++) {
+            tree.chunkKeys(f % 64, f, chunks.data(), per_file, keys.data());
+            sink += keys[0];
+        }
+        report(name + " tree, lane batches:   ", nr_keys, secsSince(start));
+        cout << "  cache hits " << tree.hits() << ", misses " << tree.misses() << endl;
+    }
+    return sink == 1; // keeps the loops from being optimized away
+}
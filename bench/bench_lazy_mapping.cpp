@@ -0,0 +1,81 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include "../decrypted_mapping.hpp"
+#include "../encrypted_reader.hpp"
+#include "../worker_pool.hpp"
+
+using namespace std;
+
+/*  Encrypted file of N MiB, the cost of getting at the data:
+    decrypt all of it (EncryptedFileReader into a buffer) vs. a DecryptedMapping
+    (open, touch 1% of the pages at random, then scan everything with readahead)
+
+    usage: bench_lazy_mapping [MiB] [file]
+*/
+
+static volatile uint8_t sink;
+
+static double msSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char** argv) {
+    size_t mib = argc > 1 ? strtoull(argv[1], nullptr, 10) : 256;
+    string path = argc > 2 ? argv[2] : "bench_lazy_mapping.tmp";
+    const size_t len = mib << 20;
+
+    uint8_t key[32] = {1}, nonce[8] = {2};
+    SnuffleKeyContext ctx;
+    snuffleInitKey(ctx, SnuffleVariant::Chacha20, key, sizeof(key));
+
+    // contents don't matter for the timing, any bytes are a valid ciphertext
+    {
+        vector<uint8_t> chunk(1 << 20, 0x5a);
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        for (size_t i=0; i<mib; i++)
+            if (write(fd, chunk.data(), chunk.size()) != (ssize_t) chunk.size())
+                return 1;
+        close(fd);
+    }
+
+    WorkerPool pool;
+    cout << mib << " MiB, " << pool.size() << " workers" << endl;
+
+    auto start = chrono::steady_clock::now();
+    {
+        EncryptedFileReader reader(path, ctx, nonce);
+        vector<uint8_t> all(len);
+        reader.read(0, all.data(), len);
+        sink = all[len/2];
+    }
+    cout << "decrypt everything:     " << fixed << setprecision(1) << setw(8) << msSince(start) << " ms" << endl;
+
+    start = chrono::steady_clock::now();
+    DecryptedMapping mapping(path, ctx, nonce, &pool);
+    cout << "open mapping (lazy=" << mapping.lazy() << "):   " << setw(8) << msSince(start) << " ms" << endl;
+
+    start = chrono::steady_clock::now();
+    mt19937_64 rng(1);
+    const size_t page = sysconf(_SC_PAGESIZE);
+    for (size_t i=0; i < len / page / 100; i++)
+        sink = mapping.data()[rng() % len];
+    cout << "touch 1% of the pages:  " << setw(8) << msSince(start) << " ms, "
+         << mapping.pagesDecrypted() << " pages decrypted" << endl;
+
+    start = chrono::steady_clock::now();
+    for (size_t off=0; off < len; off += page)
+        sink = mapping.data()[off];
+    cout << "sequential scan:        " << setw(8) << msSince(start) << " ms" << endl;
+
+    remove(path.c_str());
+    return 0;
+}
@@ -0,0 +1,51 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <stdint.h>
+
+#include "../encrypted_log.hpp"
+
+using namespace std;
+
+/*  Group commit log: appended records per second with 1, 2, 4 and 8 producer threads,
+    100 byte records, one write + fdatasync per commit interval (2 ms)
+
+    usage: bench_log_append [records per producer] [log file]
+*/
+
+int main(int argc, char** argv) {
+    size_t per_producer = argc > 1 ? strtoull(argv[1], nullptr, 10) : 200000;
+    string path = argc > 2 ? argv[2] : "bench_log_append.tmp";
+
+    uint8_t key[32] = {1}, nonce[8] = {2};
+    SnuffleKeyContext ctx;
+    snuffleInitKey(ctx, SnuffleVariant::Chacha20, key, sizeof(key));
+    uint8_t record[100] = {3};
+
+    for (unsigned producers : {1, 2, 4, 8}) {
+        remove(path.c_str());
+        EncryptedLogWriter log(path, ctx, nonce);
+
+        auto start = chrono::steady_clock::now();
+        vector<thread> threads;
+        for (unsigned p=0; p<producers; p++)
+            threads.emplace_back([&] {
+                for (size_t i=0; i<per_producer; i++)
+                    log.append(record, sizeof(record));
+            });
+        for (auto& t : threads)
+            t.join();
+        log.flush();
+        double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        cout << setw(2) << producers << " producers: "
+             << fixed << setprecision(2) << setw(7) << producers * per_producer / secs / 1e6 << " M records/s, "
+             << setw(5) << log.commits() << " commits" << endl;
+    }
+    remove(path.c_str());
+    return 0;
+}
@@ -0,0 +1,73 @@
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <string>
+#include <stdint.h>
+
+#include "../snuffle_kernels.hpp"
+#include "../worker_pool.hpp"
+
+using namespace std;
+
+/*  Latency of small encrypts (4 KiB tasks) on a WorkerPool that is busy rekeying a large buffer:
+    idle pool, the rekeying queued as plain FIFO tasks, as a bulk job, and as a bulk job capped
+    at 200 MB/s
+
+    usage: bench_pool_qos [MiB rekeyed] [latency tasks]
+*/
+
+static double percentile(vector<double> v, double p) {
+    sort(v.begin(), v.end());
+    return v[min(v.size() - 1, (size_t) (p * v.size()))];
+}
+
+int main(int argc, char** argv) {
+    size_t mib = argc > 1 ? strtoull(argv[1], nullptr, 10) : 256;
+    size_t nr_tasks = argc > 2 ? strtoull(argv[2], nullptr, 10) : 500;
+
+    uint8_t key[32] = {1}, nonce[8] = {2};
+    SnuffleKeyContext ctx;
+    snuffleInitKey(ctx, SnuffleVariant::Chacha20, key, sizeof(key));
+
+    vector<uint8_t> bulk(mib << 20, 0x5a);
+    auto rekey = [&](uint64_t offset, size_t n) { snuffleXorKeystreamAt(ctx, nonce, offset, bulk.data() + offset, bulk.data() + offset, n); };
+
+    WorkerPool pool;
+    cout << mib << " MiB rekeyed in the background, " << pool.size() << " workers, "
+         << pool.bulkThreads() << " for bulk work" << endl;
+
+    for (int mode=0; mode<4; mode++) {
+        static const char* names[] = {"idle pool:   ", "fifo tasks:  ", "bulk job:    ", "bulk capped: "};
+        vector<future<void>> background;
+        pool.setBulkBandwidth(mode == 3 ? 200000000 : 0);
+        if (mode == 1)
+            for (uint64_t off=0; off < bulk.size(); off += WorkerPool::DEFAULT_BULK_SLICE)
+                background.push_back(pool.submit([&, off] { rekey(off, WorkerPool::DEFAULT_BULK_SLICE); }));
+        else if (mode >= 2)
+            background.push_back(pool.submitBulk(bulk.size(), rekey));
+
+        vector<double> latency;
+        uint8_t msg[4096] = {};
+        for (size_t i=0; i<nr_tasks; i++) {
+            auto start = chrono::steady_clock::now();
+            pool.submit([&] { snuffleXorKeystreamAt(ctx, nonce, i * sizeof(msg), msg, msg, sizeof(msg)); }).get();
+            latency.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - start).count());
+            this_thread::sleep_for(chrono::microseconds(200));
+        }
+
+        auto start = chrono::steady_clock::now();
+        for (auto& f : background)
+            f.get();
+        cout << names[mode] << "p50 " << fixed << setprecision(1) << setw(8) << percentile(latency, 0.5)
+             << " us, p99 " << setw(8) << percentile(latency, 0.99) << " us, max " << setw(9)
+             << percentile(latency, 1) << " us";
+        if (mode)
+            cout << ", rekeying finished " << setw(7) << chrono::duration<double, milli>(chrono::steady_clock::now() - start).count()
+                 << " ms after the last encrypt";
+        cout << endl;
+    }
+    return 0;
+}
@@ -0,0 +1,81 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include "../encrypted_reader.hpp"
+#include "../worker_pool.hpp"
+
+using namespace std;
+
+/*  EncryptedFileReader with and without readahead on an N MiB file:
+    sequential 64 KiB reads, 4 KiB records every 64 KiB (strided), and 4 KiB random reads
+    (those should cost the same with readahead on)
+
+    usage: bench_reader_readahead [MiB] [file]
+*/
+
+static volatile uint8_t sink;
+
+static double secsSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char** argv) {
+    size_t mib = argc > 1 ? strtoull(argv[1], nullptr, 10) : 256;
+    string path = argc > 2 ? argv[2] : "bench_reader_readahead.tmp";
+    const size_t len = mib << 20;
+
+    uint8_t key[32] = {1}, nonce[8] = {2};
+    SnuffleKeyContext ctx;
+    snuffleInitKey(ctx, SnuffleVariant::Chacha20, key, sizeof(key));
+
+    {
+        vector<uint8_t> chunk(1 << 20, 0x5a);
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        for (size_t i=0; i<mib; i++)
+            if (write(fd, chunk.data(), chunk.size()) != (ssize_t) chunk.size())
+                return 1;
+        close(fd);
+    }
+
+    WorkerPool pool;
+    cout << mib << " MiB, " << pool.size() << " workers" << endl;
+    vector<uint8_t> buf(64 * 1024);
+
+    for (bool readahead : {false, true}) {
+        EncryptedFileReader reader(path, ctx, nonce);
+        if (readahead)
+            reader.enableReadahead(pool);
+        cout << (readahead ? "readahead:" : "plain:") << endl;
+
+        auto start = chrono::steady_clock::now();
+        for (uint64_t off=0; off < len; off += buf.size())
+            sink = buf[reader.read(off, buf.data(), buf.size()) - 1];
+        cout << "  sequential 64 KiB: " << fixed << setprecision(1) << setw(8)
+             << len / secsSince(start) / 1e6 << " MB/s" << endl;
+
+        start = chrono::steady_clock::now();
+        size_t records = 0;
+        for (uint64_t off=0; off < len; off += 64 * 1024, records++)
+            sink = buf[reader.read(off, buf.data(), 4096) - 1];
+        cout << "  strided 4 KiB:     " << setw(8) << records / secsSince(start) / 1e3 << " k records/s" << endl;
+
+        mt19937_64 rng(1);
+        const size_t nr_random = 20000;
+        start = chrono::steady_clock::now();
+        for (size_t i=0; i<nr_random; i++)
+            sink = buf[reader.read(rng() % (len - 4096), buf.data(), 4096) - 1];
+        cout << "  random 4 KiB:      " << setw(8) << secsSince(start) / nr_random * 1e6 << " us/read" << endl;
+        cout << "  served by readahead: " << reader.readaheadBytes() / (1 << 20) << " MiB" << endl;
+    }
+
+    remove(path.c_str());
+    return 0;
+}
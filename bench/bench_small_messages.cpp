@@ -0,0 +1,68 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+#include <stdint.h>
+
+// inline copies of the snuffle_core.hpp functions in this translation unit
+#define SNUFFLE_HEADER_ONLY
+#include "../salsa20.hpp"
+
+using namespace std;
+
+/*  Per call cost of encrypting 16-64 byte messages, each under its own nonce:
+    class API (setNonce() + encryptBytes(), out of line with virtual calls per round)
+    vs. the header only core (snuffleXorSmall() inlined into the loop)
+
+    usage: bench_small_messages [iterations]
+*/
+
+static volatile uint8_t sink;
+
+template <class Fn>
+static double nsPerCall(size_t iterations, Fn fn) {
+    auto start = chrono::steady_clock::now();
+    for (size_t i=0; i<iterations; i++)
+        fn(i);
+    auto end = chrono::steady_clock::now();
+    return chrono::duration<double, nano>(end - start).count() / iterations;
+}
+
+template <class Cipher>
+static void run(const char* name, size_t iterations) {
+    vector<uint8_t> key(32, 0x42);
+    uint8_t msg[64] = {1}, out[64];
+
+    Cipher cipher(key);
+    SnuffleKeyContext ctx = cipher.keyContext();
+
+    for (size_t len : {16, 32, 48, 64}) {
+        double t_class = nsPerCall(iterations, [&](size_t i) {
+            cipher.setNonce((uint64_t) i);
+            cipher.encryptBytes(msg, out, len);
+            sink = out[0];
+        });
+
+        double t_inline = nsPerCall(iterations, [&](size_t i) {
+            uint8_t nonce[8];
+            snuffleStore32(nonce, (uint32_t) (i >> 32));
+            snuffleStore32(nonce+4, (uint32_t) i);
+            snuffleXorSmall(ctx, nonce, 0, msg, out, len);
+            sink = out[0];
+        });
+
+        cout << setw(9) << name << setw(5) << len << " byte: "
+             << fixed << setprecision(1)
+             << setw(8) << t_class << " ns class  "
+             << setw(8) << t_inline << " ns inline  "
+             << setw(6) << setprecision(2) << t_class / t_inline << "x" << endl;
+    }
+}
+
+int main(int argc, char** argv) {
+    size_t iterations = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+
+    run<Salsa20>("Salsa20", iterations);
+    run<Chacha20>("Chacha20", iterations);
+    return 0;
+}
@@ -0,0 +1,123 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include "../datagram_relay.hpp"
+
+using namespace std;
+
+/*  DatagramRelay over loopback: a generator sends rounds of 64 datagrams to the relay with
+    sendmmsg, the relay seals them to a sink that drains them with recvmmsg, all on one thread.
+    Packets per second of the relay alone (its pump() calls) and of the whole round trip, for
+    one datagram per system call, recvmmsg/sendmmsg batches and batches with UDP GSO
+
+    usage: bench_udp_relay [payload bytes] [packets]
+*/
+
+static const unsigned ROUND = 64;
+
+static int udpSocket(sockaddr_in& addr) {
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    int rcvbuf = 16 << 20;
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)) != 0)
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (bind(fd, (sockaddr*) &addr, len) != 0 || getsockname(fd, (sockaddr*) &addr, &len) != 0) {
+        perror("bind");
+        exit(1);
+    }
+    return fd;
+}
+
+int main(int argc, char** argv) {
+    size_t payload = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1200;
+    size_t nr_packets = argc > 2 ? strtoull(argv[2], nullptr, 10) : 200000;
+    const size_t rounds = max<size_t>(nr_packets / ROUND, 1);
+
+    uint8_t key[32] = {1}, nonce[8] = {2};
+    SnuffleKeyContext ctx;
+    snuffleInitKey(ctx, SnuffleVariant::Chacha20, key, sizeof(key));
+
+    sockaddr_in gen_addr, relay_addr, relay_out_addr, sink_addr;
+    int gen_fd = udpSocket(gen_addr), relay_fd = udpSocket(relay_addr);
+    int relay_out_fd = udpSocket(relay_out_addr), sink_fd = udpSocket(sink_addr);
+    if (connect(gen_fd, (sockaddr*) &relay_addr, sizeof(relay_addr)) != 0
+        || connect(relay_out_fd, (sockaddr*) &sink_addr, sizeof(sink_addr)) != 0) {
+        perror("connect");
+        return 1;
+    }
+
+    // a round of datagrams to send, and room for the sealed ones at the sink
+    vector<uint8_t> data(payload, 0x5a);
+    vector<iovec> gen_iovs(ROUND, {data.data(), payload});
+    vector<mmsghdr> gen_msgs(ROUND);
+    const size_t sink_len = DatagramRelay::SEQ_LEN + payload + DatagramCipher::TAG_LEN;
+    vector<uint8_t> sink_buf(ROUND * sink_len);
+    vector<iovec> sink_iovs(ROUND);
+    vector<mmsghdr> sink_msgs(ROUND);
+    for (unsigned i=0; i<ROUND; i++) {
+        memset(&gen_msgs[i], 0, sizeof(gen_msgs[i]));
+        gen_msgs[i].msg_hdr.msg_iov = &gen_iovs[i];
+        gen_msgs[i].msg_hdr.msg_iovlen = 1;
+        sink_iovs[i] = {&sink_buf[i * sink_len], sink_len};
+        memset(&sink_msgs[i], 0, sizeof(sink_msgs[i]));
+        sink_msgs[i].msg_hdr.msg_iov = &sink_iovs[i];
+        sink_msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    cout << payload << " byte datagrams, " << rounds * ROUND << " per run, Chacha20" << endl;
+
+    struct Config { const char* name; unsigned batch; bool gso; };
+    const Config configs[] = {{"one per syscall", 1, false}, {"batch 64", ROUND, false}, {"batch 64 + GSO", ROUND, true}};
+
+    for (bool authenticated : {false, true}) {
+        cout << (authenticated ? "with Poly1305:" : "unauthenticated:") << endl;
+        DatagramCipher cipher(ctx, nonce, authenticated);
+
+        for (const Config& config : configs) {
+            DatagramRelay relay(cipher, DatagramRelay::SEAL, relay_fd, relay_out_fd, payload, config.batch);
+            relay.setGso(config.gso);
+
+            double relay_s = 0;
+            auto start = chrono::steady_clock::now();
+            for (size_t r=0; r<rounds; r++) {
+                for (unsigned sent=0; sent < ROUND;)
+                    sent += sendmmsg(gen_fd, gen_msgs.data() + sent, ROUND - sent, 0);
+
+                auto relay_start = chrono::steady_clock::now();
+                for (size_t relayed=0; relayed < ROUND;)
+                    relayed += relay.pump();
+                relay_s += chrono::duration<double>(chrono::steady_clock::now() - relay_start).count();
+
+                for (unsigned got=0; got < ROUND;)
+                    got += recvmmsg(sink_fd, sink_msgs.data(), ROUND - got, MSG_WAITFORONE, nullptr);
+            }
+            double total_s = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+            const double packets = rounds * ROUND;
+            cout << "  " << left << setw(18) << config.name << right << fixed << setprecision(2)
+                 << setw(7) << packets / relay_s / 1e6 << " Mpps relay, "
+                 << setw(7) << packets / total_s / 1e6 << " Mpps round trip, "
+                 << setw(6) << setprecision(1) << packets * payload * 8 / relay_s / 1e9 << " Gbit/s, "
+                 << relay.sendCalls() << " sends"
+                 << (config.gso && !relay.gso() ? " (GSO not supported)" : "") << endl;
+        }
+    }
+
+    close(gen_fd);
+    close(relay_fd);
+    close(relay_out_fd);
+    close(sink_fd);
+    return 0;
+}
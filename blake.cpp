@@ -0,0 +1,381 @@
+#include <cstring> // memcpy
+#include <vector>
+#include <algorithm> // std::min
+#include <stdexcept> // std::length_error
+
+#include "blake.hpp"
+#include "arx_lanes.hpp"
+#include "worker_pool.hpp"
+
+using namespace std;
+
+/*  BLAKE2s and BLAKE3 on top of arx_lanes.hpp
+    Spec references: RFC 7693 (BLAKE2s), https://github.com/BLAKE3-team/BLAKE3-specs (BLAKE3) */
+
+// IV of both, same as the SHA-256 IV
+static const uint32_t BLAKE_IV[8] = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+    0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+static inline uint32_t load32(const uint8_t* bytes) {
+    return  (uint32_t) bytes[0] |
+            ((uint32_t) bytes[1] <<  8) |
+            ((uint32_t) bytes[2] << 16) |
+            ((uint32_t) bytes[3] << 24);
+}
+
+static inline void store32(uint8_t* bytes, uint32_t word) {
+    bytes[0] = word;
+    bytes[1] = word >> 8;
+    bytes[2] = word >> 16;
+    bytes[3] = word >> 24;
+}
+
+//  one round of G on columns and diagonals, message word order given by schedule s
+#define BLAKE_ROUND(v, m, s) \
+    ARX_QUARTER(ARX_ROTR, v[0], v[4], v[8],  v[12], m[s[0]],  m[s[1]],  16, 12, 8, 7) \
+    ARX_QUARTER(ARX_ROTR, v[1], v[5], v[9],  v[13], m[s[2]],  m[s[3]],  16, 12, 8, 7) \
+    ARX_QUARTER(ARX_ROTR, v[2], v[6], v[10], v[14], m[s[4]],  m[s[5]],  16, 12, 8, 7) \
+    ARX_QUARTER(ARX_ROTR, v[3], v[7], v[11], v[15], m[s[6]],  m[s[7]],  16, 12, 8, 7) \
+    ARX_QUARTER(ARX_ROTR, v[0], v[5], v[10], v[15], m[s[8]],  m[s[9]],  16, 12, 8, 7) \
+    ARX_QUARTER(ARX_ROTR, v[1], v[6], v[11], v[12], m[s[10]], m[s[11]], 16, 12, 8, 7) \
+    ARX_QUARTER(ARX_ROTR, v[2], v[7], v[8],  v[13], m[s[12]], m[s[13]], 16, 12, 8, 7) \
+    ARX_QUARTER(ARX_ROTR, v[3], v[4], v[9],  v[14], m[s[14]], m[s[15]], 16, 12, 8, 7)
+
+
+// ------ BLAKE2s --------------------------------------------------------------------------------
+
+static const uint8_t BLAKE2S_SIGMA[10][16] = {
+    { 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15},
+    {14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3},
+    {11,  8, 12,  0,  5,  2, 15, 13, 10, 14,  3,  6,  7,  1,  9,  4},
+    { 7,  9,  3,  1, 13, 12, 11, 14,  2,  6,  5, 10,  4,  0, 15,  8},
+    { 9,  0,  5,  7,  2,  4, 10, 15, 14,  1, 11, 12,  6,  8,  3, 13},
+    { 2, 12,  6, 10,  0, 11,  8,  3,  4, 13,  7,  5, 15, 14,  1,  9},
+    {12,  5,  1, 15, 14, 13,  4, 10,  0,  7,  6,  3,  9,  2,  8, 11},
+    {13, 11,  7, 14, 12,  1,  3,  9,  5,  0, 15,  4,  8,  6,  2, 10},
+    { 6, 15, 14,  9, 11,  3,  0,  8, 12,  2, 13,  7,  1,  4, 10,  5},
+    {10,  2,  8,  4,  7,  6,  1,  5, 15, 11,  9, 14,  3, 12, 13,  0}
+};
+
+Blake2s::Blake2s(size_t out_len, const uint8_t* key, size_t key_len) : _outLen(out_len) {
+    if (out_len < 1 || out_len > 32)
+        throw length_error("BLAKE2s output has to be 1 to 32 bytes");
+    if (key_len > 32)
+        throw length_error("BLAKE2s key can be at most 32 bytes");
+
+    memcpy(_h, BLAKE_IV, sizeof(_h));
+    _h[0] ^= 0x01010000 ^ (key_len << 8) ^ out_len;
+
+    // key is processed as first block, padded with zeros
+    if (key_len) {
+        memset(_buf, 0, sizeof(_buf));
+        memcpy(_buf, key, key_len);
+        _bufLen = 64;
+    }
+}
+
+void Blake2s::compress(const uint8_t block[64], bool last) {
+    uint32_t m[16], v[16];
+    for (unsigned i=0; i<16; i++)
+        m[i] = load32(block + 4*i);
+
+    memcpy(v, _h, sizeof(_h));
+    memcpy(v+8, BLAKE_IV, sizeof(BLAKE_IV));
+    v[12] ^= _t[0];
+    v[13] ^= _t[1];
+    if (last)
+        v[14] = ~v[14];
+
+    for (unsigned r=0; r<10; r++) {
+        const uint8_t* s = BLAKE2S_SIGMA[r];
+        BLAKE_ROUND(v, m, s)
+    }
+
+    for (unsigned i=0; i<8; i++)
+        _h[i] ^= v[i] ^ v[i+8];
+}
+
+// the last block has to be compressed with the final flag, so a full buffer waits for more data
+void Blake2s::update(const uint8_t* data, size_t len) {
+    while (len) {
+        if (_bufLen == 64) {
+            _t[0] += 64;
+            if (_t[0] < 64)
+                _t[1]++;
+            compress(_buf, false);
+            _bufLen = 0;
+        }
+        size_t n = min(len, 64 - _bufLen);
+        memcpy(_buf + _bufLen, data, n);
+        _bufLen += n;
+        data += n;
+        len -= n;
+    }
+}
+
+void Blake2s::final(uint8_t* out) {
+    _t[0] += _bufLen;
+    if (_t[0] < _bufLen)
+        _t[1]++;
+    memset(_buf + _bufLen, 0, 64 - _bufLen);
+    compress(_buf, true);
+
+    uint8_t digest[32];
+    for (unsigned i=0; i<8; i++)
+        store32(digest + 4*i, _h[i]);
+    memcpy(out, digest, _outLen);
+}
+
+void blake2s(uint8_t* out, size_t out_len, const uint8_t* in, size_t in_len, const uint8_t* key, size_t key_len) {
+    Blake2s h(out_len, key, key_len);
+    h.update(in, in_len);
+    h.final(out);
+}
+
+
+// ------ BLAKE3 ---------------------------------------------------------------------------------
+
+static const size_t BLAKE3_CHUNK_LEN = 1024;
+
+// domain separation flags
+static const uint32_t CHUNK_START = 1 << 0;
+static const uint32_t CHUNK_END = 1 << 1;
+static const uint32_t PARENT = 1 << 2;
+static const uint32_t ROOT = 1 << 3;
+static const uint32_t KEYED_HASH = 1 << 4;
+static const uint32_t DERIVE_KEY_CONTEXT = 1 << 5;
+static const uint32_t DERIVE_KEY_MATERIAL = 1 << 6;
+
+// message word order of each of the 7 rounds (the BLAKE3 permutation applied r times)
+static const uint8_t BLAKE3_SCHEDULE[7][16] = {
+    { 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15},
+    { 2,  6,  3, 10,  7,  0,  4, 13,  1, 11, 12,  5,  9, 14, 15,  8},
+    { 3,  4, 10, 12, 13,  2,  7, 14,  6,  5,  9,  0, 11, 15,  8,  1},
+    {10,  7, 12,  9, 14,  3, 13, 15,  4,  0, 11,  2,  5,  8,  1,  6},
+    {12, 13,  9, 11, 15, 10, 14,  8,  7,  2,  5,  3,  0,  1,  6,  4},
+    { 9, 14, 11,  5,  8, 12, 15,  1, 13,  3,  0, 10,  2,  6,  4,  7},
+    {11, 15,  5,  0,  1,  9,  8,  6, 14, 10,  2, 12,  3,  4,  7, 13}
+};
+
+// full 16 word output of the compression function
+static void blake3Compress(const uint32_t cv[8], const uint32_t m[16], uint64_t counter,
+                           uint32_t block_len, uint32_t flags, uint32_t out[16]) {
+    uint32_t v[16] = {
+        cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+        BLAKE_IV[0], BLAKE_IV[1], BLAKE_IV[2], BLAKE_IV[3],
+        (uint32_t) counter, (uint32_t) (counter >> 32), block_len, flags
+    };
+
+    for (unsigned r=0; r<7; r++) {
+        const uint8_t* s = BLAKE3_SCHEDULE[r];
+        BLAKE_ROUND(v, m, s)
+    }
+
+    for (unsigned i=0; i<8; i++) {
+        out[i] = v[i] ^ v[i+8];
+        out[i+8] = v[i+8] ^ cv[i];
+    }
+}
+
+static void loadBlock(const uint8_t* in, size_t len, uint32_t m[16]) {
+    uint8_t block[64] = {0};
+    memcpy(block, in, len);
+    for (unsigned i=0; i<16; i++)
+        m[i] = load32(block + 4*i);
+}
+
+/*  inputs of a compression whose result is not final yet: the root node needs to be compressed
+    again with the ROOT flag and increasing counters for extendable output */
+struct Blake3Output {
+    uint32_t cv[8];
+    uint32_t block[16];
+    uint64_t counter;
+    uint32_t block_len;
+    uint32_t flags;
+
+    void chainingValue(uint32_t out_cv[8]) const {
+        uint32_t out[16];
+        blake3Compress(cv, block, counter, block_len, flags, out);
+        memcpy(out_cv, out, 32);
+    }
+
+    void rootBytes(uint8_t* out, size_t out_len) const {
+        uint32_t words[16];
+        uint8_t bytes[64];
+        for (uint64_t block_counter=0; out_len; block_counter++) {
+            blake3Compress(cv, block, block_counter, block_len, flags | ROOT, words);
+            for (unsigned i=0; i<16; i++)
+                store32(bytes + 4*i, words[i]);
+            size_t n = min<size_t>(out_len, 64);
+            memcpy(out, bytes, n);
+            out += n;
+            out_len -= n;
+        }
+    }
+};
+
+// chunk of up to 1024 bytes, everything but the last block gets compressed
+static Blake3Output chunkOutput(const uint8_t* in, size_t len, uint64_t chunk_counter,
+                                const uint32_t key[8], uint32_t flags) {
+    Blake3Output o;
+    memcpy(o.cv, key, sizeof(o.cv));
+    o.counter = chunk_counter;
+
+    size_t nr_blocks = len ? (len + 63) / 64 : 1;
+    uint32_t block_flags = flags | CHUNK_START;
+    for (size_t b=0; b+1 < nr_blocks; b++, in += 64, len -= 64) {
+        uint32_t m[16], out[16];
+        loadBlock(in, 64, m);
+        blake3Compress(o.cv, m, chunk_counter, 64, block_flags, out);
+        memcpy(o.cv, out, sizeof(o.cv));
+        block_flags = flags;
+    }
+
+    loadBlock(in, len, o.block);
+    o.block_len = len;
+    o.flags = block_flags | CHUNK_END;
+    return o;
+}
+
+static Blake3Output parentOutput(const uint32_t left[8], const uint32_t right[8], const uint32_t key[8], uint32_t flags) {
+    Blake3Output o;
+    memcpy(o.cv, key, sizeof(o.cv));
+    memcpy(o.block, left, 32);
+    memcpy(o.block+8, right, 32);
+    o.counter = 0;
+    o.block_len = 64;
+    o.flags = flags | PARENT;
+    return o;
+}
+
+/*  chaining values of ARX_LANES full chunks at once, lane i hashes the chunk at in + i*1024
+    (chunk counter first_chunk + i), cvs receives the 8 word chaining value of each chunk */
+ARX_TARGET_CLONES
+static void blake3ChunksLanes(const uint8_t* in, uint64_t first_chunk, const uint32_t key[8], uint32_t flags,
+                              uint32_t cvs[ARX_LANES][8]) {
+    const arx_lanes_t zero = {};
+    arx_lanes_t cv[8], counter_lo, counter_hi;
+
+    for (unsigned i=0; i<8; i++)
+        cv[i] = zero + key[i];
+    for (unsigned lane=0; lane<ARX_LANES; lane++) {
+        counter_lo[lane] = (uint32_t) (first_chunk + lane);
+        counter_hi[lane] = (uint32_t) ((first_chunk + lane) >> 32);
+    }
+
+    for (unsigned b=0; b<16; b++) {
+        arx_lanes_t m[16];
+        for (unsigned w=0; w<16; w++)
+            for (unsigned lane=0; lane<ARX_LANES; lane++)
+                m[w][lane] = load32(in + lane*BLAKE3_CHUNK_LEN + 64*b + 4*w);
+
+        uint32_t block_flags = flags | (b == 0 ? CHUNK_START : 0) | (b == 15 ? CHUNK_END : 0);
+        arx_lanes_t v[16] = {
+            cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+            zero + BLAKE_IV[0], zero + BLAKE_IV[1], zero + BLAKE_IV[2], zero + BLAKE_IV[3],
+            counter_lo, counter_hi, zero + 64u, zero + block_flags
+        };
+
+        for (unsigned r=0; r<7; r++) {
+            const uint8_t* s = BLAKE3_SCHEDULE[r];
+            BLAKE_ROUND(v, m, s)
+        }
+
+        for (unsigned i=0; i<8; i++)
+            cv[i] = v[i] ^ v[i+8];
+    }
+
+    for (unsigned lane=0; lane<ARX_LANES; lane++)
+        for (unsigned i=0; i<8; i++)
+            cvs[lane][i] = cv[i][lane];
+}
+
+// inputs from this size on are split over the pool
+static const size_t BLAKE3_PARALLEL_MIN = 1 << 18;
+// chunks per pool task
+static const size_t BLAKE3_TASK_CHUNKS = 64;
+
+// chaining values of chunks [first, last) of in
+static void chunkChainingValues(const uint8_t* in, size_t len, size_t first, size_t last,
+                                const uint32_t key[8], uint32_t flags, uint32_t (*cvs)[8]) {
+    size_t c = first;
+    for (; c + ARX_LANES <= last && (c + ARX_LANES) * BLAKE3_CHUNK_LEN <= len; c += ARX_LANES)
+        blake3ChunksLanes(in + c*BLAKE3_CHUNK_LEN, c, key, flags, cvs + c);
+
+    for (; c < last; c++) {
+        size_t chunk_len = min(BLAKE3_CHUNK_LEN, len - c*BLAKE3_CHUNK_LEN);
+        chunkOutput(in + c*BLAKE3_CHUNK_LEN, chunk_len, c, key, flags).chainingValue(cvs[c]);
+    }
+}
+
+// largest power of 2 < n for n >= 2, the size of the left subtree
+static size_t leftSubtreeChunks(size_t n) {
+    size_t p = 1;
+    while (2*p < n)
+        p *= 2;
+    return p;
+}
+
+// chaining value of the subtree over chunks [lo, hi)
+static void subtreeChainingValue(const uint32_t (*cvs)[8], size_t lo, size_t hi,
+                                 const uint32_t key[8], uint32_t flags, uint32_t out[8]) {
+    if (hi - lo == 1) {
+        memcpy(out, cvs[lo], 32);
+        return;
+    }
+    uint32_t left[8], right[8];
+    size_t split = lo + leftSubtreeChunks(hi - lo);
+    subtreeChainingValue(cvs, lo, split, key, flags, left);
+    subtreeChainingValue(cvs, split, hi, key, flags, right);
+    parentOutput(left, right, key, flags).chainingValue(out);
+}
+
+static void blake3Generic(uint8_t* out, size_t out_len, const uint8_t* in, size_t in_len,
+                          const uint32_t key[8], uint32_t flags, WorkerPool* pool) {
+    const size_t nr_chunks = in_len ? (in_len + BLAKE3_CHUNK_LEN - 1) / BLAKE3_CHUNK_LEN : 1;
+
+    if (nr_chunks == 1) {
+        chunkOutput(in, in_len, 0, key, flags).rootBytes(out, out_len);
+        return;
+    }
+
+    vector<uint32_t> cv_words(8*nr_chunks);
+    uint32_t (*cvs)[8] = reinterpret_cast<uint32_t (*)[8]>(cv_words.data());
+
+    if (pool && in_len >= BLAKE3_PARALLEL_MIN) {
+        size_t nr_tasks = (nr_chunks + BLAKE3_TASK_CHUNKS - 1) / BLAKE3_TASK_CHUNKS;
+        pool->parallelFor(nr_tasks, [&](size_t t) {
+            size_t first = t * BLAKE3_TASK_CHUNKS;
+            chunkChainingValues(in, in_len, first, min(nr_chunks, first + BLAKE3_TASK_CHUNKS), key, flags, cvs);
+        });
+    } else
+        chunkChainingValues(in, in_len, 0, nr_chunks, key, flags, cvs);
+
+    uint32_t left[8], right[8];
+    size_t split = leftSubtreeChunks(nr_chunks);
+    subtreeChainingValue(cvs, 0, split, key, flags, left);
+    subtreeChainingValue(cvs, split, nr_chunks, key, flags, right);
+    parentOutput(left, right, key, flags).rootBytes(out, out_len);
+}
+
+void blake3(uint8_t* out, size_t out_len, const uint8_t* in, size_t in_len, const uint8_t* key, WorkerPool* pool) {
+    if (key) {
+        uint32_t key_words[8];
+        for (unsigned i=0; i<8; i++)
+            key_words[i] = load32(key + 4*i);
+        blake3Generic(out, out_len, in, in_len, key_words, KEYED_HASH, pool);
+    } else
+        blake3Generic(out, out_len, in, in_len, BLAKE_IV, 0, pool);
+}
+
+void blake3DeriveKey(uint8_t* out, size_t out_len, const string& context, const uint8_t* material, size_t material_len) {
+    uint8_t context_key[32];
+    blake3Generic(context_key, 32, (const uint8_t*) context.data(), context.size(), BLAKE_IV, DERIVE_KEY_CONTEXT, nullptr);
+
+    uint32_t key_words[8];
+    for (unsigned i=0; i<8; i++)
+        key_words[i] = load32(context_key + 4*i);
+    blake3Generic(out, out_len, material, material_len, key_words, DERIVE_KEY_MATERIAL, nullptr);
+}
@@ -0,0 +1,56 @@
+#ifndef BLAKE_HPP
+#define BLAKE_HPP
+
+#include <string>
+#include <stdint.h>
+#include <stddef.h>
+
+class WorkerPool;
+
+/*  BLAKE2s (RFC 7693) and BLAKE3 hash functions
+
+    Both are built around the same add-rotate-xor quarter round as Chacha20 (the G function),
+    see arx_lanes.hpp. BLAKE3 hashes 8 chunks side by side in the lane kernels, with the same
+    AVX2/generic dispatch as the cipher kernels, and can split large inputs over a WorkerPool.
+
+    Uses in this library: content derived nonces and keys, dedup chunk ids and integrity of
+    encrypted chunks. Keyed modes turn both into MACs.
+*/
+
+// incremental BLAKE2s, output 1 to 32 bytes, optional key of up to 32 bytes
+class Blake2s {
+
+    uint32_t _h[8];
+    uint32_t _t[2] = {0, 0};
+    uint8_t _buf[64];
+    size_t _bufLen = 0;
+    size_t _outLen;
+
+    void compress(const uint8_t block[64], bool last);
+
+public:
+
+    //  throws std::length_error for out_len not in [1, 32] or key_len > 32
+    Blake2s(size_t out_len = 32, const uint8_t* key = nullptr, size_t key_len = 0);
+
+    void update(const uint8_t* data, size_t len);
+
+    //  writes the out_len byte digest, the object can't be updated afterwards
+    void final(uint8_t* out);
+};
+
+//  one-shot BLAKE2s
+void blake2s(uint8_t* out, size_t out_len, const uint8_t* in, size_t in_len,
+             const uint8_t* key = nullptr, size_t key_len = 0);
+
+/*  BLAKE3 of in, out_len bytes of output (extendable output, any length)
+    key: 32 bytes for keyed hashing (MAC), nullptr for the plain hash
+    pool: chunks of large inputs get hashed on the workers, nullptr hashes on the calling thread only */
+void blake3(uint8_t* out, size_t out_len, const uint8_t* in, size_t in_len,
+            const uint8_t* key = nullptr, WorkerPool* pool = nullptr);
+
+//  BLAKE3 key derivation mode: out_len bytes of key material for a context string and input key material
+void blake3DeriveKey(uint8_t* out, size_t out_len, const std::string& context,
+                     const uint8_t* material, size_t material_len);
+
+#endif // BLAKE_HPP
@@ -0,0 +1,93 @@
+#ifndef BYTE_IO_HPP
+#define BYTE_IO_HPP
+
+#include <cerrno>
+#include <cstring> // strerror
+#include <stdexcept> // std::runtime_error
+#include <string>
+#include <stdint.h>
+#include <stddef.h>
+#include <unistd.h>
+
+/*  Internal helpers of the file formats and pipes (stream_aead, archive, dedup_store, merkle, ...):
+    little endian integers, and fd I/O that retries on EINTR and short transfers and throws
+    std::runtime_error on errors. Not part of the library interface; static, so they stay out of
+    the way of the bool writeAll() of cli.hpp */
+
+static inline void putLE(uint8_t* out, uint64_t value, unsigned nr_bytes) {
+    for (unsigned i=0; i<nr_bytes; i++)
+        out[i] = value >> (8*i);
+}
+
+static inline uint64_t getLE(const uint8_t* in, unsigned nr_bytes) {
+    uint64_t value = 0;
+    for (unsigned i=0; i<nr_bytes; i++)
+        value |= (uint64_t) in[i] << (8*i);
+    return value;
+}
+
+//  bytes read at offset, less than len only at end of file
+static inline size_t preadFull(int fd, uint8_t* buf, size_t len, uint64_t offset) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pread(fd, buf + done, len - done, offset + done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            throw std::runtime_error(std::string("read failed: ") + strerror(errno));
+        if (n == 0)
+            break;
+        done += n;
+    }
+    return done;
+}
+
+//  exactly len bytes at offset, end of file is an error with eof_error as its message
+static inline void preadAll(int fd, uint8_t* buf, size_t len, uint64_t offset,
+                            const char* eof_error = "unexpected end of file") {
+    if (preadFull(fd, buf, len, offset) != len)
+        throw std::runtime_error(eof_error);
+}
+
+//  read until len bytes or end of input, returns the number of bytes read
+static inline size_t readFull(int fd, uint8_t* buf, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = read(fd, buf + done, len - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            throw std::runtime_error(std::string("read failed: ") + strerror(errno));
+        if (n == 0)
+            break;
+        done += n;
+    }
+    return done;
+}
+
+static inline void pwriteAll(int fd, const uint8_t* buf, size_t len, uint64_t offset) {
+    while (len) {
+        ssize_t n = pwrite(fd, buf, len, offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            throw std::runtime_error(std::string("write failed: ") + strerror(errno));
+        buf += n;
+        len -= n;
+        offset += n;
+    }
+}
+
+static inline void writeAll(int fd, const uint8_t* buf, size_t len) {
+    while (len) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            throw std::runtime_error(std::string("write failed: ") + strerror(errno));
+        buf += n;
+        len -= n;
+    }
+}
+
+#endif // BYTE_IO_HPP
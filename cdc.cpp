@@ -0,0 +1,210 @@
+#include <algorithm> // std::min
+#include <cstring> // memcpy
+#include <stdexcept> // std::invalid_argument
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "cdc.hpp"
+#include "worker_pool.hpp"
+
+using namespace std;
+
+// segments shorter than this per lane are scanned by the scalar loop
+static const size_t MIN_LANE_SEGMENT = 256;
+
+// pieces per worker when a pool splits the scan
+static const size_t MIN_POOL_PIECE = 1 << 20;
+
+// 256 random 64 bit values (splitmix64 from a fixed seed), part of the chunk format: never change them
+static const struct GearTable {
+    uint64_t g[256];
+    GearTable() {
+        uint64_t x = 0x73616c7361636463ull; // "salsacdc"
+        for (unsigned i=0; i<256; i++) {
+            uint64_t z = (x += 0x9e3779b97f4a7c15ull);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+            g[i] = z ^ (z >> 31);
+        }
+    }
+} GEAR;
+
+// top bits of the hash, the ones depending on the most bytes
+static uint64_t topBits(unsigned bits) {
+    return bits ? ~0ull << (64 - bits) : 0;
+}
+
+// candidate: chunk end << 1 | strict mask matched
+static void addCandidate(vector<uint64_t>& found, size_t end, uint64_t h, uint64_t mask_s) {
+    found.push_back((uint64_t) end << 1 | ((h & mask_s) == 0));
+}
+
+//  hash [from, to) on from hash h, returns the final hash
+static uint64_t scanScalar(const uint8_t* data, size_t from, size_t to, uint64_t h, uint64_t mask_l, uint64_t mask_s,
+                           vector<uint64_t>& found) {
+    for (size_t i=from; i<to; i++) {
+        h = (h << 1) + GEAR.g[data[i]];
+        if ((h & mask_l) == 0)
+            addCandidate(found, i + 1, h, mask_s);
+    }
+    return h;
+}
+
+/*  hash CDC_LANES segments of seg bytes (a multiple of 8) from begin on side by side, lane j
+    starting with hash h[j]. Candidates (loose mask) of lane j go to found[j], h holds the final hashes */
+static void scanLanesGeneric(const uint8_t* data, size_t begin, size_t seg, uint64_t mask_l, uint64_t mask_s,
+                             uint64_t h[CDC_LANES], vector<uint64_t> found[CDC_LANES]) {
+    for (size_t i=0; i<seg; i++)
+        for (unsigned lane=0; lane<CDC_LANES; lane++) {
+            const size_t pos = begin + lane*seg + i;
+            h[lane] = (h[lane] << 1) + GEAR.g[data[pos]];
+            if ((h[lane] & mask_l) == 0)
+                addCandidate(found[lane], pos + 1, h[lane], mask_s);
+        }
+}
+
+#if defined(__x86_64__)
+
+/*  same as scanLanesGeneric(), 2 x 4 lanes in AVX2 registers: 8 bytes of every lane per load,
+    the table lookups are gathers. Blocks of 8 bytes with a candidate in any lane (one in 256
+    with the default sizes) are hashed again by the scalar loop to find where it was */
+__attribute__((target("avx2")))
+static void scanLanesAvx2(const uint8_t* data, size_t begin, size_t seg, uint64_t mask_l, uint64_t mask_s,
+                          uint64_t h[CDC_LANES], vector<uint64_t> found[CDC_LANES]) {
+    static_assert(CDC_LANES == 8, "two registers of 4 lanes");
+    const long long* gear = (const long long*) GEAR.g;
+    const __m256i mask = _mm256_set1_epi64x(mask_l), zero = _mm256_setzero_si256(), low_byte = _mm256_set1_epi64x(0xff);
+    __m256i h_lo = _mm256_loadu_si256((const __m256i*) h), h_hi = _mm256_loadu_si256((const __m256i*) (h + 4));
+
+    for (size_t i=0; i<seg; i+=8) {
+        long long w[CDC_LANES];
+        for (unsigned lane=0; lane<CDC_LANES; lane++)
+            memcpy(&w[lane], data + begin + lane*seg + i, 8);
+        __m256i w_lo = _mm256_loadu_si256((const __m256i*) w), w_hi = _mm256_loadu_si256((const __m256i*) (w + 4));
+        const __m256i start_lo = h_lo, start_hi = h_hi;
+        __m256i hits = zero;
+
+        for (unsigned k=0; k<8; k++) {
+            h_lo = _mm256_add_epi64(_mm256_slli_epi64(h_lo, 1), _mm256_i64gather_epi64(gear, _mm256_and_si256(w_lo, low_byte), 8));
+            h_hi = _mm256_add_epi64(_mm256_slli_epi64(h_hi, 1), _mm256_i64gather_epi64(gear, _mm256_and_si256(w_hi, low_byte), 8));
+            w_lo = _mm256_srli_epi64(w_lo, 8);
+            w_hi = _mm256_srli_epi64(w_hi, 8);
+            hits = _mm256_or_si256(hits, _mm256_or_si256(_mm256_cmpeq_epi64(_mm256_and_si256(h_lo, mask), zero),
+                                                         _mm256_cmpeq_epi64(_mm256_and_si256(h_hi, mask), zero)));
+        }
+
+        if (__builtin_expect(!_mm256_testz_si256(hits, hits), 0)) {
+            uint64_t start[CDC_LANES];
+            _mm256_storeu_si256((__m256i*) start, start_lo);
+            _mm256_storeu_si256((__m256i*) (start + 4), start_hi);
+            for (unsigned lane=0; lane<CDC_LANES; lane++) {
+                const size_t from = begin + lane*seg + i;
+                scanScalar(data, from, from + 8, start[lane], mask_l, mask_s, found[lane]);
+            }
+        }
+    }
+    _mm256_storeu_si256((__m256i*) h, h_lo);
+    _mm256_storeu_si256((__m256i*) (h + 4), h_hi);
+}
+
+// may run before the constructor that initializes the cpu model, so init it here
+static bool detectAvx2() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+static const bool HAVE_AVX2 = detectAvx2();
+
+#else
+
+static const bool HAVE_AVX2 = false;
+#define scanLanesAvx2 scanLanesGeneric
+
+#endif
+
+//  candidates of the positions [begin, end) in order, hashes warmed up with the 64 bytes before begin
+static void scanCandidates(const uint8_t* data, size_t begin, size_t end, uint64_t mask_l, uint64_t mask_s,
+                           vector<uint64_t>& found) {
+    auto warmup = [&](size_t pos) {
+        uint64_t h = 0;
+        for (size_t i = pos >= 64 ? pos - 64 : 0; i < pos; i++)
+            h = (h << 1) + GEAR.g[data[i]];
+        return h;
+    };
+
+    const size_t seg = (end - begin) / CDC_LANES / 8 * 8;
+    if (seg < MIN_LANE_SEGMENT) {
+        scanScalar(data, begin, end, warmup(begin), mask_l, mask_s, found);
+        return;
+    }
+
+    uint64_t h[CDC_LANES];
+    vector<uint64_t> lane_found[CDC_LANES];
+    for (unsigned lane=0; lane<CDC_LANES; lane++)
+        h[lane] = warmup(begin + lane*seg);
+    if (HAVE_AVX2)
+        scanLanesAvx2(data, begin, seg, mask_l, mask_s, h, lane_found);
+    else
+        scanLanesGeneric(data, begin, seg, mask_l, mask_s, h, lane_found);
+
+    for (unsigned lane=0; lane<CDC_LANES; lane++)
+        found.insert(found.end(), lane_found[lane].begin(), lane_found[lane].end());
+    // the rest continues the last lane
+    scanScalar(data, begin + CDC_LANES*seg, end, h[CDC_LANES-1], mask_l, mask_s, found);
+}
+
+size_t cdcCut(const uint8_t* data, size_t len, bool final, const CdcParams& params,
+              vector<size_t>& cuts, WorkerPool* pool) {
+    const uint32_t min_size = params.min_size, avg_size = params.avg_size, max_size = params.max_size;
+    if (min_size < 64 || min_size > avg_size || avg_size > max_size || (avg_size & (avg_size - 1)))
+        throw invalid_argument("chunk sizes have to be 64 <= min <= avg <= max with avg a power of two");
+
+    // normalized chunking: 2 bits more than the average before it, 2 less after it
+    unsigned avg_bits = 0;
+    while ((1u << avg_bits) < avg_size)
+        avg_bits++;
+    const uint64_t mask_s = topBits(avg_bits + 2), mask_l = topBits(avg_bits >= 2 ? avg_bits - 2 : 0);
+
+    vector<uint64_t> candidates;
+    const size_t nr_pieces = pool ? min<size_t>(pool->size() * 4, len / MIN_POOL_PIECE) : 0;
+    if (nr_pieces > 1) {
+        vector<vector<uint64_t>> found(nr_pieces);
+        const size_t piece = len / nr_pieces;
+        pool->parallelFor(nr_pieces, [&](size_t i) {
+            scanCandidates(data, i * piece, i+1 < nr_pieces ? (i+1) * piece : len, mask_l, mask_s, found[i]);
+        });
+        for (auto& f : found)
+            candidates.insert(candidates.end(), f.begin(), f.end());
+    } else
+        scanCandidates(data, 0, len, mask_l, mask_s, candidates);
+
+    // first strict candidate in [start+min, start+avg), else first loose one up to start+max
+    size_t start = 0, next = 0;
+    while (start < len) {
+        size_t cut = 0;
+        while (next < candidates.size() && (candidates[next] >> 1) < start + min_size)
+            next++;
+        for (size_t c=next; c < candidates.size(); c++) {
+            const size_t end = candidates[c] >> 1;
+            if (end > start + max_size)
+                break;
+            if (end >= start + avg_size || (candidates[c] & 1)) {
+                cut = end;
+                break;
+            }
+        }
+
+        if (!cut) {
+            if (start + max_size <= len)
+                cut = start + max_size;
+            else if (final)
+                cut = len;
+            else
+                break;  // a boundary may still come with the next data
+        }
+        cuts.push_back(cut);
+        start = cut;
+    }
+    return start;
+}
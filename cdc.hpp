@@ -0,0 +1,44 @@
+#ifndef CDC_HPP
+#define CDC_HPP
+
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+class WorkerPool;
+
+/*  Content defined chunking with a gear hash (FastCDC style normalized chunking)
+
+    The gear hash of position i is h = (h << 1) + GEAR[byte], after 64 bytes it only depends on
+    the last 64 bytes, so every position can be hashed independently of where the scan started.
+    The scan uses that to hash CDC_LANES segments of the data side by side in AVX2 registers
+    (table lookups as gathers, 8 independent dependency chains instead of one), each segment
+    warmed up with the 64 bytes before it, and a WorkerPool splits large buffers further. The result is the same as one
+    sequential scan.
+
+    A chunk ends at the first position where the hash has none of the strict mask bits set once
+    it is min_size long, after avg_size bytes the looser mask is used, at max_size it is cut.
+    The masks use the top bits of the hash, which depend on the most input bytes.
+
+    Boundaries only depend on the bytes around them: an insert early in a file shifts the
+    chunks after it but leaves their boundaries and contents alone, which is what makes
+    deduplication of changed files work.
+*/
+
+#define CDC_LANES 8
+
+struct CdcParams {
+    uint32_t min_size = 2 * 1024;
+    uint32_t avg_size = 8 * 1024;   // power of two
+    uint32_t max_size = 64 * 1024;
+};
+
+/*  chunk ends (exclusive offsets) of data, appended to cuts
+    final: data ends the stream, the rest after the last boundary is a chunk as well. Otherwise the
+    rest is left for the next call, which has to start at the last returned cut
+    returns the offset up to which data was cut
+    throws std::invalid_argument unless 64 <= min_size <= avg_size <= max_size and avg_size is a power of two */
+size_t cdcCut(const uint8_t* data, size_t len, bool final, const CdcParams& params,
+              std::vector<size_t>& cuts, WorkerPool* pool = nullptr);
+
+#endif // CDC_HPP
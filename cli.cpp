@@ -0,0 +1,114 @@
+#include <iostream>
+#include <stdexcept>
+#include <cerrno>
+#include <unistd.h> // write()
+
+#include "cli.hpp"
+
+using namespace std;
+
+unique_ptr<SnuffleStreamCipher> cipherFromArgs(const string& key_str, const string& nonce_hex,
+                                               const bool hex_key, const bool chacha) {
+    unique_ptr<SnuffleStreamCipher> cipher;
+    try {
+        if (chacha)
+            cipher.reset(new Chacha20(key_str, hex_key));
+        else
+            cipher.reset(new Salsa20(key_str, hex_key));
+    } catch (length_error&) {
+        if (!hex_key)
+            cerr << "invalid key size. has to be 16 or 32 (ascii interpreted) chars" << endl;
+        else
+            cerr << "invalid key size. has to be 32 or 64 hex chars" << endl;
+        exit(EXIT_FAILURE);
+    } catch (invalid_argument&) {
+        cerr << "all key chars have to be hex chars (no 0x prefix)" << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    try {
+        cipher->setNonce(nonce_hex);
+    } catch (length_error&) {
+        cerr << "invalid nonce size. has to be 8 byte (16 hex interpreted chars) without 0x prefix)" << endl;
+        exit(EXIT_FAILURE);
+    } catch (invalid_argument&) {
+        cerr << "nonce hast to consist of only hex chars (also no 0x prefix)" << endl;
+        exit(EXIT_FAILURE);
+    }
+    return cipher;
+}
+
+SnuffleKeyContext keyContextFromArgs(const string& key_str, const bool hex_key, const bool chacha) {
+    return cipherFromArgs(key_str, "0000000000000000", hex_key, chacha)->keyContext();
+}
+
+vector<uint8_t> keyBytesFromArgs(const string& key_str, const bool hex_key) {
+    cipherFromArgs(key_str, "0000000000000000", hex_key, false); // validation and error messages
+    if (!hex_key)
+        return vector<uint8_t>(key_str.begin(), key_str.end());
+
+    vector<uint8_t> key(key_str.size() / 2);
+    for (size_t i=0; i<key.size(); i++)
+        key[i] = stoul(key_str.substr(2*i, 2), nullptr, 16);
+    return key;
+}
+
+void nonceBytesFromHex(const string& nonce_hex, uint8_t nonce[8]) {
+    for (unsigned i=0; i<8; i++)
+        nonce[i] = stoul(nonce_hex.substr(2*i, 2), nullptr, 16);
+}
+
+uint64_t parseSize(const string& str, const string& what) {
+    size_t pos = 0;
+    uint64_t value = 0;
+    try {
+        value = stoull(str, &pos, 10);
+    } catch (logic_error&) {
+        pos = 0;
+    }
+
+    if (pos == 0 || pos + 1 < str.size() || str[0] == '-') {
+        cerr << "invalid " << what << ": " << str << endl;
+        exit(EXIT_FAILURE);
+    }
+    if (pos < str.size()) {
+        switch (str[pos]) {
+            case 'k': case 'K': value <<= 10; break;
+            case 'm': case 'M': value <<= 20; break;
+            case 'g': case 'G': value <<= 30; break;
+            default:
+                cerr << "invalid " << what << ": " << str << endl;
+                exit(EXIT_FAILURE);
+        }
+    }
+    return value;
+}
+
+uint64_t parseCount(const string& str, const string& what, uint64_t max) {
+    size_t pos = 0;
+    uint64_t value = 0;
+    try {
+        value = stoull(str, &pos, 10);
+    } catch (logic_error&) {
+        pos = 0;
+    }
+
+    if (pos == 0 || pos != str.size() || str[0] == '-' || value > max) {
+        cerr << "invalid " << what << ": " << str << " (0 to " << max << ")" << endl;
+        exit(EXIT_FAILURE);
+    }
+    return value;
+}
+
+bool writeAll(int fd, const uint8_t* buf, size_t len) {
+    while (len) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
@@ -0,0 +1,49 @@
+#ifndef CLI_HPP
+#define CLI_HPP
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "salsa20.hpp"
+
+/*  helpers shared by the subcommands of the salsa program (mainprog.cpp, cli_*.cpp)
+    invalid user input is reported on stderr and ends the program with EXIT_FAILURE */
+
+//  cipher for key and nonce as given on the command line
+std::unique_ptr<SnuffleStreamCipher> cipherFromArgs(const std::string& key_str, const std::string& nonce_hex,
+                                                    const bool hex_key, const bool chacha);
+
+//  expanded key for key as given on the command line, for modes that pick their nonces themselves
+SnuffleKeyContext keyContextFromArgs(const std::string& key_str, const bool hex_key, const bool chacha);
+
+//  key as given on the command line -> its 16 or 32 raw bytes, independent of the cipher variant
+std::vector<uint8_t> keyBytesFromArgs(const std::string& key_str, const bool hex_key);
+
+//  nonce as 16 hex chars (validated by cipherFromArgs()) -> 8 bytes
+void nonceBytesFromHex(const std::string& nonce_hex, uint8_t nonce[8]);
+
+//  byte count with optional k/M/G suffix (powers of 1024)
+uint64_t parseSize(const std::string& str, const std::string& what);
+
+//  plain decimal integer from 0 to max, no suffixes
+uint64_t parseCount(const std::string& str, const std::string& what, uint64_t max);
+
+//  upper bound of --threads, 0 there picks one thread per core
+static const unsigned MAX_THREADS = 1024;
+
+//  write all len bytes to fd, retrying on short writes, false on error
+bool writeAll(int fd, const uint8_t* buf, size_t len);
+
+//  subcommands, argv[0] is the subcommand name
+int keystreamCommand(int argc, char** argv);
+int merkleCommand(int argc, char** argv);
+int sealCommand(int argc, char** argv);
+int openCommand(int argc, char** argv);
+int logCommand(int argc, char** argv);
+int udpCommand(int argc, char** argv);
+int dedupCommand(int argc, char** argv);
+int archiveCommand(int argc, char** argv);
+
+#endif // CLI_HPP
@@ -0,0 +1,123 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/random.h>
+
+#include "cli.hpp"
+#include "archive.hpp"
+#include "worker_pool.hpp"
+
+using namespace std;
+
+/*  salsa archive: encrypted single file archives (archive.hpp)
+
+    salsa archive create backup.sarc key dir file ...    pack files and directories
+    salsa archive list backup.sarc key                   members with type, size and name
+    salsa archive extract backup.sarc key [name ...]     everything (or the named members) into --dir
+    salsa archive cat backup.sarc key name               one member to stdout
+
+    create picks a random salt for the archive key, the others take the cipher from the archive header.
+*/
+
+static void usage() {
+    cerr << "usage:\n"
+         << "salsa archive create archive key path... [--segment-size N] [--threads T] [--hex-key] [--chacha20]\n"
+         << "salsa archive list archive key [--hex-key]\n"
+         << "salsa archive extract archive key [name...] [--dir D] [--threads T] [--hex-key]\n"
+         << "salsa archive cat archive key name [--threads T] [--hex-key]\n"
+         << "sizes take k, M and G suffixes, T = 0 uses all cores" << endl;
+    exit(EXIT_FAILURE);
+}
+
+int archiveCommand(int argc, char** argv) {
+    vector<string> pos_args;
+    uint64_t segment_size = STREAM_DEFAULT_SEGMENT_SIZE;
+    unsigned nr_threads = 0;
+    string dir = ".";
+    bool is_hex_key = false, use_chacha = false;
+
+    for (int i=1; i<argc; i++) {
+        string arg = argv[i];
+        bool has_value = i+1 < argc;
+
+        if (arg == "--segment-size" && has_value)
+            segment_size = parseSize(argv[++i], "segment size");
+        else if (arg == "--threads" && has_value)
+            nr_threads = parseCount(argv[++i], "thread count", MAX_THREADS);
+        else if (arg == "--dir" && has_value)
+            dir = argv[++i];
+        else if (arg == "--hex-key")
+            is_hex_key = true;
+        else if (arg == "--chacha20")
+            use_chacha = true;
+        else if (arg.rfind("--", 0) == 0) {
+            cerr << "unknown argument: " << arg << endl;
+            usage();
+        } else
+            pos_args.push_back(arg);
+    }
+    if (pos_args.size() < 3)
+        usage();
+    const string& mode = pos_args[0];
+    const string& path = pos_args[1];
+    const vector<string> rest(pos_args.begin() + 3, pos_args.end());
+
+    try {
+        if (mode == "create" && !rest.empty()) {
+            if (segment_size == 0 || segment_size > STREAM_MAX_SEGMENT_SIZE) {
+                cerr << "segment size has to be between 1 and " << STREAM_MAX_SEGMENT_SIZE << endl;
+                exit(EXIT_FAILURE);
+            }
+            SnuffleKeyContext key = keyContextFromArgs(pos_args[2], is_hex_key, use_chacha);
+            StreamHeader header;
+            header.variant = key.variant;
+            header.segment_size = segment_size;
+            if (getrandom(header.salt, sizeof(header.salt), 0) != sizeof(header.salt)) {
+                cerr << "could not get a random salt: " << strerror(errno) << endl;
+                exit(EXIT_FAILURE);
+            }
+            WorkerPool pool(nr_threads);
+            archivePack(path, rest, key, header, pool);
+            return 0;
+        }
+
+        SnuffleVariant variant = ArchiveReader::variant(path);
+        SnuffleKeyContext key = keyContextFromArgs(pos_args[2], is_hex_key, variant == SnuffleVariant::Chacha20);
+
+        if (mode == "list" && rest.empty()) {
+            ArchiveReader archive(path, key);
+            for (auto& member : archive.members())
+                cout << (member.type == ArchiveMember::DIRECTORY ? "d " : "f ") << member.size << "\t" << member.name << "\n";
+            return 0;
+        }
+
+        if (mode == "extract") {
+            ArchiveReader archive(path, key);
+            WorkerPool pool(nr_threads);
+            archive.extractTo(dir, rest, pool);
+            return 0;
+        }
+
+        if (mode == "cat" && rest.size() == 1) {
+            ArchiveReader archive(path, key);
+            const ArchiveMember* member = archive.find(rest[0]);
+            if (!member) {
+                cerr << "no member " << rest[0] << " in " << path << endl;
+                exit(EXIT_FAILURE);
+            }
+            WorkerPool pool(nr_threads);
+            archive.extract(*member, STDOUT_FILENO, &pool);
+            return 0;
+        }
+    } catch (exception& e) {
+        cerr << e.what() << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    usage();
+    return EXIT_FAILURE;
+}
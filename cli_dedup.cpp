@@ -0,0 +1,102 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "cli.hpp"
+#include "blake.hpp"
+#include "dedup_store.hpp"
+#include "worker_pool.hpp"
+
+using namespace std;
+
+/*  salsa dedup: deduplicating encrypted backup store (dedup_store.hpp)
+
+    salsa dedup put store key name [file]    chunks, encrypts and stores file (or stdin) as name
+    salsa dedup get store key name           writes name to stdout
+    salsa dedup stats store key              unique chunks and stored bytes
+
+    The store secret is derived from the raw key bytes (BLAKE3 derive_key), everything that goes
+    into one store has to use the same key to be deduplicated against each other. Chunks are always
+    encrypted with Chacha20 (dedup_store.hpp), there is no cipher choice.
+*/
+
+static const char* DEDUP_KDF_CONTEXT = "salsa dedup store v1";
+
+static void usage() {
+    cerr << "usage:\n"
+         << "salsa dedup put store key name [file] [--threads T] [--hex-key]\n"
+         << "salsa dedup get store key name [--threads T] [--hex-key]\n"
+         << "salsa dedup stats store key [--hex-key]\n"
+         << "put reads stdin without file, get writes stdout, T = 0 uses all cores" << endl;
+    exit(EXIT_FAILURE);
+}
+
+int dedupCommand(int argc, char** argv) {
+    vector<string> pos_args;
+    unsigned nr_threads = 0;
+    bool is_hex_key = false;
+
+    for (int i=1; i<argc; i++) {
+        string arg = argv[i];
+        if (arg == "--threads" && i+1 < argc)
+            nr_threads = parseCount(argv[++i], "thread count", MAX_THREADS);
+        else if (arg == "--hex-key")
+            is_hex_key = true;
+        else if (arg.rfind("--", 0) == 0) {
+            cerr << "unknown argument: " << arg << endl;
+            usage();
+        } else
+            pos_args.push_back(arg);
+    }
+    if (pos_args.size() < 3)
+        usage();
+    const string& mode = pos_args[0];
+
+    vector<uint8_t> key = keyBytesFromArgs(pos_args[2], is_hex_key);
+    uint8_t store_secret[32];
+    blake3DeriveKey(store_secret, sizeof(store_secret), DEDUP_KDF_CONTEXT, key.data(), key.size());
+
+    try {
+        if (mode == "put" && (pos_args.size() == 4 || pos_args.size() == 5)) {
+            int fd = STDIN_FILENO;
+            if (pos_args.size() == 5 && (fd = open(pos_args[4].c_str(), O_RDONLY)) < 0) {
+                cerr << "Could not open " << pos_args[4] << ": " << strerror(errno) << endl;
+                exit(EXIT_FAILURE);
+            }
+            DedupStore store(pos_args[1], store_secret);
+            WorkerPool pool(nr_threads);
+            auto recipe = store.ingest(fd, &pool);
+            if (fd != STDIN_FILENO)
+                close(fd);
+            store.putRecipe(pos_args[3], recipe);
+            cerr << store.ingestedBytes() << " bytes in " << store.ingestedChunks() << " chunks, "
+                 << store.newChunks() << " new (" << store.newBytes() << " bytes)" << endl;
+            return 0;
+        }
+
+        if (mode == "get" && pos_args.size() == 4) {
+            DedupStore store(pos_args[1], store_secret);
+            auto recipe = store.getRecipe(pos_args[3]);
+            WorkerPool pool(nr_threads);
+            store.restore(recipe, STDOUT_FILENO, &pool);
+            return 0;
+        }
+
+        if (mode == "stats" && pos_args.size() == 3) {
+            DedupStore store(pos_args[1], store_secret);
+            cout << store.uniqueChunks() << " unique chunks, " << store.storedBytes() << " bytes stored" << endl;
+            return 0;
+        }
+    } catch (exception& e) {
+        cerr << e.what() << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    usage();
+    return EXIT_FAILURE;
+}
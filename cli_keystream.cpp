@@ -0,0 +1,139 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <future>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "cli.hpp"
+#include "snuffle_kernels.hpp"
+#include "worker_pool.hpp"
+
+using namespace std;
+
+/*  salsa keystream: raw keystream to stdout or a file
+
+    Deterministic pseudo random data for load tests, reproducible from key and nonce.
+    The output is generated in windows of WINDOW_BLOCKS blocks. Every window is split over
+    the worker pool and generated with the multi block kernels while the main thread
+    writes the previous window in one large write.
+*/
+
+static const size_t WINDOW_BLOCKS = 1 << 16; // 4 MiB
+
+static void usage() {
+    cerr << "usage:\n"
+         << "salsa keystream key nonce --bytes N [--seek offset] [--threads T] [--out file] [--hex-key] [--chacha20]\n"
+         << "writes N bytes of keystream starting at byte offset of the stream to stdout (or file)\n"
+         << "sizes take k, M and G suffixes, T = 0 uses all cores" << endl;
+    exit(EXIT_FAILURE);
+}
+
+int keystreamCommand(int argc, char** argv) {
+    vector<string> pos_args;
+    string out_file;
+    uint64_t nr_bytes = 0, offset = 0;
+    unsigned nr_threads = 0;
+    bool have_bytes = false, is_hex_key = false, use_chacha = false;
+
+    for (int i=1; i<argc; i++) {
+        string arg = argv[i];
+        bool has_value = i+1 < argc;
+
+        if (arg == "--bytes" && has_value) {
+            nr_bytes = parseSize(argv[++i], "byte count");
+            have_bytes = true;
+        } else if (arg == "--seek" && has_value)
+            offset = parseSize(argv[++i], "seek offset");
+        else if (arg == "--threads" && has_value)
+            nr_threads = parseCount(argv[++i], "thread count", MAX_THREADS);
+        else if (arg == "--out" && has_value)
+            out_file = argv[++i];
+        else if (arg == "--hex-key")
+            is_hex_key = true;
+        else if (arg == "--chacha20")
+            use_chacha = true;
+        else if (arg.rfind("--", 0) == 0) {
+            cerr << "unknown argument: " << arg << endl;
+            usage();
+        } else
+            pos_args.push_back(arg);
+    }
+    if (pos_args.size() != 2 || !have_bytes)
+        usage();
+
+    auto cipher = cipherFromArgs(pos_args[0], pos_args[1], is_hex_key, use_chacha);
+    const SnuffleKeyContext ctx = cipher->keyContext();
+    uint8_t nonce[8];
+    nonceBytesFromHex(pos_args[1], nonce);
+
+    int fd = STDOUT_FILENO;
+    if (!out_file.empty()) {
+        fd = open(out_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            cerr << "Could not open " << out_file << ": " << strerror(errno) << endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    WorkerPool pool(nr_threads);
+
+    // generate nblocks starting at first_block into buf, one slice per worker
+    auto launch = [&](uint8_t* buf, uint64_t first_block, size_t nblocks) {
+        vector<future<void>> slices;
+        size_t slice = (nblocks / pool.size() + SNUFFLE_LANES - 1) / SNUFFLE_LANES * SNUFFLE_LANES;
+        slice = max<size_t>(slice, SNUFFLE_LANES);
+        for (size_t done=0; done < nblocks; done += slice) {
+            size_t n = min(slice, nblocks - done);
+            slices.push_back(pool.submit([&ctx, &nonce, buf, first_block, done, n] {
+                uint32_t state[16];
+                snuffleInitState(state, ctx, nonce, first_block + done);
+                snuffleKeystreamBlocks(ctx.variant, state, buf + 64*done, n);
+            }));
+        }
+        return slices;
+    };
+
+    // the first window starts with the block containing offset
+    const size_t skip = offset % 64;
+    uint64_t next_block = offset / 64;
+    uint64_t blocks_left = (skip + nr_bytes + 63) / 64;
+    uint64_t bytes_left = nr_bytes;
+
+    vector<uint8_t> bufs[2] = {vector<uint8_t>(64*WINDOW_BLOCKS), vector<uint8_t>(64*WINDOW_BLOCKS)};
+    unsigned cur = 0;
+    size_t cur_blocks = min<uint64_t>(blocks_left, WINDOW_BLOCKS);
+    auto pending = launch(bufs[cur].data(), next_block, cur_blocks);
+    next_block += cur_blocks;
+    blocks_left -= cur_blocks;
+    size_t cur_skip = skip;
+
+    while (bytes_left) {
+        for (auto& f : pending)
+            f.get();
+
+        // start the next window before writing this one
+        size_t next_blocks = min<uint64_t>(blocks_left, WINDOW_BLOCKS);
+        pending = launch(bufs[cur^1].data(), next_block, next_blocks);
+        next_block += next_blocks;
+        blocks_left -= next_blocks;
+
+        size_t len = min<uint64_t>(64*cur_blocks - cur_skip, bytes_left);
+        if (!writeAll(fd, bufs[cur].data() + cur_skip, len)) {
+            cerr << "Error writing output: " << strerror(errno) << endl;
+            exit(EXIT_FAILURE);
+        }
+        bytes_left -= len;
+        cur_skip = 0;
+        cur_blocks = next_blocks;
+        cur ^= 1;
+    }
+
+    if (fd != STDOUT_FILENO && close(fd) != 0) {
+        cerr << "Error writing output: " << strerror(errno) << endl;
+        exit(EXIT_FAILURE);
+    }
+    return 0;
+}
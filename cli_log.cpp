@@ -0,0 +1,124 @@
+#include <iostream>
+#include <sstream>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+
+#include "cli.hpp"
+#include "encrypted_log.hpp"
+#include "metrics_server.hpp"
+
+using namespace std;
+
+/*  salsa log: encrypted append-only event logs (encrypted_log.hpp)
+
+    append  every line of stdin becomes one record, committed in groups every interval
+            --metrics-port serves appends and commits on http://127.0.0.1:port/metrics
+    cat     prints the records of a log, one per line
+*/
+
+static void usage() {
+    cerr << "usage:\n"
+         << "salsa log append file key nonce [--interval-us N] [--metrics-port P] [--hex-key] [--chacha20]\n"
+         << "salsa log cat file key nonce [--hex-key] [--chacha20]" << endl;
+    exit(EXIT_FAILURE);
+}
+
+int logCommand(int argc, char** argv) {
+    vector<string> pos_args;
+    uint64_t interval_us = 2000;
+    int metrics_port = -1;
+    bool is_hex_key = false, use_chacha = false;
+
+    for (int i=1; i<argc; i++) {
+        string arg = argv[i];
+        bool has_value = i+1 < argc;
+
+        if (arg == "--interval-us" && has_value)
+            interval_us = parseSize(argv[++i], "commit interval");
+        else if (arg == "--metrics-port" && has_value) {
+            uint64_t port = parseSize(argv[++i], "metrics port");
+            if (port > 65535) {
+                cerr << "metrics port has to be below 65536" << endl;
+                exit(EXIT_FAILURE);
+            }
+            metrics_port = port;
+        }
+        else if (arg == "--hex-key")
+            is_hex_key = true;
+        else if (arg == "--chacha20")
+            use_chacha = true;
+        else if (arg.rfind("--", 0) == 0) {
+            cerr << "unknown argument: " << arg << endl;
+            usage();
+        } else
+            pos_args.push_back(arg);
+    }
+    if (pos_args.size() != 4)
+        usage();
+
+    const string& mode = pos_args[0];
+    const string& path = pos_args[1];
+    auto cipher = cipherFromArgs(pos_args[2], pos_args[3], is_hex_key, use_chacha);
+    const SnuffleKeyContext key = cipher->keyContext();
+    uint8_t nonce[8];
+    nonceBytesFromHex(pos_args[3], nonce);
+
+    try {
+        if (mode == "append") {
+            EncryptedLogWriter log(path, key, nonce, chrono::microseconds(interval_us));
+            atomic<uint64_t> records(0), bytes(0);
+
+            unique_ptr<MetricsServer> metrics;
+            if (metrics_port >= 0) {
+                metrics.reset(new MetricsServer(metrics_port, [&] {
+                    ostringstream out;
+                    out << prometheusProcessMetrics(nullptr, 1)
+                        << "# HELP salsa_log_records_total Records appended\n# TYPE salsa_log_records_total counter\n"
+                        << "salsa_log_records_total " << records.load() << "\n"
+                        << "# HELP salsa_log_bytes_total Payload bytes appended\n# TYPE salsa_log_bytes_total counter\n"
+                        << "salsa_log_bytes_total " << bytes.load() << "\n"
+                        << "# HELP salsa_log_commits_total Group commits (write + fdatasync)\n# TYPE salsa_log_commits_total counter\n"
+                        << "salsa_log_commits_total " << log.commits() << "\n"
+                        << "# HELP salsa_log_durable_bytes Size of the log known to be on disk\n# TYPE salsa_log_durable_bytes gauge\n"
+                        << "salsa_log_durable_bytes " << log.durableOffset() << "\n";
+                    return out.str();
+                }));
+                if (metrics_port == 0)
+                    cerr << "metrics on http://127.0.0.1:" << metrics->port() << "/metrics" << endl;
+            }
+
+            string line;
+            while (getline(cin, line)) {
+                log.append((const uint8_t*) line.data(), line.size());
+                records.fetch_add(1, memory_order_relaxed);
+                bytes.fetch_add(line.size(), memory_order_relaxed);
+            }
+            log.flush();
+            return 0;
+        }
+
+        if (mode == "cat") {
+            string out;
+            forEachLogRecord(path, key, nonce, [&](uint64_t, const uint8_t* data, size_t len) {
+                out.assign((const char*) data, len);
+                out += '\n';
+                if (!writeAll(STDOUT_FILENO, (const uint8_t*) out.data(), out.size()))
+                    throw runtime_error(string("Error writing output: ") + strerror(errno));
+            });
+            return 0;
+        }
+    } catch (exception& e) {
+        cerr << e.what() << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    usage();
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,167 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "cli.hpp"
+#include "blake.hpp"
+#include "merkle.hpp"
+#include "encrypted_reader.hpp"
+#include "worker_pool.hpp"
+
+using namespace std;
+
+/*  salsa merkle: integrity index for encrypted files
+
+    build   hashes the chunks of an encrypted file into a Merkle tree, saved as file.mrk
+    verify  checks the whole file (or a range) against the index and lists bad chunks
+    read    authenticated random access: verifies the chunks of a range, then decrypts it
+
+    The index is keyed with a MAC key derived from the cipher key (BLAKE3 derive_key),
+    --no-key builds a plain hash tree whose root has to be compared out of band.
+*/
+
+static const char* MERKLE_KDF_CONTEXT = "salsa merkle index v1";
+
+static void usage() {
+    cerr << "usage:\n"
+         << "salsa merkle build file key [--chunk-size N] [--threads T] [--no-key] [--hex-key] [--chacha20]\n"
+         << "salsa merkle verify file key [--range offset len] [--threads T] [--no-key] [--hex-key] [--chacha20]\n"
+         << "salsa merkle read file key nonce --range offset len [--hex-key] [--chacha20]\n"
+         << "the index is kept in file.mrk, sizes take k, M and G suffixes, T = 0 uses all cores" << endl;
+    exit(EXIT_FAILURE);
+}
+
+// 32 byte MAC key bound to the cipher key
+static void macKeyFromArgs(const string& key_str, bool hex_key, bool chacha, uint8_t mac_key[32]) {
+    SnuffleKeyContext ctx = keyContextFromArgs(key_str, hex_key, chacha);
+    blake3DeriveKey(mac_key, 32, MERKLE_KDF_CONTEXT, (const uint8_t*) ctx.matrix, sizeof(ctx.matrix));
+}
+
+static int openOrDie(const string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        cerr << "Could not open " << path << ": " << strerror(errno) << endl;
+        exit(EXIT_FAILURE);
+    }
+    return fd;
+}
+
+int merkleCommand(int argc, char** argv) {
+    vector<string> pos_args;
+    uint64_t chunk_size = MerkleIndex::DEFAULT_CHUNK_SIZE, range_off = 0, range_len = 0;
+    unsigned nr_threads = 0;
+    bool have_range = false, no_key = false, is_hex_key = false, use_chacha = false;
+
+    for (int i=1; i<argc; i++) {
+        string arg = argv[i];
+        bool has_value = i+1 < argc;
+
+        if (arg == "--chunk-size" && has_value)
+            chunk_size = parseSize(argv[++i], "chunk size");
+        else if (arg == "--range" && i+2 < argc) {
+            range_off = parseSize(argv[++i], "range offset");
+            range_len = parseSize(argv[++i], "range length");
+            have_range = true;
+        } else if (arg == "--threads" && has_value)
+            nr_threads = parseCount(argv[++i], "thread count", MAX_THREADS);
+        else if (arg == "--no-key")
+            no_key = true;
+        else if (arg == "--hex-key")
+            is_hex_key = true;
+        else if (arg == "--chacha20")
+            use_chacha = true;
+        else if (arg.rfind("--", 0) == 0) {
+            cerr << "unknown argument: " << arg << endl;
+            usage();
+        } else
+            pos_args.push_back(arg);
+    }
+    if (pos_args.size() < 3)
+        usage();
+
+    const string& mode = pos_args[0];
+    const string& path = pos_args[1];
+    const string index_path = path + ".mrk";
+    if (chunk_size == 0 || chunk_size > UINT32_MAX) {
+        cerr << "chunk size has to be between 1 and 4G-1" << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    uint8_t mac_key[32];
+    macKeyFromArgs(pos_args[2], is_hex_key, use_chacha, mac_key);
+    const uint8_t* key_ptr = no_key ? nullptr : mac_key;
+
+    try {
+        if (mode == "build" && pos_args.size() == 3) {
+            WorkerPool pool(nr_threads);
+            int fd = openOrDie(path);
+            MerkleIndex index = MerkleIndex::build(fd, chunk_size, key_ptr, &pool);
+            close(fd);
+            index.save(index_path);
+
+            auto root = index.rootTag();
+            cout << index.nrChunks() << " chunks, root ";
+            for (uint8_t b : root)
+                cout << "0123456789abcdef"[b >> 4] << "0123456789abcdef"[b & 15];
+            cout << endl;
+            return 0;
+        }
+
+        if (mode == "verify" && pos_args.size() == 3) {
+            MerkleIndex index = MerkleIndex::load(index_path, key_ptr);
+            int fd = openOrDie(path);
+
+            if (have_range) {
+                bool ok = index.verifyRange(fd, range_off, range_len);
+                close(fd);
+                cout << (ok ? "range ok" : "range FAILED") << endl;
+                return ok ? 0 : EXIT_FAILURE;
+            }
+
+            WorkerPool pool(nr_threads);
+            bool root_ok;
+            vector<uint64_t> bad = index.verifyAll(fd, &pool, root_ok);
+            close(fd);
+            for (uint64_t c : bad)
+                cout << "chunk " << c << " (offset " << c * index.chunkSize() << ") FAILED" << endl;
+            if (!root_ok && bad.empty())
+                cout << "file size doesn't match the index" << endl;
+            cout << (root_ok ? "ok" : "FAILED") << endl;
+            return root_ok ? 0 : EXIT_FAILURE;
+        }
+
+        if (mode == "read" && pos_args.size() == 4 && have_range) {
+            MerkleIndex index = MerkleIndex::load(index_path, key_ptr);
+            auto cipher = cipherFromArgs(pos_args[2], pos_args[3], is_hex_key, use_chacha);
+            uint8_t nonce[8];
+            nonceBytesFromHex(pos_args[3], nonce);
+
+            EncryptedFileReader reader(path, cipher->keyContext(), nonce, &index);
+            vector<uint8_t> buf(1 << 20);
+            while (range_len) {
+                size_t n = reader.read(range_off, buf.data(), min<uint64_t>(range_len, buf.size()));
+                if (n == 0)
+                    break;
+                if (!writeAll(STDOUT_FILENO, buf.data(), n)) {
+                    cerr << "Error writing output: " << strerror(errno) << endl;
+                    exit(EXIT_FAILURE);
+                }
+                range_off += n;
+                range_len -= n;
+            }
+            return 0;
+        }
+    } catch (exception& e) {
+        cerr << e.what() << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    usage();
+    return EXIT_FAILURE;
+}
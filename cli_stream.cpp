@@ -0,0 +1,233 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <csignal>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/random.h>
+
+#include "cli.hpp"
+#include "metrics_server.hpp"
+#include "pipeline_telemetry.hpp"
+#include "stream_aead.hpp"
+#include "worker_pool.hpp"
+
+using namespace std;
+
+/*  salsa seal / salsa open: authenticated encryption of pipes (stream_aead.hpp)
+
+    tar c dir | salsa seal key | ssh host 'salsa open key | tar x'
+
+    seal picks a random salt per stream, which the stream key is derived from, and writes it
+    into the stream header. open takes the cipher from the header. Both read stdin and write stdout unless
+    --in / --out are given.
+
+    seal --compress compresses every segment before it is encrypted (stream_aead.hpp), open
+    recognizes such streams by their header. open --offset / --length decrypts just that byte
+    range of a sealed stream in a file (--in) through SealedStreamReader.
+
+    --stats prints the pipeline telemetry (pipeline_telemetry.hpp) as a JSON line to stderr
+    at the end, and whenever the process gets SIGUSR1 (kill -USR1 <pid>) while it runs.
+    --metrics-port serves the same counters plus pool utilization and the kernel in use for
+    Prometheus on http://127.0.0.1:port/metrics while the stream is processed (port 0 picks
+    a free one and reports it on stderr).
+*/
+
+static void usage() {
+    cerr << "usage:\n"
+         << "salsa seal key [--segment-size N] [--compress] [--threads T] [--in file] [--out file] [--hex-key] [--chacha20] [--stats] [--metrics-port P]\n"
+         << "salsa open key [--threads T] [--in file] [--out file] [--hex-key] [--stats] [--metrics-port P]\n"
+         << "salsa open key --in file [--offset N] [--length N] [--out file] [--hex-key]\n"
+         << "sizes take k, M and G suffixes, T = 0 uses all cores" << endl;
+    exit(EXIT_FAILURE);
+}
+
+struct StreamArgs {
+    string key;
+    string in_file, out_file;
+    uint64_t segment_size = STREAM_DEFAULT_SEGMENT_SIZE;
+    unsigned nr_threads = 0;
+    bool hex_key = false, chacha = false, compress = false;
+    bool stats = false;
+    bool ranged = false;
+    uint64_t offset = 0, length = UINT64_MAX;
+    int metrics_port = -1;  // none
+};
+
+static StreamArgs parseStreamArgs(int argc, char** argv, bool seal) {
+    StreamArgs args;
+    vector<string> pos_args;
+
+    for (int i=1; i<argc; i++) {
+        string arg = argv[i];
+        bool has_value = i+1 < argc;
+
+        if (seal && arg == "--segment-size" && has_value)
+            args.segment_size = parseSize(argv[++i], "segment size");
+        else if (arg == "--threads" && has_value)
+            args.nr_threads = parseCount(argv[++i], "thread count", MAX_THREADS);
+        else if (arg == "--in" && has_value)
+            args.in_file = argv[++i];
+        else if (arg == "--out" && has_value)
+            args.out_file = argv[++i];
+        else if (arg == "--hex-key")
+            args.hex_key = true;
+        else if (seal && arg == "--chacha20")
+            args.chacha = true;
+        else if (seal && arg == "--compress")
+            args.compress = true;
+        else if (!seal && arg == "--offset" && has_value) {
+            args.offset = parseSize(argv[++i], "offset");
+            args.ranged = true;
+        }
+        else if (!seal && arg == "--length" && has_value) {
+            args.length = parseSize(argv[++i], "length");
+            args.ranged = true;
+        }
+        else if (arg == "--stats")
+            args.stats = true;
+        else if (arg == "--metrics-port" && has_value) {
+            uint64_t port = parseSize(argv[++i], "metrics port");
+            if (port > 65535) {
+                cerr << "metrics port has to be below 65536" << endl;
+                exit(EXIT_FAILURE);
+            }
+            args.metrics_port = port;
+        }
+        else if (arg.rfind("--", 0) == 0) {
+            cerr << "unknown argument: " << arg << endl;
+            usage();
+        } else
+            pos_args.push_back(arg);
+    }
+    if (pos_args.size() != 1 || (args.ranged && args.in_file.empty()))
+        usage();
+    args.key = pos_args[0];
+
+    if (args.segment_size == 0 || args.segment_size > STREAM_MAX_SEGMENT_SIZE) {
+        cerr << "segment size has to be between 1 and " << STREAM_MAX_SEGMENT_SIZE << endl;
+        exit(EXIT_FAILURE);
+    }
+    return args;
+}
+
+static int openFd(const string& path, int default_fd, bool output) {
+    if (path.empty())
+        return default_fd;
+    int fd = output ? open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644) : open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        cerr << "Could not open " << path << ": " << strerror(errno) << endl;
+        exit(EXIT_FAILURE);
+    }
+    return fd;
+}
+
+static void closeOutput(int fd) {
+    if (fd != STDOUT_FILENO && close(fd) != 0) {
+        cerr << "Error writing output: " << strerror(errno) << endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*  run(pool, telemetry) with the worker pool, --stats reporting and metrics endpoint asked for
+    telemetry is nullptr when nobody looks at it */
+static void runInstrumented(const StreamArgs& args, const function<void(WorkerPool&, PipelineTelemetry*)>& run) {
+    // before the pool, its threads have to inherit the blocked SIGUSR1
+    PipelineTelemetry telemetry;
+    unique_ptr<TelemetrySignalReporter> reporter;
+    if (args.stats)
+        reporter.reset(new TelemetrySignalReporter(telemetry, STDERR_FILENO, SIGUSR1));
+
+    WorkerPool pool(args.nr_threads);
+    atomic<unsigned> sessions(0);
+    unique_ptr<MetricsServer> metrics;
+    if (args.metrics_port >= 0) {
+        metrics.reset(new MetricsServer(args.metrics_port, [&] {
+            return prometheusProcessMetrics(&pool, sessions) + telemetry.prometheus();
+        }));
+        if (args.metrics_port == 0)
+            cerr << "metrics on http://127.0.0.1:" << metrics->port() << "/metrics" << endl;
+    }
+
+    sessions = 1;
+    run(pool, args.stats || metrics ? &telemetry : nullptr);
+    sessions = 0;
+}
+
+// --offset / --length of the sealed stream in --in to out_fd, in pieces of a few segments
+static void copyRange(const StreamArgs& args, const SnuffleKeyContext& key, int out_fd) {
+    SealedStreamReader reader(args.in_file, key);
+    vector<uint8_t> buf(4 * reader.header().segment_size);
+    uint64_t offset = args.offset;
+    const uint64_t end = args.length > reader.size() - min(offset, reader.size()) ? reader.size() : offset + args.length;
+    while (offset < end) {
+        size_t n = reader.read(offset, buf.data(), min<uint64_t>(buf.size(), end - offset));
+        for (size_t done=0; done < n;) {
+            ssize_t written = write(out_fd, buf.data() + done, n - done);
+            if (written < 0 && errno == EINTR)
+                continue;
+            if (written < 0)
+                throw runtime_error(string("write failed: ") + strerror(errno));
+            done += written;
+        }
+        offset += n;
+    }
+}
+
+int sealCommand(int argc, char** argv) {
+    StreamArgs args = parseStreamArgs(argc, argv, true);
+    SnuffleKeyContext key = keyContextFromArgs(args.key, args.hex_key, args.chacha);
+
+    StreamHeader header;
+    header.variant = key.variant;
+    header.segment_size = args.segment_size;
+    header.compressed = args.compress;
+    if (getrandom(header.salt, sizeof(header.salt), 0) != sizeof(header.salt)) {
+        cerr << "could not get a random salt: " << strerror(errno) << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    int in_fd = openFd(args.in_file, STDIN_FILENO, false);
+    int out_fd = openFd(args.out_file, STDOUT_FILENO, true);
+    try {
+        runInstrumented(args, [&](WorkerPool& pool, PipelineTelemetry* telemetry) {
+            streamSeal(in_fd, out_fd, key, header, pool, telemetry);
+        });
+    } catch (exception& e) {
+        cerr << e.what() << endl;
+        exit(EXIT_FAILURE);
+    }
+    closeOutput(out_fd);
+    return 0;
+}
+
+int openCommand(int argc, char** argv) {
+    StreamArgs args = parseStreamArgs(argc, argv, false);
+
+    int in_fd = openFd(args.in_file, STDIN_FILENO, false);
+    int out_fd = openFd(args.out_file, STDOUT_FILENO, true);
+    try {
+        StreamHeader header = streamReadHeader(in_fd);
+        SnuffleKeyContext key = keyContextFromArgs(args.key, args.hex_key, header.variant == SnuffleVariant::Chacha20);
+        if (args.ranged) {
+            copyRange(args, key, out_fd);
+            closeOutput(out_fd);
+            return 0;
+        }
+        runInstrumented(args, [&](WorkerPool& pool, PipelineTelemetry* telemetry) {
+            streamOpen(in_fd, out_fd, key, header, pool, telemetry);
+        });
+    } catch (exception& e) {
+        cerr << e.what() << endl;
+        exit(EXIT_FAILURE);
+    }
+    closeOutput(out_fd);
+    return 0;
+}
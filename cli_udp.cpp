@@ -0,0 +1,156 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <netdb.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "cli.hpp"
+#include "datagram_relay.hpp"
+
+using namespace std;
+
+/*  salsa udp: encrypted UDP tunnel, one direction per process (datagram_relay.hpp)
+
+    salsa udp seal key nonce --listen 127.0.0.1:5000 --to peer:6000     (on this side)
+    salsa udp open key nonce --listen :6000 --to 127.0.0.1:7000          (on the peer)
+
+    seal numbers the datagrams from --start-seq on, by default the current time in
+    nanoseconds, so a restarted sealer doesn't reuse sequence numbers of the one before it
+    (as long as the clock doesn't go back and it sends less than a datagram per nanosecond).
+    --packets ends after that many received datagrams, --stats prints the counters as a JSON
+    line to stderr at the end.
+*/
+
+static const int RECEIVE_BUFFER = 4 << 20;
+
+static void usage() {
+    cerr << "usage:\n"
+         << "salsa udp seal|open key nonce --listen [host]:port --to host:port [--auth] [--batch N]\n"
+         << "    [--max-payload N] [--start-seq N] [--packets N] [--no-gso] [--stats] [--hex-key] [--chacha20]" << endl;
+    exit(EXIT_FAILURE);
+}
+
+//  UDP socket bound to (listen) or connected to host:port, [v6 address]:port works too
+static int udpSocket(const string& host_port, bool listen) {
+    size_t colon = host_port.rfind(':');
+    if (colon == string::npos) {
+        cerr << "address has to be host:port: " << host_port << endl;
+        exit(EXIT_FAILURE);
+    }
+    string host = host_port.substr(0, colon), port = host_port.substr(colon + 1);
+    if (host.size() >= 2 && host.front() == '[' && host.back() == ']')
+        host = host.substr(1, host.size() - 2);
+
+    struct addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = listen ? AI_PASSIVE : 0;
+    struct addrinfo* res;
+    int err = getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &res);
+    if (err != 0) {
+        cerr << "could not resolve " << host_port << ": " << gai_strerror(err) << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    int fd = -1;
+    for (struct addrinfo* ai = res; ai && fd < 0; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd >= 0 && (listen ? bind(fd, ai->ai_addr, ai->ai_addrlen) : connect(fd, ai->ai_addr, ai->ai_addrlen)) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+    if (fd < 0) {
+        cerr << "could not " << (listen ? "listen on " : "connect to ") << host_port << ": " << strerror(errno) << endl;
+        exit(EXIT_FAILURE);
+    }
+    // room for bursts while a batch is processed, the kernel caps it at net.core.rmem_max
+    int rcvbuf = RECEIVE_BUFFER;
+    if (listen)
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    return fd;
+}
+
+int udpCommand(int argc, char** argv) {
+    vector<string> pos_args;
+    string listen_addr, to_addr;
+    uint64_t batch = DatagramRelay::DEFAULT_BATCH, max_payload = DatagramRelay::DEFAULT_MAX_PAYLOAD;
+    uint64_t start_seq = chrono::duration_cast<chrono::nanoseconds>(chrono::system_clock::now().time_since_epoch()).count();
+    uint64_t max_packets = 0;
+    bool authenticated = false, gso = true, stats = false;
+    bool is_hex_key = false, use_chacha = false;
+
+    for (int i=1; i<argc; i++) {
+        string arg = argv[i];
+        bool has_value = i+1 < argc;
+
+        if (arg == "--listen" && has_value)
+            listen_addr = argv[++i];
+        else if (arg == "--to" && has_value)
+            to_addr = argv[++i];
+        else if (arg == "--batch" && has_value)
+            batch = parseSize(argv[++i], "batch size");
+        else if (arg == "--max-payload" && has_value)
+            max_payload = parseSize(argv[++i], "payload size");
+        else if (arg == "--start-seq" && has_value)
+            start_seq = parseSize(argv[++i], "start sequence number");
+        else if (arg == "--packets" && has_value)
+            max_packets = parseSize(argv[++i], "packet count");
+        else if (arg == "--auth")
+            authenticated = true;
+        else if (arg == "--no-gso")
+            gso = false;
+        else if (arg == "--stats")
+            stats = true;
+        else if (arg == "--hex-key")
+            is_hex_key = true;
+        else if (arg == "--chacha20")
+            use_chacha = true;
+        else if (arg.rfind("--", 0) == 0) {
+            cerr << "unknown argument: " << arg << endl;
+            usage();
+        } else
+            pos_args.push_back(arg);
+    }
+    if (pos_args.size() != 3 || (pos_args[0] != "seal" && pos_args[0] != "open") || listen_addr.empty() || to_addr.empty())
+        usage();
+    if (batch == 0 || batch > 1024 || max_payload == 0 || max_payload > DatagramRelay::MAX_PAYLOAD) {
+        cerr << "batch has to be between 1 and 1024, payload size between 1 and " << DatagramRelay::MAX_PAYLOAD << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    auto cipher = cipherFromArgs(pos_args[1], pos_args[2], is_hex_key, use_chacha);
+    uint8_t nonce[8];
+    nonceBytesFromHex(pos_args[2], nonce);
+    DatagramCipher datagrams(cipher->keyContext(), nonce, authenticated);
+
+    int in_fd = udpSocket(listen_addr, true);
+    int out_fd = udpSocket(to_addr, false);
+    try {
+        DatagramRelay relay(datagrams, pos_args[0] == "seal" ? DatagramRelay::SEAL : DatagramRelay::OPEN,
+                            in_fd, out_fd, max_payload, batch);
+        relay.setNextSeq(start_seq);
+        if (!gso)
+            relay.setGso(false);
+
+        while (max_packets == 0 || relay.packetsIn() < max_packets)
+            relay.pump();
+
+        if (stats)
+            cerr << "{\"packets_in\":" << relay.packetsIn() << ",\"packets_out\":" << relay.packetsOut()
+                 << ",\"dropped\":" << relay.dropped() << ",\"recv_calls\":" << relay.recvCalls()
+                 << ",\"send_calls\":" << relay.sendCalls() << ",\"gso\":" << (relay.gso() ? "true" : "false") << "}" << endl;
+    } catch (exception& e) {
+        cerr << e.what() << endl;
+        exit(EXIT_FAILURE);
+    }
+    close(in_fd);
+    close(out_fd);
+    return 0;
+}
@@ -0,0 +1,160 @@
+#include <cstring> // memcpy
+
+#include "crc32c.hpp"
+
+using namespace std;
+
+/*  Software: slicing-by-8, table k holds the CRC of a byte followed by k zero bytes,
+    so 8 bytes are folded in with 8 independent lookups.
+    Hardware: the SSE4.2 crc32 instruction, 8 bytes per instruction.
+    Both work on the inverted running value and little endian words (like the rest of the library). */
+
+static const uint32_t CRC32C_POLY = 0x82f63b78; // reflected Castagnoli polynomial
+
+struct Crc32cTables {
+    uint32_t t[8][256];
+
+    Crc32cTables() {
+        for (uint32_t i=0; i<256; i++) {
+            uint32_t crc = i;
+            for (unsigned bit=0; bit<8; bit++)
+                crc = (crc >> 1) ^ (CRC32C_POLY & (0 - (crc & 1)));
+            t[0][i] = crc;
+        }
+        for (unsigned k=1; k<8; k++)
+            for (unsigned i=0; i<256; i++)
+                t[k][i] = (t[k-1][i] >> 8) ^ t[0][t[k-1][i] & 0xff];
+    }
+};
+
+static const Crc32cTables& tables() {
+    static const Crc32cTables tables;
+    return tables;
+}
+
+static inline uint32_t softwareWord(const Crc32cTables& tb, uint32_t crc, uint64_t word) {
+    word ^= crc;
+    return tb.t[7][word & 0xff]         ^ tb.t[6][(word >> 8) & 0xff]  ^
+           tb.t[5][(word >> 16) & 0xff] ^ tb.t[4][(word >> 24) & 0xff] ^
+           tb.t[3][(word >> 32) & 0xff] ^ tb.t[2][(word >> 40) & 0xff] ^
+           tb.t[1][(word >> 48) & 0xff] ^ tb.t[0][word >> 56];
+}
+
+static inline uint32_t softwareByte(const Crc32cTables& tb, uint32_t crc, uint8_t byte) {
+    return (crc >> 8) ^ tb.t[0][(crc ^ byte) & 0xff];
+}
+
+static uint32_t crc32cSoftware(uint32_t crc, const uint8_t* data, size_t len) {
+    const Crc32cTables& tb = tables();
+    crc = ~crc;
+    for (; len >= 8; data += 8, len -= 8) {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        crc = softwareWord(tb, crc, word);
+    }
+    for (; len; len--)
+        crc = softwareByte(tb, crc, *(data++));
+    return ~crc;
+}
+
+static void crc32cXorSoftware(const uint8_t* input, const uint8_t* stream, uint8_t* output, size_t len,
+                              uint32_t* input_crc, uint32_t* output_crc) {
+    const Crc32cTables& tb = tables();
+    uint32_t crc_in = input_crc ? ~*input_crc : 0, crc_out = output_crc ? ~*output_crc : 0;
+
+    size_t i = 0;
+    for (; i+8 <= len; i += 8) {
+        uint64_t word, key;
+        memcpy(&word, input + i, 8);
+        memcpy(&key, stream + i, 8);
+        if (input_crc) crc_in = softwareWord(tb, crc_in, word);
+        word ^= key;
+        if (output_crc) crc_out = softwareWord(tb, crc_out, word);
+        memcpy(output + i, &word, 8);
+    }
+    for (; i < len; i++) {
+        uint8_t byte = input[i];
+        if (input_crc) crc_in = softwareByte(tb, crc_in, byte);
+        byte ^= stream[i];
+        if (output_crc) crc_out = softwareByte(tb, crc_out, byte);
+        output[i] = byte;
+    }
+
+    if (input_crc) *input_crc = ~crc_in;
+    if (output_crc) *output_crc = ~crc_out;
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32cSse42(uint32_t crc, const uint8_t* data, size_t len) {
+    uint64_t c = ~crc;
+    for (; len >= 8; data += 8, len -= 8) {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        c = __builtin_ia32_crc32di(c, word);
+    }
+    for (; len; len--)
+        c = __builtin_ia32_crc32qi(c, *(data++));
+    return ~(uint32_t) c;
+}
+
+// same as crc32cXorSoftware(), both checksums are independent dependency chains
+__attribute__((target("sse4.2")))
+static void crc32cXorSse42(const uint8_t* input, const uint8_t* stream, uint8_t* output, size_t len,
+                           uint32_t* input_crc, uint32_t* output_crc) {
+    uint64_t crc_in = input_crc ? ~*input_crc : 0, crc_out = output_crc ? ~*output_crc : 0;
+
+    size_t i = 0;
+    for (; i+8 <= len; i += 8) {
+        uint64_t word, key;
+        memcpy(&word, input + i, 8);
+        memcpy(&key, stream + i, 8);
+        if (input_crc) crc_in = __builtin_ia32_crc32di(crc_in, word);
+        word ^= key;
+        if (output_crc) crc_out = __builtin_ia32_crc32di(crc_out, word);
+        memcpy(output + i, &word, 8);
+    }
+    for (; i < len; i++) {
+        uint8_t byte = input[i];
+        if (input_crc) crc_in = __builtin_ia32_crc32qi(crc_in, byte);
+        byte ^= stream[i];
+        if (output_crc) crc_out = __builtin_ia32_crc32qi(crc_out, byte);
+        output[i] = byte;
+    }
+
+    if (input_crc) *input_crc = ~(uint32_t) crc_in;
+    if (output_crc) *output_crc = ~(uint32_t) crc_out;
+}
+
+// may run before the constructor that initializes the cpu model, so init it here
+static bool detectSse42() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2");
+}
+
+static const bool HAVE_SSE42 = detectSse42();
+
+#else
+
+static const bool HAVE_SSE42 = false;
+#define crc32cSse42 crc32cSoftware
+#define crc32cXorSse42 crc32cXorSoftware
+
+#endif
+
+uint32_t crc32c(uint32_t crc, const uint8_t* data, size_t len) {
+    return HAVE_SSE42 ? crc32cSse42(crc, data, len) : crc32cSoftware(crc, data, len);
+}
+
+void crc32cXor(const uint8_t* input, const uint8_t* stream, uint8_t* output, size_t len,
+               uint32_t* input_crc, uint32_t* output_crc) {
+    if (HAVE_SSE42)
+        crc32cXorSse42(input, stream, output, len, input_crc, output_crc);
+    else
+        crc32cXorSoftware(input, stream, output, len, input_crc, output_crc);
+}
+
+bool crc32cHardware() {
+    return HAVE_SSE42;
+}
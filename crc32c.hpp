@@ -0,0 +1,27 @@
+#ifndef CRC32C_HPP
+#define CRC32C_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*  CRC32C (Castagnoli, as used by iSCSI, ext4, many storage formats)
+
+    Uses the SSE4.2 crc32 instruction when the CPU has it (checked once at startup),
+    a slicing-by-8 table implementation otherwise.
+
+    crc is the running value: 0 to start, the result of the previous call to continue,
+    crc32c(0, "123456789", 9) == 0xe3069283.
+*/
+
+uint32_t crc32c(uint32_t crc, const uint8_t* data, size_t len);
+
+/*  output = input ^ stream, and in the same pass the CRC32C of input and/or output
+    (input_crc / output_crc running values, nullptr to skip one). Every word is loaded and
+    stored once, the checksums are taken from registers. input == output is fine */
+void crc32cXor(const uint8_t* input, const uint8_t* stream, uint8_t* output, size_t len,
+               uint32_t* input_crc, uint32_t* output_crc);
+
+// true if the hardware instruction is used
+bool crc32cHardware();
+
+#endif // CRC32C_HPP
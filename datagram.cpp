@@ -0,0 +1,127 @@
+#include <cstring> // memset
+#include <algorithm> // std::min
+
+#include "datagram.hpp"
+#include "byte_io.hpp"
+#include "snuffle_kernels.hpp"
+#include "poly1305.hpp"
+
+using namespace std;
+
+// packets handled per pass of a batch, bounds the Poly1305 keys kept on the stack
+static const size_t BATCH_CHUNK = 64;
+
+// Poly1305 over the ciphertext as in RFC 8439 without associated data
+static void packetTag(const uint8_t poly_key[32], const uint8_t* data, size_t len, uint8_t tag[16]) {
+    static const uint8_t zeros[16] = {0};
+    uint8_t lengths[16];
+    putLE(lengths, 0, 8);
+    putLE(lengths+8, len, 8);
+
+    Poly1305 mac(poly_key);
+    mac.update(data, len);
+    mac.update(zeros, (16 - len % 16) % 16);
+    mac.update(lengths, sizeof(lengths));
+    mac.final(tag);
+}
+
+DatagramCipher::DatagramCipher(const SnuffleKeyContext& key, const uint8_t base_nonce[8], bool authenticated)
+    : _variant(key.variant), _authenticated(authenticated) {
+    snuffleInitState(_state, key, base_nonce, 0);
+}
+
+void DatagramCipher::packetNonce(uint64_t seq, uint8_t nonce[8]) const {
+    const unsigned ni = snuffleNonceIndex(_variant);
+    putLE(nonce, _state[ni] ^ (uint32_t) seq, 4);
+    putLE(nonce+4, _state[ni+1] ^ (uint32_t) (seq >> 32), 4);
+}
+
+void DatagramCipher::sealBatch(DatagramPacket* packets, size_t count) const {
+    SnuffleLaneQueue lanes(_variant);
+    uint32_t state[16];
+
+    if (!_authenticated) {
+        for (size_t i=0; i<count; i++) {
+            packetState(packets[i].seq, 0, state);
+            lanes.addData(state, 0, packets[i].data, packets[i].data, packets[i].len);
+        }
+        lanes.flush();
+        return;
+    }
+
+    // Poly1305 keys and data of a chunk of packets in the same lane passes, then the tags
+    uint8_t keys[BATCH_CHUNK][32];
+    for (size_t first=0; first < count; first += BATCH_CHUNK) {
+        const size_t n = min(count - first, BATCH_CHUNK);
+        for (size_t i=0; i<n; i++) {
+            DatagramPacket& p = packets[first + i];
+            packetState(p.seq, 0, state);
+            memset(keys[i], 0, 32);
+            lanes.add(state, 0, keys[i], keys[i], 32);
+            lanes.addData(state, 1, p.data, p.data, p.len);
+        }
+        lanes.flush();
+        for (size_t i=0; i<n; i++) {
+            DatagramPacket& p = packets[first + i];
+            packetTag(keys[i], p.data, p.len, p.data + p.len);
+            p.len += TAG_LEN;
+        }
+    }
+}
+
+size_t DatagramCipher::openBatch(DatagramPacket* packets, size_t count) const {
+    SnuffleLaneQueue lanes(_variant);
+    uint32_t state[16];
+
+    if (!_authenticated) {
+        sealBatch(packets, count);
+        for (size_t i=0; i<count; i++)
+            packets[i].ok = true;
+        return 0;
+    }
+
+    // all keys of a chunk, verify, then decrypt the packets that passed
+    size_t failed = 0;
+    uint8_t keys[BATCH_CHUNK][32];
+    for (size_t first=0; first < count; first += BATCH_CHUNK) {
+        const size_t n = min(count - first, BATCH_CHUNK);
+        for (size_t i=0; i<n; i++) {
+            packetState(packets[first + i].seq, 0, state);
+            memset(keys[i], 0, 32);
+            lanes.add(state, 0, keys[i], keys[i], 32);
+        }
+        lanes.flush();
+
+        for (size_t i=0; i<n; i++) {
+            DatagramPacket& p = packets[first + i];
+            p.ok = false;
+            if (p.len >= TAG_LEN) {
+                uint8_t expected[TAG_LEN];
+                packetTag(keys[i], p.data, p.len - TAG_LEN, expected);
+                p.ok = poly1305Equal(expected, p.data + p.len - TAG_LEN);
+            }
+            if (!p.ok) {
+                failed++;
+                continue;
+            }
+            p.len -= TAG_LEN;
+            packetState(p.seq, 0, state);
+            lanes.addData(state, 1, p.data, p.data, p.len);
+        }
+        lanes.flush();
+    }
+    return failed;
+}
+
+size_t DatagramCipher::seal(uint64_t seq, uint8_t* data, size_t len) const {
+    DatagramPacket p = {seq, data, len, true};
+    sealBatch(&p, 1);
+    return p.len;
+}
+
+bool DatagramCipher::open(uint64_t seq, uint8_t* data, size_t& len) const {
+    DatagramPacket p = {seq, data, len, false};
+    openBatch(&p, 1);
+    len = p.len;
+    return p.ok;
+}
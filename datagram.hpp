@@ -0,0 +1,77 @@
+#ifndef DATAGRAM_HPP
+#define DATAGRAM_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "snuffle_core.hpp"
+
+/*  Datagram mode: every packet is encrypted on its own, its nonce is the base nonce xor the
+    packet's 64 bit sequence number (both little endian), so packets can be processed in any
+    order and a lost packet costs nothing. The per packet state is the precomputed state of the
+    base nonce with two words xored, no nonce parsing or key setup per packet.
+
+    Unauthenticated: data is xored with the keystream from block 0.
+    Authenticated: like stream_aead.hpp, the Poly1305 key is the first 32 bytes of block 0, data
+    starts at block 1 and the 16 byte tag (RFC 8439 layout, no associated data) follows the data.
+    For Chacha20 that is ChaCha20-Poly1305 of RFC 8439 with the nonce prefixed by 4 zero bytes.
+
+    A sequence number must never be used twice under the same key and base nonce.
+
+    The batch functions spread the keystream blocks of all packets over the SNUFFLE_LANES lanes
+    of the kernels, block by block regardless of which packet they belong to, so a batch of
+    small packets runs at the speed of bulk data instead of one short block loop per packet.
+*/
+
+struct DatagramPacket {
+    uint64_t seq;
+    uint8_t* data;  // en-/decrypted in place
+    size_t len;     // plaintext length in, packet length out (sealing), packet length in, plaintext length out (opening)
+    bool ok;        // set by openBatch(): authenticated (always true without authentication)
+};
+
+class DatagramCipher {
+
+    uint32_t _state[16];  // key and base nonce, counter 0
+    SnuffleVariant _variant;
+    bool _authenticated;
+
+public:
+
+    static const size_t TAG_LEN = 16;
+
+    DatagramCipher(const SnuffleKeyContext& key, const uint8_t base_nonce[8], bool authenticated);
+
+    bool authenticated() const { return _authenticated; }
+
+    //  bytes a packet grows by when sealed
+    size_t overhead() const { return _authenticated ? TAG_LEN : 0; }
+
+    //  state of packet seq at block counter
+    void packetState(uint64_t seq, uint64_t counter, uint32_t state[16]) const {
+        const unsigned ni = snuffleNonceIndex(_variant), ci = snuffleCounterIndex(_variant);
+        for (unsigned i=0; i<16; i++)
+            state[i] = _state[i];
+        state[ni] ^= (uint32_t) seq;
+        state[ni+1] ^= (uint32_t) (seq >> 32);
+        state[ci] = (uint32_t) counter;
+        state[ci+1] = (uint32_t) (counter >> 32);
+    }
+
+    //  the 8 byte nonce of packet seq (for other implementations of the protocol)
+    void packetNonce(uint64_t seq, uint8_t nonce[8]) const;
+
+    /*  encrypt count packets in place, in any order of sequence numbers
+        authenticated: data needs room for TAG_LEN more bytes, len grows by TAG_LEN */
+    void sealBatch(DatagramPacket* packets, size_t count) const;
+
+    /*  decrypt count packets in place, returns the number of packets that failed authentication
+        (ok == false, data left as received, len unchanged, also for packets shorter than a tag) */
+    size_t openBatch(DatagramPacket* packets, size_t count) const;
+
+    //  single packet versions, seal returns the packet length, open false if authentication failed
+    size_t seal(uint64_t seq, uint8_t* data, size_t len) const;
+    bool open(uint64_t seq, uint8_t* data, size_t& len) const;
+};
+
+#endif // DATAGRAM_HPP
@@ -0,0 +1,159 @@
+#include <string>
+#include <cstring> // memset, strerror
+#include <cerrno>
+#include <stdexcept> // std::runtime_error, std::invalid_argument
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/uio.h>
+
+#include "datagram_relay.hpp"
+#include "byte_io.hpp"
+
+using namespace std;
+
+// kernel limits of one UDP GSO message: segments, and payload bytes of a single IPv4 datagram
+static const size_t GSO_MAX_SEGMENTS = 64;
+static const size_t GSO_MAX_BYTES = 65507;
+
+DatagramRelay::DatagramRelay(const DatagramCipher& cipher, Mode mode, int in_fd, int out_fd,
+                             size_t max_payload, unsigned batch)
+    : _cipher(cipher), _mode(mode), _inFd(in_fd), _outFd(out_fd), _maxPayload(max_payload), _batch(batch) {
+    if (batch == 0 || max_payload == 0)
+        throw invalid_argument("datagram relay needs a batch and payload size above 0");
+    if (max_payload > MAX_PAYLOAD)
+        throw invalid_argument("sealed datagrams of " + to_string(max_payload) + " byte payloads don't fit into UDP");
+#ifdef UDP_SEGMENT
+    _gso = true;
+#else
+    _gso = false;
+#endif
+
+    _slotSize = SEQ_LEN + _maxPayload + DatagramCipher::TAG_LEN;
+    _buf.resize(_batch * _slotSize);
+    _recvMsgs.resize(_batch);
+    _recvIovs.resize(_batch);
+    _packets.resize(_batch);
+    _sendIovs.resize(_batch);
+    _sendMsgs.resize(_batch);
+    _msgFirst.resize(_batch);
+    _control.resize(_batch * CMSG_SPACE(sizeof(uint16_t)));
+
+    // sealing receives behind the room for the header, opening the whole packet
+    for (unsigned i=0; i<_batch; i++) {
+        uint8_t* slot = &_buf[i * _slotSize];
+        if (_mode == SEAL)
+            _recvIovs[i] = {slot + SEQ_LEN, _maxPayload};
+        else
+            _recvIovs[i] = {slot, SEQ_LEN + _maxPayload + _cipher.overhead()};
+        memset(&_recvMsgs[i], 0, sizeof(_recvMsgs[i]));
+        _recvMsgs[i].msg_hdr.msg_iov = &_recvIovs[i];
+        _recvMsgs[i].msg_hdr.msg_iovlen = 1;
+    }
+}
+
+size_t DatagramRelay::pump() {
+    int received = recvmmsg(_inFd, _recvMsgs.data(), _batch, MSG_WAITFORONE, nullptr);
+    if (received < 0) {
+        if (errno == EINTR)
+            return 0;
+        throw runtime_error(string("recvmmsg failed: ") + strerror(errno));
+    }
+    _recvCalls++;
+    _packetsIn += received;
+
+    size_t count = 0;
+    for (int i=0; i<received; i++) {
+        uint8_t* slot = &_buf[i * _slotSize];
+        const size_t len = _recvMsgs[i].msg_len;
+        const bool truncated = _recvMsgs[i].msg_hdr.msg_flags & MSG_TRUNC;
+
+        if (_mode == SEAL && !truncated) {
+            putLE(slot, _nextSeq, SEQ_LEN);
+            _packets[count++] = {_nextSeq++, slot + SEQ_LEN, len, true};
+        } else if (_mode == OPEN && !truncated && len >= SEQ_LEN + _cipher.overhead())
+            _packets[count++] = {getLE(slot, 8), slot + SEQ_LEN, len - SEQ_LEN, false};
+        else
+            _dropped++;
+    }
+
+    size_t results = 0;
+    if (_mode == SEAL) {
+        _cipher.sealBatch(_packets.data(), count);
+        for (size_t i=0; i<count; i++)
+            _sendIovs[results++] = {_packets[i].data - SEQ_LEN, SEQ_LEN + _packets[i].len};
+    } else {
+        _dropped += _cipher.openBatch(_packets.data(), count);
+        for (size_t i=0; i<count; i++)
+            if (_packets[i].ok)
+                _sendIovs[results++] = {_packets[i].data, _packets[i].len};
+    }
+    sendResults(results);
+    return received;
+}
+
+/*  messages for the results [first, first+count), runs of the same length (the last one of a run may
+    be shorter) become one GSO message with the results as its iovecs, returns the number of messages */
+size_t DatagramRelay::buildMessages(size_t first, size_t count) {
+    const size_t end = first + count;
+    size_t nr_msgs = 0;
+
+    for (size_t i=first; i < end; nr_msgs++) {
+        const size_t seg_size = _sendIovs[i].iov_len;
+        size_t j = i + 1;
+        if (_gso && seg_size > 0) {
+            size_t total = seg_size;
+            while (j < end && j - i < GSO_MAX_SEGMENTS && _sendIovs[j].iov_len <= seg_size
+                   && _sendIovs[j].iov_len > 0 && total + _sendIovs[j].iov_len <= GSO_MAX_BYTES) {
+                total += _sendIovs[j++].iov_len;
+                if (_sendIovs[j-1].iov_len < seg_size)
+                    break;
+            }
+        }
+
+        struct msghdr& hdr = _sendMsgs[nr_msgs].msg_hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.msg_iov = &_sendIovs[i];
+        hdr.msg_iovlen = j - i;
+#ifdef UDP_SEGMENT
+        if (j - i > 1) {
+            hdr.msg_control = &_control[nr_msgs * CMSG_SPACE(sizeof(uint16_t))];
+            hdr.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+            struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+            cmsg->cmsg_level = SOL_UDP;
+            cmsg->cmsg_type = UDP_SEGMENT;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            uint16_t gso_size = seg_size;
+            memcpy(CMSG_DATA(cmsg), &gso_size, sizeof(gso_size));
+        }
+#endif
+        _msgFirst[nr_msgs] = i;
+        i = j;
+    }
+    return nr_msgs;
+}
+
+void DatagramRelay::sendResults(size_t count) {
+    size_t done = 0;
+    while (done < count) {
+        const size_t nr_msgs = buildMessages(done, count - done);
+        int sent = sendmmsg(_outFd, _sendMsgs.data(), nr_msgs, 0);
+        _sendCalls++;
+
+        if (sent < 0) {
+            // GSO not supported by the kernel or the route: from now on one message per datagram
+            if (_gso && _sendMsgs[0].msg_hdr.msg_iovlen > 1
+                && (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT || errno == EOPNOTSUPP)) {
+                _gso = false;
+                continue;
+            }
+            // ECONNREFUSED reports an earlier datagram the destination didn't take, this one wasn't sent
+            if (errno == EINTR || errno == ECONNREFUSED)
+                continue;
+            throw runtime_error(string("sendmmsg failed: ") + strerror(errno));
+        }
+
+        const size_t next = (size_t) sent < nr_msgs ? _msgFirst[sent] : count;
+        _packetsOut += next - done;
+        done = next;
+    }
+}
@@ -0,0 +1,94 @@
+#ifndef DATAGRAM_RELAY_HPP
+#define DATAGRAM_RELAY_HPP
+
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/socket.h>
+
+#include "datagram.hpp"
+
+/*  Batched UDP en-/decryption between two sockets
+
+    pump() receives up to batch datagrams with one recvmmsg, seals or opens all of them with one
+    DatagramCipher batch call and sends the results with one sendmmsg. Consecutive results of
+    the same length (the last of a run may be shorter) leave as a single UDP GSO message
+    (UDP_SEGMENT), the kernel splits them into datagrams further down the stack, so a full batch
+    of equal sized packets costs two system calls. Kernels or routes without GSO support switch
+    the relay to one message per datagram on the first failed send.
+
+    On the wire a sealed datagram is its 8 byte sequence number (little endian) followed by the
+    DatagramCipher packet. Seal numbers the datagrams from setNextSeq() on, open takes the number
+    from the header. Datagrams that are too long, too short or fail authentication are dropped
+    and counted. There is no replay window, a replayed datagram is opened again.
+
+    Received datagrams are processed in place, the sequence number header and the tag fit
+    around the payload in each slot, so nothing is copied between receiving and sending.
+
+    out_fd has to be connected (connect(2)) to the destination, in_fd bound. Both stay open
+    and owned by the caller. Not thread safe, one thread pumps.
+*/
+class DatagramRelay {
+
+public:
+
+    enum Mode { SEAL, OPEN };
+
+    static const size_t SEQ_LEN = 8;
+    static const unsigned DEFAULT_BATCH = 64;
+    static const size_t DEFAULT_MAX_PAYLOAD = 1472;  // UDP over IPv4 at a 1500 byte MTU
+    //  largest payload whose sealed datagram still fits into one IPv4 UDP datagram (65507 bytes)
+    static const size_t MAX_PAYLOAD = 65507 - SEQ_LEN - DatagramCipher::TAG_LEN;
+
+    /*  relay from in_fd to out_fd, payloads (plaintext) up to max_payload bytes
+        throws std::invalid_argument for a batch or max_payload of 0, or max_payload above MAX_PAYLOAD */
+    DatagramRelay(const DatagramCipher& cipher, Mode mode, int in_fd, int out_fd,
+                  size_t max_payload = DEFAULT_MAX_PAYLOAD, unsigned batch = DEFAULT_BATCH);
+
+    DatagramRelay(const DatagramRelay&) = delete;
+    DatagramRelay& operator=(const DatagramRelay&) = delete;
+
+    /*  wait for at least one datagram, relay everything up to batch that is queued,
+        returns the number of datagrams received (0 if interrupted by a signal)
+        throws std::runtime_error if receiving or sending fails */
+    size_t pump();
+
+    //  sequence number of the next sealed datagram, must never go back under the same key and nonce
+    void setNextSeq(uint64_t seq) { _nextSeq = seq; }
+    uint64_t nextSeq() const { return _nextSeq; }
+
+    //  send runs of datagrams as UDP GSO messages (default when the headers know UDP_SEGMENT)
+    void setGso(bool enable) { _gso = enable; }
+    bool gso() const { return _gso; }
+
+    uint64_t packetsIn() const { return _packetsIn; }
+    uint64_t packetsOut() const { return _packetsOut; }
+    uint64_t dropped() const { return _dropped; }
+    uint64_t recvCalls() const { return _recvCalls; }
+    uint64_t sendCalls() const { return _sendCalls; }
+
+private:
+
+    DatagramCipher _cipher;
+    Mode _mode;
+    int _inFd, _outFd;
+    size_t _maxPayload, _slotSize;
+    unsigned _batch;
+    bool _gso;
+    uint64_t _nextSeq = 0;
+    uint64_t _packetsIn = 0, _packetsOut = 0, _dropped = 0, _recvCalls = 0, _sendCalls = 0;
+
+    std::vector<uint8_t> _buf;               // batch slots of _slotSize bytes
+    std::vector<struct mmsghdr> _recvMsgs;
+    std::vector<struct iovec> _recvIovs;
+    std::vector<DatagramPacket> _packets;
+    std::vector<struct iovec> _sendIovs;     // the results, one per datagram
+    std::vector<struct mmsghdr> _sendMsgs;
+    std::vector<unsigned> _msgFirst;         // first index into _sendIovs of each message
+    std::vector<uint8_t> _control;           // UDP_SEGMENT control messages, one per message
+
+    size_t buildMessages(size_t first, size_t count);
+    void sendResults(size_t count);
+};
+
+#endif // DATAGRAM_RELAY_HPP
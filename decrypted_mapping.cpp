@@ -0,0 +1,233 @@
+#include <iostream>
+#include <vector>
+#include <cstring> // memset
+#include <cerrno>
+#include <cstdlib> // abort()
+#include <algorithm> // std::min
+#include <stdexcept> // std::runtime_error
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/userfaultfd.h>
+
+#include "decrypted_mapping.hpp"
+#include "encrypted_reader.hpp"
+#include "worker_pool.hpp"
+
+using namespace std;
+
+// slices of the up front decryption when userfaultfd isn't available
+static const size_t EAGER_SLICE = 1 << 20;
+
+// userfaultfd registered for missing page faults on [base, base+len), -1 if not possible
+static int registerUserfaultfd(uint8_t* base, size_t len) {
+    int uffd = syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+#ifdef UFFD_USER_MODE_ONLY
+    if (uffd < 0 && errno == EPERM)
+        uffd = syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK | UFFD_USER_MODE_ONLY);
+#endif
+    if (uffd < 0)
+        return -1;
+
+    struct uffdio_api api = {};
+    api.api = UFFD_API;
+    struct uffdio_register reg = {};
+    reg.range.start = (uintptr_t) base;
+    reg.range.len = len;
+    reg.mode = UFFDIO_REGISTER_MODE_MISSING;
+
+    if (ioctl(uffd, UFFDIO_API, &api) != 0 || ioctl(uffd, UFFDIO_REGISTER, &reg) != 0
+        || !(reg.ioctls & ((uint64_t) 1 << _UFFDIO_COPY))) {
+        close(uffd);
+        return -1;
+    }
+    return uffd;
+}
+
+DecryptedMapping::DecryptedMapping(const string& path, const SnuffleKeyContext& key, const uint8_t nonce[8],
+                                   WorkerPool* pool, size_t readahead_pages)
+    : _reader(new EncryptedFileReader(path, key, nonce)), _pool(pool), _readahead(readahead_pages) {
+    _size = _reader->size();
+    _pageSize = sysconf(_SC_PAGESIZE);
+    _nrPages = (_size + _pageSize - 1) / _pageSize;
+    _mappedLen = max<uint64_t>(_nrPages, 1) * _pageSize;
+
+    void* base = mmap(nullptr, _mappedLen, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED)
+        throw runtime_error(string("could not map ") + path + ": " + strerror(errno));
+    _base = (uint8_t*) base;
+
+    _uffd = registerUserfaultfd(_base, _mappedLen);
+    if (_uffd >= 0)
+        _stopFd = eventfd(0, EFD_CLOEXEC);
+
+    if (_uffd >= 0 && _stopFd >= 0) {
+        try {
+            _pages.reset(new atomic<uint8_t>[_nrPages]);
+            for (uint64_t p=0; p<_nrPages; p++)
+                _pages[p] = PAGE_MISSING;
+            _handler = thread(&DecryptedMapping::handlerLoop, this);
+        } catch (...) {
+            close(_uffd);
+            close(_stopFd);
+            munmap(_base, _mappedLen);
+            throw;
+        }
+        return;
+    }
+
+    // no userfaultfd: decrypt everything now
+    if (_uffd >= 0) {
+        close(_uffd);
+        _uffd = -1;
+    }
+    try {
+        if (mprotect(_base, _mappedLen, PROT_READ | PROT_WRITE) != 0)
+            throw runtime_error(string("mprotect failed: ") + strerror(errno));
+        auto slice = [&](size_t i) {
+            uint64_t off = i * EAGER_SLICE;
+            _reader->read(off, _base + off, min<uint64_t>(EAGER_SLICE, _size - off));
+        };
+        size_t nr_slices = (_size + EAGER_SLICE - 1) / EAGER_SLICE;
+        if (pool)
+            pool->parallelFor(nr_slices, slice);
+        else
+            for (size_t i=0; i<nr_slices; i++)
+                slice(i);
+        mprotect(_base, _mappedLen, PROT_READ);
+        _pagesDecrypted = _nrPages;
+    } catch (...) {
+        munmap(_base, _mappedLen);
+        throw;
+    }
+}
+
+DecryptedMapping::~DecryptedMapping() {
+    if (_uffd >= 0) {
+        uint64_t one = 1;
+        if (write(_stopFd, &one, sizeof(one)) != sizeof(one))
+            abort(); // handler would never stop
+        _handler.join();
+
+        unique_lock<mutex> lock(_mutex);
+        _idleCv.wait(lock, [&] { return _readaheadTasks == 0; });
+    }
+    munmap(_base, _mappedLen);
+    if (_uffd >= 0) {
+        close(_uffd);
+        close(_stopFd);
+    }
+}
+
+/*  decrypt and place the missing pages of [first, first+count), in runs of pages claimed
+    by this thread (missing -> loading), so the fault handler and readahead never decrypt a page twice
+    A page that can't be read can't be filled, and the thread touching it would wait forever:
+    like I/O errors on a file mapping, that ends the process */
+void DecryptedMapping::loadPages(uint64_t first, uint64_t count, bool wake_all) {
+    const uint64_t end = min(first + count, _nrPages);
+    vector<uint8_t> buf;
+
+    for (uint64_t p=first; p < end;) {
+        uint64_t run_end = p;
+        for (uint8_t expected = PAGE_MISSING; run_end < end; run_end++, expected = PAGE_MISSING)
+            if (!_pages[run_end].compare_exchange_strong(expected, PAGE_LOADING))
+                break;
+
+        if (run_end == p) {
+            // someone else has it. If it is already there a fault may still be queued for it
+            if (wake_all && _pages[p].load() == PAGE_PRESENT) {
+                struct uffdio_range range = {(uintptr_t) (_base + p*_pageSize), _pageSize};
+                ioctl(_uffd, UFFDIO_WAKE, &range);
+            }
+            p++;
+            continue;
+        }
+
+        const size_t len = (run_end - p) * _pageSize;
+        buf.resize(len);
+        try {
+            size_t n = _reader->read(p * _pageSize, buf.data(), len);
+            memset(buf.data() + n, 0, len - n);
+        } catch (exception& e) {
+            cerr << "decrypted mapping: " << e.what() << endl;
+            abort();
+        }
+
+        struct uffdio_copy copy = {};
+        copy.dst = (uintptr_t) (_base + p*_pageSize);
+        copy.src = (uintptr_t) buf.data();
+        copy.len = len;
+        while (ioctl(_uffd, UFFDIO_COPY, &copy) != 0 && errno != EEXIST) {
+            if (errno != EAGAIN) {
+                cerr << "decrypted mapping: UFFDIO_COPY failed: " << strerror(errno) << endl;
+                abort();
+            }
+            // interrupted by a change of the address space, go on after what got copied
+            if (copy.copy > 0) {
+                copy.dst += copy.copy;
+                copy.src += copy.copy;
+                copy.len -= copy.copy;
+            }
+            copy.copy = 0;
+        }
+
+        for (uint64_t q=p; q<run_end; q++)
+            _pages[q].store(PAGE_PRESENT);
+        _pagesDecrypted.fetch_add(run_end - p, memory_order_relaxed);
+        p = run_end;
+    }
+}
+
+void DecryptedMapping::startReadahead(uint64_t page) {
+    if (!_pool || _readahead == 0 || page >= _nrPages || _pages[page].load() != PAGE_MISSING)
+        return;
+
+    {
+        lock_guard<mutex> lock(_mutex);
+        _readaheadTasks++;
+    }
+    _pool->submit([this, page] {
+        loadPages(page, _readahead, false);
+        lock_guard<mutex> lock(_mutex);
+        if (--_readaheadTasks == 0)
+            _idleCv.notify_all();
+    });
+}
+
+void DecryptedMapping::handlerLoop() {
+    struct pollfd fds[2] = {{_uffd, POLLIN, 0}, {_stopFd, POLLIN, 0}};
+
+    for (;;) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            cerr << "decrypted mapping: poll failed: " << strerror(errno) << endl;
+            abort();
+        }
+        if (fds[1].revents)
+            return;
+
+        struct uffd_msg msg;
+        if (read(_uffd, &msg, sizeof(msg)) != sizeof(msg))
+            continue; // EAGAIN: someone else's wake resolved it
+        if (msg.event != UFFD_EVENT_PAGEFAULT)
+            continue;
+
+        // the faulting page first, the ones after it in the background
+        uint64_t page = (msg.arg.pagefault.address - (uintptr_t) _base) / _pageSize;
+        if (page >= _nrPages) {
+            // the page mapped for an empty file
+            struct uffdio_zeropage zero = {};
+            zero.range.start = (uintptr_t) (_base + page*_pageSize);
+            zero.range.len = _pageSize;
+            ioctl(_uffd, UFFDIO_ZEROPAGE, &zero);
+            continue;
+        }
+        loadPages(page, 1, true);
+        startReadahead(page + 1);
+    }
+}
@@ -0,0 +1,86 @@
+#ifndef DECRYPTED_MAPPING_HPP
+#define DECRYPTED_MAPPING_HPP
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include <thread>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "snuffle_core.hpp"
+
+class EncryptedFileReader;
+class WorkerPool;
+
+/*  Decrypted view of an encrypted file in memory, decrypted lazily page by page
+
+    The file is mapped as an empty anonymous region registered with userfaultfd. The first
+    touch of a page faults, a handler thread reads that page from the file, decrypts it at its
+    offset (O(1) counter seek, nothing before it is needed) and copies it into place, then the
+    touching thread continues. After each fault the following pages are decrypted as readahead
+    on the WorkerPool, so a sequential scan rarely waits for the handler.
+
+    Opening is instant regardless of the file size, only touched pages (and their readahead)
+    cost reading and decryption. The mapping is read only.
+
+    Without userfaultfd (old kernel, or disabled by vm.unprivileged_userfaultfd and no
+    UFFD_USER_MODE_ONLY support) the whole file is decrypted up front, lazy() tells which one
+    it is. With user mode only faults the region can't be handed to system calls (write(2) from
+    it fails with EFAULT) before its pages were touched from user space.
+*/
+class DecryptedMapping {
+
+public:
+
+    static const size_t DEFAULT_READAHEAD_PAGES = 32;
+
+    /*  map path, pool (may be nullptr) runs the readahead and has to outlive the mapping
+        throws std::runtime_error if the file can't be opened or mapped */
+    DecryptedMapping(const std::string& path, const SnuffleKeyContext& key, const uint8_t nonce[8],
+                     WorkerPool* pool = nullptr, size_t readahead_pages = DEFAULT_READAHEAD_PAGES);
+    ~DecryptedMapping();
+
+    DecryptedMapping(const DecryptedMapping&) = delete;
+    DecryptedMapping& operator=(const DecryptedMapping&) = delete;
+
+    const uint8_t* data() const { return _base; }
+    uint64_t size() const { return _size; }
+
+    bool lazy() const { return _uffd >= 0; }
+
+    //  pages decrypted so far (by faults and readahead)
+    uint64_t pagesDecrypted() const { return _pagesDecrypted.load(std::memory_order_relaxed); }
+
+private:
+
+    // page states
+    static const uint8_t PAGE_MISSING = 0, PAGE_LOADING = 1, PAGE_PRESENT = 2;
+
+    std::unique_ptr<EncryptedFileReader> _reader;
+    uint64_t _size;
+    size_t _pageSize;
+    uint64_t _nrPages;
+    uint8_t* _base = nullptr;
+    size_t _mappedLen = 0;
+
+    int _uffd = -1;
+    int _stopFd = -1;
+    std::thread _handler;
+    std::unique_ptr<std::atomic<uint8_t>[]> _pages;
+    std::atomic<uint64_t> _pagesDecrypted{0};
+
+    WorkerPool* _pool;
+    size_t _readahead;
+    std::mutex _mutex;
+    std::condition_variable _idleCv;
+    size_t _readaheadTasks = 0;
+
+    void handlerLoop();
+    void loadPages(uint64_t first, uint64_t count, bool wake_all);
+    void startReadahead(uint64_t page);
+};
+
+#endif // DECRYPTED_MAPPING_HPP
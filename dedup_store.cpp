@@ -0,0 +1,363 @@
+#include <algorithm> // std::min, std::max
+#include <functional>
+#include <cstring> // memcpy, memmove, memcmp, memset, strerror
+#include <cerrno>
+#include <climits> // IOV_MAX
+#include <stdexcept> // std::runtime_error, std::invalid_argument
+#include <fcntl.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "dedup_store.hpp"
+#include "byte_io.hpp"
+#include "blake.hpp"
+#include "snuffle_core.hpp"
+#include "snuffle_kernels.hpp"
+#include "worker_pool.hpp"
+
+using namespace std;
+
+static const size_t INDEX_RECORD_LEN = 32 + 8 + 4;
+static const size_t RECIPE_ENTRY_LEN = DedupStore::SECRET_LEN + 4;
+static const size_t RECIPE_HEADER_LEN = 48;
+static const char RECIPE_MAGIC[4] = {'S', 'D', 'D', 'R'};
+static const uint8_t RECIPE_VERSION = 1;
+
+//  consumes iov
+static void pwritevAll(int fd, vector<struct iovec>& iov, uint64_t offset) {
+    for (size_t first=0; first < iov.size();) {
+        ssize_t n = pwritev(fd, iov.data() + first, min<size_t>(iov.size() - first, IOV_MAX), offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            throw runtime_error(string("write failed: ") + strerror(errno));
+        offset += n;
+        for (; first < iov.size() && (size_t) n >= iov[first].iov_len; first++)
+            n -= iov[first].iov_len;
+        if (n) {
+            iov[first].iov_base = (uint8_t*) iov[first].iov_base + n;
+            iov[first].iov_len -= n;
+        }
+    }
+}
+
+static void forEach(WorkerPool* pool, size_t n, const function<void(size_t)>& fn) {
+    if (pool)
+        pool->parallelFor(n, fn);
+    else
+        for (size_t i=0; i<n; i++)
+            fn(i);
+}
+
+static void checkName(const string& name) {
+    if (name.empty() || name == "." || name == ".." || name.find('/') != string::npos)
+        throw invalid_argument("invalid recipe name: " + name);
+}
+
+size_t DedupStore::ChunkIdHash::operator()(const ChunkId& id) const {
+    size_t h;
+    memcpy(&h, id.data(), sizeof(h)); // ids are hashes already
+    return h;
+}
+
+DedupStore::DedupStore(const string& dir, const uint8_t store_secret[32], const CdcParams& params, size_t batch_size)
+    : _dir(dir), _params(params), _batchSize(max<size_t>(batch_size, 4 * (size_t) params.max_size)) {
+    vector<size_t> no_cuts;
+    cdcCut(nullptr, 0, true, params, no_cuts); // throws for bad chunk sizes
+    memcpy(_secret, store_secret, sizeof(_secret));
+    blake3DeriveKey(_recipeKey, sizeof(_recipeKey), "salsa dedup recipe key v1", _secret, sizeof(_secret));
+    blake3DeriveKey(_recipeMacKey, sizeof(_recipeMacKey), "salsa dedup recipe mac v1", _secret, sizeof(_secret));
+
+    for (const string& d : {dir, dir + "/recipes"})
+        if (mkdir(d.c_str(), 0700) != 0 && errno != EEXIST)
+            throw runtime_error("could not create " + d + ": " + strerror(errno));
+
+    const string data_path = dir + "/chunks.dat", index_path = dir + "/chunks.idx";
+    _dataFd = open(data_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (_dataFd < 0)
+        throw runtime_error("could not open " + data_path + ": " + strerror(errno));
+    _indexFd = open(index_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (_indexFd < 0) {
+        close(_dataFd);
+        throw runtime_error("could not open " + index_path + ": " + strerror(errno));
+    }
+
+    try {
+        struct stat st;
+        if (fstat(_dataFd, &st) != 0)
+            throw runtime_error(string("could not stat ") + data_path + ": " + strerror(errno));
+        _dataSize = st.st_size;
+        loadIndex();
+    } catch (...) {
+        close(_dataFd);
+        close(_indexFd);
+        throw;
+    }
+}
+
+DedupStore::~DedupStore() {
+    close(_dataFd);
+    close(_indexFd);
+}
+
+//  index records up to the first torn one or one pointing past the data, the rest is cut off
+void DedupStore::loadIndex() {
+    struct stat st;
+    if (fstat(_indexFd, &st) != 0)
+        throw runtime_error(string("could not stat chunk index: ") + strerror(errno));
+
+    vector<uint8_t> records(st.st_size);
+    preadAll(_indexFd, records.data(), records.size(), 0);
+
+    size_t valid = 0;
+    for (; valid + INDEX_RECORD_LEN <= records.size(); valid += INDEX_RECORD_LEN) {
+        const uint8_t* r = records.data() + valid;
+        Location loc = {getLE(r+32, 8), (uint32_t) getLE(r+40, 4)};
+        if (loc.offset > _dataSize || _dataSize - loc.offset < loc.len)
+            break;
+        ChunkId id;
+        memcpy(id.data(), r, id.size());
+        _index[id] = loc;
+    }
+    if (valid != records.size() && ftruncate(_indexFd, valid) != 0)
+        throw runtime_error(string("could not truncate chunk index: ") + strerror(errno));
+    _indexSize = valid;
+}
+
+void DedupStore::chunkSecret(const uint8_t* data, size_t len, uint8_t secret[SECRET_LEN]) const {
+    blake3(secret, SECRET_LEN, data, len, _secret);
+}
+
+DedupStore::ChunkId DedupStore::chunkId(const uint8_t secret[SECRET_LEN]) {
+    ChunkId id;
+    blake3(id.data(), id.size(), secret, SECRET_LEN);
+    return id;
+}
+
+/*  append the new chunks of a batch with one gathering write (runs of adjacent new chunks are one iovec),
+    their locations go to added and index_records until ingest() has written the index */
+void DedupStore::storeBatch(const uint8_t* cipher, const vector<size_t>& cuts, const vector<ChunkId>& ids,
+                            const vector<uint8_t>& is_new, ChunkIndex& added, vector<uint8_t>& index_records) {
+    vector<struct iovec> iov;
+    size_t packed = 0;
+    for (size_t i=0; i<cuts.size(); i++) {
+        if (!is_new[i])
+            continue;
+        const size_t begin = i ? cuts[i-1] : 0, len = cuts[i] - begin;
+        // the same chunk twice in one batch: both got encrypted, the first one is kept
+        if (!added.emplace(ids[i], Location{_dataSize + packed, (uint32_t) len}).second)
+            continue;
+
+        if (!iov.empty() && (const uint8_t*) iov.back().iov_base + iov.back().iov_len == cipher + begin)
+            iov.back().iov_len += len;
+        else
+            iov.push_back({(void*) (cipher + begin), len});
+        uint8_t record[INDEX_RECORD_LEN];
+        memcpy(record, ids[i].data(), 32);
+        putLE(record+32, _dataSize + packed, 8);
+        putLE(record+40, len, 4);
+        index_records.insert(index_records.end(), record, record + sizeof(record));
+        packed += len;
+    }
+
+    pwritevAll(_dataFd, iov, _dataSize);
+    _dataSize += packed;
+}
+
+vector<DedupStore::ChunkRef> DedupStore::ingest(int fd, WorkerPool* pool) {
+    vector<uint8_t> buf(_batchSize), cipher(_batchSize), index_records;
+    vector<ChunkRef> recipe;
+    vector<size_t> cuts;
+    vector<ChunkId> ids;
+    vector<uint8_t> is_new;
+    ChunkIndex added;   // new chunks of this ingest, not in _index before the index is synced
+    size_t have = 0;
+    bool eof = false;
+
+    for (;;) {
+        if (!eof) {
+            size_t n = readFull(fd, buf.data() + have, buf.size() - have);
+            have += n;
+            eof = have < buf.size();
+        }
+        if (have == 0)
+            break;
+
+        cuts.clear();
+        const size_t done = cdcCut(buf.data(), have, eof, _params, cuts, pool);
+        const size_t first = recipe.size();
+        recipe.resize(first + cuts.size());
+        ids.resize(cuts.size());
+        is_new.assign(cuts.size(), 0);
+
+        // the indexes are only read here, storeBatch adds to added afterwards
+        const size_t per_task = 16;
+        forEach(pool, (cuts.size() + per_task - 1) / per_task, [&](size_t t) {
+            for (size_t i=t*per_task; i < min(cuts.size(), (t+1)*per_task); i++) {
+                const size_t begin = i ? cuts[i-1] : 0, len = cuts[i] - begin;
+                ChunkRef& ref = recipe[first + i];
+                chunkSecret(buf.data() + begin, len, ref.secret);
+                ref.len = len;
+                ids[i] = chunkId(ref.secret);
+                if (_index.count(ids[i]) || added.count(ids[i]))
+                    continue;
+
+                SnuffleKeyContext key;
+                snuffleInitKey(key, SnuffleVariant::Chacha20, ref.secret, 32);
+                snuffleXorKeystream(key, ref.secret + 32, 0, buf.data() + begin, cipher.data() + begin, len);
+                is_new[i] = 1;
+            }
+        });
+        storeBatch(cipher.data(), cuts, ids, is_new, added, index_records);
+        _ingestedBytes += done;
+        _ingestedChunks += cuts.size();
+
+        memmove(buf.data(), buf.data() + done, have - done);
+        have -= done;
+    }
+
+    // the index only ever points to synced data
+    if (!index_records.empty()) {
+        if (fdatasync(_dataFd) != 0)
+            throw runtime_error(string("chunk data sync failed: ") + strerror(errno));
+        pwriteAll(_indexFd, index_records.data(), index_records.size(), _indexSize);
+        if (fdatasync(_indexFd) != 0)
+            throw runtime_error(string("chunk index sync failed: ") + strerror(errno));
+        _indexSize += index_records.size();
+    }
+    for (const auto& entry : added) {
+        _index.insert(entry);
+        _newBytes += entry.second.len;
+    }
+    _newChunks += added.size();
+    return recipe;
+}
+
+void DedupStore::restore(const vector<ChunkRef>& recipe, int fd, WorkerPool* pool) {
+    vector<uint8_t> buf;
+    vector<size_t> offsets;
+
+    for (size_t first=0; first < recipe.size();) {
+        // as many chunks as fit in a batch, at least one
+        size_t last = first, total = 0;
+        offsets.clear();
+        while (last < recipe.size() && (last == first || total + recipe[last].len <= _batchSize)) {
+            offsets.push_back(total);
+            total += recipe[last++].len;
+        }
+        buf.resize(total);
+
+        forEach(pool, last - first, [&](size_t k) {
+            const ChunkRef& ref = recipe[first + k];
+            auto it = _index.find(chunkId(ref.secret));
+            if (it == _index.end())
+                throw runtime_error("chunk " + to_string(first + k) + " is missing from the store");
+            if (it->second.len != ref.len)
+                throw runtime_error("chunk " + to_string(first + k) + " has the wrong length");
+
+            uint8_t* out = buf.data() + offsets[k];
+            preadAll(_dataFd, out, ref.len, it->second.offset);
+            SnuffleKeyContext key;
+            snuffleInitKey(key, SnuffleVariant::Chacha20, ref.secret, 32);
+            snuffleXorKeystream(key, ref.secret + 32, 0, out, out, ref.len);
+
+            uint8_t check[SECRET_LEN];
+            chunkSecret(out, ref.len, check);
+            if (memcmp(check, ref.secret, SECRET_LEN) != 0)
+                throw runtime_error("chunk " + to_string(first + k) + " is corrupt");
+        });
+        writeAll(fd, buf.data(), total);
+        first = last;
+    }
+}
+
+void DedupStore::putRecipe(const string& name, const vector<ChunkRef>& recipe) {
+    checkName(name);
+    vector<uint8_t> file(RECIPE_HEADER_LEN + recipe.size() * RECIPE_ENTRY_LEN, 0);
+    memcpy(file.data(), RECIPE_MAGIC, 4);
+    file[4] = RECIPE_VERSION;
+    uint8_t* nonce = file.data() + 8;
+    if (getrandom(nonce, 8, 0) != 8)
+        throw runtime_error(string("getrandom failed: ") + strerror(errno));
+
+    uint8_t* entries = file.data() + RECIPE_HEADER_LEN;
+    for (size_t i=0; i<recipe.size(); i++) {
+        memcpy(entries + i*RECIPE_ENTRY_LEN, recipe[i].secret, SECRET_LEN);
+        putLE(entries + i*RECIPE_ENTRY_LEN + SECRET_LEN, recipe[i].len, 4);
+    }
+    SnuffleKeyContext key;
+    snuffleInitKey(key, SnuffleVariant::Chacha20, _recipeKey, sizeof(_recipeKey));
+    snuffleXorKeystream(key, nonce, 0, entries, entries, file.size() - RECIPE_HEADER_LEN);
+    // tag over the whole file with the tag field zeroed
+    uint8_t tag[32];
+    blake3(tag, sizeof(tag), file.data(), file.size(), _recipeMacKey);
+    memcpy(file.data() + 16, tag, sizeof(tag));
+
+    // written next to it and renamed over it: a recipe is never half there
+    const string path = _dir + "/recipes/" + name, tmp = _dir + "/recipes/." + name + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0)
+        throw runtime_error("could not create " + tmp + ": " + strerror(errno));
+    try {
+        writeAll(fd, file.data(), file.size());
+        if (fdatasync(fd) != 0)
+            throw runtime_error(string("recipe sync failed: ") + strerror(errno));
+    } catch (...) {
+        close(fd);
+        unlink(tmp.c_str());
+        throw;
+    }
+    close(fd);
+    if (rename(tmp.c_str(), path.c_str()) != 0) {
+        unlink(tmp.c_str());
+        throw runtime_error("could not rename " + tmp + ": " + strerror(errno));
+    }
+}
+
+vector<DedupStore::ChunkRef> DedupStore::getRecipe(const string& name) {
+    checkName(name);
+    const string path = _dir + "/recipes/" + name;
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        throw runtime_error("no recipe " + name + ": " + strerror(errno));
+    vector<uint8_t> file;
+    try {
+        struct stat st;
+        if (fstat(fd, &st) != 0)
+            throw runtime_error("could not stat " + path + ": " + strerror(errno));
+        file.resize(st.st_size);
+        preadAll(fd, file.data(), file.size(), 0);
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+    close(fd);
+
+    if (file.size() < RECIPE_HEADER_LEN || (file.size() - RECIPE_HEADER_LEN) % RECIPE_ENTRY_LEN
+        || memcmp(file.data(), RECIPE_MAGIC, 4) != 0 || file[4] != RECIPE_VERSION)
+        throw runtime_error(path + " is not a recipe");
+
+    uint8_t tag[32], expected[32];
+    memcpy(tag, file.data() + 16, sizeof(tag));
+    memset(file.data() + 16, 0, sizeof(tag));
+    blake3(expected, sizeof(expected), file.data(), file.size(), _recipeMacKey);
+    uint8_t diff = 0;
+    for (unsigned i=0; i<sizeof(tag); i++)
+        diff |= tag[i] ^ expected[i];
+    if (diff)
+        throw runtime_error("recipe " + name + " failed authentication (wrong key or modified)");
+
+    uint8_t* entries = file.data() + RECIPE_HEADER_LEN;
+    SnuffleKeyContext key;
+    snuffleInitKey(key, SnuffleVariant::Chacha20, _recipeKey, sizeof(_recipeKey));
+    snuffleXorKeystream(key, file.data() + 8, 0, entries, entries, file.size() - RECIPE_HEADER_LEN);
+
+    vector<ChunkRef> recipe((file.size() - RECIPE_HEADER_LEN) / RECIPE_ENTRY_LEN);
+    for (size_t i=0; i<recipe.size(); i++) {
+        memcpy(recipe[i].secret, entries + i*RECIPE_ENTRY_LEN, SECRET_LEN);
+        recipe[i].len = getLE(entries + i*RECIPE_ENTRY_LEN + SECRET_LEN, 4);
+    }
+    return recipe;
+}
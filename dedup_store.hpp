@@ -0,0 +1,119 @@
+#ifndef DEDUP_STORE_HPP
+#define DEDUP_STORE_HPP
+
+#include <array>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "cdc.hpp"
+
+class WorkerPool;
+
+/*  Deduplicating store of encrypted chunks (convergent encryption)
+
+    Input is cut into content defined chunks (cdc.hpp). Each chunk is encrypted with Chacha20
+    under a key and nonce derived from its own content: the 40 byte chunk secret is the keyed
+    BLAKE3 of the plaintext under the store secret, key = secret[0..32), nonce = secret[32..40).
+    Equal chunks give equal ciphertexts and are stored once, under the BLAKE3 of their secret as
+    chunk id, which tells nothing about the key. Keying the derivation with the store secret keeps
+    other stores (and anyone without it) from confirming guessed contents.
+
+    A file is its recipe, the list of chunk secrets and lengths. Restoring recomputes the secret
+    of every decrypted chunk, so a chunk that doesn't match its recipe entry is detected.
+    Recipes are stored by name, encrypted under a key derived from the store secret with a random
+    nonce and authenticated with keyed BLAKE3.
+
+    Ingest reads large batches, scans them for boundaries on a WorkerPool, derives and encrypts all
+    chunks of a batch in parallel and appends the new ones with one write to the data file.
+
+    Directory layout:
+    chunks.dat      the encrypted chunks, back to back
+    chunks.idx      id [32] | offset u64 | length u32 per chunk, appended after the data is written
+    recipes/<name>  "SDDR" | version u8 | 0 [3] | nonce [8] | tag [32] | encrypted entries
+                    (secret [40] | length u32 each), integers little endian
+    A crash can leave data without index entries (stored again later) or a torn index record at the
+    end, which is dropped when the store is opened.
+*/
+class DedupStore {
+
+public:
+
+    static const size_t SECRET_LEN = 40;
+    static const size_t DEFAULT_BATCH = 16 << 20;
+
+    struct ChunkRef {
+        uint8_t secret[SECRET_LEN];
+        uint32_t len;
+    };
+
+    /*  open the store in dir (created if it doesn't exist) with a 32 byte store secret
+        throws std::runtime_error if it can't be opened or created, std::invalid_argument for bad chunk sizes */
+    DedupStore(const std::string& dir, const uint8_t store_secret[32], const CdcParams& params = CdcParams(),
+               size_t batch_size = DEFAULT_BATCH);
+    ~DedupStore();
+
+    DedupStore(const DedupStore&) = delete;
+    DedupStore& operator=(const DedupStore&) = delete;
+
+    /*  chunk, encrypt and store everything read from fd up to end of file, returns its recipe
+        pool may be nullptr. Data and index are synced before it returns, the new chunks are only
+        found in the store from then on
+        throws std::runtime_error on read or write errors, the chunks written so far stay unindexed */
+    std::vector<ChunkRef> ingest(int fd, WorkerPool* pool);
+
+    /*  write the file of recipe to fd, chunks decrypted (and checked) in parallel with a pool
+        throws std::runtime_error for missing or corrupt chunks and on I/O errors */
+    void restore(const std::vector<ChunkRef>& recipe, int fd, WorkerPool* pool);
+
+    /*  store recipe as name (replacing an older one)
+        throws std::invalid_argument for names with '/' and std::runtime_error on write errors */
+    void putRecipe(const std::string& name, const std::vector<ChunkRef>& recipe);
+
+    //  throws std::runtime_error if there is no recipe name or it fails authentication
+    std::vector<ChunkRef> getRecipe(const std::string& name);
+
+    uint64_t uniqueChunks() const { return _index.size(); }
+    uint64_t storedBytes() const { return _dataSize; }
+
+    //  bytes and chunks ingested through this object, and how many of them were new
+    uint64_t ingestedBytes() const { return _ingestedBytes; }
+    uint64_t newBytes() const { return _newBytes; }
+    uint64_t ingestedChunks() const { return _ingestedChunks; }
+    uint64_t newChunks() const { return _newChunks; }
+
+private:
+
+    typedef std::array<uint8_t, 32> ChunkId;
+
+    struct ChunkIdHash {
+        size_t operator()(const ChunkId& id) const;
+    };
+
+    struct Location {
+        uint64_t offset;
+        uint32_t len;
+    };
+
+    std::string _dir;
+    uint8_t _secret[32];
+    uint8_t _recipeKey[32], _recipeMacKey[32];
+    CdcParams _params;
+    size_t _batchSize;
+    int _dataFd = -1, _indexFd = -1;
+    uint64_t _dataSize = 0, _indexSize = 0;
+    typedef std::unordered_map<ChunkId, Location, ChunkIdHash> ChunkIndex;
+    ChunkIndex _index;
+
+    uint64_t _ingestedBytes = 0, _newBytes = 0, _ingestedChunks = 0, _newChunks = 0;
+
+    void loadIndex();
+    void chunkSecret(const uint8_t* data, size_t len, uint8_t secret[SECRET_LEN]) const;
+    static ChunkId chunkId(const uint8_t secret[SECRET_LEN]);
+    void storeBatch(const uint8_t* cipher, const std::vector<size_t>& cuts, const std::vector<ChunkId>& ids,
+                    const std::vector<uint8_t>& is_new, ChunkIndex& added, std::vector<uint8_t>& index_records);
+};
+
+#endif // DEDUP_STORE_HPP
@@ -0,0 +1,260 @@
+#include <algorithm> // min, max
+#include <cstring> // memcpy
+#include <cerrno>
+#include <stdexcept> // std::runtime_error, std::length_error
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "encrypted_log.hpp"
+#include "encrypted_reader.hpp"
+#include "snuffle_kernels.hpp"
+#include "byte_io.hpp"
+
+using namespace std;
+
+// buffer state word: sealed bit | producers copying (31 bit) | reserved bytes (32 bit)
+static const uint64_t SEALED = 1ull << 63;
+static const uint64_t WRITER_ONE = 1ull << 32;
+static const uint64_t WRITERS_MASK = 0x7fffffffull << 32;
+static const uint64_t RESERVED_MASK = 0xffffffffull;
+
+static const size_t RECORD_HEADER_LEN = 4;
+static const uint32_t VOID_PREVIOUS = 1u << 31;    // length flag of the record put behind a torn one
+static const uint32_t MAX_RECORD_LEN = VOID_PREVIOUS - 1;
+
+uint64_t forEachLogRecord(const string& path, const SnuffleKeyContext& key, const uint8_t nonce[8],
+                          const function<void(uint64_t offset, const uint8_t* data, size_t len)>& fn) {
+    EncryptedFileReader reader(path, key, nonce);
+    vector<uint8_t> payload;
+    uint64_t offset = 0;
+
+    // a record is passed on once the header behind it shows that it wasn't torn
+    bool pending = false;
+    uint64_t pending_offset = 0;
+
+    for (;;) {
+        uint8_t header[RECORD_HEADER_LEN];
+        if (reader.read(offset, header, sizeof(header)) < sizeof(header))
+            break;
+        const uint32_t word = getLE(header, sizeof(header));
+        const uint32_t len = word & MAX_RECORD_LEN;
+        if (reader.size() - offset - sizeof(header) < len)
+            break; // torn record at the end
+
+        if (word & VOID_PREVIOUS) {
+            pending = false;
+        } else if (fn) {
+            if (pending)
+                fn(pending_offset, payload.data(), payload.size());
+            payload.resize(len);
+            reader.read(offset + sizeof(header), payload.data(), len);
+            pending = true;
+            pending_offset = offset;
+        }
+        offset += sizeof(header) + len;
+    }
+    if (pending)
+        fn(pending_offset, payload.data(), payload.size());
+    return offset;
+}
+
+/*  A crash tore the record at end, the file goes on to size. The torn bytes stay: their keystream
+    is used up, anything written over them would be encrypted with it a second time. Instead
+    the torn record gets the rest of its length header (as 0 bytes) and of its payload as
+    filler, and a VOID_PREVIOUS record behind it. Returns the offset behind that */
+static uint64_t padTornRecord(int fd, const string& path, const SnuffleKeyContext& key, const uint8_t nonce[8],
+                              uint64_t end, uint64_t size) {
+    uint8_t header[RECORD_HEADER_LEN] = {0};
+    EncryptedFileReader(path, key, nonce).read(end, header, min<uint64_t>(size - end, sizeof(header)));
+    const uint64_t record_end = end + sizeof(header) + (getLE(header, sizeof(header)) & MAX_RECORD_LEN);
+    const uint64_t pad_end = max(record_end, size) + RECORD_HEADER_LEN;
+
+    vector<uint8_t> chunk;
+    for (uint64_t offset = size; offset < pad_end;) {
+        chunk.assign(min<uint64_t>(pad_end - offset, 1 << 20), 0);
+        if (offset + chunk.size() == pad_end)
+            putLE(chunk.data() + chunk.size() - RECORD_HEADER_LEN, VOID_PREVIOUS, RECORD_HEADER_LEN);
+        snuffleXorKeystreamAt(key, nonce, offset, chunk.data(), chunk.data(), chunk.size());
+        writeAll(fd, chunk.data(), chunk.size());
+        offset += chunk.size();
+    }
+    if (fdatasync(fd) != 0)
+        throw runtime_error(string("log sync failed: ") + strerror(errno));
+    return pad_end;
+}
+
+EncryptedLogWriter::EncryptedLogWriter(const string& path, const SnuffleKeyContext& key, const uint8_t nonce[8],
+                                       chrono::microseconds commit_interval, size_t buffer_size)
+    : _key(key), _interval(commit_interval) {
+    memcpy(_nonce, nonce, sizeof(_nonce));
+    if (buffer_size < RECORD_HEADER_LEN || buffer_size > RESERVED_MASK)
+        throw length_error("log buffer size has to be between 4 bytes and 4 GiB");
+
+    _fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (_fd < 0)
+        throw runtime_error("could not open " + path + ": " + strerror(errno));
+
+    // continue behind the last complete record, or behind the padding of a torn one
+    uint64_t end;
+    try {
+        end = forEachLogRecord(path, key, nonce, nullptr);
+        struct stat st;
+        if (fstat(_fd, &st) != 0)
+            throw runtime_error(strerror(errno));
+        if ((uint64_t) st.st_size != end)
+            end = padTornRecord(_fd, path, key, nonce, end, st.st_size);
+    } catch (exception& e) {
+        close(_fd);
+        throw runtime_error("could not recover the end of " + path + ": " + e.what());
+    }
+    _durable = end;
+
+    // buffer 0 takes appends, buffer 1 stays sealed until the first commit switches over
+    for (Buffer& b : _buffers)
+        b.data.resize(buffer_size);
+    _buffers[0].base = end;
+    _buffers[0].state = 0;
+    _buffers[1].state = SEALED;
+
+    _writer = thread(&EncryptedLogWriter::writerLoop, this);
+}
+
+EncryptedLogWriter::~EncryptedLogWriter() {
+    {
+        lock_guard<mutex> lock(_mutex);
+        _stop = true;
+    }
+    _writerCv.notify_all();
+    _writer.join();
+    close(_fd);
+}
+
+uint64_t EncryptedLogWriter::append(const uint8_t* data, size_t len) {
+    const uint64_t need = RECORD_HEADER_LEN + len;
+    if (need > _buffers[0].data.size() || len > MAX_RECORD_LEN)
+        throw length_error("log record larger than the log buffer");
+
+    for (;;) {
+        const unsigned b = _current.load(memory_order_acquire);
+        Buffer& buf = _buffers[b];
+        uint64_t s = buf.state.load(memory_order_acquire);
+
+        while (!(s & SEALED) && (s & RESERVED_MASK) + need <= buf.data.size()) {
+            if (!buf.state.compare_exchange_weak(s, s + need + WRITER_ONE, memory_order_acq_rel))
+                continue;
+
+            const uint64_t pos = s & RESERVED_MASK;
+            uint8_t* dst = buf.data.data() + pos;
+            dst[0] = len; dst[1] = len >> 8; dst[2] = len >> 16; dst[3] = len >> 24;
+            if (len) // empty records may come without data
+                memcpy(dst + RECORD_HEADER_LEN, data, len);
+            const uint64_t end = buf.base + pos + need;
+            buf.state.fetch_sub(WRITER_ONE, memory_order_release);
+            return end;
+        }
+
+        if (s & SEALED) {
+            // writer is switching buffers right now
+            this_thread::yield();
+            continue;
+        }
+
+        // full: have the writer commit early, wait for the switch
+        unique_lock<mutex> lock(_mutex);
+        if (_failed)
+            throw runtime_error(_error);
+        _wakeWriter = true;
+        _writerCv.notify_one();
+        _spaceCv.wait(lock, [&] { return _current.load(memory_order_acquire) != b || _failed; });
+    }
+}
+
+void EncryptedLogWriter::waitDurable(uint64_t offset) {
+    unique_lock<mutex> lock(_mutex);
+    _durableCv.wait(lock, [&] { return _durable.load(memory_order_acquire) >= offset || _failed; });
+    if (_durable.load(memory_order_acquire) < offset)
+        throw runtime_error(_error);
+}
+
+void EncryptedLogWriter::flush() {
+    unique_lock<mutex> lock(_mutex);
+    // the commit after the next one to start has everything appended before this call
+    const uint64_t target = _commitsStarted + 1;
+    _wakeWriter = true;
+    _writerCv.notify_one();
+    _durableCv.wait(lock, [&] { return _commitsDone >= target || _failed; });
+    if (_failed)
+        throw runtime_error(_error);
+}
+
+void EncryptedLogWriter::writerLoop() {
+    for (;;) {
+        bool stopping;
+        {
+            unique_lock<mutex> lock(_mutex);
+            _writerCv.wait_for(lock, _interval, [&] { return _wakeWriter || _stop; });
+            _wakeWriter = false;
+            stopping = _stop;
+            _commitsStarted++;
+        }
+
+        try {
+            commit();
+        } catch (exception& e) {
+            lock_guard<mutex> lock(_mutex);
+            _failed = true;
+            _error = e.what();
+        }
+
+        {
+            lock_guard<mutex> lock(_mutex);
+            _commitsDone++;
+        }
+        _durableCv.notify_all();
+        if (stopping)
+            return;
+    }
+}
+
+void EncryptedLogWriter::commit() {
+    const unsigned cur = _current.load(memory_order_relaxed);
+    Buffer& full = _buffers[cur];
+    Buffer& next = _buffers[cur^1];
+
+    // seal: no reservations after this, the reserved count is final
+    const uint64_t used = full.state.fetch_or(SEALED, memory_order_acq_rel) & RESERVED_MASK;
+
+    // producers go on in the other buffer while this one is written
+    next.base = full.base + used;
+    next.state.store(0, memory_order_release);
+    _current.store(cur^1, memory_order_release);
+    {
+        lock_guard<mutex> lock(_mutex); // producers check _current under the lock before waiting
+    }
+    _spaceCv.notify_all();
+
+    while (full.state.load(memory_order_acquire) & WRITERS_MASK)
+        this_thread::yield();
+
+    if (used == 0)
+        return;
+    if (_failed)
+        throw runtime_error(_error);
+
+    // one batch: one keystream call, one write, one sync
+    snuffleXorKeystreamAt(_key, _nonce, full.base, full.data.data(), full.data.data(), used);
+    for (size_t done=0; done < used;) {
+        ssize_t n = write(_fd, full.data.data() + done, used - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            throw runtime_error(string("log write failed: ") + strerror(errno));
+        done += n;
+    }
+    if (fdatasync(_fd) != 0)
+        throw runtime_error(string("log sync failed: ") + strerror(errno));
+
+    _durable.store(full.base + used, memory_order_release);
+    _commits.fetch_add(1, memory_order_relaxed);
+}
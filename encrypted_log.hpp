@@ -0,0 +1,108 @@
+#ifndef ENCRYPTED_LOG_HPP
+#define ENCRYPTED_LOG_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "snuffle_core.hpp"
+
+/*  Encrypted append-only log with group commit
+
+    The log file is one keystream: byte i of the file is encrypted with keystream byte i
+    (like `salsa infile outfile key nonce`), so EncryptedFileReader can read any part of it.
+    Records are framed as length u32 (little endian) | payload, records are shorter than 2 GiB.
+
+    Producers append into a double buffer without taking a lock: a single atomic word per
+    buffer holds the reserved bytes, the number of producers still copying and a seal bit.
+    A producer reserves its bytes with one CAS and copies its record in. The writer thread
+    commits every commit interval (or earlier when a buffer runs full or on flush()):
+    it seals the current buffer and switches producers over to the other one, waits for the
+    copies still in flight, encrypts the whole batch with the bulk kernels in one call at its
+    log offset and issues one write + fdatasync for all of it.
+
+    Reopening a log continues the keystream at the end of the file, it never goes back. A record
+    torn by a crash during a write is left in place: reopening pads it to its length and puts
+    an empty record with bit 31 of the length set behind it, which voids the record in front.
+*/
+class EncryptedLogWriter {
+
+public:
+
+    static const size_t DEFAULT_BUFFER_SIZE = 4 << 20;
+
+    /*  open (or create) the log at path for appending
+        throws std::runtime_error if the file can't be opened */
+    EncryptedLogWriter(const std::string& path, const SnuffleKeyContext& key, const uint8_t nonce[8],
+                       std::chrono::microseconds commit_interval = std::chrono::milliseconds(2),
+                       size_t buffer_size = DEFAULT_BUFFER_SIZE);
+
+    //  commits everything appended so far, all producers have to be done
+    ~EncryptedLogWriter();
+
+    EncryptedLogWriter(const EncryptedLogWriter&) = delete;
+    EncryptedLogWriter& operator=(const EncryptedLogWriter&) = delete;
+
+    /*  append one record, thread safe. Returns the log offset just behind the record,
+        durable once durableOffset() reaches it (see waitDurable())
+        throws std::length_error for records that don't fit a buffer (or 2 GiB), std::runtime_error
+        once a write to the log failed */
+    uint64_t append(const uint8_t* data, size_t len);
+
+    //  block until the log is durable up to offset, throws std::runtime_error if writing failed
+    void waitDurable(uint64_t offset);
+
+    //  commit now instead of at the end of the interval and wait for it
+    void flush();
+
+    uint64_t durableOffset() const { return _durable.load(std::memory_order_acquire); }
+    uint64_t commits() const { return _commits.load(std::memory_order_relaxed); }
+
+private:
+
+    struct Buffer {
+        std::vector<uint8_t> data;
+        std::atomic<uint64_t> state;    // sealed bit | producers copying | reserved bytes
+        uint64_t base = 0;              // log offset of data[0], set before the buffer is unsealed
+    };
+
+    int _fd;
+    SnuffleKeyContext _key;
+    uint8_t _nonce[8];
+    std::chrono::microseconds _interval;
+
+    Buffer _buffers[2];
+    std::atomic<unsigned> _current{0};
+    std::atomic<uint64_t> _durable{0};
+    std::atomic<uint64_t> _commits{0};
+
+    std::mutex _mutex;
+    std::condition_variable _writerCv;  // writer waits for interval / full buffer / flush / stop
+    std::condition_variable _spaceCv;   // producers wait for the next buffer
+    std::condition_variable _durableCv; // waitDurable() and flush()
+    bool _wakeWriter = false;
+    bool _stop = false;
+    bool _failed = false;
+    std::string _error;
+    uint64_t _commitsStarted = 0, _commitsDone = 0;
+
+    std::thread _writer;
+
+    void writerLoop();
+    void commit();
+};
+
+/*  call fn(offset, data, len) for every complete record of the log at path, in order, skipping
+    voided ones. Returns the log offset behind the last complete record (fn may be empty to only
+    find that) */
+uint64_t forEachLogRecord(const std::string& path, const SnuffleKeyContext& key, const uint8_t nonce[8],
+                          const std::function<void(uint64_t offset, const uint8_t* data, size_t len)>& fn);
+
+#endif // ENCRYPTED_LOG_HPP
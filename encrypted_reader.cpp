@@ -0,0 +1,240 @@
+#include <cstring> // memcpy
+#include <cerrno>
+#include <chrono>
+#include <algorithm> // std::min
+#include <stdexcept> // std::runtime_error
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "encrypted_reader.hpp"
+#include "byte_io.hpp"
+#include "snuffle_kernels.hpp"
+#include "merkle.hpp"
+#include "worker_pool.hpp"
+
+using namespace std;
+
+EncryptedFileReader::EncryptedFileReader(const string& path, const SnuffleKeyContext& key, const uint8_t nonce[8],
+                                         const MerkleIndex* index)
+    : _key(key), _index(index) {
+    memcpy(_nonce, nonce, sizeof(_nonce));
+
+    _fd = open(path.c_str(), O_RDONLY);
+    if (_fd < 0)
+        throw runtime_error("could not open " + path + ": " + strerror(errno));
+
+    struct stat st;
+    if (fstat(_fd, &st) != 0) {
+        close(_fd);
+        throw runtime_error("could not stat " + path);
+    }
+    _size = st.st_size;
+
+    if (_index) {
+        if (_index->fileSize() != _size) {
+            close(_fd);
+            throw runtime_error(path + " doesn't match its merkle index (size differs)");
+        }
+        _chunkBuf.resize(_index->chunkSize());
+    }
+}
+
+EncryptedFileReader::~EncryptedFileReader() {
+    // windows still being decrypted on the pool write into this reader
+    for (auto& w : _windows)
+        if (w.pending.valid())
+            w.pending.wait();
+    close(_fd);
+}
+
+// consecutive reads matching the pattern before windows get prefetched
+static const unsigned PATTERN_MIN_HITS = 2;
+
+void EncryptedFileReader::enableReadahead(WorkerPool& pool, size_t window_size, unsigned nr_windows) {
+    if (window_size == 0 || nr_windows == 0)
+        throw invalid_argument("readahead needs at least one window of at least one byte");
+    for (auto& w : _windows)
+        if (w.pending.valid())
+            w.pending.wait();
+
+    _pool = &pool;
+    _windowSize = window_size;
+    _windows = vector<Window>(nr_windows);
+    _patternHits = 0;
+    _prefetchEnd = 0;
+}
+
+size_t EncryptedFileReader::read(uint64_t offset, uint8_t* buf, size_t len) {
+    if (offset >= _size)
+        return 0;
+    len = min<uint64_t>(len, _size - offset);
+
+    if (!_pool) {
+        readAt(offset, buf, len, _chunkBuf);
+        return len;
+    }
+
+    trackPattern(offset, len);
+    size_t served = serveFromWindows(offset, buf, len);
+    if (served < len)
+        readAt(offset + served, buf + served, len - served, _chunkBuf);
+    _readaheadBytes += served;
+
+    if (_patternHits >= PATTERN_MIN_HITS)
+        prefetch(offset, len);
+    return len;
+}
+
+void EncryptedFileReader::readAt(uint64_t offset, uint8_t* buf, size_t len, vector<uint8_t>& chunk_buf) const {
+    if (!_index) {
+        preadAll(_fd, buf, len, offset);
+    } else {
+        // whole chunks get read and verified, only the requested part is copied out
+        const uint32_t chunk_size = _index->chunkSize();
+        for (uint64_t pos=offset; pos < offset+len;) {
+            uint64_t chunk = pos / chunk_size;
+            size_t chunk_len = min<uint64_t>(chunk_size, _size - chunk*chunk_size);
+            preadAll(_fd, chunk_buf.data(), chunk_len, chunk*chunk_size);
+            if (!_index->verifyChunk(chunk, chunk_buf.data(), chunk_len))
+                throw runtime_error("chunk " + to_string(chunk) + " failed verification");
+
+            size_t in_chunk = pos - chunk*chunk_size;
+            size_t n = min<uint64_t>(chunk_len - in_chunk, offset + len - pos);
+            memcpy(buf + (pos - offset), chunk_buf.data() + in_chunk, n);
+            pos += n;
+        }
+    }
+
+    snuffleXorKeystreamAt(_key, _nonce, offset, buf, buf, len);
+}
+
+/*  copy the longest prefix of [offset, offset+len) the windows hold into buf, waiting for
+    windows still on the pool. A window that failed is dropped and its error rethrown,
+    the same error a direct read would have run into */
+size_t EncryptedFileReader::serveFromWindows(uint64_t offset, uint8_t* buf, size_t len) {
+    uint64_t pos = offset;
+    while (pos < offset + len) {
+        Window* found = nullptr;
+        for (auto& w : _windows)
+            if (w.valid && w.offset <= pos && pos < w.offset + w.len) {
+                found = &w;
+                break;
+            }
+        if (!found)
+            break;
+
+        if (!found->loaded) {
+            try {
+                found->pending.get();
+            } catch (...) {
+                found->valid = false;
+                throw;
+            }
+            found->loaded = true;
+        }
+        size_t n = min<uint64_t>(found->offset + found->len, offset + len) - pos;
+        memcpy(buf + (pos - offset), found->data.data() + (pos - found->offset), n);
+        pos += n;
+    }
+    return pos - offset;
+}
+
+/*  a read continues the pattern if it starts where the last one ended (sequential) or
+    is as far after the last one as that was after the one before (forward stride) */
+void EncryptedFileReader::trackPattern(uint64_t offset, size_t len) {
+    const bool have_last = _lastEnd != UINT64_MAX;
+    const bool sequential = have_last && offset == _lastEnd;
+    const int64_t stride = (int64_t) (offset - _lastOffset);
+
+    if (sequential || (have_last && stride > 0 && stride == _stride)) {
+        _patternHits++;
+    } else {
+        _patternHits = 0;
+        _prefetchEnd = 0;
+        dropWindows(UINT64_MAX);
+    }
+    _sequential = sequential;
+    _stride = have_last ? stride : 0;
+    _lastOffset = offset;
+    _lastEnd = offset + len;
+}
+
+void EncryptedFileReader::prefetch(uint64_t offset, size_t len) {
+    // what lies before this read won't be asked for again
+    dropWindows(offset);
+
+    auto schedule = [this](Window* w, uint64_t off, size_t n) {
+        w->offset = off;
+        w->len = n;
+        w->data.resize(n);
+        w->valid = true;
+        w->loaded = false;
+        w->pending = _pool->submit([this, w] {
+            vector<uint8_t> chunk_buf(_index ? _index->chunkSize() : 0);
+            readAt(w->offset, w->data.data(), w->len, chunk_buf);
+        });
+    };
+
+    if (_sequential || (uint64_t) _stride <= 2 * (uint64_t) len) {
+        // dense (at least half of the bytes get read): keep the contiguous windows after this read filled
+        const uint64_t next = _sequential ? offset + len : offset + _stride;
+        const uint64_t limit = min<uint64_t>(_size, next + _windows.size() * _windowSize);
+        uint64_t pos = max(_prefetchEnd, next);
+        while (pos < limit) {
+            Window* w = freeWindow();
+            if (!w)
+                break;
+            schedule(w, pos, min<uint64_t>(_windowSize, _size - pos));
+            pos += w->len;
+        }
+        _prefetchEnd = max(_prefetchEnd, pos);
+    } else {
+        // sparse: just the records the stride predicts
+        for (uint64_t k=1; k <= _windows.size(); k++) {
+            uint64_t off = offset + k * _stride;
+            if (off >= _size)
+                break;
+            size_t n = min<uint64_t>(len, _size - off);
+            if (covered(off, n))
+                continue;
+            Window* w = freeWindow();
+            if (!w)
+                break;
+            schedule(w, off, n);
+        }
+    }
+}
+
+// a window that is neither holding data nor still being decrypted, nullptr if there is none
+EncryptedFileReader::Window* EncryptedFileReader::freeWindow() {
+    for (auto& w : _windows) {
+        if (w.valid)
+            continue;
+        if (w.pending.valid()) {
+            if (w.pending.wait_for(chrono::seconds(0)) != future_status::ready)
+                continue;
+            try {
+                w.pending.get();
+            } catch (...) {
+                // dropped before anyone asked for it
+            }
+        }
+        return &w;
+    }
+    return nullptr;
+}
+
+bool EncryptedFileReader::covered(uint64_t offset, size_t len) const {
+    for (auto& w : _windows)
+        if (w.valid && w.offset <= offset && offset + len <= w.offset + w.len)
+            return true;
+    return false;
+}
+
+// drop the windows ending at or before below, ones still on the pool are reaped by freeWindow()
+void EncryptedFileReader::dropWindows(uint64_t below) {
+    for (auto& w : _windows)
+        if (w.valid && w.offset + w.len <= below)
+            w.valid = false;
+}
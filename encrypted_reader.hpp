@@ -0,0 +1,96 @@
+#ifndef ENCRYPTED_READER_HPP
+#define ENCRYPTED_READER_HPP
+
+#include <future>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "snuffle_core.hpp"
+
+class MerkleIndex;
+class WorkerPool;
+
+/*  Random access to a file encrypted as one stream (as written by `salsa infile outfile key nonce`)
+
+    read() decrypts any byte range using the O(1) counter position of its first block,
+    nothing before it gets read or decrypted. With a MerkleIndex every chunk a read touches
+    is verified before any of it is decrypted and returned (authenticated reads).
+
+    Readahead (enableReadahead()): the reader watches the offsets of consecutive reads. Once they
+    are sequential or keep the same forward stride, the next windows are read and decrypted on a
+    WorkerPool into a few buffers, and reads are served from them. Dense patterns (the reads cover at
+    least half of the stride) prefetch contiguous windows, sparse ones just the predicted records.
+    Any other read drops the prediction, so random reads go straight to the file as before.
+*/
+class EncryptedFileReader {
+
+public:
+
+    static const size_t DEFAULT_READAHEAD_WINDOW = 256 * 1024;
+    static const unsigned DEFAULT_READAHEAD_WINDOWS = 4;
+
+    /*  open path for reading, index is optional and has to outlive the reader
+        throws std::runtime_error if the file can't be opened or doesn't match the index */
+    EncryptedFileReader(const std::string& path, const SnuffleKeyContext& key, const uint8_t nonce[8],
+                        const MerkleIndex* index = nullptr);
+    ~EncryptedFileReader();
+
+    EncryptedFileReader(const EncryptedFileReader&) = delete;
+    EncryptedFileReader& operator=(const EncryptedFileReader&) = delete;
+
+    uint64_t size() const { return _size; }
+
+    /*  decrypt up to len bytes at offset into buf, returns the number of bytes (less at end of file)
+        throws std::runtime_error on read errors and chunks failing verification
+        without an index and without readahead, concurrent calls from several threads are fine */
+    size_t read(uint64_t offset, uint8_t* buf, size_t len);
+
+    /*  prefetch nr_windows windows of window_size bytes on pool (which has to outlive the reader)
+        once reads follow a pattern. Makes read() single threaded */
+    void enableReadahead(WorkerPool& pool, size_t window_size = DEFAULT_READAHEAD_WINDOW,
+                         unsigned nr_windows = DEFAULT_READAHEAD_WINDOWS);
+
+    //  bytes read() served from readahead windows
+    uint64_t readaheadBytes() const { return _readaheadBytes; }
+
+private:
+
+    struct Window {
+        uint64_t offset = 0;
+        size_t len = 0;
+        std::vector<uint8_t> data;
+        std::future<void> pending;  // decryption on the pool
+        bool valid = false;         // holds (or will hold) [offset, offset+len)
+        bool loaded = false;        // pending has been collected
+    };
+
+    int _fd;
+    uint64_t _size;
+    SnuffleKeyContext _key;
+    uint8_t _nonce[8];
+    const MerkleIndex* _index;
+    std::vector<uint8_t> _chunkBuf;
+
+    // readahead
+    WorkerPool* _pool = nullptr;
+    size_t _windowSize = 0;
+    std::vector<Window> _windows;
+    uint64_t _lastOffset = UINT64_MAX, _lastEnd = UINT64_MAX;
+    int64_t _stride = 0;
+    bool _sequential = false;
+    unsigned _patternHits = 0;
+    uint64_t _prefetchEnd = 0;
+    uint64_t _readaheadBytes = 0;
+
+    void readAt(uint64_t offset, uint8_t* buf, size_t len, std::vector<uint8_t>& chunk_buf) const;
+    size_t serveFromWindows(uint64_t offset, uint8_t* buf, size_t len);
+    void trackPattern(uint64_t offset, size_t len);
+    void prefetch(uint64_t offset, size_t len);
+    Window* freeWindow();
+    bool covered(uint64_t offset, size_t len) const;
+    void dropWindows(uint64_t below);
+};
+
+#endif // ENCRYPTED_READER_HPP
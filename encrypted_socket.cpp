@@ -0,0 +1,213 @@
+#include <string>
+#include <cstring> // memcpy, strerror
+#include <cerrno>
+#include <algorithm> // std::min
+#include <stdexcept> // std::runtime_error, std::invalid_argument
+#include <netinet/in.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <linux/errqueue.h>
+
+#include "encrypted_socket.hpp"
+#include "snuffle_kernels.hpp"
+
+using namespace std;
+
+// completions in a row the kernel reports as copied before zerocopy is given up for plain sends
+static const unsigned COPIED_LIMIT = 32;
+
+uint32_t ZerocopyQueue::complete(uint32_t first, uint32_t last, vector<unsigned>& refs) {
+    const uint32_t count = last - first + 1;
+    for (uint32_t k=0; k<count; k++) {
+        size_t idx = (uint32_t) (first + k - _firstId);
+        if (idx < _inFlight.size() && !_inFlight[idx].done) {
+            _inFlight[idx].done = true;
+            refs[_inFlight[idx].buffer]--;
+        }
+    }
+    while (!_inFlight.empty() && _inFlight.front().done) {
+        _inFlight.pop_front();
+        _firstId++;
+    }
+    return count;
+}
+
+EncryptedSocket::EncryptedSocket(int fd, const SnuffleKeyContext& key, const uint8_t send_nonce[8],
+                                 const uint8_t recv_nonce[8], size_t buffer_size, unsigned nr_buffers)
+    : _fd(fd), _key(key) {
+    if (nr_buffers == 0 || buffer_size == 0)
+        throw invalid_argument("encrypted socket needs at least one buffer");
+    memcpy(_sendNonce, send_nonce, sizeof(_sendNonce));
+    memcpy(_recvNonce, recv_nonce, sizeof(_recvNonce));
+
+    const size_t page = sysconf(_SC_PAGESIZE);
+    _bufferSize = (buffer_size + page - 1) / page * page;
+    _poolLen = _bufferSize * nr_buffers;
+    void* pool = mmap(nullptr, _poolLen, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (pool == MAP_FAILED)
+        throw runtime_error(string("could not map send buffers: ") + strerror(errno));
+    _pool = (uint8_t*) pool;
+    mlock(_pool, _poolLen); // saves faulting and pinning the pages per send, fine without
+    _refs.assign(nr_buffers, 0);
+
+#ifdef SO_ZEROCOPY
+    int one = 1;
+    _zerocopy = setsockopt(_fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+#endif
+}
+
+EncryptedSocket::~EncryptedSocket() {
+    try {
+        flush();
+    } catch (exception&) {
+    }
+    // pages the kernel still sends from stay pinned by it, unmapping only drops our view of them
+    munmap(_pool, _poolLen);
+}
+
+void EncryptedSocket::write(const uint8_t* data, size_t len) {
+    while (len) {
+        if (_fill < 0) {
+            _fill = acquireBuffer();
+            _fillLen = 0;
+        }
+        size_t n = min(len, _bufferSize - _fillLen);
+        snuffleXorKeystreamAt(_key, _sendNonce, _sendOffset, data, buffer(_fill) + _fillLen, n);
+        _fillLen += n;
+        _sendOffset += n;
+        data += n;
+        len -= n;
+        if (_fillLen == _bufferSize)
+            flush();
+    }
+}
+
+void EncryptedSocket::flush() {
+    if (_fill < 0)
+        return;
+    const unsigned i = _fill;
+    const size_t len = _fillLen;
+    _fill = -1;
+    _fillLen = 0;
+    if (len)
+        sendBuffer(i, len);
+}
+
+void EncryptedSocket::drain() {
+    flush();
+    while (!_inFlight.empty())
+        waitCompletions();
+}
+
+size_t EncryptedSocket::recv(uint8_t* buf, size_t len) {
+    for (;;) {
+        ssize_t n = ::recv(_fd, buf, len, 0);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            throw runtime_error(string("recv failed: ") + strerror(errno));
+        }
+        snuffleXorKeystreamAt(_key, _recvNonce, _recvOffset, buf, buf, n);
+        _recvOffset += n;
+        return n;
+    }
+}
+
+// a buffer no send is pending on, waiting for completions if all of them are
+unsigned EncryptedSocket::acquireBuffer() {
+    for (;;) {
+        for (unsigned i=0; i<_refs.size(); i++)
+            if (_refs[i] == 0)
+                return i;
+        waitCompletions();
+    }
+}
+
+void EncryptedSocket::sendBuffer(unsigned i, size_t len) {
+    bool zerocopy = _zerocopy && len >= ZEROCOPY_MIN;
+    for (size_t pos=0; pos < len;) {
+        ssize_t n = ::send(_fd, buffer(i) + pos, len - pos, MSG_NOSIGNAL | (zerocopy ? MSG_ZEROCOPY : 0));
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            // out of socket option memory for pinned pages: wait for the sends holding them, or copy
+            if (errno == ENOBUFS && zerocopy) {
+                if (_inFlight.empty())
+                    zerocopy = false;
+                else
+                    waitCompletions();
+                continue;
+            }
+            throw runtime_error(string("send failed: ") + strerror(errno));
+        }
+        // every successful zerocopy send gets the next notification id
+        if (zerocopy) {
+            _refs[i]++;
+            _inFlight.push(i);
+            _zerocopySends++;
+        }
+        pos += n;
+    }
+}
+
+/*  process the zerocopy completions on the error queue without blocking, true if there were any
+    A completion covers the notification ids [ee_info, ee_data] */
+bool EncryptedSocket::reapCompletions() {
+    bool found = false;
+    uint8_t control[256];
+
+    for (;;) {
+        struct msghdr msg = {};
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(_fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return found;
+            throw runtime_error(string("reading send completions failed: ") + strerror(errno));
+        }
+
+        for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR)
+                && !(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))
+                continue;
+            struct sock_extended_err err;
+            memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+            if (err.ee_errno != 0 || err.ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                continue;
+            found = true;
+
+            const uint32_t count = _inFlight.complete(err.ee_info, err.ee_data, _refs);
+
+            if (err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                _copiedCompletions += count;
+                _copiedRun += count;
+                if (_copiedRun >= COPIED_LIMIT)
+                    _zerocopy = false;
+            } else
+                _copiedRun = 0;
+        }
+    }
+}
+
+//  block until at least one completion came in (or none is pending)
+void EncryptedSocket::waitCompletions() {
+    while (!reapCompletions() && !_inFlight.empty()) {
+        // POLLERR says the error queue has something, or the socket failed
+        struct pollfd pfd = {_fd, 0, 0};
+        if (poll(&pfd, 1, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            throw runtime_error(string("poll failed: ") + strerror(errno));
+        }
+        if (reapCompletions())
+            return;
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(_fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err != 0)
+            throw runtime_error(string("socket failed: ") + strerror(err));
+    }
+}
@@ -0,0 +1,121 @@
+#ifndef ENCRYPTED_SOCKET_HPP
+#define ENCRYPTED_SOCKET_HPP
+
+#include <deque>
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "snuffle_core.hpp"
+
+/*  Encryption of a connected TCP socket, each direction one keystream (send_nonce and
+    recv_nonce, the peer uses them the other way round), byte i of a direction encrypted with
+    keystream byte i like `salsa infile outfile key nonce`. No authentication, see stream_aead.hpp.
+
+    write() encrypts with the bulk kernels straight from the caller's data into a pool of page
+    aligned, locked (mlock, where RLIMIT_MEMLOCK allows) buffers and sends each full buffer with
+    one send(). Sends of at least ZEROCOPY_MIN bytes use MSG_ZEROCOPY: the kernel transmits from
+    the buffer itself and a completion on the socket's error queue tells when it let go of it, the
+    buffer is reused only then. Without zerocopy support (or when the kernel keeps reporting that
+    it copied anyway, as on loopback) sends fall back to plain send().
+
+    recv() decrypts in place in the caller's buffer. Not thread safe, but one thread writing
+    and another one reading is fine. The fd stays owned by the caller and has to outlive
+    the socket object.
+*/
+/*  MSG_ZEROCOPY sends in flight in notification id order. The kernel numbers the zerocopy sends
+    of a socket 0, 1, ... (wrapping at 2^32) and reports completions as id ranges, in any order */
+class ZerocopyQueue {
+
+public:
+
+    explicit ZerocopyQueue(uint32_t first_id = 0) : _firstId(first_id) {}
+
+    //  the next zerocopy send went out from buffer
+    void push(unsigned buffer) { _inFlight.push_back({buffer, false}); }
+
+    /*  ids first to last completed: refs[buffer] drops by one for each send not completed before,
+        ids not in flight are ignored. Returns the number of ids in the range */
+    uint32_t complete(uint32_t first, uint32_t last, std::vector<unsigned>& refs);
+
+    bool empty() const { return _inFlight.empty(); }
+    size_t size() const { return _inFlight.size(); }
+    uint32_t firstId() const { return _firstId; }
+
+private:
+
+    struct Notification {
+        unsigned buffer;
+        bool done;
+    };
+
+    uint32_t _firstId;              // notification id of _inFlight.front()
+    std::deque<Notification> _inFlight;
+};
+
+class EncryptedSocket {
+
+public:
+
+    static const size_t DEFAULT_BUFFER_SIZE = 256 * 1024;
+    static const unsigned DEFAULT_BUFFERS = 8;
+    static const size_t ZEROCOPY_MIN = 16 * 1024;  // below that pinning pages and the completion cost more than a copy
+
+    /*  wrap the connected socket fd, buffer_size is rounded up to whole pages
+        throws std::invalid_argument for no buffers, std::runtime_error if they can't be mapped */
+    EncryptedSocket(int fd, const SnuffleKeyContext& key, const uint8_t send_nonce[8], const uint8_t recv_nonce[8],
+                    size_t buffer_size = DEFAULT_BUFFER_SIZE, unsigned nr_buffers = DEFAULT_BUFFERS);
+
+    //  flushes what was written, errors are lost then (call flush() to see them)
+    ~EncryptedSocket();
+
+    EncryptedSocket(const EncryptedSocket&) = delete;
+    EncryptedSocket& operator=(const EncryptedSocket&) = delete;
+
+    /*  encrypt len bytes into the send buffers, sending every buffer that runs full
+        throws std::runtime_error if sending fails */
+    void write(const uint8_t* data, size_t len);
+
+    //  send what write() buffered so far, throws std::runtime_error if sending fails
+    void flush();
+
+    //  flush() and block until the kernel released every buffer, throws std::runtime_error on socket errors
+    void drain();
+
+    /*  receive up to len bytes into buf and decrypt them there, returns the number of bytes, 0 at end of stream
+        throws std::runtime_error on socket errors */
+    size_t recv(uint8_t* buf, size_t len);
+
+    bool zerocopy() const { return _zerocopy; }
+
+    uint64_t bytesSent() const { return _sendOffset - _fillLen; }
+    uint64_t bytesReceived() const { return _recvOffset; }
+    uint64_t zerocopySends() const { return _zerocopySends; }
+    uint64_t copiedCompletions() const { return _copiedCompletions; }
+
+private:
+
+    int _fd;
+    SnuffleKeyContext _key;
+    uint8_t _sendNonce[8], _recvNonce[8];
+    uint64_t _sendOffset = 0, _recvOffset = 0;  // keystream positions, send includes what is buffered
+
+    uint8_t* _pool = nullptr;
+    size_t _bufferSize, _poolLen;
+    std::vector<unsigned> _refs;    // zerocopy sends per buffer the kernel hasn't released yet
+    int _fill = -1;                 // buffer write() fills, -1 none
+    size_t _fillLen = 0;
+
+    bool _zerocopy = false;
+    ZerocopyQueue _inFlight;        // each completion releases a reference on its buffer
+    unsigned _copiedRun = 0;
+    uint64_t _zerocopySends = 0, _copiedCompletions = 0;
+
+    uint8_t* buffer(unsigned i) const { return _pool + i * _bufferSize; }
+    unsigned acquireBuffer();
+    void sendBuffer(unsigned i, size_t len);
+    bool reapCompletions();
+    void waitCompletions();
+};
+
+#endif // ENCRYPTED_SOCKET_HPP
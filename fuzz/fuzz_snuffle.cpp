@@ -0,0 +1,2180 @@
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "../salsa20.hpp"
+#include "../snuffle_c.h"
+#include "../snuffle_kernels.hpp"
+#include "../stream_aead.hpp"
+#include "../poly1305.hpp"
+#include "../crc32c.hpp"
+#include "../key_cache.hpp"
+#include "../datagram.hpp"
+#include "../datagram_relay.hpp"
+#include "../cdc.hpp"
+#include "../key_tree.hpp"
+#include "../lz.hpp"
+#include "../key_rotation.hpp"
+#include "../encrypted_log.hpp"
+#include "../encrypted_socket.hpp"
+#include "../archive.hpp"
+#include "../worker_pool.hpp"
+#include "../merkle.hpp"
+#include "../blake.hpp"
+#include "../pipeline_telemetry.hpp"
+#include "../metrics_server.hpp"
+#include "../dedup_store.hpp"
+#include "../decrypted_mapping.hpp"
+#include "../encrypted_reader.hpp"
+#include "../byte_io.hpp"
+
+using namespace std;
+
+/*  Differential fuzzing harness for Salsa20 and Chacha20
+
+    Every case decoded from the fuzzer input is run through all public en-/decryption paths
+    and compared byte by byte against the reference: one call to the scalar keyStreamBlock()
+    per 64 bytes, starting at the block counter of the case.
+
+    Covered: key constructors (hex, ascii, bytevector), chunked encryptBytes() with odd sizes and
+    misaligned buffers (partial block carry-over), the std::vector wrappers, seek() to arbitrary
+    byte offsets, setNonce() resetting a half used block, the snuffle_core.hpp key context
+    (also through KeyContextCache) and block functions, the stateless position addressed keystream,
+    datagram batches, content defined chunking (lane scan of the whole message vs. small streamed
+    pieces), LZ compression round trips and malformed blocks, the multi block lane kernels,
+    HSalsa20 / HChacha20 subkeys and the key tree built on them, fan-out to many keys, the batch
+    functions of the C interface, and archive round trips with tampered members, a tampered index
+    and truncated files. Start counters are biased towards the 2^32 and 2^64 boundaries to hit
+    the carry into the high counter word.
+
+    Scenarios that need threads, files or sockets run once at startup instead of per case, and so
+    do the known answer tests (BLAKE2s of RFC 7693, the official BLAKE3 test vectors, Poly1305 of
+    RFC 8439):
+    EpochDomain / RcuKeyTable readers against a rotator, with and without membarrier; the
+    encrypted log with group commit from several producers, torn records and reopening; encrypted
+    sockets against encryptBytes() over loopback TCP (zerocopy) and a socketpair, the zerocopy
+    notification ids across their wraparound, Merkle index headers with corrupt sizes, a seal
+    relay into an open relay over loopback UDP, sealed streams end to end with cut, dropped,
+    repeated and swapped segments, compressed streams through streamOpen() and random reads
+    with tampered frame lengths and indexes, the JSON snapshots of PipelineTelemetry, scrapes
+    of a MetricsServer over loopback, DedupStore round trips with repeated ingests, a failed
+    ingest and corrupted chunks and recipes, and concurrent random reads of a lazy (userfaultfd)
+    DecryptedMapping.
+
+    standalone (make fuzz):             random inputs until the time budget is used up
+                                        usage: fuzz_snuffle [seconds] [seed]
+    libFuzzer (make fuzz-libfuzzer):    built with -DSNUFFLE_LIBFUZZER, no main()
+*/
+
+// the protected reference path made accessible
+template <class Cipher>
+class Reference : public Cipher {
+public:
+    using Cipher::Cipher;
+    using Cipher::keyStreamBlock;
+};
+
+// consumes the fuzzer input, yields 0 once it is used up
+class FuzzInput {
+    const uint8_t* _data;
+    size_t _size;
+    size_t _pos = 0;
+public:
+    FuzzInput(const uint8_t* data, size_t size) : _data(data), _size(size) {}
+
+    uint8_t byte() { return _pos < _size ? _data[_pos++] : 0; }
+
+    uint64_t word(unsigned nr_bytes) {
+        uint64_t w = 0;
+        for (unsigned i=0; i<nr_bytes; i++)
+            w |= (uint64_t) byte() << (8*i);
+        return w;
+    }
+};
+
+struct FuzzCase {
+    bool chacha;
+    vector<uint8_t> key;
+    uint8_t nonce[8];
+    uint64_t start_block;
+    vector<uint8_t> msg;
+    uint64_t chunk_seed;
+    unsigned in_align, out_align;
+};
+
+static string toHex(const uint8_t* bytes, size_t len) {
+    ostringstream ss;
+    for (size_t i=0; i<len; i++)
+        ss << hex << setw(2) << setfill('0') << (unsigned) bytes[i];
+    return ss.str();
+}
+
+static void fail(const FuzzCase& fc, const string& path, size_t pos) {
+    cerr << "MISMATCH in " << path << " at byte " << pos << "\n"
+         << "  cipher      = " << (fc.chacha ? "Chacha20" : "Salsa20") << "\n"
+         << "  key         = " << toHex(fc.key.data(), fc.key.size()) << "\n"
+         << "  nonce       = " << toHex(fc.nonce, 8) << "\n"
+         << "  start block = " << fc.start_block << "\n"
+         << "  length      = " << fc.msg.size() << "\n"
+         << "  chunk seed  = " << fc.chunk_seed << "\n"
+         << "  alignment   = " << fc.in_align << "/" << fc.out_align << endl;
+    abort();
+}
+
+static void compare(const FuzzCase& fc, const string& path, const uint8_t* expected, const uint8_t* got, size_t len) {
+    if (memcmp(expected, got, len) == 0) return;
+    size_t pos = 0;
+    while (expected[pos] == got[pos]) pos++;
+    fail(fc, path, pos);
+}
+
+// chunk sizes hitting block boundaries +-1 most of the time, random sizes else
+class Chunker {
+    mt19937_64 _rng;
+public:
+    Chunker(uint64_t seed) : _rng(seed) {}
+
+    size_t next(size_t remaining) {
+        static const size_t interesting[] = {1, 7, 63, 64, 65, 127, 128, 129, 511, 512};
+        size_t chunk;
+        if (_rng() % 2)
+            chunk = interesting[_rng() % (sizeof(interesting)/sizeof(interesting[0]))];
+        else
+            chunk = _rng() % 300 + 1;
+        return chunk < remaining ? chunk : remaining;
+    }
+};
+
+// temporary directory of the harness, removed at exit: files put there are removed by whoever made them
+static const string& tempDir() {
+    static string dir;
+    if (dir.empty()) {
+        char dir_template[] = "/tmp/fuzz_snuffle_XXXXXX";
+        if (!mkdtemp(dir_template)) {
+            cerr << "could not create a temporary directory" << endl;
+            abort();
+        }
+        dir = dir_template;
+        atexit([] { rmdir(dir.c_str()); });
+    }
+    return dir;
+}
+
+static void removeTree(const string& path) {
+    nftw(path.c_str(), [](const char* p, const struct stat*, int, struct FTW*) { return remove(p); }, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+static uint64_t fileSize(const string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 ? st.st_size : UINT64_MAX;
+}
+
+static vector<uint8_t> readFile(const string& path) {
+    vector<uint8_t> data(fileSize(path) == UINT64_MAX ? 0 : fileSize(path));
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd >= 0)
+        data.resize(readFull(fd, data.data(), data.size()));
+    close(fd);
+    return data;
+}
+
+static void writeFile(const string& path, const uint8_t* data, size_t len) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    writeAll(fd, data, len);
+    close(fd);
+}
+
+// bitwise CRC32C as the reference for crc32c.hpp
+static uint32_t crc32cReference(const uint8_t* data, size_t len) {
+    uint32_t crc = 0xffffffff;
+    for (size_t i=0; i<len; i++) {
+        crc ^= data[i];
+        for (unsigned bit=0; bit<8; bit++)
+            crc = (crc >> 1) ^ (0x82f63b78 & (0 - (crc & 1)));
+    }
+    return ~crc;
+}
+
+static FuzzCase decodeCase(const uint8_t* data, size_t size) {
+    FuzzInput in(data, size);
+    FuzzCase fc;
+
+    uint8_t flags = in.byte();
+    fc.chacha = flags & 1;
+    fc.key.resize((flags & 2) ? 16 : 32);
+    for (auto& b : fc.key) b = in.byte();
+    for (auto& b : fc.nonce) b = in.byte();
+
+    uint64_t r = in.word(8);
+    switch ((flags >> 2) & 7) {
+        case 0:  fc.start_block = 0; break;
+        case 1:  fc.start_block = r % 1024; break;
+        case 2:
+        case 3:  fc.start_block = 0x100000000ull - (r % 16); break; // carry into high counter word
+        case 4:  fc.start_block = 0 - (r % 16); break;              // wrap of the whole counter
+        default: fc.start_block = r;
+    }
+
+    size_t len = in.word(2) % 4097;
+    if (flags & 0x20)
+        len = len * 16;
+    fc.msg.resize(len);
+    mt19937_64 msg_rng(in.word(8));
+    for (auto& b : fc.msg) b = msg_rng();
+
+    fc.chunk_seed = in.word(8);
+    fc.in_align = in.byte() % 16;
+    fc.out_align = in.byte() % 16;
+    return fc;
+}
+
+template <class Cipher>
+static void runCase(const FuzzCase& fc) {
+    const size_t len = fc.msg.size();
+    const string key_hex = toHex(fc.key.data(), fc.key.size());
+    const string key_ascii((const char*) fc.key.data(), fc.key.size());
+    const string nonce_hex = toHex(fc.nonce, 8);
+    Chunker chunker(fc.chunk_seed);
+
+    // reference: whole blocks from keyStreamBlock(), xored bytewise
+    vector<uint8_t> expected(len);
+    {
+        Reference<Cipher> ref(fc.key);
+        ref.setNonce(nonce_hex);
+        ref.skipBlocks(fc.start_block);
+        uint8_t block[64];
+        for (size_t i=0; i<len; i++) {
+            if (i%64 == 0)
+                ref.keyStreamBlock(block);
+            expected[i] = fc.msg[i] ^ block[i%64];
+        }
+    }
+
+    // misaligned copies of input and output
+    vector<uint8_t> in_buf(len + 16), out_buf(len + 16);
+    uint8_t* in = in_buf.data() + fc.in_align;
+    uint8_t* out = out_buf.data() + fc.out_align;
+    if (len) memcpy(in, fc.msg.data(), len);
+
+    // pointer API in random chunks, after a half used block that setNonce() has to discard
+    {
+        Cipher c(key_hex, true);
+        uint8_t junk[100] = {0};
+        c.encryptBytes(junk, junk, chunker.next(sizeof(junk)));
+        c.setNonce(nonce_hex);
+        c.skipBlocks(fc.start_block);
+        for (size_t done=0, n; done < len; done += n) {
+            n = chunker.next(len - done);
+            c.encryptBytes(in + done, out + done, n);
+        }
+        compare(fc, "chunked encryptBytes()", expected.data(), out, len);
+    }
+
+    // in place, same chunking pattern, ascii key
+    {
+        Cipher c(key_ascii, false);
+        c.setNonce(nonce_hex);
+        c.skipBlocks(fc.start_block);
+        vector<uint8_t> buf(fc.msg);
+        for (size_t done=0, n; done < len; done += n) {
+            n = chunker.next(len - done);
+            c.encryptBytes(buf.data() + done, buf.data() + done, n);
+        }
+        compare(fc, "in place encryptBytes()", expected.data(), buf.data(), len);
+    }
+
+    // std::vector wrappers
+    {
+        Cipher c(fc.key);
+        c.setNonce(nonce_hex);
+        c.skipBlocks(fc.start_block);
+        vector<uint8_t> out_vec;
+        c.encryptBytes(fc.msg, out_vec);
+        if (len) compare(fc, "encryptBytes(vector, vector)", expected.data(), out_vec.data(), len);
+
+        c.setNonce(nonce_hex);
+        c.skipBlocks(fc.start_block);
+        vector<uint8_t> buf(fc.msg);
+        c.encryptBytes(buf);
+        compare(fc, "encryptBytes(vector)", expected.data(), buf.data(), len);
+    }
+
+    // seek() to a byte offset inside the message, then the rest in chunks
+    // (byte offsets only reach counters below 2^58)
+    if (len && fc.start_block < (1ull << 58)) {
+        Cipher c(fc.key);
+        c.setNonce(nonce_hex);
+        size_t off = chunker.next(len) % len;
+        c.seek(fc.start_block*64 + off);
+        for (size_t done=off, n; done < len; done += n) {
+            n = chunker.next(len - done);
+            c.encryptBytes(in + done, out + done, n);
+        }
+        compare(fc, "seek()", expected.data() + off, out + off, len - off);
+    }
+
+    // snuffle_core.hpp: key context from the raw key and from the class, block aligned chunks
+    {
+        SnuffleKeyContext ctx, from_class = Cipher(key_hex, true).keyContext();
+        snuffleInitKey(ctx, from_class.variant, fc.key.data(), fc.key.size());
+        if (memcmp(ctx.matrix, from_class.matrix, sizeof(ctx.matrix)) != 0)
+            fail(fc, "keyContext()", 0);
+
+        for (size_t done=0, n; done < len; done += n) {
+            n = min(len - done, (chunker.next(len) + 63) / 64 * 64);
+            snuffleXorSmall(ctx, fc.nonce, fc.start_block + done/64, in + done, out + done, n);
+        }
+        compare(fc, "snuffleXorSmall()", expected.data(), out, len);
+
+        // the same context through a one set cache, after churn that evicts and replaces it
+        KeyContextCache cache(KeyContextCache::WAYS);
+        SnuffleKeyContext other = ctx, cached;
+        cache.insert(fc.start_block, other);
+        for (uint64_t id=1; id <= 3*KeyContextCache::WAYS; id++) {
+            other.matrix[4] = id;
+            cache.insert(fc.start_block + id, other);
+        }
+        cache.insert(fc.start_block, ctx);
+        if (!cache.lookup(fc.start_block, cached) || cached.variant != ctx.variant
+            || memcmp(cached.matrix, ctx.matrix, sizeof(ctx.matrix)) != 0)
+            fail(fc, "KeyContextCache", 0);
+    }
+
+    // lane kernels: whole message as consecutive keystream blocks, full lane passes and tail
+    {
+        SnuffleKeyContext ctx = Cipher(fc.key).keyContext();
+        vector<uint8_t> stream((len + 63) / 64 * 64);
+        uint32_t state[16];
+        snuffleInitState(state, ctx, fc.nonce, fc.start_block);
+        snuffleKeystreamBlocks(ctx.variant, state, stream.data(), stream.size() / 64);
+        for (size_t i=0; i<len; i++)
+            stream[i] ^= fc.msg[i];
+        compare(fc, "snuffleKeystreamBlocks()", expected.data(), stream.data(), len);
+    }
+
+    // HSalsa20 / HChacha20: block minus the input state (the feed forward) from the reference at the
+    // nonce and counter the 16 byte input fills, then the key tree in batches vs. one key at a time
+    {
+        const SnuffleKeyContext ctx = Cipher(fc.key).keyContext();
+        const size_t nr_inputs = min<size_t>(1 + fc.chunk_seed % 37, len / 16);
+        vector<uint8_t> subkeys(32 * nr_inputs);
+        snuffleHashKeys(ctx, fc.msg.data(), subkeys.data(), nr_inputs);
+        for (size_t i=0; i<nr_inputs; i++) {
+            const uint8_t* input = fc.msg.data() + 16*i;
+            const uint8_t* nonce = fc.chacha ? input + 8 : input;
+            uint64_t counter = 0;
+            for (unsigned j=0; j<8; j++)
+                counter |= (uint64_t) input[fc.chacha ? j : 8 + j] << 8*j;
+
+            Reference<Cipher> ref(fc.key);
+            ref.setNonce(toHex(nonce, 8));
+            ref.skipBlocks(counter);
+            uint8_t block[64], subkey[32];
+            uint32_t state[16];
+            ref.keyStreamBlock(block);
+            snuffleInitState(state, ctx, nonce, counter);
+            static const unsigned salsa_words[8] = {0, 5, 10, 15, 6, 7, 8, 9}, chacha_words[8] = {0, 1, 2, 3, 12, 13, 14, 15};
+            for (unsigned j=0; j<8; j++) {
+                unsigned w = fc.chacha ? chacha_words[j] : salsa_words[j];
+                uint32_t word = (block[4*w] | block[4*w+1] << 8 | block[4*w+2] << 16 | (uint32_t) block[4*w+3] << 24) - state[w];
+                for (unsigned b=0; b<4; b++)
+                    subkey[4*j + b] = word >> 8*b;
+            }
+            compare(fc, "snuffleHashKeys() input " + to_string(i), subkey, &subkeys[32*i], 32);
+        }
+
+        uint8_t master[32] = {};
+        memcpy(master, fc.key.data(), fc.key.size());
+        KeyTree tree(master, ctx.variant, 1), fresh(master, ctx.variant);
+        vector<uint64_t> ids(nr_inputs);
+        for (size_t i=0; i<nr_inputs; i++)
+            ids[i] = fc.start_block + i * (fc.chunk_seed | 1);
+        const uint64_t volume = fc.chunk_seed >> 32, file = fc.start_block;
+        vector<uint8_t> batch(32 * nr_inputs);
+        uint8_t key[32];
+        tree.chunkKeys(volume, file, ids.data(), nr_inputs, batch.data());
+        for (size_t i=0; i<nr_inputs; i++) {
+            tree.chunkKey(volume, file ^ 1, ids[i], key);    // churn the one set cache
+            fresh.chunkKey(volume, file, ids[i], key);
+            compare(fc, "KeyTree::chunkKeys() chunk " + to_string(i), key, &batch[32*i], 32);
+        }
+        tree.fileKeys(volume, ids.data(), nr_inputs, batch.data());
+        for (size_t i=0; i<nr_inputs; i++) {
+            fresh.fileKey(volume, ids[i], key);
+            compare(fc, "KeyTree::fileKeys() file " + to_string(i), key, &batch[32*i], 32);
+        }
+    }
+
+    // stateless keystream: block aligned chunks out of place, then unaligned offsets in place
+    // as EncryptedFileReader does (byte offsets only reach counters below 2^58)
+    {
+        SnuffleKeyContext ctx = Cipher(fc.key).keyContext();
+        vector<uint8_t> buf(len);
+        for (size_t done=0, n; done < len; done += n) {
+            n = min(len - done, (chunker.next(len) + 63) / 64 * 64);
+            snuffleXorKeystream(ctx, fc.nonce, fc.start_block + done/64, in + done, buf.data() + done, n);
+        }
+        compare(fc, "snuffleXorKeystream()", expected.data(), buf.data(), len);
+
+        vector<uint8_t> stream((len + 63) / 64 * 64);
+        snuffleKeystream(ctx, fc.nonce, fc.start_block, stream.data(), stream.size() / 64);
+        for (size_t i=0; i<len; i++)
+            stream[i] ^= fc.msg[i];
+        compare(fc, "snuffleKeystream()", expected.data(), stream.data(), len);
+    }
+    if (len && fc.start_block < (1ull << 58)) {
+        SnuffleKeyContext ctx = Cipher(fc.key).keyContext();
+        vector<uint8_t> buf(fc.msg);
+        size_t off = chunker.next(len) % len;
+        for (size_t done=off, n; done < len; done += n) {
+            n = chunker.next(len - done);
+            snuffleXorKeystreamAt(ctx, fc.nonce, fc.start_block*64 + done, buf.data() + done, buf.data() + done, n);
+        }
+        compare(fc, "snuffleXorKeystreamAt()", expected.data() + off, buf.data() + off, len - off);
+    }
+
+    // stream segments: ciphertext is the keystream from block 1, incremental Poly1305 matches one-shot,
+    // open() restores the message and rejects a flipped bit
+    {
+        SnuffleKeyContext ctx = Cipher(fc.key).keyContext();
+        vector<uint8_t> buf(fc.msg), aad(fc.key);
+        uint8_t tag[STREAM_TAG_LEN];
+        streamSealSegment(ctx, fc.nonce, aad.data(), aad.size(), buf.data(), len, tag);
+
+        vector<uint8_t> stream(fc.msg);
+        snuffleXorSmall(ctx, fc.nonce, 1, stream.data(), stream.data(), len);
+        compare(fc, "streamSealSegment()", stream.data(), buf.data(), len);
+
+        uint8_t one_shot[16], chunked[16], poly_key[32];
+        memcpy(poly_key, fc.key.data(), 16);
+        memcpy(poly_key+16, fc.nonce, 8);
+        memcpy(poly_key+24, fc.nonce, 8);
+        poly1305(one_shot, poly_key, fc.msg.data(), len);
+        Poly1305 mac(poly_key);
+        for (size_t done=0, n; done < len; done += n) {
+            n = chunker.next(len - done);
+            mac.update(fc.msg.data() + done, n);
+        }
+        mac.final(chunked);
+        compare(fc, "Poly1305 update()", one_shot, chunked, 16);
+
+        if (!streamOpenSegment(ctx, fc.nonce, aad.data(), aad.size(), buf.data(), len, tag))
+            fail(fc, "streamOpenSegment()", 0);
+        compare(fc, "streamOpenSegment()", fc.msg.data(), buf.data(), len);
+
+        if (len) {
+            size_t bit = chunker.next(8*len) % (8*len);
+            buf[bit/8] ^= 1 << (bit%8);
+            if (streamOpenSegment(ctx, fc.nonce, aad.data(), aad.size(), buf.data(), len, tag))
+                fail(fc, "streamOpenSegment() accepted a modified segment", bit/8);
+        }
+    }
+
+    // fused encrypt + CRC32C: kernel from start_block, C interface in chunks, in place
+    {
+        const uint32_t crc_plain = crc32cReference(fc.msg.data(), len), crc_cipher = crc32cReference(expected.data(), len);
+        SnuffleKeyContext ctx = Cipher(fc.key).keyContext();
+        uint32_t crc_in = 0, crc_out = 0;
+        snuffleXorCrc32c(ctx, fc.nonce, fc.start_block, in, out, len, &crc_in, &crc_out);
+        compare(fc, "snuffleXorCrc32c()", expected.data(), out, len);
+        if (crc_in != crc_plain || crc_out != crc_cipher)
+            fail(fc, "snuffleXorCrc32c() checksum", 0);
+
+        if (fc.start_block < (1ull << 58)) {
+            snuffle_stream* s;
+            if (snuffle_new(&s, fc.chacha ? SNUFFLE_CHACHA20 : SNUFFLE_SALSA20, fc.key.data(), fc.key.size(), fc.nonce) != SNUFFLE_OK)
+                fail(fc, "snuffle_new()", 0);
+            snuffle_seek(s, fc.start_block*64);
+            vector<uint8_t> buf(fc.msg);
+            crc_in = crc_out = 0;
+            for (size_t done=0, n; done < len; done += n) {
+                n = chunker.next(len - done);
+                snuffle_xor_crc32c(s, buf.data() + done, buf.data() + done, n, &crc_in, &crc_out);
+            }
+            snuffle_free(s);
+            compare(fc, "snuffle_xor_crc32c()", expected.data(), buf.data(), len);
+            if (crc_in != crc_plain || crc_out != crc_cipher || crc32c(0, buf.data(), len) != crc_cipher)
+                fail(fc, "snuffle_xor_crc32c() checksum", 0);
+        }
+    }
+
+    // fan-out: recipient 0 is the case, the others get their own nonce and are checked against the core
+    {
+        const SnuffleKeyContext ctx = Cipher(fc.key).keyContext();
+        const size_t nr_recipients = 1 + fc.chunk_seed % 19;
+        vector<SnuffleKeyContext> keys(nr_recipients, ctx);
+        vector<uint8_t> nonces(8*nr_recipients);
+        vector<vector<uint8_t>> outputs(nr_recipients, vector<uint8_t>(len));
+        vector<uint8_t*> output_ptrs;
+        for (size_t r=0; r<nr_recipients; r++) {
+            memcpy(&nonces[8*r], fc.nonce, 8);
+            nonces[8*r] ^= r;
+            output_ptrs.push_back(outputs[r].data());
+        }
+
+        snuffleFanOut(keys.data(), nonces.data(), nr_recipients, fc.start_block, in, output_ptrs.data(), len);
+        compare(fc, "snuffleFanOut()", expected.data(), outputs[0].data(), len);
+        for (size_t r=1; r<nr_recipients; r++) {
+            snuffleXorSmall(ctx, &nonces[8*r], fc.start_block, in, out, len);
+            compare(fc, "snuffleFanOut() recipient " + to_string(r), out, outputs[r].data(), len);
+        }
+    }
+
+    // datagram batches: the message cut into packets with scattered sequence numbers, each checked
+    // against the core under its own nonce, then sealed, reordered and opened with a tampered packet
+    {
+        const SnuffleKeyContext ctx = Cipher(fc.key).keyContext();
+        DatagramCipher plain(ctx, fc.nonce, false), sealed(ctx, fc.nonce, true);
+        vector<vector<uint8_t>> bufs;
+        vector<DatagramPacket> packets;
+        for (size_t done=0, n; done < len || packets.empty(); done += n) {
+            n = chunker.next(len - done);
+            bufs.emplace_back(fc.msg.begin() + done, fc.msg.begin() + done + n);
+            bufs.back().resize(n + DatagramCipher::TAG_LEN);
+            packets.push_back({fc.start_block + packets.size() * 0x9e3779b97f4a7c15ull, nullptr, n, false});
+            if (n == 0)
+                break;
+        }
+        for (size_t i=0; i<packets.size(); i++)
+            packets[i].data = bufs[i].data();
+
+        plain.sealBatch(packets.data(), packets.size());
+        for (size_t i=0, off=0; i<packets.size(); off += packets[i++].len) {
+            uint8_t nonce[8];
+            plain.packetNonce(packets[i].seq, nonce);
+            snuffleXorSmall(ctx, nonce, 0, fc.msg.data() + off, out, packets[i].len);
+            compare(fc, "DatagramCipher::sealBatch() packet " + to_string(i), out, packets[i].data, packets[i].len);
+        }
+        plain.openBatch(packets.data(), packets.size());
+        for (size_t i=0, off=0; i<packets.size(); off += packets[i++].len)
+            compare(fc, "DatagramCipher::openBatch() packet " + to_string(i), fc.msg.data() + off, packets[i].data, packets[i].len);
+
+        sealed.sealBatch(packets.data(), packets.size());
+        const size_t tampered = chunker.next(packets.size()) % packets.size();
+        bufs[tampered][chunker.next(packets[tampered].len) % packets[tampered].len] ^= 0x80;
+        reverse(packets.begin(), packets.end());
+        if (sealed.openBatch(packets.data(), packets.size()) != 1)
+            fail(fc, "DatagramCipher::openBatch() authentication", tampered);
+        reverse(packets.begin(), packets.end());
+        for (size_t i=0, off=0; i<packets.size(); i++) {
+            if (packets[i].ok == (i == tampered))
+                fail(fc, "DatagramCipher::openBatch() ok flag", i);
+            if (i != tampered)
+                compare(fc, "DatagramCipher::openBatch() sealed packet " + to_string(i), fc.msg.data() + off, packets[i].data, packets[i].len);
+            off += i == tampered ? packets[i].len - DatagramCipher::TAG_LEN : packets[i].len;
+        }
+    }
+
+    // content defined chunking: one call (lane scan) and small streamed pieces (scalar scan) cut alike
+    {
+        CdcParams params;
+        params.min_size = 64 + fc.chunk_seed % 193;
+        params.avg_size = 256u << (fc.chunk_seed >> 8) % 3;
+        params.max_size = params.avg_size + (fc.chunk_seed >> 16) % 2048;
+        vector<size_t> whole, streamed;
+        if (cdcCut(fc.msg.data(), len, true, params, whole) != len)
+            fail(fc, "cdcCut() whole message", 0);
+
+        Chunker pieces(fc.chunk_seed);
+        for (size_t start=0, have=0; start < len;) {
+            have += pieces.next(len - have);
+            vector<size_t> cuts;
+            size_t done = cdcCut(fc.msg.data() + start, have - start, have == len, params, cuts);
+            for (size_t c : cuts)
+                streamed.push_back(start + c);
+            start += done;
+        }
+        if (whole != streamed)
+            fail(fc, "cdcCut() streamed", mismatch(whole.begin(), whole.end(), streamed.begin(), streamed.end()).first - whole.begin());
+        for (size_t i=0; i<whole.size(); i++) {
+            size_t chunk = whole[i] - (i ? whole[i-1] : 0);
+            if (chunk > params.max_size || (chunk < params.min_size && i+1 < whole.size()))
+                fail(fc, "cdcCut() chunk size", i);
+        }
+    }
+
+    // LZ: the message (incompressible) and a compressible one made of pieces of it copied back from
+    // earlier, overlapping too; round trip, a tight output buffer, and the message as a malformed block
+    {
+        vector<uint8_t> repetitive(fc.msg);
+        for (size_t pos=1; pos < len;) {
+            size_t n = min(len - pos, chunker.next(300) + 1), back = 1 + chunker.next(512) * 131 % pos;
+            for (size_t i=0; i<n; i++)
+                repetitive[pos + i] = repetitive[pos + i - back];
+            pos += n + chunker.next(40);
+        }
+        const vector<uint8_t>* inputs[] = {&fc.msg, &repetitive};
+        for (const vector<uint8_t>* data : inputs) {
+            vector<uint8_t> packed(lzCompressBound(len)), unpacked(len + 1);
+            size_t packed_len = lzCompress(data->data(), len, packed.data(), packed.size());
+            if (packed_len == 0)
+                fail(fc, "lzCompress() bound", 0);
+            if (lzDecompress(packed.data(), packed_len, unpacked.data(), unpacked.size()) != len)
+                fail(fc, "lzDecompress() length", 0);
+            compare(fc, "lzDecompress()", data->data(), unpacked.data(), len);
+            if (lzCompress(data->data(), len, packed.data(), packed_len - 1) != 0)
+                fail(fc, "lzCompress() capacity", packed_len);
+            bool thrown = false;
+            try {
+                lzDecompress(packed.data(), packed_len, unpacked.data(), len - min<size_t>(len, 1));
+            } catch (runtime_error&) {
+                thrown = true;
+            }
+            if (!thrown && len > 0)
+                fail(fc, "lzDecompress() output capacity", 0);
+        }
+        try {
+            vector<uint8_t> unpacked(chunker.next(8 * len + 1));
+            if (lzDecompress(fc.msg.data(), len, unpacked.data(), unpacked.size()) > unpacked.size())
+                fail(fc, "lzDecompress() malformed block", 0);
+        } catch (runtime_error&) {
+        }
+    }
+
+    /*  archive: the message as four files (two in a subdirectory) packed with a small segment size,
+        read back through list / cat / extract. A flipped bit in a member or in the index and a cut
+        off archive have to be rejected */
+    {
+        static WorkerPool pool(1);
+        mt19937_64 r(fc.chunk_seed);
+        SnuffleKeyContext ctx = Cipher(fc.key).keyContext();
+        const string dir = tempDir() + "/archive", src = dir + "/src", path = dir + "/a.sarc";
+        mkdir(dir.c_str(), 0700);
+        mkdir(src.c_str(), 0700);
+        mkdir((src + "/sub").c_str(), 0700);
+
+        size_t cuts[5] = {0, r() % (len + 1), r() % (len + 1), r() % (len + 1), len};
+        sort(cuts, cuts + 5);
+        const char* names[4] = {"f0", "sub/f1", "f2", "sub/f3"};
+        const string prefix = src.substr(1) + "/";
+        for (unsigned i=0; i<4; i++)
+            writeFile(src + "/" + names[i], fc.msg.data() + cuts[i], cuts[i+1] - cuts[i]);
+
+        StreamHeader header;
+        header.variant = ctx.variant;
+        header.segment_size = 1 + r() % 2048;
+        memcpy(header.salt, fc.nonce, 8);
+        memcpy(header.salt + 8, fc.nonce, 8);
+        archivePack(path, {src}, ctx, header, pool);
+
+        ArchiveReader reader(path, ctx);
+        if (reader.members().size() != 6)
+            fail(fc, "archive list: " + to_string(reader.members().size()) + " members", 0);
+        const string cat = dir + "/cat", out = dir + "/out";
+        mkdir(out.c_str(), 0700);
+        reader.extractTo(out, {}, pool);
+        for (unsigned i=0; i<4; i++) {
+            const ArchiveMember* m = reader.find(prefix + names[i]);
+            if (!m || m->type != ArchiveMember::FILE || m->size != cuts[i+1] - cuts[i])
+                fail(fc, string("archive list: ") + names[i], 0);
+            int fd = open(cat.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+            reader.extract(*m, fd, &pool);
+            close(fd);
+            vector<uint8_t> got = readFile(cat), extracted = readFile(out + "/" + prefix + names[i]);
+            if (got.size() != m->size || extracted.size() != m->size)
+                fail(fc, string("archive cat / extract size: ") + names[i], 0);
+            compare(fc, string("archive cat: ") + names[i], fc.msg.data() + cuts[i], got.data(), got.size());
+            compare(fc, string("archive extract: ") + names[i], fc.msg.data() + cuts[i], extracted.data(), extracted.size());
+        }
+
+        const vector<uint8_t> raw = readFile(path);
+        const string bad = dir + "/bad.sarc";
+        auto rejects = [&](const vector<uint8_t>& archive, const ArchiveMember* member) {
+            writeFile(bad, archive.data(), archive.size());
+            try {
+                ArchiveReader tampered(bad, ctx);
+                int fd = open(cat.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+                for (auto& m : tampered.members())
+                    if (!member || m.name == member->name)
+                        tampered.extract(m, fd, &pool);
+                close(fd);
+            } catch (runtime_error&) {
+                return true;
+            }
+            return false;
+        };
+
+        const ArchiveMember* m = reader.find(prefix + names[r() % 4]);
+        vector<uint8_t> modified = raw;
+        size_t pos = m->offset + r() % archiveSealedSize(m->size, header.segment_size);
+        modified[pos] ^= 1 << (r() % 8);
+        if (!rejects(modified, m))
+            fail(fc, "archive accepted a modified member", pos);
+
+        const uint64_t index_offset = getLE(&raw[raw.size() - ARCHIVE_TRAILER_LEN], 8);
+        modified = raw;
+        pos = index_offset + r() % (raw.size() - index_offset);
+        modified[pos] ^= 1 << (r() % 8);
+        if (!rejects(modified, nullptr))
+            fail(fc, "archive accepted a modified index", pos);
+
+        modified.assign(raw.begin(), raw.begin() + r() % raw.size());
+        if (!rejects(modified, nullptr))
+            fail(fc, "archive accepted a truncated file", modified.size());
+        removeTree(dir);
+    }
+
+    // C interface: chunks as one scatter/gather batch after seek(), every chunk a stream of its own
+    if (fc.start_block < (1ull << 58)) {
+        snuffle_stream* s;
+        if (snuffle_new(&s, fc.chacha ? SNUFFLE_CHACHA20 : SNUFFLE_SALSA20, fc.key.data(), fc.key.size(), fc.nonce) != SNUFFLE_OK)
+            fail(fc, "snuffle_new()", 0);
+
+        vector<const uint8_t*> ins;
+        vector<uint8_t*> outs;
+        vector<size_t> lens;
+        for (size_t done=0, n; done < len; done += n) {
+            n = chunker.next(len - done);
+            ins.push_back(in + done);
+            outs.push_back(out + done);
+            lens.push_back(n);
+        }
+        snuffle_seek(s, fc.start_block*64);
+        if (snuffle_xor_buffers(s, ins.data(), outs.data(), lens.data(), lens.size()) != SNUFFLE_OK)
+            fail(fc, "snuffle_xor_buffers()", 0);
+        compare(fc, "snuffle_xor_buffers()", expected.data(), out, len);
+
+        vector<snuffle_stream*> streams(lens.size());
+        for (size_t i=0, off=0; i<lens.size(); off += lens[i++]) {
+            snuffle_new(&streams[i], fc.chacha ? SNUFFLE_CHACHA20 : SNUFFLE_SALSA20, fc.key.data(), fc.key.size(), fc.nonce);
+            snuffle_seek(streams[i], fc.start_block*64 + off);
+        }
+        memset(out, 0, len);
+        if (snuffle_xor_streams(streams.data(), ins.data(), outs.data(), lens.data(), lens.size()) != SNUFFLE_OK)
+            fail(fc, "snuffle_xor_streams()", 0);
+        compare(fc, "snuffle_xor_streams()", expected.data(), out, len);
+
+        // one stream repeated over the whole batch has to continue like scatter/gather
+        vector<snuffle_stream*> same(lens.size(), s);
+        snuffle_seek(s, fc.start_block*64);
+        memset(out, 0, len);
+        if (snuffle_xor_streams(same.data(), ins.data(), outs.data(), lens.data(), lens.size()) != SNUFFLE_OK)
+            fail(fc, "snuffle_xor_streams() repeated stream", 0);
+        compare(fc, "snuffle_xor_streams() repeated stream", expected.data(), out, len);
+
+        // every chunk a message with a nonce of its own, against snuffle_xor() from the start
+        vector<uint8_t> nonces(8 * lens.size());
+        for (size_t i=0; i<lens.size(); i++) {
+            memcpy(&nonces[8*i], fc.nonce, 8);
+            nonces[8*i] ^= i;
+            nonces[8*i + 1] ^= i >> 8;
+        }
+        if (snuffle_xor_messages(s, nonces.data(), ins.data(), outs.data(), lens.data(), lens.size()) != SNUFFLE_OK)
+            fail(fc, "snuffle_xor_messages()", 0);
+        for (size_t i=0, off=0; i<lens.size(); off += lens[i++]) {
+            vector<uint8_t> message(lens[i]);
+            snuffle_set_nonce(streams[i], &nonces[8*i]);
+            snuffle_xor(streams[i], in + off, message.data(), lens[i]);
+            compare(fc, "snuffle_xor_messages()", message.data(), out + off, lens[i]);
+        }
+
+        for (auto st : streams) snuffle_free(st);
+        snuffle_free(s);
+    }
+}
+
+static void scenarioFailed(const string& scenario, const string& what) {
+    cerr << "FAILED scenario " << scenario << ": " << what << endl;
+    abort();
+}
+
+static vector<uint8_t> fromHex(const string& hex) {
+    vector<uint8_t> bytes(hex.size() / 2);
+    for (size_t i=0; i<bytes.size(); i++)
+        bytes[i] = stoul(hex.substr(2*i, 2), nullptr, 16);
+    return bytes;
+}
+
+//  input of the RFC 7693 self test (Appendix E)
+static void blake2sSelftestSeq(uint8_t* out, size_t len, uint32_t seed) {
+    uint32_t a = 0xDEAD4BAD * seed, b = 1;
+    for (size_t i=0; i<len; i++) {
+        uint32_t t = a + b;
+        a = b;
+        b = t;
+        out[i] = t >> 24;
+    }
+}
+
+/*  Known answers for the hashes behind Merkle tags, dedup chunk ids and recipe MACs: BLAKE2s from
+    RFC 7693 (Appendix B, and the Appendix E self test over output lengths, input lengths and keys),
+    BLAKE3 from the official test vectors (input byte i = i % 251) for the plain hash, keyed hash
+    and key derivation, at lengths around one chunk (1 KiB) and one lane batch (8 chunks) */
+static void scenarioBlakeVectors() {
+    const string name = "BLAKE2s/BLAKE3 test vectors";
+
+    uint8_t md[32];
+    blake2s(md, 32, (const uint8_t*) "abc", 3);
+    if (toHex(md, 32) != "508c5e8c327c14e2e1a72ba34eeb452f37458b209ed63a294d999b4c86675982")
+        scenarioFailed(name, "BLAKE2s(\"abc\")");
+
+    Blake2s grand(32);
+    uint8_t in[1024], key[32];
+    for (size_t out_len : {16, 20, 28, 32}) {
+        for (size_t in_len : {0, 3, 64, 65, 255, 1024}) {
+            blake2sSelftestSeq(in, in_len, in_len);
+            blake2s(md, out_len, in, in_len);
+            grand.update(md, out_len);
+            blake2sSelftestSeq(key, out_len, out_len);
+            blake2s(md, out_len, in, in_len, key, out_len);
+            grand.update(md, out_len);
+        }
+    }
+    grand.final(md);
+    if (toHex(md, 32) != "6a411f08ce25adcdfb02aba641451cec53c598b24f4fc787fbdc88797f4c1dfe")
+        scenarioFailed(name, "BLAKE2s self test of RFC 7693 Appendix E");
+
+    // first 32 bytes of the official outputs: hash, keyed hash, derive key
+    static const struct { size_t len; const char* hash; const char* keyed; const char* derived; } vectors[] = {
+        {0,      "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262",
+                 "92b2b75604ed3c761f9d6f62392c8a9227ad0ea3f09573e783f1498a4ed60d26",
+                 "2cc39783c223154fea8dfb7c1b1660f2ac2dcbd1c1de8277b0b0dd39b7e50d7d"},
+        {1,      "2d3adedff11b61f14c886e35afa036736dcd87a74d27b5c1510225d0f592e213",
+                 "6d7878dfff2f485635d39013278ae14f1454b8c0a3a2d34bc1ab38228a80c95b",
+                 "b3e2e340a117a499c6cf2398a19ee0d29cca2bb7404c73063382693bf66cb06c"},
+        {1023,   "10108970eeda3eb932baac1428c7a2163b0e924c9a9e25b35bba72b28f70bd11",
+                 "c951ecdf03288d0fcc96ee3413563d8a6d3589547f2c2fb36d9786470f1b9d6e",
+                 "74a16c1c3d44368a86e1ca6df64be6a2f64cce8f09220787450722d85725dea5"},
+        {1024,   "42214739f095a406f3fc83deb889744ac00df831c10daa55189b5d121c855af7",
+                 "75c46f6f3d9eb4f55ecaaee480db732e6c2105546f1e675003687c31719c7ba4",
+                 "7356cd7720d5b66b6d0697eb3177d9f8d73a4a5c5e968896eb6a689684302706"},
+        {1025,   "d00278ae47eb27b34faecf67b4fe263f82d5412916c1ffd97c8cb7fb814b8444",
+                 "357dc55de0c7e382c900fd6e320acc04146be01db6a8ce7210b7189bd664ea69",
+                 "effaa245f065fbf82ac186839a249707c3bddf6d3fdda22d1b95a3c970379bcb"},
+        {2048,   "e776b6028c7cd22a4d0ba182a8bf62205d2ef576467e838ed6f2529b85fba24a",
+                 "879cf1fa2ea0e79126cb1063617a05b6ad9d0b696d0d757cf053439f60a99dd1",
+                 "7b2945cb4fef70885cc5d78a87bf6f6207dd901ff239201351ffac04e1088a23"},
+        {2049,   "5f4d72f40d7a5f82b15ca2b2e44b1de3c2ef86c426c95c1af0b6879522563030",
+                 "9f29700902f7c86e514ddc4df1e3049f258b2472b6dd5267f61bf13983b78dd5",
+                 "2ea477c5515cc3dd606512ee72bb3e0e758cfae7232826f35fb98ca1bcbdf273"},
+        {3073,   "7124b49501012f81cc7f11ca069ec9226cecb8a2c850cfe644e327d22d3e1cd3",
+                 "68dede9bef00ba89e43f31a6825f4cf433389fedae75c04ee9f0cf16a427c95a",
+                 "72613c9ec9ff7e40f8f5c173784c532ad852e827dba2bf85b2ab4b76f7079081"},
+        {4096,   "015094013f57a5277b59d8475c0501042c0b642e531b0a1c8f58d2163229e969",
+                 "befc660aea2f1718884cd8deb9902811d332f4fc4a38cf7c7300d597a081bfc0",
+                 "1e0d7f3db8c414c97c6307cbda6cd27ac3b030949da8e23be1a1a924ad2f25b9"},
+        {8192,   "aae792484c8efe4f19e2ca7d371d8c467ffb10748d8a5a1ae579948f718a2a63",
+                 "dc9637c8845a770b4cbf76b8daec0eebf7dc2eac11498517f08d44c8fc00d58a",
+                 "ad01d7ae4ad059b0d33baa3c01319dcf8088094d0359e5fd45d6aeaa8b2d0c3d"},
+        {8193,   "bab6c09cb8ce8cf459261398d2e7aef35700bf488116ceb94a36d0f5f1b7bc3b",
+                 "954a2a75420c8d6547e3ba5b98d963e6fa6491addc8c023189cc519821b4a1f5",
+                 "af1e0346e389b17c23200270a64aa4e1ead98c61695d917de7d5b00491c9b0f1"},
+        {16384,  "f875d6646de28985646f34ee13be9a576fd515f76b5b0a26bb324735041ddde4",
+                 "9e9fc4eb7cf081ea7c47d1807790ed211bfec56aa25bb7037784c13c4b707b0d",
+                 "160e18b5878cd0df1c3af85eb25a0db5344d43a6fbd7a8ef4ed98d0714c3f7e1"},
+        {31744,  "62b6960e1a44bcc1eb1a611a8d6235b6b4b78f32e7abc4fb4c6cdcce94895c47",
+                 "efa53b389ab67c593dba624d898d0f7353ab99e4ac9d42302ee64cbf9939a419",
+                 "39772aef80e0ebe60596361e45b061e8f417429d529171b6764468c22928e28e"},
+        {102400, "bc3e3d41a1146b069abffad3c0d44860cf664390afce4d9661f7902e7943e085",
+                 "1c35d1a5811083fd7119f5d5d1ba027b4d01c0c6c49fb6ff2cf75393ea5db4a7",
+                 "4652cff7a3f385a6103b5c260fc1593e13c778dbe608efb092fe7ee69df6e9c6"},
+    };
+    const uint8_t* blake3_key = (const uint8_t*) "whats the Elvish word for friend";
+    const string context = "BLAKE3 2019-12-27 16:29:52 test vectors context";
+    vector<uint8_t> input(1 << 20);
+    for (size_t i=0; i<input.size(); i++)
+        input[i] = i % 251;
+
+    for (auto& v : vectors) {
+        blake3(md, 32, input.data(), v.len);
+        if (toHex(md, 32) != v.hash)
+            scenarioFailed(name, "BLAKE3 hash of " + to_string(v.len) + " bytes");
+        blake3(md, 32, input.data(), v.len, blake3_key);
+        if (toHex(md, 32) != v.keyed)
+            scenarioFailed(name, "BLAKE3 keyed hash of " + to_string(v.len) + " bytes");
+        blake3DeriveKey(md, 32, context, input.data(), v.len);
+        if (toHex(md, 32) != v.derived)
+            scenarioFailed(name, "BLAKE3 derive key of " + to_string(v.len) + " bytes");
+    }
+
+    // the whole 131 byte outputs of the vectors for 1025 bytes, extended output over three blocks
+    vector<uint8_t> xof(131);
+    blake3(xof.data(), xof.size(), input.data(), 1025);
+    if (xof != fromHex("d00278ae47eb27b34faecf67b4fe263f82d5412916c1ffd97c8cb7fb814b8444f4c4a22b4b399155358a994e52bf255d"
+                       "e60035742ec71bd08ac275a1b51cc6bfe332b0ef84b409108cda080e6269ed4b3e2c3f7d722aa4cdc98d16deb554e562"
+                       "7be8f955c98e1d5f9565a9194cad0c4285f93700062d9595adb992ae68ff12800ab67a"))
+        scenarioFailed(name, "BLAKE3 extended output of 1025 bytes");
+    blake3(xof.data(), xof.size(), input.data(), 1025, blake3_key);
+    if (xof != fromHex("357dc55de0c7e382c900fd6e320acc04146be01db6a8ce7210b7189bd664ea69362396b77fdc0d2634a552970843722"
+                       "066c3c15902ae5097e00ff53f1e116f1cd5352720113a837ab2452cafbde4d54085d9cf5d21ca613071551b25d52e69d"
+                       "6c81123872b6f19cd3bc1333edf0c52b94de23ba772cf82636cff4542540a7738d5b930"))
+        scenarioFailed(name, "BLAKE3 keyed extended output of 1025 bytes");
+    blake3DeriveKey(xof.data(), xof.size(), context, input.data(), 1025);
+    if (xof != fromHex("effaa245f065fbf82ac186839a249707c3bddf6d3fdda22d1b95a3c970379bcb5d31013a167509e9066273ab6e2123b"
+                       "c835b408b067d88f96addb550d96b6852dad38e320b9d940f86db74d398c770f462118b35d2724efa13da97194491d96d"
+                       "d37c3c09cbef665953f2ee85ec83d88b88d11547a6f911c8217cca46defa2751e7f3ad"))
+        scenarioFailed(name, "BLAKE3 derive key extended output of 1025 bytes");
+
+    // inputs large enough to be split over a pool have to hash the same as on one thread
+    WorkerPool pool(3);
+    uint8_t single[32];
+    blake3(single, 32, input.data(), input.size());
+    blake3(md, 32, input.data(), input.size(), nullptr, &pool);
+    if (memcmp(md, single, 32) != 0)
+        scenarioFailed(name, "BLAKE3 of 1 MiB on a pool");
+}
+
+//  RFC 8439: the example of section 2.5.2 and the test vectors of Appendix A.3, one-shot and incremental
+static void scenarioPoly1305Vectors(uint64_t seed) {
+    const string name = "Poly1305 test vectors";
+    mt19937_64 rng(seed);
+    const string ietf = "Any submission to the IETF intended by the Contributor for publication as all or part of an "
+                        "IETF Internet-Draft or RFC and any statement made within the context of an IETF activity is "
+                        "considered an \"IETF Contribution\". Such statements include oral statements in IETF sessions, "
+                        "as well as written and electronic communications made at any time or place, which are addressed to";
+    const string jabberwocky = "'Twas brillig, and the slithy toves\nDid gyre and gimble in the wabe:\n"
+                               "All mimsy were the borogoves,\nAnd the mome raths outgrabe.";
+    const string zeros32(64, '0');
+
+    // key, message (hex unless text), tag
+    static const struct { string key; string msg; bool text; string tag; } vectors[] = {
+        {"85d6be7857556d337f4452fe42d506a80103808afb0db2fd4abff6af4149f51b", "Cryptographic Forum Research Group", true,
+         "a8061dc1305136c6c22b8baf0c0127a9"},
+        {zeros32, string(128, '0'), false, "00000000000000000000000000000000"},
+        {"0000000000000000000000000000000036e5f6b5c5e06070f0efca96227a863e", ietf, true, "36e5f6b5c5e06070f0efca96227a863e"},
+        {"36e5f6b5c5e06070f0efca96227a863e00000000000000000000000000000000", ietf, true, "f3477e7cd95417af89a6b8794c310cf0"},
+        {"1c9240a5eb55d38af333888604f6b5f0473917c1402b80099dca5cbc207075c0", jabberwocky, true,
+         "4541669a7eaaee61e708dc7cbcc5eb62"},
+        {"02" + zeros32.substr(2), "ffffffffffffffffffffffffffffffff", false, "03000000000000000000000000000000"},
+        {"02000000000000000000000000000000ffffffffffffffffffffffffffffffff", "02000000000000000000000000000000", false,
+         "03000000000000000000000000000000"},
+        {"01" + zeros32.substr(2), "ffffffffffffffffffffffffffffffff" "f0ffffffffffffffffffffffffffffff"
+                                   "11000000000000000000000000000000", false, "05000000000000000000000000000000"},
+        {"01" + zeros32.substr(2), "ffffffffffffffffffffffffffffffff" "fbfefefefefefefefefefefefefefefe"
+                                   "01010101010101010101010101010101", false, "00000000000000000000000000000000"},
+        {"02" + zeros32.substr(2), "fdffffffffffffffffffffffffffffff", false, "faffffffffffffffffffffffffffffff"},
+        {"01000000000000000400000000000000" + zeros32.substr(32),
+         "e33594d7505e43b900000000000000003394d7505e4379cd0100000000000000"
+         "0000000000000000000000000000000001000000000000000000000000000000", false, "14000000000000005500000000000000"},
+        {"01000000000000000400000000000000" + zeros32.substr(32),
+         "e33594d7505e43b900000000000000003394d7505e4379cd010000000000000000000000000000000000000000000000", false,
+         "13000000000000000000000000000000"},
+    };
+
+    for (size_t i=0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+        const auto& v = vectors[i];
+        const vector<uint8_t> key = fromHex(v.key);
+        const vector<uint8_t> msg = v.text ? vector<uint8_t>(v.msg.begin(), v.msg.end()) : fromHex(v.msg);
+        uint8_t tag[16];
+        poly1305(tag, key.data(), msg.data(), msg.size());
+        if (toHex(tag, 16) != v.tag)
+            scenarioFailed(name, "vector " + to_string(i) + ": tag " + toHex(tag, 16) + ", expected " + v.tag);
+
+        Poly1305 mac(key.data());
+        for (size_t pos=0; pos < msg.size();) {
+            size_t n = min<size_t>(msg.size() - pos, rng() % 40);
+            mac.update(msg.data() + pos, n);
+            pos += n;
+        }
+        mac.final(tag);
+        if (toHex(tag, 16) != v.tag)
+            scenarioFailed(name, "vector " + to_string(i) + " fed in pieces: tag " + toHex(tag, 16));
+    }
+}
+
+/*  Readers grab the current object and check it in a read section while a rotator replaces and
+    retires objects as fast as it can. Retired objects are only marked dead and kept until the end,
+    so a reader seeing one that was reclaimed under it is caught without a sanitizer */
+struct EpochObject {
+    uint64_t value;
+    atomic<bool> dead{false};
+};
+
+static mutex epoch_graveyard_mutex;
+static vector<EpochObject*> epoch_graveyard;
+
+static void buryEpochObject(void* p) {
+    EpochObject* object = static_cast<EpochObject*>(p);
+    object->dead.store(true, memory_order_relaxed);
+    lock_guard<mutex> lock(epoch_graveyard_mutex);
+    epoch_graveyard.push_back(object);
+}
+
+static void scenarioEpochDomain(bool membarrier, double seconds) {
+    const string name = string("EpochDomain ") + (membarrier ? "with" : "without") + " membarrier";
+    const unsigned nr_readers = 3;
+    EpochDomain domain(8, membarrier);
+    if (!membarrier && domain.usesMembarrier())
+        scenarioFailed(name, "membarrier used although disabled");
+
+    atomic<EpochObject*> current{new EpochObject{0}};
+    atomic<bool> stop{false};
+    atomic<uint64_t> nr_reads{0};
+    vector<thread> readers;
+    for (unsigned t=0; t<nr_readers; t++) {
+        readers.emplace_back([&] {
+            EpochDomain::Reader reader = domain.registerReader();
+            uint64_t last = 0;
+            while (!stop.load(memory_order_relaxed)) {
+                EpochDomain::Section section(reader);
+                EpochObject* object = current.load(memory_order_acquire);
+                if (object->dead.load(memory_order_relaxed))
+                    scenarioFailed(name, "reader got a reclaimed object");
+                if (object->value < last)
+                    scenarioFailed(name, "reader went back to an older object");
+                last = object->value;
+                for (volatile unsigned spin=0; spin < 64; spin++) {}
+                if (object->dead.load(memory_order_relaxed))
+                    scenarioFailed(name, "object reclaimed while a reader was in its section");
+                nr_reads.fetch_add(1, memory_order_relaxed);
+            }
+        });
+    }
+
+    auto start = chrono::steady_clock::now();
+    uint64_t value = 0;
+    while (chrono::duration<double>(chrono::steady_clock::now() - start).count() < seconds
+           || (nr_reads.load() < 1000 && value < 10000000)) {
+        EpochObject* old = current.exchange(new EpochObject{++value}, memory_order_acq_rel);
+        domain.retire(old, buryEpochObject);
+        if (value % 1000 == 0)
+            domain.reclaim();
+        if (value % 64 == 0)
+            this_thread::yield();
+    }
+    stop = true;
+    for (auto& t : readers)
+        t.join();
+
+    // no reader left, everything retired has to go now
+    if (domain.reclaim() != 0 || domain.pending() != 0)
+        scenarioFailed(name, to_string(domain.pending()) + " objects still pending after the readers left");
+    {
+        lock_guard<mutex> lock(epoch_graveyard_mutex);
+        if (epoch_graveyard.size() != value)
+            scenarioFailed(name, "reclaimed " + to_string(epoch_graveyard.size()) + " of " + to_string(value) + " objects");
+        for (EpochObject* object : epoch_graveyard)
+            delete object;
+        epoch_graveyard.clear();
+    }
+    delete current.load();
+
+    // RcuKeyTable on top: versions only move forward and always come with their own context
+    SnuffleKeyContext ctx;
+    uint8_t key[32] = {0};
+    snuffleInitKey(ctx, SnuffleVariant::Chacha20, key, sizeof(key));
+    RcuKeyTable table(4, ctx, 8, membarrier);
+    stop = false;
+    readers.clear();
+    for (unsigned t=0; t<nr_readers; t++) {
+        readers.emplace_back([&] {
+            EpochDomain::Reader reader = table.registerReader();
+            uint32_t last[4] = {0};
+            for (uint64_t i=0; !stop.load(memory_order_relaxed); i++) {
+                EpochDomain::Section section(reader);
+                const RcuKeyTable::KeyVersion* kv = table.get(i % 4);
+                if (kv->version < last[i % 4] || kv->ctx.matrix[4] != kv->version)
+                    scenarioFailed(name, "RcuKeyTable reader got a stale or torn key version");
+                last[i % 4] = kv->version;
+            }
+        });
+    }
+    start = chrono::steady_clock::now();
+    for (uint32_t v=1; chrono::duration<double>(chrono::steady_clock::now() - start).count() < seconds / 2; v++) {
+        SnuffleKeyContext next = ctx;
+        for (size_t i=0; i<4; i++) {
+            next.matrix[4] = v;
+            if (table.rotate(i, next) != v)
+                scenarioFailed(name, "RcuKeyTable rotate() returned the wrong version");
+        }
+    }
+    stop = true;
+    for (auto& t : readers)
+        t.join();
+    if (table.domain().reclaim() != 0)
+        scenarioFailed(name, "RcuKeyTable versions still pending after the readers left");
+}
+
+/*  Log records of random sizes from several producers into small buffers (so they keep running
+    full while the writer is in a commit), checked through the offsets append() returns: the
+    plaintext image has every record at its place, the file has to decrypt to exactly that.
+    Then the last record is torn, the log reopened and appended to */
+static void scenarioEncryptedLog(uint64_t seed) {
+    const string name = "EncryptedLog";
+    const string path = tempDir() + "/log";
+    mt19937_64 rng(seed);
+
+    vector<uint8_t> key(32);
+    for (auto& b : key) b = rng();
+    const uint8_t nonce[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+    Chacha20 cipher(key);
+    const SnuffleKeyContext ctx = cipher.keyContext();
+
+    mutex image_mutex;
+    vector<uint8_t> image;      // plaintext of the log
+    vector<uint64_t> starts;    // of all records in the image
+    auto record = [](uint64_t id, mt19937_64& r) {
+        vector<uint8_t> data(r() % 300);
+        for (auto& b : data) b = id + r();
+        return data;
+    };
+    auto place = [&](uint64_t end, const vector<uint8_t>& data) {
+        lock_guard<mutex> lock(image_mutex);
+        const uint64_t start = end - 4 - data.size();
+        if (image.size() < end)
+            image.resize(end);
+        for (unsigned i=0; i<4; i++)
+            image[start + i] = data.size() >> (8*i);
+        copy(data.begin(), data.end(), image.begin() + start + 4);
+        starts.push_back(start);
+    };
+    auto checkFile = [&](const string& when) {
+        vector<uint8_t> raw(fileSize(path));
+        FILE* f = fopen(path.c_str(), "rb");
+        if (!f || raw.size() != image.size() || fread(raw.data(), 1, raw.size(), f) != raw.size())
+            scenarioFailed(name, when + ": log has " + to_string(raw.size()) + " bytes, expected " + to_string(image.size()));
+        fclose(f);
+        cipher.setNonce("0102030405060708");
+        cipher.encryptBytes(raw);
+        if (raw != image)
+            scenarioFailed(name, when + ": log doesn't decrypt to the appended records");
+
+        sort(starts.begin(), starts.end());
+        size_t nr = 0;
+        uint64_t end = forEachLogRecord(path, ctx, nonce, [&](uint64_t offset, const uint8_t* data, size_t len) {
+            if (nr >= starts.size() || offset != starts[nr] || memcmp(data, &image[offset + 4], len) != 0)
+                scenarioFailed(name, when + ": forEachLogRecord() record " + to_string(nr) + " differs");
+            nr++;
+        });
+        if (nr != starts.size() || end != image.size())
+            scenarioFailed(name, when + ": forEachLogRecord() found " + to_string(nr) + " of " + to_string(starts.size()) + " records");
+    };
+    unlink(path.c_str());
+
+    // one producer: flush() makes everything appended before it durable, waitDurable() after it returns at once
+    {
+        EncryptedLogWriter log(path, ctx, nonce, chrono::seconds(10), 1024);
+        for (uint64_t i=0; i<200; i++) {
+            vector<uint8_t> data = record(i, rng);
+            uint64_t end = log.append(data.data(), data.size());
+            place(end, data);
+            if (rng() % 16 == 0) {
+                uint64_t commits = log.commits();
+                log.flush();
+                if (log.durableOffset() < end || log.commits() <= commits)
+                    scenarioFailed(name, "flush() returned before the appends ahead of it were committed");
+                log.waitDurable(end);
+            }
+        }
+    }
+    checkFile("after flushes");
+
+    // producers against full buffers, every one waits for some of its records
+    {
+        EncryptedLogWriter log(path, ctx, nonce, chrono::microseconds(200), 512);
+        if (log.durableOffset() != image.size())
+            scenarioFailed(name, "reopened log doesn't continue at its end");
+        vector<thread> producers;
+        for (unsigned t=0; t<4; t++) {
+            producers.emplace_back([&, t, thread_seed = rng()] {
+                mt19937_64 r(thread_seed);
+                for (uint64_t i=0; i<300; i++) {
+                    vector<uint8_t> data = record(t << 16 | i, r);
+                    data.resize(min<size_t>(data.size(), 200));
+                    uint64_t end = log.append(data.data(), data.size());
+                    place(end, data);
+                    if (i % 50 == 49) {
+                        log.waitDurable(end);
+                        if (log.durableOffset() < end)
+                            scenarioFailed(name, "waitDurable() returned early");
+                    }
+                }
+            });
+        }
+        for (auto& t : producers)
+            t.join();
+        log.flush();
+        if (log.durableOffset() != image.size())
+            scenarioFailed(name, "flush() didn't commit everything");
+    }
+    checkFile("after concurrent appends");
+
+    /*  crash in the middle of the last record, first in its length, then anywhere: reopening
+        leaves the torn bytes alone and goes on behind them. File offset and keystream offset
+        are the same, so as long as no byte that was written once changes and the file only
+        grows, no keystream offset is used twice */
+    for (unsigned round=0; round<2; round++) {
+        sort(starts.begin(), starts.end());
+        const uint64_t last = starts.back();
+        const uint64_t torn = last + 1 + rng() % min<uint64_t>(round ? image.size() - last - 1 : 3, image.size() - last - 1);
+        if (truncate(path.c_str(), torn) != 0)
+            scenarioFailed(name, "could not truncate the log");
+        const vector<uint8_t> before = readFile(path);
+        if (forEachLogRecord(path, ctx, nonce, nullptr) != last)
+            scenarioFailed(name, "forEachLogRecord() didn't stop in front of the torn record");
+        starts.pop_back();
+        {
+            EncryptedLogWriter log(path, ctx, nonce, chrono::milliseconds(1), 4096);
+            const vector<uint8_t> reopened = readFile(path);
+            if (log.durableOffset() != reopened.size() || reopened.size() < torn + 4
+                || !equal(before.begin(), before.end(), reopened.begin()))
+                scenarioFailed(name, "reopening changed the torn record instead of going on behind it");
+
+            // the padding is what the writer chose, everything else has to be as appended
+            vector<uint8_t> padding(reopened.begin() + torn, reopened.end());
+            cipher.setNonce("0102030405060708");
+            cipher.seek(torn);
+            cipher.encryptBytes(padding);
+            image.resize(torn);
+            image.insert(image.end(), padding.begin(), padding.end());
+
+            for (uint64_t i=0; i<20; i++) {
+                vector<uint8_t> data = record(1u << 31 | round << 16 | i, rng);
+                place(log.append(data.data(), data.size()), data);
+            }
+        }
+        const vector<uint8_t> after = readFile(path);
+        if (!equal(before.begin(), before.end(), after.begin()))
+            scenarioFailed(name, "appending after a torn record rewrote bytes of the log");
+        checkFile("after reopening a torn log");
+    }
+    unlink(path.c_str());
+}
+
+/*  Zerocopy completions starting just below the id wraparound: ranges reported out of order,
+    twice, or for ids never sent, have to release every send exactly once */
+static void scenarioZerocopyIds(uint64_t seed) {
+    const string name = "ZerocopyQueue";
+    mt19937_64 rng(seed);
+    const uint32_t first = UINT32_MAX - 20;
+    const unsigned nr_sends = 50, nr_buffers = 3;
+
+    ZerocopyQueue queue(first);
+    vector<unsigned> refs(nr_buffers, 0), expected(nr_buffers, 0), buffer_of(nr_sends);
+    for (unsigned i=0; i<nr_sends; i++) {
+        buffer_of[i] = rng() % nr_buffers;
+        queue.push(buffer_of[i]);
+        refs[buffer_of[i]]++;
+    }
+    expected = refs;
+
+    // a random partition of the ids into ranges, completed in random order
+    vector<pair<unsigned, unsigned>> ranges;
+    for (unsigned pos=0; pos < nr_sends;) {
+        unsigned n = min<unsigned>(nr_sends - pos, rng() % 6 + 1);
+        ranges.push_back({pos, pos + n - 1});
+        pos += n;
+    }
+    shuffle(ranges.begin(), ranges.end(), rng);
+    vector<bool> done(nr_sends, false);
+    for (auto& range : ranges) {
+        if (queue.complete(first + range.first, first + range.second, refs) != range.second - range.first + 1)
+            scenarioFailed(name, "wrong id count of a completion");
+        for (unsigned i=range.first; i<=range.second; i++) {
+            done[i] = true;
+            expected[buffer_of[i]]--;
+        }
+        queue.complete(first + range.first, first + range.second, refs);   // reported again
+        queue.complete(first + nr_sends, first + nr_sends + 3, refs);      // not sent yet
+        if (refs != expected)
+            scenarioFailed(name, "buffer references wrong after a completion");
+        unsigned front = 0;
+        while (front < nr_sends && done[front])
+            front++;
+        if (queue.firstId() != (uint32_t) (first + front) || queue.size() != nr_sends - front)
+            scenarioFailed(name, "queue front wrong after a completion");
+    }
+    if (!queue.empty() || queue.firstId() != (uint32_t) (first + nr_sends))
+        scenarioFailed(name, "sends left in flight after all completions");
+}
+
+// random sizes around the 16 KiB buffers, now and then a flush
+static void writeSocketChunks(EncryptedSocket& socket, const vector<uint8_t>& data, uint64_t seed) {
+    mt19937_64 rng(seed);
+    for (size_t pos=0, n; pos < data.size(); pos += n) {
+        n = min<size_t>(data.size() - pos, rng() % 2 ? rng() % 64 + 1 : rng() % 70000 + 1);
+        socket.write(data.data() + pos, n);
+        if (rng() % 8 == 0)
+            socket.flush();
+    }
+    socket.drain();
+}
+
+/*  EncryptedSocket with three 16 KiB buffers against encryptBytes(): over loopback TCP the
+    bytes on the wire (sends of 16 KiB go zerocopy where the kernel has it), over a socketpair
+    both directions at once through recv() */
+static void scenarioEncryptedSocket(uint64_t seed) {
+    const string name = "EncryptedSocket";
+    mt19937_64 rng(seed);
+    vector<uint8_t> key(32);
+    for (auto& b : key) b = rng();
+    const uint8_t nonce_a[8] = {1, 2, 3, 4, 5, 6, 7, 8}, nonce_b[8] = {8, 7, 6, 5, 4, 3, 2, 1};
+    Chacha20 cipher(key);
+    const SnuffleKeyContext ctx = cipher.keyContext();
+    vector<uint8_t> data_a(3 << 20), data_b(1 << 20);
+    for (auto& b : data_a) b = rng();
+    for (auto& b : data_b) b = rng();
+
+    // loopback: raw bytes against encryptBytes()
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addr_len = sizeof(addr);
+    int client = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener < 0 || client < 0 || bind(listener, (struct sockaddr*) &addr, sizeof(addr)) != 0 || listen(listener, 1) != 0
+        || getsockname(listener, (struct sockaddr*) &addr, &addr_len) != 0
+        || connect(client, (struct sockaddr*) &addr, sizeof(addr)) != 0)
+        scenarioFailed(name, string("no loopback connection: ") + strerror(errno));
+    int server = accept(listener, nullptr, nullptr);
+    close(listener);
+
+    vector<uint8_t> wire(data_a.size());
+    {
+        EncryptedSocket sender(client, ctx, nonce_a, nonce_b, 16 * 1024, 3);
+        const bool zerocopy = sender.zerocopy();
+        thread writer([&, s = rng()] { writeSocketChunks(sender, data_a, s); });
+        for (size_t done=0; done < wire.size();) {
+            ssize_t n = recv(server, wire.data() + done, min<size_t>(wire.size() - done, rng() % 50000 + 1), 0);
+            if (n <= 0)
+                scenarioFailed(name, "loopback connection ended early");
+            done += n;
+        }
+        writer.join();
+        if (zerocopy && sender.zerocopySends() == 0)
+            scenarioFailed(name, "no zerocopy sends although the socket has zerocopy");
+        if (sender.bytesSent() != data_a.size())
+            scenarioFailed(name, "bytesSent() wrong");
+    }
+    close(client);
+    close(server);
+    vector<uint8_t> expected(data_a.size());
+    cipher.setNonce("0102030405060708");
+    cipher.encryptBytes(data_a.data(), expected.data(), data_a.size());
+    if (wire != expected)
+        scenarioFailed(name, "bytes on the wire differ from encryptBytes()");
+
+    // socketpair: both directions, decrypted by the peer
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+        scenarioFailed(name, "no socketpair");
+    {
+        EncryptedSocket a(fds[0], ctx, nonce_a, nonce_b, 16 * 1024, 3), b(fds[1], ctx, nonce_b, nonce_a, 16 * 1024, 3);
+        auto receive = [&](EncryptedSocket& socket, size_t len, uint64_t recv_seed) {
+            mt19937_64 r(recv_seed);
+            vector<uint8_t> got(len);
+            for (size_t done=0; done < len;) {
+                size_t n = socket.recv(got.data() + done, min<size_t>(len - done, r() % 30000 + 1));
+                if (n == 0)
+                    scenarioFailed(name, "socketpair ended early");
+                done += n;
+            }
+            return got;
+        };
+        vector<uint8_t> got_a, got_b;
+        thread writer_a([&, s = rng()] { writeSocketChunks(a, data_a, s); });
+        thread writer_b([&, s = rng()] { writeSocketChunks(b, data_b, s); });
+        thread reader_b([&, s = rng()] { got_b = receive(b, data_a.size(), s); });
+        got_a = receive(a, data_b.size(), rng());
+        writer_a.join();
+        writer_b.join();
+        reader_b.join();
+        if (got_b != data_a || got_a != data_b)
+            scenarioFailed(name, "socketpair peer decrypted something else than was written");
+    }
+    close(fds[0]);
+    close(fds[1]);
+}
+
+//  corrupt chunk and file sizes in a merkle index header have to be rejected before anything
+//  is allocated for them; a hang or a bad_alloc here is a failure as much as accepting them
+static void scenarioMerkleHeader(uint64_t seed) {
+    const string name = "MerkleIndex::load";
+    mt19937_64 rng(seed);
+    const string data_path = tempDir() + "/merkle_data", index_path = tempDir() + "/merkle_index";
+
+    vector<uint8_t> data(rng() % 5000), mac_key(32);
+    for (auto& b : data) b = rng();
+    for (auto& b : mac_key) b = rng();
+    writeFile(data_path, data.data(), data.size());
+    int fd = open(data_path.c_str(), O_RDONLY);
+    MerkleIndex::build(fd, 64, mac_key.data(), nullptr).save(index_path);
+    close(fd);
+    const vector<uint8_t> good = readFile(index_path);
+    if (MerkleIndex::load(index_path, mac_key.data()).fileSize() != data.size())
+        scenarioFailed(name, "intact index did not load");
+
+    const uint64_t sizes[][2] = {   // chunk size, file size
+        {1, UINT64_MAX}, {2, UINT64_MAX}, {64, UINT64_MAX}, {UINT32_MAX, UINT64_MAX},
+        {1, 1ull << 40}, {1, data.size()}, {64, data.size() + 64}, {64, data.size() ^ 1},
+        {rng() % 64 + 1, rng()}, {(uint32_t) rng(), rng() >> (rng() % 64)},
+    };
+    for (auto& size : sizes) {
+        vector<uint8_t> index = good;
+        putLE(index.data() + 8, size[0], 4);
+        putLE(index.data() + 12, size[1], 8);
+        if (index == good)
+            continue;
+        writeFile(index_path, index.data(), index.size());
+        try {
+            MerkleIndex::load(index_path, mac_key.data());
+            scenarioFailed(name, "accepted chunk size " + to_string(size[0]) + ", file size " + to_string(size[1]));
+        } catch (const runtime_error&) {
+        } catch (const exception& e) {
+            scenarioFailed(name, string("chunk size ") + to_string(size[0]) + ", file size " + to_string(size[1]) + ": " + e.what());
+        }
+    }
+    unlink(data_path.c_str());
+    unlink(index_path.c_str());
+}
+
+static int loopbackUdpSocket(struct sockaddr_in& addr) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    int rcvbuf = 8 << 20;
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)) != 0)
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    struct timeval timeout = {2, 0};    // a lost datagram fails the scenario instead of hanging it
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addr_len = sizeof(addr);
+    if (fd < 0 || bind(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0
+        || getsockname(fd, (struct sockaddr*) &addr, &addr_len) != 0)
+        scenarioFailed("DatagramRelay", string("no loopback UDP socket: ") + strerror(errno));
+    return fd;
+}
+
+/*  a seal relay into an open relay over loopback, with and without authentication and GSO:
+    datagrams of mixed lengths (empty ones, runs of equal lengths with a shorter one at the end for
+    the GSO messages, some up to MAX_PAYLOAD) have to come out of the open relay unchanged */
+static void scenarioDatagramRelay(uint64_t seed) {
+    const string name = "DatagramRelay";
+    mt19937_64 rng(seed);
+    uint8_t key[32], nonce[8];
+    for (auto& b : key) b = rng();
+    for (auto& b : nonce) b = rng();
+    SnuffleKeyContext ctx;
+    snuffleInitKey(ctx, rng() % 2 ? SnuffleVariant::Chacha20 : SnuffleVariant::Salsa20, key, sizeof(key));
+
+    try {
+        DatagramRelay relay(DatagramCipher(ctx, nonce, true), DatagramRelay::SEAL, -1, -1, DatagramRelay::MAX_PAYLOAD + 1);
+        scenarioFailed(name, "accepted a payload size whose sealed datagrams don't fit into UDP");
+    } catch (const invalid_argument&) {
+    }
+
+    for (int config=0; config<4; config++) {
+        const bool authenticated = config & 1, gso = config & 2;
+        DatagramCipher cipher(ctx, nonce, authenticated);
+        struct sockaddr_in src_addr, seal_in_addr, seal_out_addr, open_in_addr, open_out_addr, sink_addr;
+        int src = loopbackUdpSocket(src_addr), seal_in = loopbackUdpSocket(seal_in_addr);
+        int seal_out = loopbackUdpSocket(seal_out_addr), open_in = loopbackUdpSocket(open_in_addr);
+        int open_out = loopbackUdpSocket(open_out_addr), sink = loopbackUdpSocket(sink_addr);
+        if (connect(src, (struct sockaddr*) &seal_in_addr, sizeof(seal_in_addr)) != 0
+            || connect(seal_out, (struct sockaddr*) &open_in_addr, sizeof(open_in_addr)) != 0
+            || connect(open_out, (struct sockaddr*) &sink_addr, sizeof(sink_addr)) != 0)
+            scenarioFailed(name, string("connect failed: ") + strerror(errno));
+
+        DatagramRelay sealer(cipher, DatagramRelay::SEAL, seal_in, seal_out, DatagramRelay::MAX_PAYLOAD, 64);
+        DatagramRelay opener(cipher, DatagramRelay::OPEN, open_in, open_out, DatagramRelay::MAX_PAYLOAD, 64);
+        sealer.setNextSeq(rng());
+        if (!gso) {
+            sealer.setGso(false);
+            opener.setGso(false);
+        }
+
+        vector<uint8_t> got(DatagramRelay::MAX_PAYLOAD + 1);
+        for (int round=0; round<20; round++) {
+            // runs of one length, now and then ended by a shorter datagram, about 100 KiB a round
+            vector<vector<uint8_t>> sent;
+            size_t bytes = 0;
+            while (sent.size() < 48 && bytes < 100000) {
+                size_t len = rng() % 8 == 0 ? 0 : rng() % 8 == 0 ? rng() % (DatagramRelay::MAX_PAYLOAD + 1)
+                                                                  : rng() % 1500;
+                size_t run = len > 20000 ? 1 : rng() % 12 + 1;
+                for (size_t i=0; i<run; i++)
+                    sent.push_back(vector<uint8_t>(len));
+                if (len && rng() % 2)
+                    sent.push_back(vector<uint8_t>(rng() % len));
+                bytes += (run + 1) * len;
+            }
+            for (auto& datagram : sent) {
+                for (auto& b : datagram) b = rng();
+                if (send(src, datagram.data(), datagram.size(), 0) != (ssize_t) datagram.size())
+                    scenarioFailed(name, string("send failed: ") + strerror(errno));
+            }
+
+            try {
+                const uint64_t sealed = sealer.packetsIn() + sent.size();
+                while (sealer.packetsIn() < sealed)
+                    sealer.pump();
+                while (opener.packetsIn() < sealer.packetsOut())
+                    opener.pump();
+            } catch (const runtime_error& e) {
+                scenarioFailed(name, e.what());
+            }
+            if (sealer.dropped() || opener.dropped())
+                scenarioFailed(name, "relay dropped datagrams" + string(authenticated ? " (authenticated)" : ""));
+
+            for (auto& datagram : sent) {
+                ssize_t n = recv(sink, got.data(), got.size(), 0);
+                if (n < 0)
+                    scenarioFailed(name, string("datagram missing at the sink: ") + strerror(errno));
+                if ((size_t) n != datagram.size() || (n && memcmp(got.data(), datagram.data(), n) != 0))
+                    scenarioFailed(name, "datagram of " + to_string(datagram.size()) + " bytes came out as "
+                                   + to_string(n) + " different bytes" + (gso ? " (GSO)" : ""));
+            }
+        }
+        if (gso && sealer.gso() && sealer.sendCalls() >= sealer.packetsOut())
+            scenarioFailed(name, "runs of equal lengths didn't leave as GSO messages");
+
+        for (int fd : {src, seal_in, seal_out, open_in, open_out, sink})
+            close(fd);
+    }
+}
+
+//  streamSeal() of plain through files in the temp dir, returns the sealed stream
+static vector<uint8_t> sealStream(const SnuffleKeyContext& key, const StreamHeader& header,
+                                  const vector<uint8_t>& plain, WorkerPool& pool) {
+    const string in_path = tempDir() + "/stream_plain", out_path = tempDir() + "/stream_sealed";
+    writeFile(in_path, plain.data(), plain.size());
+    int in_fd = open(in_path.c_str(), O_RDONLY);
+    int out_fd = open(out_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    streamSeal(in_fd, out_fd, key, header, pool);
+    close(in_fd);
+    close(out_fd);
+    vector<uint8_t> sealed = readFile(out_path);
+    unlink(in_path.c_str());
+    unlink(out_path.c_str());
+    return sealed;
+}
+
+//  streamReadHeader() and streamOpen() of sealed, false if the stream is rejected
+static bool openStream(const SnuffleKeyContext& key, const vector<uint8_t>& sealed, WorkerPool& pool, vector<uint8_t>& plain) {
+    const string in_path = tempDir() + "/stream_sealed", out_path = tempDir() + "/stream_opened";
+    writeFile(in_path, sealed.data(), sealed.size());
+    int in_fd = open(in_path.c_str(), O_RDONLY);
+    int out_fd = open(out_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    bool ok = true;
+    try {
+        StreamHeader header = streamReadHeader(in_fd);
+        streamOpen(in_fd, out_fd, key, header, pool);
+    } catch (const runtime_error&) {
+        ok = false;
+    } catch (const invalid_argument&) {     // a changed cipher in the header
+        ok = false;
+    }
+    close(in_fd);
+    close(out_fd);
+    plain = readFile(out_path);
+    unlink(in_path.c_str());
+    unlink(out_path.c_str());
+    return ok;
+}
+
+/*  streamSeal() -> streamOpen() of plain streams end to end through the pipeline: empty streams,
+    whole segments only (the last one full too) and a short last segment. A stream cut
+    at any segment boundary, a dropped, repeated or swapped segment, a flipped bit, a changed salt
+    and the wrong key have to be rejected */
+static void scenarioSealedStream(uint64_t seed) {
+    const string name = "streamSeal/streamOpen";
+    mt19937_64 rng(seed);
+    WorkerPool pool(3);
+    uint8_t key_bytes[32];
+    for (auto& b : key_bytes) b = rng();
+    SnuffleKeyContext key, other_key;
+    snuffleInitKey(key, rng() % 2 ? SnuffleVariant::Chacha20 : SnuffleVariant::Salsa20, key_bytes, sizeof(key_bytes));
+    key_bytes[rng() % 32] ^= 1;
+    snuffleInitKey(other_key, key.variant, key_bytes, sizeof(key_bytes));
+
+    for (int round=0; round<8; round++) {
+        StreamHeader header;
+        header.variant = key.variant;
+        header.segment_size = rng() % 2000 + 1;
+        for (auto& b : header.salt) b = rng();
+        const size_t seg = header.segment_size, frame = seg + STREAM_TAG_LEN;
+        const size_t len = round == 0 ? 0 : (rng() % 6) * seg + (round % 2 ? rng() % seg : 0);
+        const size_t nr_segments = len ? (len + seg - 1) / seg : 1;
+        vector<uint8_t> plain(len), opened;
+        for (auto& b : plain) b = rng();
+
+        const vector<uint8_t> sealed = sealStream(key, header, plain, pool);
+        if (sealed.size() != STREAM_HEADER_LEN + len + nr_segments * STREAM_TAG_LEN)
+            scenarioFailed(name, "sealed stream of " + to_string(len) + " bytes has the wrong size");
+        if (!openStream(key, sealed, pool, opened) || opened != plain)
+            scenarioFailed(name, "round trip of " + to_string(len) + " bytes in segments of " + to_string(seg));
+
+        auto rejected = [&](const vector<uint8_t>& bad, const SnuffleKeyContext& k, const string& what) {
+            vector<uint8_t> out;
+            if (openStream(k, bad, pool, out))
+                scenarioFailed(name, what + " was accepted (" + to_string(len) + " bytes, segments of " + to_string(seg) + ")");
+        };
+        for (size_t j=0; j < nr_segments; j++) {
+            vector<uint8_t> bad(sealed.begin(), sealed.begin() + STREAM_HEADER_LEN + j * frame);
+            rejected(bad, key, "stream cut after segment " + to_string(j));
+        }
+        if (nr_segments >= 2) {
+            // full segments are [0, nr_segments - 1), only the last one may be shorter
+            const size_t a = rng() % (nr_segments - 1), b = rng() % (nr_segments - 1);
+            const auto seg_a = sealed.begin() + STREAM_HEADER_LEN + a * frame;
+            const auto seg_b = sealed.begin() + STREAM_HEADER_LEN + b * frame;
+            vector<uint8_t> bad(sealed);
+            bad.erase(bad.begin() + (seg_a - sealed.begin()), bad.begin() + (seg_a - sealed.begin()) + frame);
+            rejected(bad, key, "dropped segment " + to_string(a));
+            bad = sealed;
+            bad.insert(bad.begin() + (seg_b - sealed.begin()), seg_a, seg_a + frame);
+            rejected(bad, key, "segment " + to_string(a) + " repeated before segment " + to_string(b));
+            if (a != b) {
+                bad = sealed;
+                swap_ranges(bad.begin() + (seg_a - sealed.begin()), bad.begin() + (seg_a - sealed.begin()) + frame,
+                            bad.begin() + (seg_b - sealed.begin()));
+                rejected(bad, key, "swapped segments " + to_string(a) + " and " + to_string(b));
+            }
+        }
+        vector<uint8_t> bad(sealed);
+        const size_t bit = rng() % (8 * bad.size());
+        bad[bit / 8] ^= 1 << (bit % 8);
+        rejected(bad, key, "flipped bit " + to_string(bit));
+        bad = sealed;
+        bad[12 + rng() % STREAM_SALT_LEN] ^= 1;
+        rejected(bad, key, "changed salt");
+        rejected(sealed, other_key, "the wrong key");
+    }
+}
+
+/*  Compressed streams: streamSeal() -> streamOpen(), and SealedStreamReader::read() at random
+    offsets against the plaintext (for plain streams too), with compressible and random stretches
+    mixed so both frame methods show up. A flipped frame length has to fail opening and reading
+    that segment, a flipped bit in the index or a cut index opening the reader */
+static void scenarioCompressedStream(uint64_t seed) {
+    const string name = "compressed streams";
+    mt19937_64 rng(seed);
+    WorkerPool pool(3);
+    uint8_t key_bytes[32];
+    for (auto& b : key_bytes) b = rng();
+    SnuffleKeyContext key;
+    snuffleInitKey(key, rng() % 2 ? SnuffleVariant::Chacha20 : SnuffleVariant::Salsa20, key_bytes, sizeof(key_bytes));
+    const string path = tempDir() + "/compressed_stream";
+
+    for (int round=0; round<9; round++) {
+        StreamHeader header;
+        header.variant = key.variant;
+        header.segment_size = rng() % 4000 + 64;
+        header.compressed = round % 3 != 2;
+        for (auto& b : header.salt) b = rng();
+        const size_t seg = header.segment_size;
+        const size_t len = round == 0 ? 0 : rng() % (8 * seg);
+        vector<uint8_t> plain, opened;
+        while (plain.size() < len) {
+            size_t n = min<size_t>(len - plain.size(), rng() % (2 * seg) + 1);
+            uint8_t fill = rng();
+            for (size_t i=0; i<n; i++)
+                plain.push_back(rng() % 3 ? fill + i % 7 : rng());
+            if (rng() % 2)
+                for (auto it = plain.end() - n; it != plain.end(); ++it)
+                    *it = rng();
+        }
+
+        const vector<uint8_t> sealed = sealStream(key, header, plain, pool);
+        if (!openStream(key, sealed, pool, opened) || opened != plain)
+            scenarioFailed(name, "round trip of " + to_string(len) + " bytes in segments of " + to_string(seg)
+                           + (header.compressed ? "" : " (plain)"));
+
+        writeFile(path, sealed.data(), sealed.size());
+        {
+            SealedStreamReader reader(path, key);
+            if (reader.size() != len || reader.header().compressed != header.compressed)
+                scenarioFailed(name, "reader got the wrong size or header");
+            vector<uint8_t> buf(2 * seg);
+            for (int r=0; r<30; r++) {
+                const uint64_t offset = rng() % (len + 10);
+                const size_t n = rng() % buf.size();
+                const size_t expected = offset < len ? min<size_t>(n, len - offset) : 0;
+                if (reader.read(offset, buf.data(), n) != expected
+                    || (expected && memcmp(buf.data(), plain.data() + offset, expected) != 0))
+                    scenarioFailed(name, "read(" + to_string(offset) + ", " + to_string(n) + ") of " + to_string(len) + " bytes");
+            }
+        }
+        if (!header.compressed)
+            continue;
+
+        // the first frame's length prefix, the low 31 bits are the length, bit 31 the last flag
+        vector<uint8_t> bad(sealed);
+        const unsigned bit = rng() % 32;
+        bad[STREAM_HEADER_LEN + bit / 8] ^= 1 << (bit % 8);
+        if (openStream(key, bad, pool, opened))
+            scenarioFailed(name, "flipped bit " + to_string(bit) + " of a frame length was accepted");
+        writeFile(path, bad.data(), bad.size());
+        if (len) {  // an empty stream has nothing to read, the reader never opens its frame
+            try {
+                SealedStreamReader reader(path, key);
+                uint8_t byte;
+                reader.read(0, &byte, 1);
+                scenarioFailed(name, "reader accepted flipped bit " + to_string(bit) + " of a frame length");
+            } catch (const runtime_error&) {
+            }
+        }
+
+        // index: size u64 | frame lengths | tag, then its length u64
+        const size_t nr_segments = len ? (len + seg - 1) / seg : 1;
+        const size_t index_total = 8 + 4 * nr_segments + STREAM_TAG_LEN + 8;
+        for (int cut_or_flip=0; cut_or_flip<2; cut_or_flip++) {
+            bad = sealed;
+            const size_t pos = rng() % index_total;
+            if (cut_or_flip)
+                bad[sealed.size() - index_total + pos] ^= 1 << rng() % 8;
+            else
+                bad.resize(sealed.size() - index_total + pos);
+            writeFile(path, bad.data(), bad.size());
+            try {
+                SealedStreamReader reader(path, key);
+                scenarioFailed(name, string(cut_or_flip ? "flipped bit in" : "cut") + " index at byte " + to_string(pos) + " was accepted");
+            } catch (const runtime_error&) {
+            }
+        }
+    }
+    unlink(path.c_str());
+}
+
+//  the object of stage name in a PipelineTelemetry::json() snapshot, empty if it isn't there
+static string jsonStage(const string& json, const string& name) {
+    size_t pos = json.find("{\"name\":\"" + name + "\"");
+    return pos == string::npos ? "" : json.substr(pos, json.find('}', pos) + 1 - pos);
+}
+
+//  integer field of a JSON object, UINT64_MAX if it's missing
+static uint64_t jsonCount(const string& object, const string& field) {
+    size_t pos = object.find("\"" + field + "\":");
+    return pos == string::npos ? UINT64_MAX : stoull(object.substr(pos + field.size() + 3));
+}
+
+/*  PipelineTelemetry::json(): counters of known stages, the in flight histogram, the bottleneck
+    as busy time over wall time (pool stages together as "compute"), and the counters a real
+    streamSeal() run leaves behind */
+static void scenarioPipelineTelemetry(uint64_t seed) {
+    const string name = "PipelineTelemetry";
+    mt19937_64 rng(seed);
+
+    PipelineTelemetry telemetry;
+    const unsigned read = telemetry.stage("read"), encrypt = telemetry.stage("encrypt", 4);
+    const unsigned mac = telemetry.stage("mac", 4), write = telemetry.stage("write");
+    if (telemetry.stage("encrypt", 4) != encrypt || read == write)
+        scenarioFailed(name, "stage() doesn't map names to stages one to one");
+    telemetry.addBusy(read, 2000, 100);
+    telemetry.addBusy(read, 500, 50);
+    telemetry.addBusy(mac, 1000, 150);
+    telemetry.addWait(write, 7000);
+    for (size_t in_flight : {0, 2, 2, 2, 1000})
+        telemetry.sampleQueue(in_flight);
+
+    string json = telemetry.json();
+    const string read_stage = jsonStage(json, "read"), write_stage = jsonStage(json, "write");
+    if (json.front() != '{' || json.back() != '}' || count(json.begin(), json.end(), '{') != count(json.begin(), json.end(), '}'))
+        scenarioFailed(name, "json() isn't one object: " + json);
+    if (read_stage.find("\"threads\":1,\"pooled\":false") == string::npos || jsonCount(read_stage, "bytes") != 150
+        || jsonCount(read_stage, "records") != 2 || jsonCount(write_stage, "records") != 0
+        || jsonStage(json, "mac").find("\"threads\":4,\"pooled\":true") == string::npos)
+        scenarioFailed(name, "json() has the wrong stage counters: " + json);
+    string queue = "\"queue_in_flight\":[1,0,3";
+    for (size_t i=3; i < PipelineTelemetry::QUEUE_BUCKETS - 1; i++)
+        queue += ",0";
+    if (json.find(queue + ",1]") == string::npos)
+        scenarioFailed(name, "json() has the wrong in flight histogram: " + json);
+
+    // far more busy time than wall time makes a stage the bottleneck
+    telemetry.addBusy(write, 1000000000000ull, 0);
+    if (telemetry.json().find("\"bottleneck\":\"write\"") == string::npos)
+        scenarioFailed(name, "a saturated writer isn't the bottleneck");
+    telemetry.addBusy(encrypt, 3000000000000ull, 0);
+    telemetry.addBusy(mac, 3000000000000ull, 0);
+    if (telemetry.json().find("\"bottleneck\":\"compute\"") == string::npos)
+        scenarioFailed(name, "saturated pool stages aren't the bottleneck");
+
+    // a sealed stream counts its plaintext in read, encrypt and mac
+    WorkerPool pool(2);
+    uint8_t key_bytes[32];
+    for (auto& b : key_bytes) b = rng();
+    SnuffleKeyContext key;
+    snuffleInitKey(key, SnuffleVariant::Chacha20, key_bytes, sizeof(key_bytes));
+    StreamHeader header;
+    header.variant = key.variant;
+    header.segment_size = 4096;
+    for (auto& b : header.salt) b = rng();
+    const size_t len = rng() % 100000 + 1;
+    vector<uint8_t> plain(len);
+    for (auto& b : plain) b = rng();
+    const string in_path = tempDir() + "/telemetry_plain";
+    writeFile(in_path, plain.data(), plain.size());
+    int in_fd = open(in_path.c_str(), O_RDONLY), out_fd = open("/dev/null", O_WRONLY);
+    PipelineTelemetry seal_telemetry;
+    streamSeal(in_fd, out_fd, key, header, pool, &seal_telemetry);
+    close(in_fd);
+    close(out_fd);
+    unlink(in_path.c_str());
+
+    json = seal_telemetry.json();
+    for (const char* stage : {"read", "encrypt", "mac"})
+        if (jsonCount(jsonStage(json, stage), "bytes") != len)
+            scenarioFailed(name, string("stage ") + stage + " of a sealed stream of " + to_string(len) + " bytes: " + json);
+    if (jsonCount(jsonStage(json, "encrypt"), "records") != (len + 4095) / 4096)
+        scenarioFailed(name, "encrypt records of a sealed stream: " + json);
+}
+
+//  one HTTP request to 127.0.0.1:port, returns everything the server sent until it closed
+static string httpRequest(uint16_t port, const string& request) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    struct timeval timeout = {5, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (fd < 0 || connect(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0)
+        scenarioFailed("MetricsServer", string("can't connect: ") + strerror(errno));
+    writeAll(fd, (const uint8_t*) request.data(), request.size());
+    string response;
+    char buf[4096];
+    for (ssize_t n; (n = recv(fd, buf, sizeof(buf), 0)) > 0;)
+        response.append(buf, n);
+    close(fd);
+    return response;
+}
+
+/*  MetricsServer on a free port over loopback, as curl http://127.0.0.1:port/metrics would see
+    it: 200 with the process and pipeline metrics in the text format (every family with its
+    # TYPE line, histograms counting as many records as their +Inf bucket), 404 elsewhere and
+    500 when rendering fails */
+static void scenarioMetricsServer(uint64_t seed) {
+    const string name = "MetricsServer";
+    mt19937_64 rng(seed);
+    WorkerPool pool(2);
+    PipelineTelemetry telemetry;
+    const unsigned read = telemetry.stage("read"), encrypt = telemetry.stage("encrypt", 2);
+    const unsigned records = rng() % 50 + 1;
+    for (unsigned i=0; i<records; i++) {
+        telemetry.addBusy(read, rng() % 5000000, 4096);
+        telemetry.addBusy(encrypt, rng() % 5000000, 4096);
+        telemetry.sampleQueue(rng() % 10);
+    }
+    atomic<bool> broken{false};
+    MetricsServer server(0, [&] {
+        if (broken)
+            throw runtime_error("render failed");
+        return prometheusProcessMetrics(&pool, 3) + telemetry.prometheus();
+    });
+    if (server.port() == 0)
+        scenarioFailed(name, "port() of a server on port 0 is still 0");
+
+    const string response = httpRequest(server.port(), "GET /metrics HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n");
+    const size_t body_pos = response.find("\r\n\r\n");
+    if (response.rfind("HTTP/1.1 200 ", 0) != 0 || body_pos == string::npos)
+        scenarioFailed(name, "GET /metrics: " + response.substr(0, 100));
+    const string body = response.substr(body_pos + 4);
+    if (response.find("Content-Length: " + to_string(body.size()) + "\r\n") == string::npos)
+        scenarioFailed(name, "Content-Length doesn't match the body");
+
+    for (const char* type : {"salsa_kernel_info gauge", "salsa_active_sessions gauge", "salsa_pool_threads gauge",
+                             "salsa_pool_busy_seconds_total counter", "salsa_pipeline_busy_seconds_total counter",
+                             "salsa_pipeline_bytes_total counter", "salsa_pipeline_records_total counter",
+                             "salsa_pipeline_latency_seconds histogram", "salsa_pipeline_in_flight histogram"})
+        if (body.find(string("# TYPE ") + type + "\n") == string::npos)
+            scenarioFailed(name, string("no # TYPE ") + type);
+    if (body.find("salsa_active_sessions 3\n") == string::npos
+        || body.find("salsa_pipeline_bytes_total{stage=\"encrypt\"} " + to_string(records * 4096) + "\n") == string::npos
+        || body.find("salsa_pipeline_latency_seconds_bucket{stage=\"read\",le=\"+Inf\"} " + to_string(records) + "\n") == string::npos
+        || body.find("salsa_pipeline_latency_seconds_count{stage=\"read\"} " + to_string(records) + "\n") == string::npos
+        || body.find("salsa_pipeline_in_flight_bucket{le=\"+Inf\"} " + to_string(records) + "\n") == string::npos)
+        scenarioFailed(name, "metrics with the wrong values:\n" + body);
+
+    // every sample belongs to the family of the # TYPE line before it
+    string family;
+    istringstream lines(body);
+    for (string line; getline(lines, line);) {
+        if (line.rfind("# TYPE ", 0) == 0)
+            family = line.substr(7, line.find(' ', 7) - 7);
+        else if (line[0] != '#' && (family.empty() || line.rfind(family, 0) != 0))
+            scenarioFailed(name, "sample outside its family: " + line);
+    }
+
+    if (httpRequest(server.port(), "GET /metrics?name=x HTTP/1.1\r\n\r\n").rfind("HTTP/1.1 200 ", 0) != 0)
+        scenarioFailed(name, "GET /metrics with a query string");
+    for (const char* request : {"GET / HTTP/1.1\r\n\r\n", "GET /metricsx HTTP/1.1\r\n\r\n",
+                                "GET /other HTTP/1.1\r\n\r\n", "POST /metrics HTTP/1.1\r\n\r\n"})
+        if (httpRequest(server.port(), request).rfind("HTTP/1.1 404 ", 0) != 0)
+            scenarioFailed(name, string("no 404 for ") + request);
+    broken = true;
+    if (httpRequest(server.port(), "GET /metrics HTTP/1.1\r\n\r\n").rfind("HTTP/1.1 500 ", 0) != 0)
+        scenarioFailed(name, "no 500 when rendering throws");
+}
+
+/*  DedupStore round trip: ingest, recipe stored and read back, restore. Ingesting the same data
+    again (also after reopening) adds no chunks, an ingest that fails with a read error leaves
+    nothing indexed, and a corrupted chunk or recipe is rejected */
+static void scenarioDedupStore(uint64_t seed) {
+    const string name = "DedupStore";
+    const string dir = tempDir() + "/dedup", input = tempDir() + "/dedup_input", output = tempDir() + "/dedup_output";
+    mt19937_64 rng(seed);
+    uint8_t secret[32];
+    for (auto& b : secret) b = rng();
+    CdcParams params;
+    params.min_size = 256;
+    params.avg_size = 1024;
+    params.max_size = 4096;
+    WorkerPool pool(3);
+
+    // random pieces, some of them repeated, so that chunks repeat within and across batches
+    vector<uint8_t> data;
+    vector<vector<uint8_t>> pieces(4);
+    for (auto& p : pieces) {
+        p.resize(rng() % 8000 + 2000);
+        for (auto& b : p) b = rng();
+    }
+    while (data.size() < 150000) {
+        if (rng() % 3) {
+            const vector<uint8_t>& p = pieces[rng() % pieces.size()];
+            data.insert(data.end(), p.begin(), p.end());
+        } else {
+            for (size_t n = rng() % 5000 + 1; n; n--)
+                data.push_back(rng());
+        }
+    }
+    writeFile(input, data.data(), data.size());
+
+    auto ingest = [&](DedupStore& store, WorkerPool* p) {
+        int fd = open(input.c_str(), O_RDONLY);
+        vector<DedupStore::ChunkRef> recipe = store.ingest(fd, p);
+        close(fd);
+        return recipe;
+    };
+    auto restored = [&](DedupStore& store, const vector<DedupStore::ChunkRef>& recipe) {
+        int fd = open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        try {
+            store.restore(recipe, fd, &pool);
+        } catch (runtime_error&) {
+            close(fd);
+            return false;
+        }
+        close(fd);
+        return readFile(output) == data;
+    };
+    auto sameRecipe = [](const vector<DedupStore::ChunkRef>& a, const vector<DedupStore::ChunkRef>& b) {
+        if (a.size() != b.size())
+            return false;
+        for (size_t i=0; i<a.size(); i++)
+            if (a[i].len != b[i].len || memcmp(a[i].secret, b[i].secret, sizeof(a[i].secret)) != 0)
+                return false;
+        return true;
+    };
+
+    // read error in the middle: the first batches are written, none of them may be indexed
+    uint64_t unindexed;
+    {
+        DedupStore store(dir, secret, params, 1);
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+            scenarioFailed(name, "could not create a socketpair");
+        struct timeval timeout = {0, 100000};
+        setsockopt(fds[0], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        writeAll(fds[1], data.data(), 50000);
+        bool failed = false;
+        try {
+            store.ingest(fds[0], &pool);
+        } catch (runtime_error&) {
+            failed = true;
+        }
+        close(fds[0]);
+        close(fds[1]);
+        if (!failed || store.storedBytes() == 0)
+            scenarioFailed(name, "ingest() didn't fail after storing some chunks");
+        if (store.uniqueChunks() != 0 || store.newChunks() != 0)
+            scenarioFailed(name, "a failed ingest() left " + to_string(store.uniqueChunks()) + " chunks indexed");
+        unindexed = store.storedBytes();
+    }
+
+    vector<DedupStore::ChunkRef> recipe;
+    uint64_t chunks, stored;
+    {
+        DedupStore store(dir, secret, params, 1);
+        if (store.uniqueChunks() != 0)
+            scenarioFailed(name, "the index of the failed ingest() was written");
+        recipe = ingest(store, &pool);
+        vector<string> secrets;
+        for (const auto& ref : recipe)
+            secrets.emplace_back((const char*) ref.secret, sizeof(ref.secret));
+        sort(secrets.begin(), secrets.end());
+        const uint64_t distinct = unique(secrets.begin(), secrets.end()) - secrets.begin();
+        if (store.uniqueChunks() != distinct || store.newChunks() != distinct || distinct == recipe.size())
+            scenarioFailed(name, to_string(store.uniqueChunks()) + " chunks stored for " + to_string(distinct)
+                           + " distinct ones of " + to_string(recipe.size()));
+
+        store.putRecipe("file", recipe);
+        if (!sameRecipe(store.getRecipe("file"), recipe) || !restored(store, recipe))
+            scenarioFailed(name, "round trip through the store lost data");
+
+        chunks = store.uniqueChunks();
+        stored = store.storedBytes();
+        if (stored <= unindexed)
+            scenarioFailed(name, "chunks of the failed ingest() were taken as stored");
+        if (!sameRecipe(ingest(store, nullptr), recipe) || store.uniqueChunks() != chunks || store.storedBytes() != stored)
+            scenarioFailed(name, "ingesting the same data again stored chunks");
+    }
+    {
+        DedupStore store(dir, secret, params, 1);
+        if (store.uniqueChunks() != chunks || !sameRecipe(ingest(store, &pool), recipe)
+            || store.newChunks() != 0 || store.storedBytes() != stored)
+            scenarioFailed(name, "ingesting the same data into the reopened store stored chunks");
+        if (!sameRecipe(store.getRecipe("file"), recipe) || !restored(store, recipe))
+            scenarioFailed(name, "reopened store doesn't restore the file");
+    }
+
+    // one flipped bit in a chunk (behind the unindexed data of the failed ingest) or in the recipe
+    const string chunks_path = dir + "/chunks.dat", recipe_path = dir + "/recipes/file";
+    for (const string& path : {chunks_path, recipe_path}) {
+        const vector<uint8_t> original = readFile(path);
+        vector<uint8_t> file = original;
+        const size_t pos = path == chunks_path ? unindexed + rng() % (stored - unindexed) : rng() % file.size();
+        file[pos] ^= 1 << (rng() % 8);
+        writeFile(path, file.data(), file.size());
+
+        DedupStore store(dir, secret, params, 1);
+        bool rejected = false;
+        try {
+            rejected = !restored(store, store.getRecipe("file"));
+        } catch (runtime_error&) {
+            rejected = true;
+        }
+        if (!rejected)
+            scenarioFailed(name, "store accepted a flipped bit at " + to_string(pos) + " of " + path);
+        writeFile(path, original.data(), original.size());
+    }
+    removeTree(dir);
+    unlink(input.c_str());
+    unlink(output.c_str());
+}
+
+/*  DecryptedMapping against EncryptedFileReader: threads touching random ranges of the lazy
+    mapping at once, with faults racing each other and the readahead. Skipped without userfaultfd,
+    where the mapping is decrypted up front */
+static void scenarioDecryptedMapping(uint64_t seed) {
+    const string name = "DecryptedMapping";
+    const string path = tempDir() + "/mapping";
+    mt19937_64 rng(seed);
+    vector<uint8_t> key(32);
+    for (auto& b : key) b = rng();
+    const uint8_t nonce[8] = {8, 7, 6, 5, 4, 3, 2, 1};
+    const SnuffleKeyContext ctx = Chacha20(key).keyContext();
+
+    vector<uint8_t> file(rng() % (3 << 20) + 1);
+    for (auto& b : file) b = rng();
+    writeFile(path, file.data(), file.size());
+    vector<uint8_t> expected(file.size());
+    EncryptedFileReader(path, ctx, nonce).read(0, expected.data(), expected.size());
+
+    WorkerPool pool(2);
+    {
+        DecryptedMapping mapping(path, ctx, nonce, &pool, rng() % 8);
+        if (!mapping.lazy()) {
+            unlink(path.c_str());
+            return;
+        }
+        if (mapping.size() != file.size())
+            scenarioFailed(name, "mapping has " + to_string(mapping.size()) + " bytes of " + to_string(file.size()));
+
+        atomic<bool> differs{false};
+        vector<thread> threads;
+        for (unsigned t=0; t<4; t++) {
+            threads.emplace_back([&, thread_seed = rng()] {
+                mt19937_64 r(thread_seed);
+                for (unsigned i=0; i<300; i++) {
+                    const size_t offset = r() % file.size(), len = min<size_t>(r() % 10000 + 1, file.size() - offset);
+                    if (memcmp(mapping.data() + offset, expected.data() + offset, len) != 0)
+                        differs = true;
+                }
+            });
+        }
+        for (auto& t : threads)
+            t.join();
+        if (differs)
+            scenarioFailed(name, "mapping differs from EncryptedFileReader");
+
+        // every page once, however many threads and readahead tasks went for it
+        const uint64_t page_size = sysconf(_SC_PAGESIZE), pages = (file.size() + page_size - 1) / page_size;
+        if (memcmp(mapping.data(), expected.data(), file.size()) != 0)
+            scenarioFailed(name, "mapping differs from EncryptedFileReader after touching all of it");
+        if (mapping.pagesDecrypted() > pages)
+            scenarioFailed(name, to_string(mapping.pagesDecrypted()) + " pages decrypted of " + to_string(pages));
+    }
+    unlink(path.c_str());
+}
+
+static void runScenarios(uint64_t seed) {
+    scenarioBlakeVectors();
+    scenarioPoly1305Vectors(seed);
+    scenarioEpochDomain(true, 0.5);
+    scenarioEpochDomain(false, 0.5);
+    scenarioEncryptedLog(seed);
+    scenarioZerocopyIds(seed);
+    scenarioEncryptedSocket(seed);
+    scenarioMerkleHeader(seed);
+    scenarioDatagramRelay(seed);
+    scenarioSealedStream(seed);
+    scenarioCompressedStream(seed);
+    scenarioPipelineTelemetry(seed);
+    scenarioMetricsServer(seed);
+    scenarioDedupStore(seed);
+    scenarioDecryptedMapping(seed);
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    FuzzCase fc = decodeCase(data, size);
+    if (fc.chacha)
+        runCase<Chacha20>(fc);
+    else
+        runCase<Salsa20>(fc);
+    return 0;
+}
+
+#ifdef SNUFFLE_LIBFUZZER
+
+extern "C" int LLVMFuzzerInitialize(int*, char***) {
+    runScenarios(chrono::steady_clock::now().time_since_epoch().count());
+    return 0;
+}
+
+#else
+
+int main(int argc, char** argv) {
+    double budget = argc > 1 ? atof(argv[1]) : 10;
+    uint64_t seed = argc > 2 ? strtoull(argv[2], nullptr, 10) : chrono::steady_clock::now().time_since_epoch().count();
+
+    cout << "fuzzing for " << budget << "s, seed " << seed << endl;
+    runScenarios(seed);
+    cout << "scenarios passed" << endl;
+
+    mt19937_64 rng(seed);
+    vector<uint8_t> input;
+    uint64_t nr_cases = 0;
+    auto start = chrono::steady_clock::now();
+
+    while (chrono::duration<double>(chrono::steady_clock::now() - start).count() < budget) {
+        input.resize(rng() % 128);
+        for (auto& b : input) b = rng();
+        LLVMFuzzerTestOneInput(input.data(), input.size());
+        nr_cases++;
+    }
+
+    cout << nr_cases << " cases, no mismatches" << endl;
+    return 0;
+}
+
+#endif // SNUFFLE_LIBFUZZER
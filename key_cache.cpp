@@ -0,0 +1,124 @@
+#include <stdexcept> // std::invalid_argument
+#include <thread>
+
+#include "key_cache.hpp"
+
+using namespace std;
+
+KeyContextCache::KeyContextCache(size_t capacity, Loader loader) : _loader(move(loader)) {
+    if (capacity == 0)
+        throw invalid_argument("key cache capacity has to be at least 1");
+    _nrSets = 1;
+    while (_nrSets * WAYS < capacity)
+        _nrSets *= 2;
+    _sets.reset(new Set[_nrSets]);
+    for (size_t i=0; i<_nrSets; i++)
+        for (Slot& slot : _sets[i].slots)
+            for (auto& word : slot.matrix)
+                word.store(0, memory_order_relaxed);
+}
+
+// splitmix64 finalizer, ids are often sequential
+KeyContextCache::Set& KeyContextCache::setOf(uint64_t key_id) const {
+    uint64_t h = key_id;
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+    h ^= h >> 31;
+    return _sets[h & (_nrSets - 1)];
+}
+
+bool KeyContextCache::lookup(uint64_t key_id, SnuffleKeyContext& ctx) {
+    Set& set = setOf(key_id);
+    for (Slot& slot : set.slots) {
+        if (slot.key_id.load(memory_order_relaxed) != key_id)
+            continue;
+
+        for (;;) {
+            uint32_t seq = slot.seq.load(memory_order_acquire);
+            if (seq & 1) {
+                this_thread::yield();
+                continue;
+            }
+            bool valid = slot.valid.load(memory_order_relaxed);
+            uint64_t id = slot.key_id.load(memory_order_relaxed);
+            for (unsigned i=0; i<16; i++)
+                ctx.matrix[i] = slot.matrix[i].load(memory_order_relaxed);
+            ctx.variant = (SnuffleVariant) slot.variant.load(memory_order_relaxed);
+            atomic_thread_fence(memory_order_acquire);
+            if (slot.seq.load(memory_order_relaxed) != seq)
+                continue;
+
+            if (!valid || id != key_id)
+                break; // replaced since the first look
+            if (!slot.referenced.load(memory_order_relaxed))
+                slot.referenced.store(1, memory_order_relaxed);
+            _hits.fetch_add(1, memory_order_relaxed);
+            return true;
+        }
+    }
+    _misses.fetch_add(1, memory_order_relaxed);
+    return false;
+}
+
+bool KeyContextCache::get(uint64_t key_id, SnuffleKeyContext& ctx) {
+    if (lookup(key_id, ctx))
+        return true;
+    if (!_loader || !_loader(key_id, ctx))
+        return false;
+    insert(key_id, ctx);
+    return true;
+}
+
+// seqlock write, the caller holds the set's writer mutex
+void KeyContextCache::writeSlot(Slot& slot, bool valid, uint64_t key_id, const SnuffleKeyContext& ctx) {
+    uint32_t seq = slot.seq.load(memory_order_relaxed);
+    slot.seq.store(seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    slot.valid.store(valid, memory_order_relaxed);
+    slot.key_id.store(key_id, memory_order_relaxed);
+    for (unsigned i=0; i<16; i++)
+        slot.matrix[i].store(ctx.matrix[i], memory_order_relaxed);
+    slot.variant.store((uint8_t) ctx.variant, memory_order_relaxed);
+    slot.referenced.store(valid, memory_order_relaxed);
+
+    slot.seq.store(seq + 2, memory_order_release);
+}
+
+void KeyContextCache::insert(uint64_t key_id, const SnuffleKeyContext& ctx) {
+    Set& set = setOf(key_id);
+    lock_guard<mutex> lock(set.writer);
+
+    // replace the key's own slot, else take a free one, else evict
+    Slot* target = nullptr;
+    for (Slot& slot : set.slots)
+        if (slot.valid.load(memory_order_relaxed) && slot.key_id.load(memory_order_relaxed) == key_id) {
+            target = &slot;
+            break;
+        }
+    for (unsigned i=0; !target && i<WAYS; i++)
+        if (!set.slots[i].valid.load(memory_order_relaxed))
+            target = &set.slots[i];
+    while (!target) {
+        Slot& slot = set.slots[set.hand];
+        set.hand = (set.hand + 1) % WAYS;
+        if (slot.referenced.load(memory_order_relaxed))
+            slot.referenced.store(0, memory_order_relaxed);
+        else {
+            target = &slot;
+            _evictions.fetch_add(1, memory_order_relaxed);
+        }
+    }
+    writeSlot(*target, true, key_id, ctx);
+}
+
+void KeyContextCache::erase(uint64_t key_id) {
+    Set& set = setOf(key_id);
+    lock_guard<mutex> lock(set.writer);
+    for (Slot& slot : set.slots)
+        if (slot.valid.load(memory_order_relaxed) && slot.key_id.load(memory_order_relaxed) == key_id) {
+            // the key material doesn't stay around either
+            SnuffleKeyContext zero = {};
+            writeSlot(slot, false, 0, zero);
+        }
+}
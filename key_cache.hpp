@@ -0,0 +1,88 @@
+#ifndef KEY_CACHE_HPP
+#define KEY_CACHE_HPP
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "snuffle_core.hpp"
+
+/*  Bounded concurrent cache of expanded keys (SnuffleKeyContext) by 64 bit key id, for servers
+    with many tenants: per request setup becomes a lookup plus snuffleInitState() with the nonce,
+    instead of parsing a key string and building a cipher object every time.
+
+    The table is set associative, 8 slots per set picked by a hash of the key id. Lookups are
+    lock free: every slot is a seqlock, a reader copies the slot and retries if a writer was in
+    it at the same time, readers never write shared state except the CLOCK reference bit (and
+    only when it isn't set yet). Inserts lock their set (one mutex per set, they are the rare
+    case) and evict with CLOCK: the hand of the set skips and clears referenced slots and takes
+    the first unreferenced one.
+
+    Capacity is rounded up to a power of two number of sets, a hot set may evict while others
+    still have room.
+*/
+class KeyContextCache {
+
+public:
+
+    static const unsigned WAYS = 8;
+
+    /*  loader(key_id, ctx) fills ctx for a key id that isn't cached, false if there is no such key
+        it may be called concurrently, and more than once for a key several threads miss at once */
+    typedef std::function<bool(uint64_t key_id, SnuffleKeyContext& ctx)> Loader;
+
+    //  throws std::invalid_argument for capacity 0
+    explicit KeyContextCache(size_t capacity, Loader loader = nullptr);
+
+    KeyContextCache(const KeyContextCache&) = delete;
+    KeyContextCache& operator=(const KeyContextCache&) = delete;
+
+    //  copy the cached context of key_id to ctx, false if it isn't cached. Lock free
+    bool lookup(uint64_t key_id, SnuffleKeyContext& ctx);
+
+    /*  lookup(), on a miss the loader is asked and its result cached
+        false if the key isn't cached and there is no loader or the loader doesn't know it */
+    bool get(uint64_t key_id, SnuffleKeyContext& ctx);
+
+    //  add or replace the context of key_id
+    void insert(uint64_t key_id, const SnuffleKeyContext& ctx);
+
+    //  remove key_id (key revoked or rotated away), no-op if it isn't cached
+    void erase(uint64_t key_id);
+
+    size_t capacity() const { return _nrSets * WAYS; }
+    uint64_t hits() const { return _hits.load(std::memory_order_relaxed); }
+    uint64_t misses() const { return _misses.load(std::memory_order_relaxed); }
+    uint64_t evictions() const { return _evictions.load(std::memory_order_relaxed); }
+
+private:
+
+    // fields are atomics read relaxed inside the seqlock, so torn reads are detected rather than UB
+    struct alignas(64) Slot {
+        std::atomic<uint32_t> seq{0};       // odd while a writer is in the slot
+        std::atomic<uint8_t> valid{0};
+        std::atomic<uint8_t> referenced{0};  // CLOCK bit
+        std::atomic<uint8_t> variant{0};
+        std::atomic<uint64_t> key_id{0};
+        std::atomic<uint32_t> matrix[16];
+    };
+
+    struct Set {
+        Slot slots[WAYS];
+        std::mutex writer;
+        unsigned hand = 0;  // CLOCK hand, under writer
+    };
+
+    std::unique_ptr<Set[]> _sets;
+    size_t _nrSets;
+    Loader _loader;
+    std::atomic<uint64_t> _hits{0}, _misses{0}, _evictions{0};
+
+    Set& setOf(uint64_t key_id) const;
+    static void writeSlot(Slot& slot, bool valid, uint64_t key_id, const SnuffleKeyContext& ctx);
+};
+
+#endif // KEY_CACHE_HPP
@@ -0,0 +1,120 @@
+#include <algorithm> // std::min
+#include <string>
+#include <stdexcept> // std::runtime_error, std::out_of_range
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/membarrier.h>
+
+#include "key_rotation.hpp"
+
+using namespace std;
+
+// retired objects collected before retire() scans the readers (one membarrier per batch)
+static const size_t RECLAIM_BATCH = 32;
+
+EpochDomain::EpochDomain(unsigned max_readers, bool membarrier)
+    : _slots(new ReaderSlot[max_readers]), _nrSlots(max_readers) {
+    if (!membarrier)
+        return;
+    // the expedited command has to be registered once per process before use
+    long cmds = syscall(SYS_membarrier, MEMBARRIER_CMD_QUERY, 0, 0);
+    _membarrier = cmds > 0 && (cmds & MEMBARRIER_CMD_PRIVATE_EXPEDITED)
+                  && syscall(SYS_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0, 0) == 0;
+}
+
+EpochDomain::~EpochDomain() {
+    for (Retired& r : _retired)
+        r.deleter(r.object);
+}
+
+EpochDomain::Reader EpochDomain::registerReader() {
+    for (unsigned i=0; i<_nrSlots; i++) {
+        bool expected = false;
+        if (_slots[i].used.compare_exchange_strong(expected, true))
+            return Reader(this, &_slots[i]);
+    }
+    throw runtime_error("no free reader slot in the epoch domain");
+}
+
+EpochDomain::Reader::~Reader() {
+    if (!_slot)
+        return;
+    _slot->epoch.store(0, memory_order_release);
+    _slot->used.store(false, memory_order_release);
+}
+
+// full barrier on every thread of the process that is running right now (or on this one only)
+void EpochDomain::barrier() {
+    if (!_membarrier || syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0) != 0)
+        atomic_thread_fence(memory_order_seq_cst);
+}
+
+void EpochDomain::retire(void* object, void (*deleter)(void*)) {
+    size_t nr_retired;
+    {
+        lock_guard<mutex> lock(_mutex);
+        // readers that see the advanced epoch see the new pointer, only older ones may hold object
+        _retired.push_back({_epoch.fetch_add(1), object, deleter});
+        nr_retired = _retired.size();
+    }
+    if (nr_retired >= RECLAIM_BATCH)
+        reclaim();
+}
+
+size_t EpochDomain::reclaim() {
+    vector<Retired> ready;
+    size_t left;
+    {
+        lock_guard<mutex> lock(_mutex);
+        if (_retired.empty())
+            return 0;
+        barrier();
+
+        uint64_t oldest = UINT64_MAX;
+        for (unsigned i=0; i<_nrSlots; i++) {
+            uint64_t e = _slots[i].epoch.load(memory_order_acquire);
+            if (e)
+                oldest = min(oldest, e);
+        }
+        auto keep = partition(_retired.begin(), _retired.end(), [&](const Retired& r) { return r.epoch >= oldest; });
+        ready.assign(keep, _retired.end());
+        _retired.erase(keep, _retired.end());
+        left = _retired.size();
+    }
+    for (Retired& r : ready)
+        r.deleter(r.object);
+    return left;
+}
+
+size_t EpochDomain::pending() const {
+    lock_guard<mutex> lock(_mutex);
+    return _retired.size();
+}
+
+RcuKeyTable::RcuKeyTable(size_t nr_keys, const SnuffleKeyContext& ctx, unsigned max_readers, bool membarrier)
+    : _domain(max_readers, membarrier), _keys(new atomic<const KeyVersion*>[nr_keys]), _nrKeys(nr_keys) {
+    for (size_t i=0; i<nr_keys; i++)
+        _keys[i].store(new KeyVersion{ctx, 0}, memory_order_relaxed);
+}
+
+RcuKeyTable::~RcuKeyTable() {
+    for (size_t i=0; i<_nrKeys; i++)
+        delete _keys[i].load(memory_order_relaxed);
+}
+
+uint32_t RcuKeyTable::rotate(size_t index, const SnuffleKeyContext& ctx) {
+    if (index >= _nrKeys)
+        throw out_of_range("key index " + to_string(index) + " out of range");
+
+    const KeyVersion* old;
+    uint32_t version;
+    {
+        // serializes rotations of the same key, readers don't care
+        lock_guard<mutex> lock(_rotateMutex);
+        old = _keys[index].load(memory_order_relaxed);
+        version = old->version + 1;
+        _keys[index].store(new KeyVersion{ctx, version}, memory_order_release);
+    }
+    _domain.retire(const_cast<KeyVersion*>(old), [](void* p) { delete static_cast<KeyVersion*>(p); });
+    return version;
+}
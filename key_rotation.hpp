@@ -0,0 +1,155 @@
+#ifndef KEY_ROTATION_HPP
+#define KEY_ROTATION_HPP
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "snuffle_core.hpp"
+
+/*  Epoch based reclamation (the read side of RCU) for objects that readers use without locks
+
+    Every reader thread registers once and gets a slot. Entering a read section stores the
+    global epoch into the slot, leaving stores 0: plain stores, no locks, no atomic read modify
+    write. A writer publishes a new object with one pointer store and retires the old one with
+    the current epoch, then advances the epoch. A retired object is freed once no reader is
+    still in a section entered at or before its epoch, so nobody can hold it anymore.
+
+    The store-load ordering between the slot and the pointer that this depends on is paid by
+    the writer: membarrier(MEMBARRIER_CMD_PRIVATE_EXPEDITED) makes every running thread of the
+    process execute a full barrier before the slots are scanned. Kernels without it (before
+    4.14) get a fence on the read side instead.
+
+    Readers must not block for long inside a section, objects retired meanwhile pile up.
+*/
+class EpochDomain {
+
+public:
+
+    //  membarrier false takes the read side fence even where the kernel has membarrier
+    explicit EpochDomain(unsigned max_readers = 1024, bool membarrier = true);
+    ~EpochDomain();  // frees everything still retired, no reader may be in a section anymore
+
+    EpochDomain(const EpochDomain&) = delete;
+    EpochDomain& operator=(const EpochDomain&) = delete;
+
+private:
+    struct ReaderSlot;
+public:
+
+    //  a reader thread's registration, owns its slot until destroyed
+    class Reader {
+        EpochDomain* _domain;
+        ReaderSlot* _slot;
+        friend class EpochDomain;
+        Reader(EpochDomain* domain, ReaderSlot* slot) : _domain(domain), _slot(slot) {}
+    public:
+        Reader(Reader&& other) : _domain(other._domain), _slot(other._slot) { other._slot = nullptr; }
+        ~Reader();
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+
+        void enter() {
+            _slot->epoch.store(_domain->_epoch.load(std::memory_order_acquire), std::memory_order_relaxed);
+            if (_domain->_membarrier)
+                std::atomic_signal_fence(std::memory_order_seq_cst);
+            else
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+        void leave() { _slot->epoch.store(0, std::memory_order_release); }
+    };
+
+    //  read section as a scope
+    class Section {
+        Reader& _reader;
+    public:
+        explicit Section(Reader& reader) : _reader(reader) { _reader.enter(); }
+        ~Section() { _reader.leave(); }
+        Section(const Section&) = delete;
+        Section& operator=(const Section&) = delete;
+    };
+
+    //  throws std::runtime_error if all max_readers slots are taken
+    Reader registerReader();
+
+    /*  hand an object that readers can't reach anymore (the pointer to it was replaced before)
+        over to be deleted with deleter once all readers that might see it have left
+        reclaims every few dozen objects, so a membarrier is paid per batch, not per object */
+    void retire(void* object, void (*deleter)(void*));
+
+    //  delete what can be deleted now, returns the number of objects still waiting
+    size_t reclaim();
+
+    size_t pending() const;
+
+    bool usesMembarrier() const { return _membarrier; }
+
+private:
+
+    struct alignas(64) ReaderSlot {
+        std::atomic<uint64_t> epoch{0};  // 0: not in a read section
+        std::atomic<bool> used{false};
+    };
+
+    struct Retired {
+        uint64_t epoch;
+        void* object;
+        void (*deleter)(void*);
+    };
+
+    std::unique_ptr<ReaderSlot[]> _slots;
+    unsigned _nrSlots;
+    std::atomic<uint64_t> _epoch{1};
+    bool _membarrier = false;
+    mutable std::mutex _mutex;  // writers: retired list and epoch advances
+    std::vector<Retired> _retired;
+
+    void barrier();
+};
+
+/*  Key versions of many tenants / sessions, rotated while readers keep encrypting
+
+    get() inside a read section of a registered reader returns the current version, valid until
+    the section is left. rotate() publishes a new context (version + 1) and retires the old one,
+    never waiting for readers: threads that picked up the old version finish with it, new
+    sections see the new one.
+*/
+class RcuKeyTable {
+
+public:
+
+    struct KeyVersion {
+        SnuffleKeyContext ctx;
+        uint32_t version;
+    };
+
+    //  nr_keys entries, all with ctx as version 0. max_readers and membarrier as for EpochDomain
+    RcuKeyTable(size_t nr_keys, const SnuffleKeyContext& ctx, unsigned max_readers = 1024, bool membarrier = true);
+    ~RcuKeyTable();
+
+    RcuKeyTable(const RcuKeyTable&) = delete;
+    RcuKeyTable& operator=(const RcuKeyTable&) = delete;
+
+    EpochDomain::Reader registerReader() { return _domain.registerReader(); }
+
+    //  current version of key index, only while the caller is in a read section
+    const KeyVersion* get(size_t index) const { return _keys[index].load(std::memory_order_acquire); }
+
+    //  replace the context of key index, returns the new version. Thread safe, doesn't wait
+    uint32_t rotate(size_t index, const SnuffleKeyContext& ctx);
+
+    size_t size() const { return _nrKeys; }
+    EpochDomain& domain() { return _domain; }
+
+private:
+
+    EpochDomain _domain;
+    std::unique_ptr<std::atomic<const KeyVersion*>[]> _keys;
+    size_t _nrKeys;
+    std::mutex _rotateMutex;
+};
+
+#endif // KEY_ROTATION_HPP
@@ -0,0 +1,143 @@
+#include <cstring>
+#include <stdexcept> // std::invalid_argument
+
+#include "key_tree.hpp"
+#include "byte_io.hpp"
+#include "snuffle_kernels.hpp"
+
+using namespace std;
+
+// children per snuffleHashKeys() call, the inputs live on the stack
+static const size_t BATCH = 64;
+
+KeyTree::KeyTree(const uint8_t master[32], SnuffleVariant variant, size_t cache_capacity) {
+    if (cache_capacity == 0)
+        throw invalid_argument("key tree cache capacity has to be at least 1");
+    snuffleInitKey(_master, variant, master, 32);
+    _nrSets = 1;
+    while (_nrSets * WAYS < cache_capacity)
+        _nrSets *= 2;
+    _sets.reset(new Set[_nrSets]);
+}
+
+KeyTree::~KeyTree() {
+    // the node keys don't stay around in freed memory
+    for (size_t i=0; i<_nrSets; i++)
+        for (Slot& slot : _sets[i].slots)
+            memset((void*) &slot.ctx, 0, sizeof(slot.ctx));
+    memset((void*) &_master, 0, sizeof(_master));
+}
+
+// splitmix64 finalizer over the path, ids are often sequential
+KeyTree::Set& KeyTree::setOf(Level level, uint64_t volume, uint64_t file) const {
+    uint64_t h = volume * 0x9e3779b97f4a7c15ull ^ file ^ (uint64_t) level << 60;
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+    h ^= h >> 31;
+    return _sets[h & (_nrSets - 1)];
+}
+
+bool KeyTree::lookup(Level level, uint64_t volume, uint64_t file, SnuffleKeyContext& ctx) {
+    Set& set = setOf(level, volume, file);
+    lock_guard<mutex> lock(set.lock);
+    for (Slot& slot : set.slots)
+        if (slot.valid && slot.level == level && slot.volume == volume && slot.file == file) {
+            slot.referenced = true;
+            ctx = slot.ctx;
+            _hits.fetch_add(1, memory_order_relaxed);
+            return true;
+        }
+    _misses.fetch_add(1, memory_order_relaxed);
+    return false;
+}
+
+void KeyTree::insert(Level level, uint64_t volume, uint64_t file, const SnuffleKeyContext& ctx) {
+    Set& set = setOf(level, volume, file);
+    lock_guard<mutex> lock(set.lock);
+
+    // another thread may have derived the same node meanwhile, else a free slot, else evict
+    Slot* target = nullptr;
+    for (Slot& slot : set.slots)
+        if (slot.valid && slot.level == level && slot.volume == volume && slot.file == file)
+            return;
+    for (unsigned i=0; !target && i<WAYS; i++)
+        if (!set.slots[i].valid)
+            target = &set.slots[i];
+    while (!target) {
+        Slot& slot = set.slots[set.hand];
+        set.hand = (set.hand + 1) % WAYS;
+        if (slot.referenced)
+            slot.referenced = false;
+        else
+            target = &slot;
+    }
+    target->valid = true;
+    target->referenced = true;
+    target->level = level;
+    target->volume = volume;
+    target->file = file;
+    target->ctx = ctx;
+}
+
+void KeyTree::children(const SnuffleKeyContext& parent, Level level, const uint64_t* ids, size_t n,
+                       uint8_t* out) const {
+    uint8_t inputs[16 * BATCH];
+    for (size_t done=0; done < n;) {
+        size_t count = min(n - done, BATCH);
+        for (size_t i=0; i<count; i++) {
+            uint8_t* input = inputs + 16*i;
+            putLE(input, ids[done + i], 8);
+            putLE(input + 8, level, 4);
+            memcpy(input + 12, "ktr1", 4);
+        }
+        snuffleHashKeys(parent, inputs, out + 32*done, count);
+        done += count;
+    }
+    memset(inputs, 0, sizeof(inputs));
+}
+
+void KeyTree::volumeContext(uint64_t volume, SnuffleKeyContext& ctx) {
+    if (lookup(VOLUME, volume, 0, ctx))
+        return;
+    uint8_t key[32];
+    children(_master, VOLUME, &volume, 1, key);
+    snuffleInitKey(ctx, _master.variant, key, sizeof(key));
+    memset(key, 0, sizeof(key));
+    insert(VOLUME, volume, 0, ctx);
+}
+
+void KeyTree::fileContext(uint64_t volume, uint64_t file, SnuffleKeyContext& ctx) {
+    if (lookup(FILE, volume, file, ctx))
+        return;
+    SnuffleKeyContext volume_ctx;
+    volumeContext(volume, volume_ctx);
+    uint8_t key[32];
+    children(volume_ctx, FILE, &file, 1, key);
+    snuffleInitKey(ctx, _master.variant, key, sizeof(key));
+    memset(key, 0, sizeof(key));
+    insert(FILE, volume, file, ctx);
+}
+
+void KeyTree::volumeKey(uint64_t volume, uint8_t out[32]) {
+    children(_master, VOLUME, &volume, 1, out);
+}
+
+void KeyTree::fileKey(uint64_t volume, uint64_t file, uint8_t out[32]) {
+    fileKeys(volume, &file, 1, out);
+}
+
+void KeyTree::chunkKey(uint64_t volume, uint64_t file, uint64_t chunk, uint8_t out[32]) {
+    chunkKeys(volume, file, &chunk, 1, out);
+}
+
+void KeyTree::fileKeys(uint64_t volume, const uint64_t* files, size_t n, uint8_t* out) {
+    SnuffleKeyContext ctx;
+    volumeContext(volume, ctx);
+    children(ctx, FILE, files, n, out);
+}
+
+void KeyTree::chunkKeys(uint64_t volume, uint64_t file, const uint64_t* chunks, size_t n, uint8_t* out) {
+    SnuffleKeyContext ctx;
+    fileContext(volume, file, ctx);
+    children(ctx, CHUNK, chunks, n, out);
+}
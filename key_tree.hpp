@@ -0,0 +1,87 @@
+#ifndef KEY_TREE_HPP
+#define KEY_TREE_HPP
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "snuffle_core.hpp"
+
+/*  Key derivation tree: master -> volume -> file -> chunk, every node a 32 byte key
+    Children come from their parent with one HSalsa20 / HChacha20 call (snuffleHashKeys(), the
+    subkey step of XSalsa20 / XChacha20) on the 16 byte input
+
+        child id u64 | level u32 | "ktr1"          (little endian, level 1 volume, 2 file, 3 chunk)
+
+    so a chunk key costs three block permutations from scratch. Volume and file nodes are kept
+    expanded in a cache, a chunk key of a file seen recently costs one; chunkKeys() / fileKeys()
+    derive many siblings at once, SNUFFLE_LANES of them per lane pass.
+
+    The cache is set associative like KeyContextCache, 8 slots per set and CLOCK eviction, but
+    keyed by the whole node path (level, volume, file) instead of a 64 bit id: a hash of the path
+    could collide and hand out another file's key. Every set has a mutex, the object is safe to
+    use from several threads.
+
+    Keys depend on the variant, a tree is Salsa20 or Chacha20 all the way down.
+*/
+class KeyTree {
+
+public:
+
+    static const unsigned WAYS = 8;
+
+    //  throws std::invalid_argument for cache capacity 0
+    KeyTree(const uint8_t master[32], SnuffleVariant variant, size_t cache_capacity = 4096);
+    ~KeyTree();
+
+    KeyTree(const KeyTree&) = delete;
+    KeyTree& operator=(const KeyTree&) = delete;
+
+    void volumeKey(uint64_t volume, uint8_t out[32]);
+    void fileKey(uint64_t volume, uint64_t file, uint8_t out[32]);
+    void chunkKey(uint64_t volume, uint64_t file, uint64_t chunk, uint8_t out[32]);
+
+    //  keys of n files of a volume / n chunks of a file, key i to out + 32*i
+    void fileKeys(uint64_t volume, const uint64_t* files, size_t n, uint8_t* out);
+    void chunkKeys(uint64_t volume, uint64_t file, const uint64_t* chunks, size_t n, uint8_t* out);
+
+    SnuffleVariant variant() const { return _master.variant; }
+    size_t capacity() const { return _nrSets * WAYS; }
+    //  node cache lookups, every key asks for its parent (a volume key for none)
+    uint64_t hits() const { return _hits.load(std::memory_order_relaxed); }
+    uint64_t misses() const { return _misses.load(std::memory_order_relaxed); }
+
+private:
+
+    enum Level : uint32_t { VOLUME = 1, FILE = 2, CHUNK = 3 };
+
+    struct Slot {
+        bool valid = false;
+        bool referenced = false;  // CLOCK bit
+        Level level;
+        uint64_t volume, file;
+        SnuffleKeyContext ctx;
+    };
+
+    struct Set {
+        Slot slots[WAYS];
+        std::mutex lock;
+        unsigned hand = 0;  // CLOCK hand
+    };
+
+    SnuffleKeyContext _master;
+    std::unique_ptr<Set[]> _sets;
+    size_t _nrSets;
+    std::atomic<uint64_t> _hits{0}, _misses{0};
+
+    Set& setOf(Level level, uint64_t volume, uint64_t file) const;
+    bool lookup(Level level, uint64_t volume, uint64_t file, SnuffleKeyContext& ctx);
+    void insert(Level level, uint64_t volume, uint64_t file, const SnuffleKeyContext& ctx);
+    void volumeContext(uint64_t volume, SnuffleKeyContext& ctx);
+    void fileContext(uint64_t volume, uint64_t file, SnuffleKeyContext& ctx);
+    void children(const SnuffleKeyContext& parent, Level level, const uint64_t* ids, size_t n, uint8_t* out) const;
+};
+
+#endif // KEY_TREE_HPP
@@ -0,0 +1,204 @@
+#include <cstring>
+#include <stdexcept> // std::runtime_error
+
+#include "lz.hpp"
+
+using namespace std;
+
+static const unsigned HASH_BITS = 12;
+static const size_t MIN_MATCH = 4;
+static const size_t MAX_OFFSET = 65535;
+// matches end this many bytes before the end of the block, and none starts in the last MATCH_LIMIT
+static const size_t LAST_LITERALS = 5, MATCH_LIMIT = 12;
+
+static uint32_t load32(const uint8_t* p) {
+    uint32_t value;
+    memcpy(&value, p, 4);
+    return value;
+}
+
+static uint64_t load64(const uint8_t* p) {
+    uint64_t value;
+    memcpy(&value, p, 8);
+    return value;
+}
+
+// len bytes in 16 byte steps, so short copies don't go through a memcpy call. Reads and writes
+// up to 15 bytes past len, the caller checked both buffers have them
+static void wildCopy(uint8_t* dst, const uint8_t* src, size_t len) {
+    for (size_t i=0; i<len; i+=16)
+        memcpy(dst + i, src + i, 16);
+}
+
+// equal leading bytes of two 8 byte loads, diff their (nonzero) xor
+static size_t commonBytes(uint64_t diff) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    return __builtin_ctzll(diff) / 8;
+#else
+    return __builtin_clzll(diff) / 8;
+#endif
+}
+
+static unsigned hashOf(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// length beyond the token nibble as 255 bytes and a rest, out has room
+static uint8_t* putLength(uint8_t* out, size_t len) {
+    for (; len >= 255; len -= 255)
+        *out++ = 255;
+    *out++ = len;
+    return out;
+}
+
+size_t lzCompressBound(size_t len) {
+    return len + len / 255 + 16;
+}
+
+// literals and a match (none for match_len 0), false if out would overflow. in_end bounds the literals' buffer
+static bool putSequence(uint8_t*& out, const uint8_t* out_end, const uint8_t* literals, size_t nr_literals,
+                        const uint8_t* in_end, size_t offset, size_t match_len) {
+    size_t need = 1 + nr_literals + nr_literals / 255 + 1;
+    if (match_len)
+        need += 2 + (match_len - MIN_MATCH) / 255 + 1;
+    if (need > (size_t) (out_end - out))
+        return false;
+
+    uint8_t* token = out++;
+    *token = (nr_literals < 15 ? nr_literals : 15) << 4;
+    if (nr_literals >= 15)
+        out = putLength(out, nr_literals - 15);
+    if ((size_t) (in_end - literals) >= nr_literals + 15 && (size_t) (out_end - out) >= nr_literals + 15)
+        wildCopy(out, literals, nr_literals);
+    else if (nr_literals)  // an empty block may come as nullptr
+        memcpy(out, literals, nr_literals);
+    out += nr_literals;
+    if (!match_len)
+        return true;
+
+    *out++ = offset;
+    *out++ = offset >> 8;
+    size_t len_code = match_len - MIN_MATCH;
+    *token |= len_code < 15 ? len_code : 15;
+    if (len_code >= 15)
+        out = putLength(out, len_code - 15);
+    return true;
+}
+
+size_t lzCompress(const uint8_t* in, size_t len, uint8_t* out, size_t out_capacity) {
+    uint8_t* op = out;
+    uint8_t* const out_end = out + out_capacity;
+    size_t anchor = 0;
+
+    if (len > MATCH_LIMIT) {
+        uint32_t table[1 << HASH_BITS] = {};
+        const size_t last_start = len - MATCH_LIMIT, match_end = len - LAST_LITERALS;
+        size_t pos = 1;
+        while (pos <= last_start) {
+            uint32_t sequence = load32(in + pos);
+            unsigned h = hashOf(sequence);
+            size_t candidate = table[h];
+            table[h] = pos;
+            if (pos - candidate > MAX_OFFSET || load32(in + candidate) != sequence) {
+                // 1 byte steps at first, longer ones the longer nothing matched
+                pos += 1 + ((pos - anchor) >> 6);
+                continue;
+            }
+
+            while (pos > anchor && candidate > 0 && in[pos-1] == in[candidate-1]) {
+                pos--;
+                candidate--;
+            }
+            size_t match_len = MIN_MATCH;
+            for (;;) {
+                if (pos + match_len + 8 > match_end) {
+                    while (pos + match_len < match_end && in[pos + match_len] == in[candidate + match_len])
+                        match_len++;
+                    break;
+                }
+                uint64_t diff = load64(in + pos + match_len) ^ load64(in + candidate + match_len);
+                if (diff) {
+                    match_len += commonBytes(diff);
+                    break;
+                }
+                match_len += 8;
+            }
+
+            if (!putSequence(op, out_end, in + anchor, pos - anchor, in + len, pos - candidate, match_len))
+                return 0;
+            pos += match_len;
+            anchor = pos;
+            if (pos <= last_start)
+                table[hashOf(load32(in + pos - 2))] = pos - 2;
+        }
+    }
+
+    if (!putSequence(op, out_end, in + anchor, len - anchor, in + len, 0, 0))
+        return 0;
+    return op - out;
+}
+
+// length continued in 255 bytes after a nibble of 15
+static size_t getLength(const uint8_t*& in, const uint8_t* in_end) {
+    size_t len = 0;
+    for (;;) {
+        if (in == in_end)
+            throw runtime_error("compressed block truncated");
+        uint8_t b = *in++;
+        len += b;
+        if (b != 255)
+            return len;
+    }
+}
+
+size_t lzDecompress(const uint8_t* in, size_t len, uint8_t* out, size_t out_capacity) {
+    const uint8_t* in_end = in + len;
+    size_t pos = 0;
+
+    for (;;) {
+        if (in == in_end)
+            throw runtime_error("compressed block truncated");
+        uint8_t token = *in++;
+
+        size_t nr_literals = token >> 4;
+        if (nr_literals == 15)
+            nr_literals += getLength(in, in_end);
+        if (nr_literals > (size_t) (in_end - in) || nr_literals > out_capacity - pos)
+            throw runtime_error("compressed block malformed or too large");
+        if ((size_t) (in_end - in) >= nr_literals + 15 && out_capacity - pos >= nr_literals + 15)
+            wildCopy(out + pos, in, nr_literals);
+        else
+            memcpy(out + pos, in, nr_literals);
+        in += nr_literals;
+        pos += nr_literals;
+        if (in == in_end)
+            return pos;
+
+        if (in_end - in < 2)
+            throw runtime_error("compressed block truncated");
+        size_t offset = in[0] | in[1] << 8;
+        in += 2;
+        size_t match_len = (token & 15) + MIN_MATCH;
+        if ((token & 15) == 15)
+            match_len += getLength(in, in_end);
+        if (offset == 0 || offset > pos || match_len > out_capacity - pos)
+            throw runtime_error("compressed block malformed or too large");
+
+        uint8_t* dst = out + pos;
+        const uint8_t* src = dst - offset;
+        if (offset >= 16 && out_capacity - pos >= match_len + 15)
+            wildCopy(dst, src, match_len);
+        else if (offset >= match_len)
+            memcpy(dst, src, match_len);
+        else if (offset >= 8) {
+            // overlapping, but every 8 byte step reads bytes written before it
+            size_t i = 0;
+            for (; i + 8 <= match_len; i += 8)
+                memcpy(dst + i, src + i, 8);
+            memcpy(dst + i, src + i, match_len - i);
+        } else
+            for (size_t i=0; i<match_len; i++)
+                dst[i] = src[i];
+        pos += match_len;
+    }
+}
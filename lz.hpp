@@ -0,0 +1,33 @@
+#ifndef LZ_HPP
+#define LZ_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*  Fast LZ77 block compression (LZ4 style byte oriented format, no entropy coding)
+
+    Greedy matching through a 4096 entry hash table of 4 byte sequences, matches within the
+    last 64 KiB, and the scan steps faster through data that doesn't match (incompressible
+    input costs little). Decoding is a copy loop with every length checked against the input
+    and output bounds, malformed input can't make it read or write outside them.
+
+    Format: sequences of
+                token u8 (literal count << 4 | match length - 4, 15 = more length bytes follow)
+                [literal count - 15 as bytes of 255 and one below]   literals
+                offset u16 (little endian, back from the current output position)
+                [match length - 19 as bytes of 255 and one below]
+            the last sequence ends after its literals.
+*/
+
+//  output size lzCompress() never exceeds for len bytes of input
+size_t lzCompressBound(size_t len);
+
+//  compress len bytes, returns the compressed size or 0 if that would be more than out_capacity
+size_t lzCompress(const uint8_t* in, size_t len, uint8_t* out, size_t out_capacity);
+
+/*  decompress a block of len bytes, returns the decompressed size. Bytes of out past that size
+    (below out_capacity) may be overwritten
+    throws std::runtime_error if the block is malformed or decompresses to more than out_capacity */
+size_t lzDecompress(const uint8_t* in, size_t len, uint8_t* out, size_t out_capacity);
+
+#endif // LZ_HPP
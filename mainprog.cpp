@@ -5,6 +5,7 @@
 #include <stdexcept>
 
 #include "salsa20.hpp"
+#include "cli.hpp"
 
 #define NR_POS_ARGS 4
 #define NR_OPT_ARGS 2
@@ -16,17 +17,43 @@ using namespace std;
 /*  Small program to show sample usage of this Salsa20 cipher implementation
 
     Encrypt infile with Salsa20 into outfile (or with Chacha20 if --chacha20 set)
+    Other modes are subcommands, implemented in cli_*.cpp
 */
 
 void usage(string progname) {
     cout << "usage:\n"
          << progname << " infile outfile key nonce [--hex-key] [--chacha20]\n"
-         << "32 byte key as (ascii interpreted) str, 8 byte nonce in hex (without 0x prefix)" << endl;
+         << "32 byte key as (ascii interpreted) str, 8 byte nonce in hex (without 0x prefix)\n"
+         << progname << " keystream key nonce --bytes N [--seek offset] [--threads T] [--out file] [--hex-key] [--chacha20]\n"
+         << progname << " merkle build|verify|read file key [nonce] [--range offset len] ...  (integrity index, see salsa merkle)\n"
+         << progname << " seal|open key [--segment-size N] [--threads T] [--in file] [--out file] ...  (authenticated pipes)\n"
+         << progname << " log append|cat file key nonce [--interval-us N] ...  (encrypted append-only log)\n"
+         << progname << " udp seal|open key nonce --listen [host]:port --to host:port ...  (encrypted UDP tunnel)\n"
+         << progname << " dedup put|get|stats store key [name] [file] [--threads T] ...  (deduplicating backup store)\n"
+         << progname << " archive create|list|extract|cat archive key [paths or names] ...  (encrypted archive)" << endl;
     exit(EXIT_FAILURE);
 }
 
 int main(int argc, char** argv){
 
+    // -------------- subcommands -------------------------
+    if (argc > 1 && string(argv[1]) == "keystream")
+        return keystreamCommand(argc-1, argv+1);
+    if (argc > 1 && string(argv[1]) == "merkle")
+        return merkleCommand(argc-1, argv+1);
+    if (argc > 1 && string(argv[1]) == "seal")
+        return sealCommand(argc-1, argv+1);
+    if (argc > 1 && string(argv[1]) == "open")
+        return openCommand(argc-1, argv+1);
+    if (argc > 1 && string(argv[1]) == "log")
+        return logCommand(argc-1, argv+1);
+    if (argc > 1 && string(argv[1]) == "udp")
+        return udpCommand(argc-1, argv+1);
+    if (argc > 1 && string(argv[1]) == "dedup")
+        return dedupCommand(argc-1, argv+1);
+    if (argc > 1 && string(argv[1]) == "archive")
+        return archiveCommand(argc-1, argv+1);
+
     // -------------- input validation --------------------
     if (argc < MIN_ARGC || argc > MAX_ARGC)
         usage(argv[0]);
@@ -61,33 +88,8 @@ int main(int argc, char** argv){
         exit(EXIT_FAILURE); 
     }
 
-    SnuffleStreamCipher* cipher_ptr;
-    try {
-        if (use_chacha) 
-            cipher_ptr = new Chacha20(key_str, is_hex_key);
-        else 
-            cipher_ptr = new Salsa20(key_str, is_hex_key);
-    } catch (length_error&) {
-        if (!is_hex_key)
-            cerr << "invalid key size. has to be 16 or 32 (ascii interpreted) chars" << endl;
-        else
-            cerr << "invalid key size. has to be 32 or 64 hex chars" << endl;
-    } catch (invalid_argument&) {
-        cerr << "all key chars have to be hex chars (no 0x prefix)" << endl;
-    }
-
-    if (!cipher_ptr)
-        exit(EXIT_FAILURE);    
-
-    try {
-        cipher_ptr->setNonce(nonce_hex_str);
-    } catch (length_error&) {
-        cerr << "invalid nonce size. has to be 8 byte (16 hex interpreted chars) without 0x prefix)" << endl;
-        exit(EXIT_FAILURE);
-    } catch (invalid_argument&) {
-        cerr << "nonce hast to consist of only hex chars (also no 0x prefix)" << endl;
-        exit(EXIT_FAILURE);        
-    }
+    // exits with a message on invalid key or nonce
+    unique_ptr<SnuffleStreamCipher> cipher_ptr = cipherFromArgs(key_str, nonce_hex_str, is_hex_key, use_chacha);
 
     // -------------- end of input validation -------------
 
@@ -119,6 +121,5 @@ int main(int argc, char** argv){
 
     infile.close();
     outfile.close();
-    delete cipher_ptr;
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,263 @@
+#include <cstring> // memcpy
+#include <cerrno>
+#include <fstream>
+#include <algorithm> // std::min
+#include <stdexcept> // std::runtime_error
+#include <sys/stat.h>
+#include <unistd.h> // pread()
+
+#include "merkle.hpp"
+#include "byte_io.hpp"
+#include "blake.hpp"
+#include "worker_pool.hpp"
+
+using namespace std;
+
+static const char MERKLE_MAGIC[4] = {'S', 'M', 'R', 'K'};
+static const uint8_t MERKLE_VERSION = 1;
+static const uint8_t MERKLE_FLAG_KEYED = 1;
+static const size_t MERKLE_HEADER_LEN = 4 + 1 + 1 + 2 + 4 + 8 + 32;
+
+// domain separation of the three kinds of hashes in the tree
+static const uint8_t LEAF_PREFIX = 0, NODE_PREFIX = 1, ROOT_PREFIX = 2;
+
+// chunks a task of verifyAll()/build() hashes in one go
+static const size_t CHUNKS_PER_TASK_BYTES = 1 << 20;
+
+static uint64_t fileSizeOf(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+        throw runtime_error(string("stat failed: ") + strerror(errno));
+    return st.st_size;
+}
+
+// an empty file still has one (empty) chunk
+static uint64_t chunksFor(uint64_t file_size, uint32_t chunk_size) {
+    return file_size ? file_size / chunk_size + (file_size % chunk_size != 0) : 1;
+}
+
+void MerkleIndex::setKey(const uint8_t* mac_key) {
+    _keyed = mac_key != nullptr;
+    if (_keyed)
+        memcpy(_macKey, mac_key, sizeof(_macKey));
+}
+
+MerkleIndex::Hash MerkleIndex::leafHash(uint64_t index, const uint8_t* data, size_t len) const {
+    uint8_t msg[1 + 8 + 8 + 32];
+    msg[0] = LEAF_PREFIX;
+    putLE(msg+1, index, 8);
+    putLE(msg+9, len, 8);
+    blake3(msg+17, 32, data, len, _keyed ? _macKey : nullptr);
+
+    Hash h;
+    blake3(h.data(), h.size(), msg, sizeof(msg), _keyed ? _macKey : nullptr);
+    return h;
+}
+
+MerkleIndex::Hash MerkleIndex::nodeHash(const Hash& left, const Hash& right) const {
+    uint8_t msg[1 + 64];
+    msg[0] = NODE_PREFIX;
+    memcpy(msg+1, left.data(), 32);
+    memcpy(msg+33, right.data(), 32);
+
+    Hash h;
+    blake3(h.data(), h.size(), msg, sizeof(msg), _keyed ? _macKey : nullptr);
+    return h;
+}
+
+// root bound to the parameters of the tree
+MerkleIndex::Hash MerkleIndex::computeRootTag() const {
+    uint8_t msg[1 + 32 + 4 + 8];
+    msg[0] = ROOT_PREFIX;
+    memcpy(msg+1, _levels.back()[0].data(), 32);
+    putLE(msg+33, _chunkSize, 4);
+    putLE(msg+37, _fileSize, 8);
+
+    Hash h;
+    blake3(h.data(), h.size(), msg, sizeof(msg), _keyed ? _macKey : nullptr);
+    return h;
+}
+
+// all levels above the leaves, large levels are split over the pool
+void MerkleIndex::buildLevels(WorkerPool* pool) {
+    _levels.resize(1);
+    while (_levels.back().size() > 1) {
+        const vector<Hash>& below = _levels.back();
+        vector<Hash> level((below.size() + 1) / 2);
+
+        auto combine = [&](size_t i) {
+            level[i] = 2*i+1 < below.size() ? nodeHash(below[2*i], below[2*i+1]) : below[2*i];
+        };
+        if (pool && level.size() >= 4096) {
+            const size_t per_task = 1024;
+            pool->parallelFor((level.size() + per_task - 1) / per_task, [&](size_t t) {
+                for (size_t i=t*per_task; i < min(level.size(), (t+1)*per_task); i++)
+                    combine(i);
+            });
+        } else {
+            for (size_t i=0; i<level.size(); i++)
+                combine(i);
+        }
+        _levels.push_back(move(level));
+    }
+    _rootTag = computeRootTag();
+}
+
+vector<MerkleIndex::Hash> MerkleIndex::hashChunks(int fd, WorkerPool* pool) const {
+    const uint64_t nr_chunks = chunksFor(_fileSize, _chunkSize);
+    const size_t per_task = max<size_t>(1, CHUNKS_PER_TASK_BYTES / _chunkSize);
+    vector<Hash> leaves(nr_chunks);
+
+    auto task = [&](size_t t) {
+        vector<uint8_t> buf(_chunkSize);
+        for (uint64_t c=t*per_task; c < min<uint64_t>(nr_chunks, (t+1)*per_task); c++) {
+            size_t len = min<uint64_t>(_chunkSize, _fileSize - c*_chunkSize);
+            preadAll(fd, buf.data(), len, c*_chunkSize);
+            leaves[c] = leafHash(c, buf.data(), len);
+        }
+    };
+
+    size_t nr_tasks = (nr_chunks + per_task - 1) / per_task;
+    if (pool)
+        pool->parallelFor(nr_tasks, task);
+    else
+        for (size_t t=0; t<nr_tasks; t++)
+            task(t);
+    return leaves;
+}
+
+MerkleIndex MerkleIndex::build(int fd, uint32_t chunk_size, const uint8_t* mac_key, WorkerPool* pool) {
+    if (chunk_size == 0)
+        throw invalid_argument("chunk size must not be 0");
+
+    MerkleIndex index;
+    index.setKey(mac_key);
+    index._chunkSize = chunk_size;
+    index._fileSize = fileSizeOf(fd);
+    index._levels.push_back(index.hashChunks(fd, pool));
+    index.buildLevels(pool);
+    return index;
+}
+
+void MerkleIndex::save(const string& path) const {
+    ofstream out(path, ios::out | ios::binary | ios::trunc);
+    if (!out)
+        throw runtime_error("could not open " + path);
+
+    uint8_t header[MERKLE_HEADER_LEN] = {0};
+    memcpy(header, MERKLE_MAGIC, 4);
+    header[4] = MERKLE_VERSION;
+    header[5] = _keyed ? MERKLE_FLAG_KEYED : 0;
+    putLE(header+8, _chunkSize, 4);
+    putLE(header+12, _fileSize, 8);
+    memcpy(header+20, _rootTag.data(), 32);
+    out.write((const char*) header, sizeof(header));
+
+    for (auto& level : _levels)
+        out.write((const char*) level.data(), level.size() * sizeof(Hash));
+
+    if (!out.good())
+        throw runtime_error("could not write " + path);
+}
+
+MerkleIndex MerkleIndex::load(const string& path, const uint8_t* mac_key) {
+    ifstream in(path, ios::in | ios::binary);
+    if (!in)
+        throw runtime_error("could not open " + path);
+
+    uint8_t header[MERKLE_HEADER_LEN];
+    if (!in.read((char*) header, sizeof(header)) || memcmp(header, MERKLE_MAGIC, 4) != 0 || header[4] != MERKLE_VERSION)
+        throw runtime_error(path + " is not a merkle index");
+
+    MerkleIndex index;
+    if (((header[5] & MERKLE_FLAG_KEYED) != 0) != (mac_key != nullptr))
+        throw runtime_error(mac_key ? path + " was built without a key" : path + " needs a key");
+    index.setKey(mac_key);
+    index._chunkSize = getLE(header+8, 4);
+    index._fileSize = getLE(header+12, 8);
+    if (index._chunkSize == 0)
+        throw runtime_error(path + " is corrupt");
+
+    // nothing in the header is authenticated yet: bound it by the index file before allocating,
+    // the leaves alone take a hash per chunk, so with nr_chunks <= nr_hashes the sums below
+    // stay far from overflowing
+    in.seekg(0, ios::end);
+    uint64_t index_size = in.tellg();
+    uint64_t nr_hashes = (index_size - MERKLE_HEADER_LEN) / sizeof(Hash);
+    uint64_t nr_chunks = chunksFor(index._fileSize, index._chunkSize);
+    if (nr_chunks > nr_hashes)
+        throw runtime_error(path + " has the wrong size");
+
+    uint64_t nr_nodes = 0;
+    for (uint64_t n = nr_chunks; ; n = (n+1) / 2) {
+        nr_nodes += n;
+        if (n == 1) break;
+    }
+    if (index_size != MERKLE_HEADER_LEN + nr_nodes * sizeof(Hash))
+        throw runtime_error(path + " has the wrong size");
+    in.seekg(MERKLE_HEADER_LEN);
+
+    for (uint64_t n = nr_chunks; ; n = (n+1) / 2) {
+        vector<Hash> level(n);
+        if (!in.read((char*) level.data(), n * sizeof(Hash)))
+            throw runtime_error(path + " is truncated");
+        index._levels.push_back(move(level));
+        if (n == 1) break;
+    }
+
+    memcpy(index._rootTag.data(), header+20, 32);
+    if (index.computeRootTag() != index._rootTag)
+        throw runtime_error(path + ": root tag mismatch (wrong key or modified index)");
+    return index;
+}
+
+bool MerkleIndex::verifyChunk(uint64_t index, const uint8_t* data, size_t len) const {
+    if (index >= nrChunks() || len != min<uint64_t>(_chunkSize, _fileSize - index*_chunkSize))
+        return false;
+
+    Hash h = leafHash(index, data, len);
+    for (size_t l=0; l+1 < _levels.size(); l++, index /= 2) {
+        const vector<Hash>& level = _levels[l];
+        if (index % 2)
+            h = nodeHash(level[index-1], h);
+        else if (index+1 < level.size())
+            h = nodeHash(h, level[index+1]);
+        // else: odd node at the end, moves up unchanged
+    }
+    return h == _levels.back()[0];
+}
+
+bool MerkleIndex::verifyRange(int fd, uint64_t offset, uint64_t len) const {
+    if (offset > _fileSize || len > _fileSize - offset)
+        return false;
+
+    uint64_t first = offset / _chunkSize;
+    uint64_t last = len ? (offset + len - 1) / _chunkSize : first;
+    vector<uint8_t> buf(_chunkSize);
+
+    for (uint64_t c=first; c<=last && c < nrChunks(); c++) {
+        size_t chunk_len = min<uint64_t>(_chunkSize, _fileSize - c*_chunkSize);
+        preadAll(fd, buf.data(), chunk_len, c*_chunkSize);
+        if (!verifyChunk(c, buf.data(), chunk_len))
+            return false;
+    }
+    return true;
+}
+
+vector<uint64_t> MerkleIndex::verifyAll(int fd, WorkerPool* pool, bool& root_ok) const {
+    vector<uint64_t> bad;
+    if (fileSizeOf(fd) != _fileSize) {
+        root_ok = false;
+        return bad;
+    }
+
+    MerkleIndex recomputed(*this);
+    recomputed._levels.assign(1, hashChunks(fd, pool));
+    for (uint64_t c=0; c < nrChunks(); c++)
+        if (recomputed._levels[0][c] != _levels[0][c])
+            bad.push_back(c);
+
+    recomputed.buildLevels(pool);
+    root_ok = recomputed._rootTag == _rootTag;
+    return bad;
+}
@@ -0,0 +1,78 @@
+#ifndef MERKLE_HPP
+#define MERKLE_HPP
+
+#include <array>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+class WorkerPool;
+
+/*  Merkle tree over the fixed size chunks of an (encrypted) file, stored beside it as an index file
+
+    Leaves are BLAKE3 hashes of the chunks bound to their index and length, inner nodes hash their
+    two children, an odd node at the end of a level moves up unchanged. With a MAC key all hashes
+    are keyed BLAKE3, the tree then authenticates the data; without one the root tag has to be
+    compared out of band. The root tag also covers chunk size and file size.
+
+    Any chunk can be verified with O(log n) hashes through its authentication path, so random
+    access readers (EncryptedFileReader) only hash what they read. Building and verifying the
+    whole file hashes the chunks on a WorkerPool.
+
+    Index file: "SMRK" | version u8 | flags u8 | 0 u16 | chunk size u32 | file size u64 |
+                root tag [32] | nodes [32] level by level, leaves first   (integers little endian)
+*/
+class MerkleIndex {
+
+public:
+
+    typedef std::array<uint8_t, 32> Hash;
+
+    static const uint32_t DEFAULT_CHUNK_SIZE = 64 * 1024;
+
+    /*  hash all chunks of the file open as fd
+        mac_key: 32 bytes or nullptr. throws std::runtime_error on read errors */
+    static MerkleIndex build(int fd, uint32_t chunk_size, const uint8_t* mac_key, WorkerPool* pool);
+
+    /*  load an index file, mac_key has to match the one used to build it
+        throws std::runtime_error on format errors or if the root tag doesn't match */
+    static MerkleIndex load(const std::string& path, const uint8_t* mac_key);
+
+    void save(const std::string& path) const;
+
+    uint32_t chunkSize() const { return _chunkSize; }
+    uint64_t fileSize() const { return _fileSize; }
+    uint64_t nrChunks() const { return _levels[0].size(); }
+    Hash rootTag() const { return _rootTag; }
+
+    //  check data of chunk index against the root through its authentication path
+    bool verifyChunk(uint64_t index, const uint8_t* data, size_t len) const;
+
+    //  read all chunks overlapping [offset, offset+len) from fd and verify them
+    bool verifyRange(int fd, uint64_t offset, uint64_t len) const;
+
+    /*  hash every chunk of fd (in parallel with a pool) and recompute the root
+        returns the indices of chunks that don't match, also fails if the file size changed */
+    std::vector<uint64_t> verifyAll(int fd, WorkerPool* pool, bool& root_ok) const;
+
+private:
+
+    uint32_t _chunkSize = DEFAULT_CHUNK_SIZE;
+    uint64_t _fileSize = 0;
+    bool _keyed = false;
+    uint8_t _macKey[32] = {0};
+    Hash _rootTag;
+    std::vector<std::vector<Hash>> _levels; // _levels[0] leaves, _levels.back() the root
+
+    MerkleIndex() = default;
+
+    void setKey(const uint8_t* mac_key);
+    Hash leafHash(uint64_t index, const uint8_t* data, size_t len) const;
+    Hash nodeHash(const Hash& left, const Hash& right) const;
+    Hash computeRootTag() const;
+    void buildLevels(WorkerPool* pool);
+    std::vector<Hash> hashChunks(int fd, WorkerPool* pool) const;
+};
+
+#endif // MERKLE_HPP
@@ -0,0 +1,148 @@
+#include <sstream>
+#include <iomanip>
+#include <stdexcept> // std::runtime_error
+#include <cstring>
+#include <cerrno>
+#include <poll.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+#include "metrics_server.hpp"
+#include "snuffle_kernels.hpp"
+#include "worker_pool.hpp"
+
+using namespace std;
+
+// a scraper that doesn't send its request within this long is dropped
+static const int REQUEST_TIMEOUT_MS = 2000;
+static const size_t MAX_REQUEST = 8192;
+
+MetricsServer::MetricsServer(uint16_t port, function<string()> render)
+    : _port(port), _render(move(render)) {
+    _listenFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (_listenFd < 0)
+        throw runtime_error(string("could not create metrics socket: ") + strerror(errno));
+
+    int one = 1;
+    setsockopt(_listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    socklen_t addr_len = sizeof(addr);
+    if (bind(_listenFd, (struct sockaddr*) &addr, sizeof(addr)) != 0 || listen(_listenFd, 16) != 0
+        || getsockname(_listenFd, (struct sockaddr*) &addr, &addr_len) != 0) {
+        string reason = strerror(errno);
+        close(_listenFd);
+        throw runtime_error("could not listen on 127.0.0.1:" + to_string(port) + " for metrics: " + reason);
+    }
+    _port = ntohs(addr.sin_port);
+
+    _stopFd = eventfd(0, EFD_CLOEXEC);
+    if (_stopFd < 0) {
+        close(_listenFd);
+        throw runtime_error(string("could not create eventfd: ") + strerror(errno));
+    }
+    _thread = thread(&MetricsServer::serveLoop, this);
+}
+
+MetricsServer::~MetricsServer() {
+    uint64_t one = 1;
+    if (write(_stopFd, &one, sizeof(one)) == sizeof(one))
+        _thread.join();
+    else
+        _thread.detach(); // can't be told to stop, leave it to the end of the process
+    close(_listenFd);
+    close(_stopFd);
+}
+
+void MetricsServer::serveLoop() {
+    struct pollfd fds[2] = {{_listenFd, POLLIN, 0}, {_stopFd, POLLIN, 0}};
+    for (;;) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        if (fds[1].revents)
+            return;
+
+        int fd = accept4(_listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0)
+            continue;
+        serveConnection(fd);
+        close(fd);
+    }
+}
+
+static void sendAll(int fd, const string& data) {
+    for (size_t done=0; done < data.size();) {
+        ssize_t n = send(fd, data.data() + done, data.size() - done, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return; // the scraper went away
+        done += n;
+    }
+}
+
+void MetricsServer::serveConnection(int fd) {
+    // the request line and headers, the body (if any) isn't needed
+    string request;
+    char buf[1024];
+    while (request.find("\r\n\r\n") == string::npos && request.size() < MAX_REQUEST) {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        if (poll(&pfd, 1, REQUEST_TIMEOUT_MS) <= 0)
+            return;
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        request.append(buf, n);
+    }
+
+    string status = "200 OK", body;
+    if (request.rfind("GET /metrics ", 0) == 0 || request.rfind("GET /metrics?", 0) == 0) {
+        try {
+            body = _render();
+        } catch (exception& e) {
+            status = "500 Internal Server Error";
+            body = string(e.what()) + "\n";
+        }
+    } else {
+        status = "404 Not Found";
+        body = "metrics are at /metrics\n";
+    }
+
+    sendAll(fd, "HTTP/1.1 " + status + "\r\n"
+                "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                "Content-Length: " + to_string(body.size()) + "\r\n"
+                "Connection: close\r\n\r\n" + body);
+}
+
+string prometheusProcessMetrics(const WorkerPool* pool, unsigned active_sessions) {
+    ostringstream out;
+    out << setprecision(9)
+        << "# HELP salsa_kernel_info Keystream kernel selected for this CPU\n"
+        << "# TYPE salsa_kernel_info gauge\n"
+        << "salsa_kernel_info{kernel=\"" << snuffleKernelName() << "\"} 1\n"
+        << "# HELP salsa_active_sessions Streams being encrypted or decrypted\n"
+        << "# TYPE salsa_active_sessions gauge\n"
+        << "salsa_active_sessions " << active_sessions << "\n";
+    if (pool)
+        out << "# HELP salsa_pool_threads Worker threads in the pool\n"
+            << "# TYPE salsa_pool_threads gauge\n"
+            << "salsa_pool_threads " << pool->size() << "\n"
+            << "# HELP salsa_pool_busy_seconds_total Time the workers spent running tasks, summed over the workers\n"
+            << "# TYPE salsa_pool_busy_seconds_total counter\n"
+            << "salsa_pool_busy_seconds_total " << pool->busyNs() * 1e-9 << "\n"
+            << "# HELP salsa_pool_bulk_busy_seconds_total Part of the busy time spent on bulk slices\n"
+            << "# TYPE salsa_pool_bulk_busy_seconds_total counter\n"
+            << "salsa_pool_bulk_busy_seconds_total " << pool->bulkBusyNs() * 1e-9 << "\n";
+    return out.str();
+}
@@ -0,0 +1,48 @@
+#ifndef METRICS_SERVER_HPP
+#define METRICS_SERVER_HPP
+
+#include <functional>
+#include <string>
+#include <thread>
+#include <stdint.h>
+
+class WorkerPool;
+
+/*  Minimal HTTP listener on 127.0.0.1 for Prometheus scrapes
+
+    GET /metrics answers with render() in the text exposition format, anything else with 404.
+    One connection at a time on a thread of its own, each closed after its response, which is
+    all a scraper (or curl http://127.0.0.1:port/metrics) needs. Only the loopback interface
+    is bound, the metrics are for the local monitoring agent.
+
+    render is called on the server thread and has to be safe against the running program.
+*/
+class MetricsServer {
+
+    int _listenFd = -1;
+    int _stopFd = -1;
+    uint16_t _port;
+    std::function<std::string()> _render;
+    std::thread _thread;
+
+    void serveLoop();
+    void serveConnection(int fd);
+
+public:
+
+    /*  listen on port (0 picks a free one, see port())
+        throws std::runtime_error if the port can't be bound */
+    MetricsServer(uint16_t port, std::function<std::string()> render);
+    ~MetricsServer();
+
+    MetricsServer(const MetricsServer&) = delete;
+    MetricsServer& operator=(const MetricsServer&) = delete;
+
+    uint16_t port() const { return _port; }
+};
+
+/*  metrics of the process as a whole: the keystream kernel in use (salsa_kernel_info), active
+    sessions, and the utilization counters of pool (may be nullptr) */
+std::string prometheusProcessMetrics(const WorkerPool* pool, unsigned active_sessions);
+
+#endif // METRICS_SERVER_HPP
@@ -0,0 +1,190 @@
+#include <vector>
+#include <string>
+#include <functional>
+#include <chrono>
+#include <future>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <stdexcept> // std::runtime_error
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+
+#include "pipeline.hpp"
+#include "byte_io.hpp"
+#include "pipeline_telemetry.hpp"
+#include "worker_pool.hpp"
+
+using namespace std;
+
+static uint64_t nsSince(chrono::steady_clock::time_point start) {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+}
+
+// one record in flight, reused every depth records
+struct PipelineSlot {
+    vector<uint8_t> buf;
+    size_t len = 0;
+    bool last = false;
+    future<void> done;
+};
+
+// reads the next record into buf and returns its length, sets last if no record follows
+typedef function<size_t(uint8_t* buf, bool& last)> RecordReader;
+
+static void pipelineLoop(int out_fd, size_t buf_capacity, WorkerPool& pool, const PipelineStage& process,
+                         PipelineTelemetry* telemetry, const RecordReader& read_record) {
+    unsigned read_stage = 0, write_stage = 0;
+    if (telemetry) {
+        read_stage = telemetry->stage("read");
+        write_stage = telemetry->stage("write");
+    }
+
+    const size_t depth = 2*pool.size() + 2;
+    vector<PipelineSlot> slots(depth);
+    for (PipelineSlot& s : slots)
+        s.buf.resize(buf_capacity);
+
+    mutex m;
+    condition_variable cv;
+    uint64_t submitted = 0, written = 0;
+    bool finished = false;
+    exception_ptr error;
+
+    auto setError = [&](exception_ptr e) {
+        lock_guard<mutex> lock(m);
+        if (!error)
+            error = e;
+        cv.notify_all();
+    };
+
+    // writer: records in input order, as soon as each is processed
+    thread writer([&] {
+        for (uint64_t i=0; ; i++) {
+            auto wait_start = chrono::steady_clock::now();
+            {
+                unique_lock<mutex> lock(m);
+                cv.wait(lock, [&] { return i < submitted || finished || error; });
+                if (error || i >= submitted)
+                    return;
+            }
+            PipelineSlot& s = slots[i % depth];
+            try {
+                s.done.get();
+                if (telemetry)
+                    telemetry->addWait(write_stage, nsSince(wait_start));
+                PipelineTelemetry::Timer timer(telemetry, write_stage, s.len);
+                writeAll(out_fd, s.buf.data(), s.len);
+            } catch (...) {
+                setError(current_exception());
+                return;
+            }
+            bool last = s.last;
+            {
+                lock_guard<mutex> lock(m);
+                written++;
+                if (telemetry)
+                    telemetry->sampleQueue(submitted - written);
+            }
+            cv.notify_all();
+            if (last)
+                return;
+        }
+    });
+
+    // reader: fill a free slot, hand it to the pool
+    try {
+        for (uint64_t i=0; ; i++) {
+            auto wait_start = chrono::steady_clock::now();
+            {
+                unique_lock<mutex> lock(m);
+                cv.wait(lock, [&] { return i - written < depth || error; });
+                if (error)
+                    break;
+            }
+            if (telemetry)
+                telemetry->addWait(read_stage, nsSince(wait_start));
+
+            auto read_start = chrono::steady_clock::now();
+            PipelineSlot& s = slots[i % depth];
+            bool last = false;
+            size_t n = read_record(s.buf.data(), last);
+            if (telemetry)
+                telemetry->addBusy(read_stage, nsSince(read_start), n);
+
+            s.len = n;
+            s.last = last;
+            s.done = pool.submit([&s, &process, i, last] {
+                s.len = process(i, last, s.buf.data(), s.len);
+            });
+            {
+                lock_guard<mutex> lock(m);
+                submitted++;
+                if (telemetry)
+                    telemetry->sampleQueue(submitted - written);
+            }
+            cv.notify_all();
+            if (last)
+                break;
+        }
+    } catch (...) {
+        setError(current_exception());
+    }
+
+    {
+        lock_guard<mutex> lock(m);
+        finished = true;
+    }
+    cv.notify_all();
+    writer.join();
+
+    // tasks the writer didn't get to still use the slots
+    for (PipelineSlot& s : slots)
+        if (s.done.valid())
+            s.done.wait();
+    if (error)
+        rethrow_exception(error);
+}
+
+void runPipeline(int in_fd, int out_fd, size_t record_len, size_t buf_capacity,
+                 WorkerPool& pool, const PipelineStage& process, PipelineTelemetry* telemetry) {
+    if (record_len == 0 || buf_capacity < record_len)
+        throw invalid_argument("record length must be in [1, buffer capacity]");
+
+    bool have_carry = false;
+    uint8_t carry = 0;
+    pipelineLoop(out_fd, buf_capacity, pool, process, telemetry, [&](uint8_t* buf, bool& last) {
+        size_t n = 0;
+        if (have_carry)
+            buf[n++] = carry;
+        n += readFull(in_fd, buf + n, record_len - n);
+        last = n < record_len;
+        if (!last) {
+            have_carry = readFull(in_fd, &carry, 1) == 1;
+            last = !have_carry;
+        }
+        return n;
+    });
+}
+
+void runFramedPipeline(int in_fd, int out_fd, size_t prefix_len, const PipelineFraming& framing, size_t buf_capacity,
+                       WorkerPool& pool, const PipelineStage& process, PipelineTelemetry* telemetry) {
+    if (prefix_len == 0 || buf_capacity < prefix_len)
+        throw invalid_argument("record prefix length must be in [1, buffer capacity]");
+
+    pipelineLoop(out_fd, buf_capacity, pool, process, telemetry, [&](uint8_t* buf, bool& last) {
+        size_t n = readFull(in_fd, buf, prefix_len);
+        if (n == 0)
+            throw runtime_error("input ended before its last record");
+        if (n < prefix_len)
+            throw runtime_error("input truncated in a record prefix");
+        size_t len = framing(buf, last);
+        if (len > buf_capacity - prefix_len)
+            throw runtime_error("record of " + to_string(len) + " bytes does not fit the buffer");
+        if (readFull(in_fd, buf + prefix_len, len) != len)
+            throw runtime_error("input truncated in a record");
+        return prefix_len + len;
+    });
+}
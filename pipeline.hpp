@@ -0,0 +1,44 @@
+#ifndef PIPELINE_HPP
+#define PIPELINE_HPP
+
+#include <functional>
+#include <stdint.h>
+#include <stddef.h>
+
+class WorkerPool;
+class PipelineTelemetry;
+
+/*  Pipelined processing of a stream in fixed size records: reader -> workers -> writer
+
+    The calling thread reads records from in_fd, every record is processed on the WorkerPool,
+    a writer thread writes the results to out_fd in input order. Up to 2 records per worker
+    (plus two) are in flight, so reading, processing and writing overlap and a pipe keeps
+    moving at the speed of its slowest stage without the whole input being buffered.
+
+    A record is record_len bytes, only the last one may be shorter (even empty for empty input).
+    The reader looks one byte ahead, so the last record is known as such when it gets processed.
+
+    process(index, last, buf, len) works in place on a buffer of buf_capacity bytes and returns
+    the number of bytes to write. An exception thrown by process or by reading / writing stops
+    the pipeline: nothing from that record on gets written and runPipeline() rethrows it.
+
+    With telemetry, the reader and writer record their busy and waiting times as the stages
+    "read" and "write", and the records in flight are sampled at every hand over.
+*/
+
+typedef std::function<size_t(uint64_t index, bool last, uint8_t* buf, size_t len)> PipelineStage;
+
+void runPipeline(int in_fd, int out_fd, size_t record_len, size_t buf_capacity,
+                 WorkerPool& pool, const PipelineStage& process, PipelineTelemetry* telemetry = nullptr);
+
+/*  runPipeline() for records of varying length, each starting with a prefix of prefix_len bytes
+    framing(prefix, last) returns the length of the record after the prefix and sets last for
+    the final one, nothing after that gets read. process gets prefix and record in buf.
+    throws std::runtime_error (through runFramedPipeline()) if the input ends before the last
+    record or a record doesn't fit buf_capacity; framing may throw for prefixes it rejects */
+typedef std::function<size_t(const uint8_t* prefix, bool& last)> PipelineFraming;
+
+void runFramedPipeline(int in_fd, int out_fd, size_t prefix_len, const PipelineFraming& framing, size_t buf_capacity,
+                       WorkerPool& pool, const PipelineStage& process, PipelineTelemetry* telemetry = nullptr);
+
+#endif // PIPELINE_HPP
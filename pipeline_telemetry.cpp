@@ -0,0 +1,195 @@
+#include <sstream>
+#include <iomanip>
+#include <stdexcept> // std::length_error
+#include <csignal>
+#include <cerrno>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "pipeline_telemetry.hpp"
+
+using namespace std;
+
+static int64_t nowNs() {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+PipelineTelemetry::PipelineTelemetry() {
+    for (auto& bucket : _queue)
+        bucket = 0;
+    for (auto& stage : _stages)
+        for (auto& bucket : stage.latency)
+            bucket = 0;
+    start();
+}
+
+void PipelineTelemetry::start() {
+    _startNs = nowNs();
+}
+
+unsigned PipelineTelemetry::stage(const string& name, unsigned pool_threads) {
+    lock_guard<mutex> lock(_mutex);
+    unsigned n = _nrStages.load();
+    for (unsigned i=0; i<n; i++)
+        if (_stages[i].name == name)
+            return i;
+    if (n == MAX_STAGES)
+        throw length_error("too many pipeline stages");
+    _stages[n].name = name;
+    _stages[n].threads = max(1u, pool_threads);
+    _stages[n].pooled = pool_threads > 0;
+    _nrStages.store(n + 1, memory_order_release);
+    return n;
+}
+
+void PipelineTelemetry::addBusy(unsigned stage, uint64_t ns, uint64_t bytes) {
+    _stages[stage].busy_ns.fetch_add(ns, memory_order_relaxed);
+    _stages[stage].bytes.fetch_add(bytes, memory_order_relaxed);
+    _stages[stage].records.fetch_add(1, memory_order_relaxed);
+
+    // bucket k holds up to 2^k us
+    size_t bucket = 0;
+    for (uint64_t limit = 1000; ns > limit && bucket < LATENCY_BUCKETS - 1; limit *= 2)
+        bucket++;
+    _stages[stage].latency[bucket].fetch_add(1, memory_order_relaxed);
+}
+
+void PipelineTelemetry::addWait(unsigned stage, uint64_t ns) {
+    _stages[stage].wait_ns.fetch_add(ns, memory_order_relaxed);
+}
+
+void PipelineTelemetry::sampleQueue(size_t in_flight) {
+    _queue[min(in_flight, QUEUE_BUCKETS - 1)].fetch_add(1, memory_order_relaxed);
+}
+
+string PipelineTelemetry::json() const {
+    const double wall = max<int64_t>(nowNs() - _startNs.load(), 1) / 1e9;
+    const unsigned n = _nrStages.load(memory_order_acquire);
+
+    ostringstream out;
+    out << fixed << setprecision(6) << "{\"wall_s\":" << wall << ",\"stages\":[";
+
+    // single threaded stages compete on their own, the pool stages together as "compute"
+    string bottleneck;
+    double worst = -1, compute_busy = 0;
+    unsigned compute_threads = 0;
+    for (unsigned i=0; i<n; i++) {
+        const Stage& s = _stages[i];
+        double busy = s.busy_ns.load(memory_order_relaxed) / 1e9;
+        double utilization = busy / (wall * s.threads);
+        out << (i ? "," : "") << "{\"name\":\"" << s.name << "\",\"threads\":" << s.threads
+            << ",\"pooled\":" << (s.pooled ? "true" : "false")
+            << ",\"busy_s\":" << busy << ",\"wait_s\":" << s.wait_ns.load(memory_order_relaxed) / 1e9
+            << ",\"bytes\":" << s.bytes.load(memory_order_relaxed)
+            << ",\"records\":" << s.records.load(memory_order_relaxed)
+            << ",\"utilization\":" << utilization << "}";
+
+        if (s.pooled) {
+            compute_busy += busy;
+            compute_threads = max(compute_threads, s.threads);
+        } else if (utilization > worst) {
+            worst = utilization;
+            bottleneck = s.name;
+        }
+    }
+    if (compute_threads && compute_busy / (wall * compute_threads) > worst)
+        bottleneck = "compute";
+
+    // histogram up to the highest occupancy seen
+    size_t used = QUEUE_BUCKETS;
+    while (used > 0 && _queue[used - 1].load(memory_order_relaxed) == 0)
+        used--;
+    out << "],\"queue_in_flight\":[";
+    for (size_t i=0; i<used; i++)
+        out << (i ? "," : "") << _queue[i].load(memory_order_relaxed);
+    out << "],\"bottleneck\":\"" << bottleneck << "\"}";
+    return out.str();
+}
+
+string PipelineTelemetry::prometheus() const {
+    const unsigned n = _nrStages.load(memory_order_acquire);
+    ostringstream out;
+    out << setprecision(9);
+
+    struct Counter { const char* name; const char* help; atomic<uint64_t> Stage::* field; double scale; };
+    static const Counter counters[] = {
+        {"salsa_pipeline_busy_seconds_total", "Time spent working, per stage", &Stage::busy_ns, 1e-9},
+        {"salsa_pipeline_wait_seconds_total", "Time spent waiting for other stages", &Stage::wait_ns, 1e-9},
+        {"salsa_pipeline_bytes_total", "Bytes processed, per stage", &Stage::bytes, 1},
+        {"salsa_pipeline_records_total", "Records processed, per stage", &Stage::records, 1},
+    };
+    for (const Counter& c : counters) {
+        out << "# HELP " << c.name << " " << c.help << "\n# TYPE " << c.name << " counter\n";
+        for (unsigned i=0; i<n; i++)
+            out << c.name << "{stage=\"" << _stages[i].name << "\"} " << (_stages[i].*c.field).load(memory_order_relaxed) * c.scale << "\n";
+    }
+
+    out << "# HELP salsa_pipeline_latency_seconds Busy time per record, per stage\n"
+        << "# TYPE salsa_pipeline_latency_seconds histogram\n";
+    for (unsigned i=0; i<n; i++) {
+        const Stage& s = _stages[i];
+        uint64_t cumulative = 0;
+        for (size_t b=0; b<LATENCY_BUCKETS; b++) {
+            cumulative += s.latency[b].load(memory_order_relaxed);
+            out << "salsa_pipeline_latency_seconds_bucket{stage=\"" << s.name << "\",le=\"";
+            if (b == LATENCY_BUCKETS - 1)
+                out << "+Inf";
+            else
+                out << (double) (1ull << b) * 1e-6;
+            out << "\"} " << cumulative << "\n";
+        }
+        out << "salsa_pipeline_latency_seconds_sum{stage=\"" << s.name << "\"} " << s.busy_ns.load(memory_order_relaxed) * 1e-9 << "\n"
+            << "salsa_pipeline_latency_seconds_count{stage=\"" << s.name << "\"} " << cumulative << "\n";
+    }
+
+    out << "# HELP salsa_pipeline_in_flight Records between reader and writer, sampled at every hand over\n"
+        << "# TYPE salsa_pipeline_in_flight histogram\n";
+    uint64_t cumulative = 0, sum = 0;
+    for (size_t b=0; b<QUEUE_BUCKETS; b++) {
+        uint64_t count = _queue[b].load(memory_order_relaxed);
+        cumulative += count;
+        sum += b * count;
+        if (b < QUEUE_BUCKETS - 1)
+            out << "salsa_pipeline_in_flight_bucket{le=\"" << b << "\"} " << cumulative << "\n";
+    }
+    out << "salsa_pipeline_in_flight_bucket{le=\"+Inf\"} " << cumulative << "\n"
+        << "salsa_pipeline_in_flight_sum " << sum << "\n"
+        << "salsa_pipeline_in_flight_count " << cumulative << "\n";
+    return out.str();
+}
+
+TelemetrySignalReporter::TelemetrySignalReporter(const PipelineTelemetry& telemetry, int fd, int signo)
+    : _telemetry(telemetry), _fd(fd), _signo(signo) {
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, signo);
+    pthread_sigmask(SIG_BLOCK, &set, nullptr);
+
+    _thread = thread([this, set] {
+        for (;;) {
+            int sig;
+            if (sigwait(&set, &sig) != 0 || _stop)
+                return;
+            report();
+        }
+    });
+}
+
+TelemetrySignalReporter::~TelemetrySignalReporter() {
+    _stop = true;
+    pthread_kill(_thread.native_handle(), _signo);
+    _thread.join();
+    report();
+}
+
+void TelemetrySignalReporter::report() {
+    string line = _telemetry.json() + "\n";
+    for (size_t done=0; done < line.size();) {
+        ssize_t n = write(_fd, line.data() + done, line.size() - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return; // nowhere to report it
+        done += n;
+    }
+}
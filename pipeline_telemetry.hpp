@@ -0,0 +1,120 @@
+#ifndef PIPELINE_TELEMETRY_HPP
+#define PIPELINE_TELEMETRY_HPP
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+/*  Per stage counters of a pipeline (pipeline.hpp): busy time, time spent waiting, bytes and
+    records, plus a histogram of the records in flight between reader and writer
+
+    runPipeline() fills in the "read" and "write" stages and the queue, the process function
+    times its own steps ("encrypt", "mac") with Timer. All counters are relaxed atomics, a
+    snapshot (json()) can be taken at any time from any thread.
+
+    Utilization is busy time over wall time times the stage's threads. The stage (or the pool
+    stages together as "compute") with the highest utilization is reported as the bottleneck:
+    "read" for a slow disk or a starving input pipe, "compute" for too few cores, "write" for
+    a slow output.
+*/
+class PipelineTelemetry {
+
+public:
+
+    static const unsigned MAX_STAGES = 8;
+    static const size_t QUEUE_BUCKETS = 64;  // occupancies from 63 on share the last bucket
+    static const size_t LATENCY_BUCKETS = 22; // busy time per record: <= 1 us, 2 us, 4 us ... 1 s, more
+
+    PipelineTelemetry();
+
+    PipelineTelemetry(const PipelineTelemetry&) = delete;
+    PipelineTelemetry& operator=(const PipelineTelemetry&) = delete;
+
+    /*  index of the stage called name, added on first use. pool_threads is 0 for a stage with a
+        thread of its own (reader, writer), the pool size for steps of the process function
+        throws std::length_error beyond MAX_STAGES stages */
+    unsigned stage(const std::string& name, unsigned pool_threads = 0);
+
+    void addBusy(unsigned stage, uint64_t ns, uint64_t bytes);
+    void addWait(unsigned stage, uint64_t ns);
+    void sampleQueue(size_t in_flight);
+
+    //  restart the wall clock (the constructor starts it)
+    void start();
+
+    //  snapshot of all counters as one JSON object (one line)
+    std::string json() const;
+
+    //  the same counters in Prometheus text exposition format, metric names start with salsa_pipeline_
+    std::string prometheus() const;
+
+    //  busy time of a stage from construction to destruction, a no-op for telemetry == nullptr
+    class Timer {
+        PipelineTelemetry* _telemetry;
+        unsigned _stage;
+        uint64_t _bytes;
+        std::chrono::steady_clock::time_point _start;
+    public:
+        Timer(PipelineTelemetry* telemetry, unsigned stage, uint64_t bytes)
+            : _telemetry(telemetry), _stage(stage), _bytes(bytes) {
+            if (_telemetry)
+                _start = std::chrono::steady_clock::now();
+        }
+        ~Timer() {
+            if (_telemetry)
+                _telemetry->addBusy(_stage, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                                std::chrono::steady_clock::now() - _start).count(), _bytes);
+        }
+        Timer(const Timer&) = delete;
+        Timer& operator=(const Timer&) = delete;
+    };
+
+private:
+
+    struct Stage {
+        std::string name;
+        unsigned threads = 1;
+        bool pooled = false;
+        std::atomic<uint64_t> busy_ns{0}, wait_ns{0}, bytes{0}, records{0};
+        std::atomic<uint64_t> latency[LATENCY_BUCKETS];
+    };
+
+    Stage _stages[MAX_STAGES];
+    std::atomic<unsigned> _nrStages{0};
+    std::mutex _mutex;  // adding stages
+    std::atomic<uint64_t> _queue[QUEUE_BUCKETS];
+    std::atomic<int64_t> _startNs;
+};
+
+/*  writes telemetry.json() as a line to fd whenever the process gets signo (SIGUSR1), and once
+    more when destroyed (at the end of the run)
+
+    Blocks signo in the constructing thread, so it has to be created before any other thread
+    (worker pool, pipeline) for all of them to inherit the mask and leave the signal to the
+    reporter's own thread.
+*/
+class TelemetrySignalReporter {
+
+    const PipelineTelemetry& _telemetry;
+    int _fd;
+    int _signo;
+    std::atomic<bool> _stop{false};
+    std::thread _thread;
+
+    void report();
+
+public:
+
+    TelemetrySignalReporter(const PipelineTelemetry& telemetry, int fd, int signo);
+    ~TelemetrySignalReporter();
+
+    TelemetrySignalReporter(const TelemetrySignalReporter&) = delete;
+    TelemetrySignalReporter& operator=(const TelemetrySignalReporter&) = delete;
+};
+
+#endif // PIPELINE_TELEMETRY_HPP
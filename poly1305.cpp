@@ -0,0 +1,132 @@
+#include <cstring> // memcpy
+#include <algorithm> // std::min
+
+#include "poly1305.hpp"
+
+using namespace std;
+
+/*  poly1305-donna style arithmetic: h and r in three limbs of 44, 44 and 42 bits,
+    products in 128 bit integers. r is clamped, s1/s2 are the precomputed 5*4*r[1], 5*4*r[2]
+    for the wraparound of 2^130 = 5 mod p */
+
+typedef unsigned __int128 u128;
+
+static const uint64_t MASK44 = 0xfffffffffff, MASK42 = 0x3ffffffffff;
+
+static inline uint64_t load64(const uint8_t* p) {
+    uint64_t v = 0;
+    for (unsigned i=0; i<8; i++)
+        v |= (uint64_t) p[i] << (8*i);
+    return v;
+}
+
+static inline void store64(uint8_t* p, uint64_t v) {
+    for (unsigned i=0; i<8; i++)
+        p[i] = v >> (8*i);
+}
+
+Poly1305::Poly1305(const uint8_t key[32]) {
+    uint64_t t0 = load64(key), t1 = load64(key+8);
+
+    // clamp r
+    _r[0] = t0 & 0xffc0fffffff;
+    _r[1] = ((t0 >> 44) | (t1 << 20)) & 0xfffffc0ffff;
+    _r[2] = (t1 >> 24) & 0x00ffffffc0f;
+
+    _pad[0] = load64(key+16);
+    _pad[1] = load64(key+24);
+}
+
+void Poly1305::blocks(const uint8_t* in, size_t len, uint64_t hibit) {
+    const uint64_t r0 = _r[0], r1 = _r[1], r2 = _r[2];
+    const uint64_t s1 = r1 * (5 << 2), s2 = r2 * (5 << 2);
+    uint64_t h0 = _h[0], h1 = _h[1], h2 = _h[2];
+
+    for (; len >= 16; in += 16, len -= 16) {
+        uint64_t t0 = load64(in), t1 = load64(in+8);
+        h0 += t0 & MASK44;
+        h1 += ((t0 >> 44) | (t1 << 20)) & MASK44;
+        h2 += ((t1 >> 24) & MASK42) | hibit;
+
+        u128 d0 = (u128) h0*r0 + (u128) h1*s2 + (u128) h2*s1;
+        u128 d1 = (u128) h0*r1 + (u128) h1*r0 + (u128) h2*s2;
+        u128 d2 = (u128) h0*r2 + (u128) h1*r1 + (u128) h2*r0;
+
+        uint64_t c = (uint64_t) (d0 >> 44); h0 = (uint64_t) d0 & MASK44;
+        d1 += c;  c = (uint64_t) (d1 >> 44); h1 = (uint64_t) d1 & MASK44;
+        d2 += c;  c = (uint64_t) (d2 >> 42); h2 = (uint64_t) d2 & MASK42;
+        h0 += c * 5; c = h0 >> 44; h0 &= MASK44;
+        h1 += c;
+    }
+
+    _h[0] = h0; _h[1] = h1; _h[2] = h2;
+}
+
+void Poly1305::update(const uint8_t* data, size_t len) {
+    if (_bufLen) {
+        size_t n = min(len, sizeof(_buf) - _bufLen);
+        memcpy(_buf + _bufLen, data, n);
+        _bufLen += n;
+        data += n;
+        len -= n;
+        if (_bufLen < sizeof(_buf))
+            return;
+        blocks(_buf, 16, (uint64_t) 1 << 40);
+        _bufLen = 0;
+    }
+
+    size_t full = len & ~(size_t) 15;
+    blocks(data, full, (uint64_t) 1 << 40);
+    memcpy(_buf, data + full, len - full);
+    _bufLen = len - full;
+}
+
+void Poly1305::final(uint8_t tag[16]) {
+    // last partial block gets a 1 byte appended instead of the high bit
+    if (_bufLen) {
+        _buf[_bufLen] = 1;
+        memset(_buf + _bufLen + 1, 0, sizeof(_buf) - _bufLen - 1);
+        blocks(_buf, 16, 0);
+    }
+
+    uint64_t h0 = _h[0], h1 = _h[1], h2 = _h[2], c;
+    c = h1 >> 44; h1 &= MASK44;
+    h2 += c;     c = h2 >> 42; h2 &= MASK42;
+    h0 += c * 5; c = h0 >> 44; h0 &= MASK44;
+    h1 += c;     c = h1 >> 44; h1 &= MASK44;
+    h2 += c;     c = h2 >> 42; h2 &= MASK42;
+    h0 += c * 5; c = h0 >> 44; h0 &= MASK44;
+    h1 += c;
+
+    // g = h + -p, select h or g without branching
+    uint64_t g0 = h0 + 5; c = g0 >> 44; g0 &= MASK44;
+    uint64_t g1 = h1 + c; c = g1 >> 44; g1 &= MASK44;
+    uint64_t g2 = h2 + c - ((uint64_t) 1 << 42);
+
+    c = (g2 >> 63) - 1; // all ones if h >= p
+    h0 = (h0 & ~c) | (g0 & c);
+    h1 = (h1 & ~c) | (g1 & c);
+    h2 = (h2 & ~c) | (g2 & c);
+
+    // h + s mod 2^128
+    uint64_t t0 = _pad[0], t1 = _pad[1];
+    h0 += t0 & MASK44;                         c = h0 >> 44; h0 &= MASK44;
+    h1 += (((t0 >> 44) | (t1 << 20)) & MASK44) + c; c = h1 >> 44; h1 &= MASK44;
+    h2 += ((t1 >> 24) & MASK42) + c;           h2 &= MASK42;
+
+    store64(tag, h0 | (h1 << 44));
+    store64(tag+8, (h1 >> 20) | (h2 << 24));
+}
+
+void poly1305(uint8_t tag[16], const uint8_t key[32], const uint8_t* in, size_t len) {
+    Poly1305 mac(key);
+    mac.update(in, len);
+    mac.final(tag);
+}
+
+bool poly1305Equal(const uint8_t a[16], const uint8_t b[16]) {
+    uint8_t diff = 0;
+    for (unsigned i=0; i<16; i++)
+        diff |= a[i] ^ b[i];
+    return diff == 0;
+}
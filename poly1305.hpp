@@ -0,0 +1,41 @@
+#ifndef POLY1305_HPP
+#define POLY1305_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*  Poly1305 one-time authenticator (RFC 8439)
+
+    The key (r, s) must never be used for two messages. The AEAD constructions of this
+    library take it from the first keystream block under the message nonce, like
+    ChaCha20-Poly1305 does.
+*/
+
+// incremental Poly1305 with 64 bit limbs (44/44/42 bits)
+class Poly1305 {
+
+    uint64_t _r[3];
+    uint64_t _h[3] = {0, 0, 0};
+    uint64_t _pad[2];
+    uint8_t _buf[16];
+    size_t _bufLen = 0;
+
+    void blocks(const uint8_t* in, size_t len, uint64_t hibit);
+
+public:
+
+    explicit Poly1305(const uint8_t key[32]);
+
+    void update(const uint8_t* data, size_t len);
+
+    //  writes the 16 byte tag, the object can't be updated afterwards
+    void final(uint8_t tag[16]);
+};
+
+//  one-shot Poly1305
+void poly1305(uint8_t tag[16], const uint8_t key[32], const uint8_t* in, size_t len);
+
+//  compare two tags in constant time
+bool poly1305Equal(const uint8_t a[16], const uint8_t b[16]);
+
+#endif // POLY1305_HPP
@@ -7,6 +7,7 @@
 #include <stdexcept> //std::length_error, std::invalid_argument
 
 #include "salsa20.hpp"
+#include "snuffle_kernels.hpp"
 
 using namespace std;
 
@@ -47,7 +48,7 @@ SnuffleStreamCipher::SnuffleStreamCipher(const string key_str, const bool hex_ke
             _key[j] = charsToLittleEndianWord(key_str, i);
 
         // if short key, copy same key in other half of key blocks
-        if (key_str.length() == 32) { 
+        if (key_str.length() == 16) { 
             memcpy(&_key[4], &_key[0], sizeof(_key[0])*4);
             _inputKeyLength = 16;
         } else {
@@ -84,14 +85,12 @@ SnuffleStreamCipher::SnuffleStreamCipher(const vector<uint8_t> key) {
     if (!(key.size()==16 || key.size()==32))
         throw length_error("Keylength has to be 16 or 32 byte");
 
-    uint32_t key_words[8];
-
     for (uint8_t i=0, j=0; (i < (key.size() / 4) && j < key.size()); i++, j+=4)
-        key_words[i] = littleEndianWordFromBytes(&key[j]);
+        _key[i] = littleEndianWordFromBytes(&key[j]);
 
     // if keysize 16 byte duplicate into the remaining 16 byte
     if (key.size() == 16) {
-        memcpy(&key_words[4], &key_words[0], 4*sizeof(key_words));
+        memcpy(&_key[4], &_key[0], 4*sizeof(_key[0]));
         _inputKeyLength = 16;
     } else
         _inputKeyLength = 32;
@@ -122,7 +121,7 @@ uint32_t SnuffleStreamCipher::rotate(const uint32_t val, const uint8_t bits) {
 void SnuffleStreamCipher::keyStreamBlock(uint8_t* out_block) {
 
     // make copy of matrix as we need the original matrix later 
-    static uint32_t state[4][4];
+    uint32_t state[4][4];
     memcpy(&state, &_matrix, sizeof(_matrix));
     
     // 10 double-rounds -> 20 rounds
@@ -152,36 +151,76 @@ void SnuffleStreamCipher::keyStreamBlock(uint8_t* out_block) {
     (-> start keystream at 3*64+1=193th byte instead of first)
     this way you can decrypt a part of a large stream without decrypting everything before this part
 
-    TODO: implement for byte offset instead (64byte) block offset */
-void SnuffleStreamCipher::skipBlocks(unsigned nr_blocks) {
-    for (; nr_blocks > 0; nr_blocks--)
-        incrementCounter();
+    counter is 64 bit wide and wraps around like incrementCounter() does */
+void SnuffleStreamCipher::skipBlocks(uint64_t nr_blocks) {
+    setCounter(counter() + nr_blocks);
+    _blockPos = 64;
+}
+
+/*  position keystream at byte_offset of the stream for the current nonce
+    the block containing byte_offset is generated right away if byte_offset is not block aligned,
+    its remaining bytes are used by the next call to encryptBytes() */
+void SnuffleStreamCipher::seek(uint64_t byte_offset) {
+    setCounter(byte_offset / 64);
+    _blockPos = 64;
+
+    if (byte_offset % 64) {
+        keyStreamBlock(_blockBuf);
+        _blockPos = byte_offset % 64;
+    }
 }
 
-// encrypt num_bytes bytes from input into output
+/*  encrypt num_bytes bytes from input into output
+    keystream not used up by the last call (partial block) is used first, so encrypting
+    a message in several calls of arbitrary size gives the same result as a single call.
+    Whole blocks go through the stateless kernels of snuffle_kernels.hpp at the current counter */
 void SnuffleStreamCipher::encryptBytes(const uint8_t* input, uint8_t* output, const size_t num_bytes) {
     assert(input != nullptr && output != nullptr);
-    if (num_bytes==0) return;
+    size_t len = num_bytes;
+
+    // rest of the last block
+    for (; len && _blockPos < 64; len--)
+        *(output++) = _blockBuf[_blockPos++] ^ *(input++);
+
+    const size_t bulk = len / 64 * 64;
+    if (bulk) {
+        const unsigned ni = snuffleNonceIndex(variant());
+        uint8_t nonce[8];
+        bytesFromLittleEndianWord(_matrix[ni/4][ni%4], nonce);
+        bytesFromLittleEndianWord(_matrix[(ni+1)/4][(ni+1)%4], nonce+4);
+
+        snuffleXorKeystream(keyContext(), nonce, counter(), input, output, bulk);
+        setCounter(counter() + bulk/64);
+        input += bulk;
+        output += bulk;
+        len -= bulk;
+    }
 
-    // allocate once and reuse it
-    static uint8_t block_buf[64] ={0};
-    
-    for (size_t i=0; i<num_bytes; i++) {
-
-        // get new block of keystream after every 64 bytes
-        if (i%64 == 0) 
-            keyStreamBlock(block_buf);
-        
-        // xor input byte with keystream byte incrementing pointers
-        *(output++) = block_buf[(i%64)] ^ *(input++);
+    if (len) {
+        keyStreamBlock(_blockBuf);
+        _blockPos = 0;
+        for (; len; len--)
+            *(output++) = _blockBuf[_blockPos++] ^ *(input++);
     }
 }
 
+// copy of _matrix without nonce and counter
+SnuffleKeyContext SnuffleStreamCipher::keyContext() const {
+    SnuffleKeyContext ctx;
+    ctx.variant = variant();
+    memcpy(ctx.matrix, _matrix, sizeof(ctx.matrix));
+
+    const unsigned ni = snuffleNonceIndex(ctx.variant), ci = snuffleCounterIndex(ctx.variant);
+    ctx.matrix[ni] = ctx.matrix[ni+1] = 0;
+    ctx.matrix[ci] = ctx.matrix[ci+1] = 0;
+    return ctx;
+}
+
 // wrapper to use encrytBytes with std::vector
 void SnuffleStreamCipher::encryptBytes(const vector<uint8_t>& input, vector<uint8_t>& output) {
     if (input.size() == 0) return;
 
-    output.reserve(input.size());
+    output.resize(input.size());
     encryptBytes(input.data(), output.data(), input.size());
 }
 
@@ -292,13 +331,24 @@ void Salsa20::incrementCounter() {
         _matrix[2][1]++; 
 }
 
+// 64bit block counter, low word first
+uint64_t Salsa20::counter() const {
+    return ((uint64_t) _matrix[2][1] << 32) | _matrix[2][0];
+}
+
+void Salsa20::setCounter(const uint64_t counter) {
+    _matrix[2][0] = (uint32_t) counter;
+    _matrix[2][1] = (uint32_t) (counter >> 32);
+}
+
 // set nonce to nonce, set counter to 0 as nonce is used as IV
 void Salsa20::setNonce(const uint64_t nonce) {
     
     _matrix[1][2] = (uint32_t) ((nonce & 0xffffffff00000000) >> 32);
-    _matrix[1][3] = (uint32_t) ((nonce & 0x00000000ffffffff) >> 32);
+    _matrix[1][3] = (uint32_t) (nonce & 0x00000000ffffffff);
     _matrix[2][0] = 0;
     _matrix[2][1] = 0;
+    _blockPos = 64;
 }
 
 /*  nonce/IV interpreted as hex chars
@@ -315,6 +365,7 @@ void Salsa20::setNonce(const string hex_str) {
     _matrix[1][3] = hexCharsToLittleEndianWord(hex_str, 8);
     _matrix[2][0] = 0;
     _matrix[2][1] = 0;
+    _blockPos = 64;
 }
 
 
@@ -390,13 +441,24 @@ void Chacha20::incrementCounter() {
         _matrix[3][1]++; 
 }
 
+// 64bit block counter, low word first
+uint64_t Chacha20::counter() const {
+    return ((uint64_t) _matrix[3][1] << 32) | _matrix[3][0];
+}
+
+void Chacha20::setCounter(const uint64_t counter) {
+    _matrix[3][0] = (uint32_t) counter;
+    _matrix[3][1] = (uint32_t) (counter >> 32);
+}
+
 // set nonce to nonce, set counter to 0 as nonce is used as IV
 void Chacha20::setNonce(const uint64_t nonce) {
     
     _matrix[3][0] = 0;
     _matrix[3][1] = 0;
     _matrix[3][2] = (uint32_t) ((nonce & 0xffffffff00000000) >> 32);
-    _matrix[3][3] = (uint32_t) ((nonce & 0x00000000ffffffff) >> 32);
+    _matrix[3][3] = (uint32_t) (nonce & 0x00000000ffffffff);
+    _blockPos = 64;
 }
 
 /*  nonce/IV interpreted as hex chars
@@ -413,4 +475,5 @@ void Chacha20::setNonce(const string hex_str) {
     _matrix[3][1] = 0;
     _matrix[3][2] = hexCharsToLittleEndianWord(hex_str, 0);
     _matrix[3][3] = hexCharsToLittleEndianWord(hex_str, 8);
+    _blockPos = 64;
 }
\ No newline at end of file
@@ -4,6 +4,8 @@
 #include <string>
 #include <vector>
 
+#include "snuffle_core.hpp"
+
 /*  
     Implementation of Salsa20 and Chacha20 stream ciphers from D.J. Bernstein
     More info at: http://cr.yp.to/snuffle.html and https://cr.yp.to/chacha.html
@@ -31,6 +33,8 @@ protected:
     virtual void initMatrix(const uint32_t key[8], const size_t key_bytelen) = 0;
     virtual void doubleRound(uint32_t state[4][4]) = 0;
     virtual void incrementCounter() = 0;
+    virtual uint64_t counter() const = 0;
+    virtual void setCounter(const uint64_t counter) = 0;
 
     // used by both
     uint32_t charsToLittleEndianWord(const std::string, size_t);
@@ -45,6 +49,11 @@ protected:
     uint32_t _key[8];
     size_t  _inputKeyLength;
 
+    /*  keystream left over from the last block of the previous encryptBytes() call
+        _blockPos == 64 means there is none left and a new block has to be generated */
+    uint8_t _blockBuf[64] = {0};
+    uint8_t _blockPos = 64;
+
     /*  constructors for key as string or byte sequence
         in case of key string, if hex_key set it will get interpreted as hex chars
 
@@ -64,18 +73,28 @@ public:
     virtual void setNonce(const std::string nonce_hex) = 0;
     virtual void setNonce(const uint64_t nonce) = 0;
 
+    virtual SnuffleVariant variant() const = 0;
+
+    /*  constants and key as SnuffleKeyContext for the functions of snuffle_core.hpp
+        (nonce and counter words are 0) */
+    SnuffleKeyContext keyContext() const;
+
     /*  start keystream generation after nr_blocks*64byte.
         use this to init keystream generation with counter > 0
 
         i.e.: using skipBlocks(3) before en-/decryption, the first call to keyStreamBlock() will yield the 4th block of keystream
         (-> start keystream at 3*64+1=193th byte instead of first)
-        this way you can decrypt a part of a large stream without decrypting everything before this part
+        this way you can decrypt a part of a large stream without decrypting everything before this part */
+    void skipBlocks(uint64_t nr_blocks);
 
-        TODO: implement for byte offset instead 64byte block offset */
-    void skipBlocks(unsigned nr_blocks);
+    /*  position the keystream at byte_offset relative to the start of the stream for the current nonce
+        (counter = byte_offset/64, the first byte_offset%64 bytes of that block are skipped)
+        O(1), the next encryptBytes() call starts at exactly this offset */
+    void seek(uint64_t byte_offset);
 
     /*  encrypt bytes from input into output
-        input will stay unchanged */
+        input will stay unchanged
+        consecutive calls continue the keystream where the last call stopped (also mid-block) */
     void encryptBytes(const uint8_t* input, uint8_t* output, const size_t num_bytes);
     void encryptBytes(const std::vector<uint8_t>& input, std::vector<uint8_t>& output);
 
@@ -96,6 +115,8 @@ class Salsa20 : public SnuffleStreamCipher {
     void columnRound(uint32_t state[4][4]); // different to Chacha20::columnRound
     void doubleRound(uint32_t state[4][4]);
     void incrementCounter();
+    uint64_t counter() const;
+    void setCounter(const uint64_t counter);
 
 public:
 
@@ -110,6 +131,8 @@ public:
     //  set Nonce/IV, will also set counter to 0
     void setNonce(const std::string nonce_hex);
     void setNonce(const uint64_t nonce);
+
+    SnuffleVariant variant() const { return SnuffleVariant::Salsa20; };
 };
 
 
@@ -123,6 +146,8 @@ class Chacha20 : public SnuffleStreamCipher {
     void columnRound(uint32_t state[4][4]); // different so Salsa20::columnRound
     void doubleRound(uint32_t state[4][4]);
     void incrementCounter();
+    uint64_t counter() const;
+    void setCounter(const uint64_t counter);
 
 public:
 
@@ -136,6 +161,8 @@ public:
 
     void setNonce(const std::string nonce_hex);
     void setNonce(const uint64_t nonce);
+
+    SnuffleVariant variant() const { return SnuffleVariant::Chacha20; };
 };
 
 #endif // SALSA20_HPP
\ No newline at end of file
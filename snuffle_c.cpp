@@ -0,0 +1,330 @@
+#include <cstring> // memcpy
+#include <new> // std::nothrow
+#include <vector>
+#include <algorithm> // min
+
+#include "snuffle_c.h"
+#include "snuffle_core.hpp"
+#include "snuffle_kernels.hpp"
+#include "crc32c.hpp"
+
+/*  Implementation of the flat C interface on top of snuffle_core.hpp
+    All entry points validate their arguments up front and catch everything,
+    so callers only ever see status codes. */
+
+struct snuffle_stream {
+    SnuffleKeyContext key;
+    uint8_t nonce[8];
+    uint64_t counter;       // next block to generate
+    uint8_t block[64];      // last generated block
+    unsigned block_pos;     // bytes of block already used, 64 = none left
+    bool queued;            // block is still waiting in a lane queue of snuffle_xor_streams()
+};
+
+// xor len bytes of keystream continuing at the position of s, whole blocks go through the lane kernels
+static void xorStream(snuffle_stream* s, const uint8_t* input, uint8_t* output, size_t len) {
+
+    // rest of the last partial block first
+    for (; len && s->block_pos < 64; len--)
+        *(output++) = *(input++) ^ s->block[s->block_pos++];
+    if (!len) return;
+
+    size_t bulk = len / 64 * 64;
+    snuffleXorKeystream(s->key, s->nonce, s->counter, input, output, bulk);
+    s->counter += bulk / 64;
+    input += bulk;
+    output += bulk;
+    len -= bulk;
+    if (!len) return;
+
+    uint32_t state[16];
+    snuffleInitState(state, s->key, s->nonce, s->counter++);
+    snuffleBlock(s->key.variant, state, s->block);
+    for (size_t i=0; i<len; i++)
+        output[i] = input[i] ^ s->block[i];
+    s->block_pos = len;
+}
+
+// xorStream() for a few bytes, with checksums taken separately
+static void xorStreamCrc(snuffle_stream* s, const uint8_t* input, uint8_t* output, size_t len,
+                         uint32_t* input_crc, uint32_t* output_crc) {
+    if (input_crc)
+        *input_crc = crc32c(*input_crc, input, len);
+    xorStream(s, input, output, len);
+    if (output_crc)
+        *output_crc = crc32c(*output_crc, output, len);
+}
+
+static bool validBatch(const void* inputs, const void* outputs, const size_t* lens, size_t count) {
+    return count == 0 || (inputs && outputs && lens);
+}
+
+using namespace std;
+
+extern "C" {
+
+const char* snuffle_strerror(int status) {
+    switch (status) {
+        case SNUFFLE_OK:            return "ok";
+        case SNUFFLE_ERR_ARG:       return "invalid argument";
+        case SNUFFLE_ERR_KEYLEN:    return "key has to be 16 or 32 bytes";
+        case SNUFFLE_ERR_NOMEM:     return "out of memory";
+        case SNUFFLE_ERR_INTERNAL:  return "internal error";
+        default:                    return "unknown status";
+    }
+}
+
+int snuffle_new(snuffle_stream** out, int variant, const uint8_t* key, size_t key_len, const uint8_t* nonce) {
+    if (!out || !key || !(variant == SNUFFLE_SALSA20 || variant == SNUFFLE_CHACHA20))
+        return SNUFFLE_ERR_ARG;
+    if (!(key_len == 16 || key_len == 32))
+        return SNUFFLE_ERR_KEYLEN;
+
+    snuffle_stream* s = new (std::nothrow) snuffle_stream;
+    if (!s)
+        return SNUFFLE_ERR_NOMEM;
+
+    try {
+        snuffleInitKey(s->key, variant == SNUFFLE_SALSA20 ? SnuffleVariant::Salsa20 : SnuffleVariant::Chacha20,
+                       key, key_len);
+    } catch (...) {
+        delete s;
+        return SNUFFLE_ERR_INTERNAL;
+    }
+
+    snuffle_set_nonce(s, nonce);
+    *out = s;
+    return SNUFFLE_OK;
+}
+
+void snuffle_free(snuffle_stream* stream) {
+    delete stream;
+}
+
+int snuffle_set_nonce(snuffle_stream* stream, const uint8_t* nonce) {
+    if (!stream)
+        return SNUFFLE_ERR_ARG;
+
+    if (nonce)
+        memcpy(stream->nonce, nonce, 8);
+    else
+        memset(stream->nonce, 0, 8);
+    stream->counter = 0;
+    stream->block_pos = 64;
+    stream->queued = false;
+    return SNUFFLE_OK;
+}
+
+int snuffle_seek(snuffle_stream* stream, uint64_t byte_offset) {
+    if (!stream)
+        return SNUFFLE_ERR_ARG;
+
+    stream->counter = byte_offset / 64;
+    stream->block_pos = 64;
+
+    if (byte_offset % 64) {
+        uint32_t state[16];
+        snuffleInitState(state, stream->key, stream->nonce, stream->counter++);
+        snuffleBlock(stream->key.variant, state, stream->block);
+        stream->block_pos = byte_offset % 64;
+    }
+    return SNUFFLE_OK;
+}
+
+int snuffle_xor(snuffle_stream* stream, const uint8_t* input, uint8_t* output, size_t len) {
+    if (!stream || (len && !(input && output)))
+        return SNUFFLE_ERR_ARG;
+
+    xorStream(stream, input, output, len);
+    return SNUFFLE_OK;
+}
+
+int snuffle_xor_crc32c(snuffle_stream* stream, const uint8_t* input, uint8_t* output, size_t len,
+                       uint32_t* input_crc, uint32_t* output_crc) {
+    if (!stream || (len && !(input && output)))
+        return SNUFFLE_ERR_ARG;
+
+    // rest of the partial block, whole blocks in the fused kernel, the tail through the block buffer
+    size_t head = stream->block_pos < 64 ? 64 - stream->block_pos : 0;
+    head = head < len ? head : len;
+    xorStreamCrc(stream, input, output, head, input_crc, output_crc);
+
+    size_t bulk = (len - head) / 64 * 64;
+    snuffleXorCrc32c(stream->key, stream->nonce, stream->counter, input + head, output + head, bulk,
+                     input_crc, output_crc);
+    stream->counter += bulk / 64;
+
+    xorStreamCrc(stream, input + head + bulk, output + head + bulk, len - head - bulk, input_crc, output_crc);
+    return SNUFFLE_OK;
+}
+
+int snuffle_xor_buffers(snuffle_stream* stream, const uint8_t* const* inputs, uint8_t* const* outputs,
+                        const size_t* lens, size_t count) {
+    if (!stream || !validBatch(inputs, outputs, lens, count))
+        return SNUFFLE_ERR_ARG;
+    for (size_t i=0; i<count; i++)
+        if (lens[i] && !(inputs[i] && outputs[i]))
+            return SNUFFLE_ERR_ARG;
+
+    /*  The buffers are one run of keystream. Long buffers go straight through the lane kernel,
+        short ones share SNUFFLE_LANES blocks generated at once across buffer boundaries */
+    size_t remaining = 0;
+    for (size_t i=0; i<count; i++)
+        remaining += lens[i];
+
+    uint8_t ks[64*SNUFFLE_LANES];
+    size_t ks_pos = 0, ks_len = 0;
+
+    for (size_t i=0; i<count; i++) {
+        const uint8_t* in = inputs[i];
+        uint8_t* out = outputs[i];
+        size_t len = lens[i];
+
+        while (len) {
+            size_t n;
+            if (stream->block_pos < 64) {
+                n = min<size_t>(len, 64 - stream->block_pos);
+                for (size_t j=0; j<n; j++)
+                    out[j] = in[j] ^ stream->block[stream->block_pos++];
+            } else if (ks_pos < ks_len) {
+                n = min(len, ks_len - ks_pos);
+                for (size_t j=0; j<n; j++)
+                    out[j] = in[j] ^ ks[ks_pos++];
+            } else if (len >= sizeof(ks)) {
+                n = len / 64 * 64;
+                snuffleXorKeystream(stream->key, stream->nonce, stream->counter, in, out, n);
+                stream->counter += n / 64;
+            } else {
+                size_t nblocks = min<size_t>(SNUFFLE_LANES, (remaining + 63) / 64);
+                snuffleKeystream(stream->key, stream->nonce, stream->counter, ks, nblocks);
+                stream->counter += nblocks;
+                ks_pos = 0;
+                ks_len = 64 * nblocks;
+                continue;
+            }
+            in += n;
+            out += n;
+            len -= n;
+            remaining -= n;
+        }
+    }
+
+    // the last generated block is the partial block of the stream from here on
+    if (ks_pos < ks_len) {
+        memcpy(stream->block, ks + ks_len - 64, 64);
+        stream->block_pos = ks_pos - (ks_len - 64);
+    }
+    return SNUFFLE_OK;
+}
+
+int snuffle_xor_streams(snuffle_stream* const* streams, const uint8_t* const* inputs, uint8_t* const* outputs,
+                        const size_t* lens, size_t count) {
+    if (!validBatch(inputs, outputs, lens, count) || (count && !streams))
+        return SNUFFLE_ERR_ARG;
+    for (size_t i=0; i<count; i++)
+        if (!streams[i] || (lens[i] && !(inputs[i] && outputs[i])))
+            return SNUFFLE_ERR_ARG;
+
+    /*  Whole blocks of all streams share the lanes. The block a stream ends in is generated into
+        its block buffer and the tail xored from there after the lanes ran; a stream showing up
+        again before that flushes the queue first */
+    struct Tail {
+        snuffle_stream* stream;
+        const uint8_t* input;
+        uint8_t* output;
+        size_t len;
+    };
+    static const uint8_t zeros[64] = {0};
+    SnuffleVariant variant = count ? streams[0]->key.variant : SnuffleVariant::Salsa20;
+    SnuffleLaneQueue lanes(variant);
+    vector<Tail> tails;
+    try {
+        tails.reserve(count);   // the only allocation, made before any stream moves on
+    } catch (...) {
+        return SNUFFLE_ERR_NOMEM;
+    }
+
+    auto finishTails = [&]() {
+        lanes.flush();
+        for (const Tail& t : tails) {
+            for (size_t j=0; j<t.len; j++)
+                t.output[j] = t.input[j] ^ t.stream->block[j];
+            t.stream->block_pos = t.len;
+            t.stream->queued = false;
+        }
+        tails.clear();
+    };
+
+    for (size_t i=0; i<count; i++) {
+        snuffle_stream* s = streams[i];
+        const uint8_t* in = inputs[i];
+        uint8_t* out = outputs[i];
+        size_t len = lens[i];
+        if (!len)
+            continue;
+        if (s->queued || s->key.variant != variant) {
+            finishTails();
+            if (s->key.variant != variant) {
+                variant = s->key.variant;
+                lanes = SnuffleLaneQueue(variant);
+            }
+        }
+
+        size_t head = s->block_pos < 64 ? min<size_t>(len, 64 - s->block_pos) : 0;
+        xorStream(s, in, out, head);
+        in += head;
+        out += head;
+        len -= head;
+        if (!len)
+            continue;
+
+        if (len >= 64*SNUFFLE_LANES) {
+            size_t bulk = len / 64 * 64;
+            snuffleXorKeystream(s->key, s->nonce, s->counter, in, out, bulk);
+            s->counter += bulk / 64;
+            in += bulk;
+            out += bulk;
+            len -= bulk;
+            if (!len)
+                continue;
+        }
+
+        uint32_t state[16];
+        snuffleInitState(state, s->key, s->nonce, s->counter);
+        size_t whole = len / 64 * 64;
+        lanes.addData(state, s->counter, in, out, whole);
+        s->counter += whole / 64;
+        if (whole < len) {
+            lanes.add(state, s->counter++, zeros, s->block, 64);
+            s->queued = true;
+            tails.push_back({s, in + whole, out + whole, len - whole});
+        }
+    }
+    finishTails();
+    return SNUFFLE_OK;
+}
+
+int snuffle_xor_messages(const snuffle_stream* stream, const uint8_t* nonces, const uint8_t* const* inputs,
+                         uint8_t* const* outputs, const size_t* lens, size_t count) {
+    if (!stream || !validBatch(inputs, outputs, lens, count) || (count && !nonces))
+        return SNUFFLE_ERR_ARG;
+    for (size_t i=0; i<count; i++)
+        if (lens[i] && !(inputs[i] && outputs[i]))
+            return SNUFFLE_ERR_ARG;
+
+    // long messages through the lane kernel, short ones and the ends of long ones share the lanes
+    SnuffleLaneQueue lanes(stream->key.variant);
+    uint32_t state[16];
+    for (size_t i=0; i<count; i++) {
+        if (!lens[i])
+            continue;
+        size_t bulk = lens[i] / (64*SNUFFLE_LANES) * (64*SNUFFLE_LANES);
+        snuffleXorKeystream(stream->key, nonces + 8*i, 0, inputs[i], outputs[i], bulk);
+        snuffleInitState(state, stream->key, nonces + 8*i, 0);
+        lanes.addData(state, bulk / 64, inputs[i] + bulk, outputs[i] + bulk, lens[i] - bulk);
+    }
+    lanes.flush();
+    return SNUFFLE_OK;
+}
+
+} // extern "C"
@@ -0,0 +1,80 @@
+#ifndef SNUFFLE_C_H
+#define SNUFFLE_C_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*  Flat C interface to Salsa20 and Chacha20 for FFI consumers (ctypes, cgo, ...)
+
+    - opaque handles, keys and nonces as raw bytes (no hex strings)
+    - every function returns a status code, no C++ exception ever crosses this boundary
+    - batch functions handle many buffers or many streams in a single call,
+      so per buffer cost is not dominated by the FFI crossing
+
+    A handle is a key plus a stream position (nonce, block counter, unused keystream of the
+    last partial block). Handles are not thread safe, use one per thread or per stream.
+    Built into libsalsa.so by `make libsalsa.so`.
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum snuffle_variant {
+    SNUFFLE_SALSA20  = 0,
+    SNUFFLE_CHACHA20 = 1
+};
+
+enum snuffle_status {
+    SNUFFLE_OK          =  0,
+    SNUFFLE_ERR_ARG     = -1,   // null pointer or unknown variant
+    SNUFFLE_ERR_KEYLEN  = -2,   // key not 16 or 32 bytes
+    SNUFFLE_ERR_NOMEM   = -3,
+    SNUFFLE_ERR_INTERNAL = -4
+};
+
+typedef struct snuffle_stream snuffle_stream;
+
+// human readable description of a status code
+const char* snuffle_strerror(int status);
+
+/*  new stream for key (16 or 32 bytes) and 8 byte nonce, counter 0
+    nonce may be NULL for an all zero nonce */
+int snuffle_new(snuffle_stream** out, int variant, const uint8_t* key, size_t key_len, const uint8_t* nonce);
+void snuffle_free(snuffle_stream* stream);
+
+// set nonce and rewind to the start of its keystream
+int snuffle_set_nonce(snuffle_stream* stream, const uint8_t* nonce);
+
+// position the keystream at byte_offset of the stream for the current nonce
+int snuffle_seek(snuffle_stream* stream, uint64_t byte_offset);
+
+/*  xor len bytes of keystream into output (input == output is fine)
+    consecutive calls continue the keystream */
+int snuffle_xor(snuffle_stream* stream, const uint8_t* input, uint8_t* output, size_t len);
+
+/*  snuffle_xor() plus the CRC32C of input and/or output, computed in the same pass over the data
+    input_crc / output_crc are running values (0 to start, the last result to continue a checksum
+    over several calls), either may be NULL to skip it */
+int snuffle_xor_crc32c(snuffle_stream* stream, const uint8_t* input, uint8_t* output, size_t len,
+                       uint32_t* input_crc, uint32_t* output_crc);
+
+/*  batch: count buffers one after another on the same stream (scatter/gather),
+    same result as count calls to snuffle_xor() */
+int snuffle_xor_buffers(snuffle_stream* stream, const uint8_t* const* inputs, uint8_t* const* outputs,
+                        const size_t* lens, size_t count);
+
+//  batch: buffer i on stream i, for count independent streams
+int snuffle_xor_streams(snuffle_stream* const* streams, const uint8_t* const* inputs, uint8_t* const* outputs,
+                        const size_t* lens, size_t count);
+
+/*  batch: count independent messages under the key of stream, message i with the 8 byte nonce at
+    nonces + 8*i starting at counter 0. The position of stream is neither used nor changed */
+int snuffle_xor_messages(const snuffle_stream* stream, const uint8_t* nonces, const uint8_t* const* inputs,
+                         uint8_t* const* outputs, const size_t* lens, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SNUFFLE_C_H
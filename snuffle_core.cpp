@@ -0,0 +1,5 @@
+/*  library build of the core functions declared in snuffle_core.hpp
+    (translation units defining SNUFFLE_HEADER_ONLY get their own inline copies instead) */
+
+#define SNUFFLE_CORE_IMPLEMENTATION
+#include "snuffle_core.hpp"
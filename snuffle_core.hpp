@@ -0,0 +1,221 @@
+#ifndef SNUFFLE_CORE_HPP
+#define SNUFFLE_CORE_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*  Core of Salsa20 and Chacha20 without the class machinery of salsa20.hpp:
+    an expanded key context, the block functions and en-/decryption of small messages.
+    No virtual calls, no hidden state. All state is passed in, so these are thread safe.
+
+    Build modes:
+    By default the functions are compiled once into snuffle_core.o and called like any library function.
+    Defining SNUFFLE_HEADER_ONLY before including this header turns them into static inline functions
+    of the including translation unit instead, so the compiler can inline them into the caller and
+    constant propagate variant, message length etc. Worth it for hot paths with messages of a few
+    dozen bytes where call overhead is a big part of the work.
+    Large message kernels stay in the compiled library either way.
+
+    State layout (16 words, row major like SnuffleStreamCipher::_matrix):
+    Salsa20:  const key   key   key  | key   const nonce nonce | ctr   ctr   const key | key key key const
+    Chacha20: const const const const| key   key   key   key   | key   key   key   key | ctr ctr nonce nonce
+*/
+
+#if defined(SNUFFLE_HEADER_ONLY)
+#define SNUFFLE_CORE_API static inline
+#else
+#define SNUFFLE_CORE_API
+#endif
+
+enum class SnuffleVariant : uint8_t { Salsa20, Chacha20 };
+
+/*  expanded key: the 16 word input matrix with constants and key filled in,
+    nonce and counter words are 0. Build once per key and copy freely */
+struct SnuffleKeyContext {
+    uint32_t matrix[16];
+    SnuffleVariant variant;
+};
+
+// word index of the low counter word (high word follows) in the state
+constexpr unsigned snuffleCounterIndex(SnuffleVariant variant) {
+    return variant == SnuffleVariant::Salsa20 ? 8 : 12;
+}
+
+// word index of the first nonce word (second word follows) in the state
+constexpr unsigned snuffleNonceIndex(SnuffleVariant variant) {
+    return variant == SnuffleVariant::Salsa20 ? 6 : 14;
+}
+
+/*  fill ctx for a 16 or 32 byte key (16 byte keys get duplicated like in SnuffleStreamCipher)
+    throws std::length_error for other key sizes */
+SNUFFLE_CORE_API void snuffleInitKey(SnuffleKeyContext& ctx, SnuffleVariant variant, const uint8_t* key, size_t key_len);
+
+//  state = key context + nonce (8 bytes as in setNonce(hex_str)) + 64 bit block counter
+SNUFFLE_CORE_API void snuffleInitState(uint32_t state[16], const SnuffleKeyContext& ctx, const uint8_t nonce[8], uint64_t counter);
+
+// one block (64 byte) of keystream for state, state itself is not changed (counter is not incremented)
+SNUFFLE_CORE_API void snuffleSalsa20Block(const uint32_t state[16], uint8_t out[64]);
+SNUFFLE_CORE_API void snuffleChacha20Block(const uint32_t state[16], uint8_t out[64]);
+SNUFFLE_CORE_API void snuffleBlock(SnuffleVariant variant, const uint32_t state[16], uint8_t out[64]);
+
+/*  xor len bytes of keystream, starting at block counter, into output
+    meant for small messages, bulk data should go through the kernels of the library */
+SNUFFLE_CORE_API void snuffleXorSmall(const SnuffleKeyContext& ctx, const uint8_t nonce[8], uint64_t counter,
+                                      const uint8_t* input, uint8_t* output, size_t len);
+
+
+#if defined(SNUFFLE_HEADER_ONLY) || defined(SNUFFLE_CORE_IMPLEMENTATION)
+
+#include <cstring>      // memcpy
+#include <stdexcept>    // std::length_error
+
+static inline uint32_t snuffleLoad32(const uint8_t* bytes) {
+    return  (uint32_t) bytes[0] |
+            ((uint32_t) bytes[1] <<  8) |
+            ((uint32_t) bytes[2] << 16) |
+            ((uint32_t) bytes[3] << 24);
+}
+
+static inline void snuffleStore32(uint8_t* bytes, uint32_t word) {
+    bytes[0] = word;
+    bytes[1] = word >> 8;
+    bytes[2] = word >> 16;
+    bytes[3] = word >> 24;
+}
+
+static inline uint32_t snuffleRotate(uint32_t val, unsigned bits) {
+    return (val << bits) | (val >> (32 - bits));
+}
+
+SNUFFLE_CORE_API void snuffleInitKey(SnuffleKeyContext& ctx, SnuffleVariant variant, const uint8_t* key, size_t key_len) {
+    if (!(key_len == 16 || key_len == 32))
+        throw std::length_error("Keylength has to be 16 or 32 byte");
+
+    static const char constants_32byte_key[17] = "expand 32-byte k";
+    static const char constants_16byte_key[17] = "expand 16-byte k";
+    const uint8_t* c = (const uint8_t*) (key_len == 32 ? constants_32byte_key : constants_16byte_key);
+
+    uint32_t k[8];
+    for (unsigned i=0; i<8; i++)
+        k[i] = snuffleLoad32(key + (4*i) % key_len);
+
+    uint32_t* m = ctx.matrix;
+    ctx.variant = variant;
+
+    if (variant == SnuffleVariant::Salsa20) {
+        m[0]  = snuffleLoad32(c);    m[1]  = k[0];                m[2]  = k[1];                 m[3]  = k[2];
+        m[4]  = k[3];                m[5]  = snuffleLoad32(c+4);  m[6]  = 0;                    m[7]  = 0;
+        m[8]  = 0;                   m[9]  = 0;                   m[10] = snuffleLoad32(c+8);   m[11] = k[4];
+        m[12] = k[5];                m[13] = k[6];                m[14] = k[7];                 m[15] = snuffleLoad32(c+12);
+    } else {
+        for (unsigned i=0; i<4; i++)
+            m[i] = snuffleLoad32(c + 4*i);
+        memcpy(m+4, k, sizeof(k));
+        m[12] = m[13] = m[14] = m[15] = 0;
+    }
+}
+
+SNUFFLE_CORE_API void snuffleInitState(uint32_t state[16], const SnuffleKeyContext& ctx, const uint8_t nonce[8], uint64_t counter) {
+    const unsigned ni = snuffleNonceIndex(ctx.variant);
+    const unsigned ci = snuffleCounterIndex(ctx.variant);
+
+    memcpy(state, ctx.matrix, sizeof(ctx.matrix));
+    state[ni]   = snuffleLoad32(nonce);
+    state[ni+1] = snuffleLoad32(nonce+4);
+    state[ci]   = (uint32_t) counter;
+    state[ci+1] = (uint32_t) (counter >> 32);
+}
+
+// add input state to permuted state and serialize little endian
+static inline void snuffleFeedForward(const uint32_t x[16], const uint32_t state[16], uint8_t out[64]) {
+    for (unsigned i=0; i<16; i++)
+        snuffleStore32(out + 4*i, x[i] + state[i]);
+}
+
+#define SNUFFLE_SALSA_QR(a, b, c, d) \
+    x[b] ^= snuffleRotate(x[a]+x[d], 7);  \
+    x[c] ^= snuffleRotate(x[b]+x[a], 9);  \
+    x[d] ^= snuffleRotate(x[c]+x[b], 13); \
+    x[a] ^= snuffleRotate(x[d]+x[c], 18);
+
+#define SNUFFLE_CHACHA_QR(a, b, c, d) \
+    x[a] += x[b]; x[d] = snuffleRotate(x[d]^x[a], 16); \
+    x[c] += x[d]; x[b] = snuffleRotate(x[b]^x[c], 12); \
+    x[a] += x[b]; x[d] = snuffleRotate(x[d]^x[a], 8);  \
+    x[c] += x[d]; x[b] = snuffleRotate(x[b]^x[c], 7);
+
+SNUFFLE_CORE_API void snuffleSalsa20Block(const uint32_t state[16], uint8_t out[64]) {
+    uint32_t x[16];
+    memcpy(x, state, sizeof(x));
+
+    for (unsigned i=0; i<20; i+=2) {
+        // column round
+        SNUFFLE_SALSA_QR(0, 4, 8, 12)
+        SNUFFLE_SALSA_QR(5, 9, 13, 1)
+        SNUFFLE_SALSA_QR(10, 14, 2, 6)
+        SNUFFLE_SALSA_QR(15, 3, 7, 11)
+        // row round
+        SNUFFLE_SALSA_QR(0, 1, 2, 3)
+        SNUFFLE_SALSA_QR(5, 6, 7, 4)
+        SNUFFLE_SALSA_QR(10, 11, 8, 9)
+        SNUFFLE_SALSA_QR(15, 12, 13, 14)
+    }
+    snuffleFeedForward(x, state, out);
+}
+
+SNUFFLE_CORE_API void snuffleChacha20Block(const uint32_t state[16], uint8_t out[64]) {
+    uint32_t x[16];
+    memcpy(x, state, sizeof(x));
+
+    for (unsigned i=0; i<20; i+=2) {
+        // column round
+        SNUFFLE_CHACHA_QR(0, 4, 8, 12)
+        SNUFFLE_CHACHA_QR(1, 5, 9, 13)
+        SNUFFLE_CHACHA_QR(2, 6, 10, 14)
+        SNUFFLE_CHACHA_QR(3, 7, 11, 15)
+        // diagonal round
+        SNUFFLE_CHACHA_QR(0, 5, 10, 15)
+        SNUFFLE_CHACHA_QR(1, 6, 11, 12)
+        SNUFFLE_CHACHA_QR(2, 7, 8, 13)
+        SNUFFLE_CHACHA_QR(3, 4, 9, 14)
+    }
+    snuffleFeedForward(x, state, out);
+}
+
+#undef SNUFFLE_SALSA_QR
+#undef SNUFFLE_CHACHA_QR
+
+SNUFFLE_CORE_API void snuffleBlock(SnuffleVariant variant, const uint32_t state[16], uint8_t out[64]) {
+    if (variant == SnuffleVariant::Salsa20)
+        snuffleSalsa20Block(state, out);
+    else
+        snuffleChacha20Block(state, out);
+}
+
+SNUFFLE_CORE_API void snuffleXorSmall(const SnuffleKeyContext& ctx, const uint8_t nonce[8], uint64_t counter,
+                                      const uint8_t* input, uint8_t* output, size_t len) {
+    const unsigned ci = snuffleCounterIndex(ctx.variant);
+    uint32_t state[16];
+    uint8_t block[64];
+
+    snuffleInitState(state, ctx, nonce, counter);
+
+    while (len) {
+        snuffleBlock(ctx.variant, state, block);
+
+        // 64 bit counter increment
+        if (++state[ci] == 0)
+            state[ci+1]++;
+
+        size_t n = len < 64 ? len : 64;
+        for (size_t i=0; i<n; i++)
+            output[i] = input[i] ^ block[i];
+        input += n;
+        output += n;
+        len -= n;
+    }
+}
+
+#endif // SNUFFLE_HEADER_ONLY || SNUFFLE_CORE_IMPLEMENTATION
+
+#endif // SNUFFLE_CORE_HPP
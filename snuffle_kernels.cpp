@@ -0,0 +1,321 @@
+#include <cstring> // memcpy
+#include <algorithm> // std::min
+#include <stdexcept> // std::invalid_argument
+#include <vector>
+
+#include "snuffle_kernels.hpp"
+#include "arx_lanes.hpp"
+#include "crc32c.hpp"
+
+using namespace std;
+
+/*  Lane engine of snuffle_kernels.hpp
+
+    Uses the vector type of arx_lanes.hpp: arx_lanes_t holds one state word of every lane.
+    Operations on it compile to SSE2 (two registers per lane vector) or AVX2 (one register),
+    target_clones builds both and an ifunc resolver selects one when the library is loaded.
+*/
+
+static_assert(SNUFFLE_LANES == ARX_LANES, "lane kernels are built on arx_lanes_t");
+
+#define SALSA_QR(a, b, c, d) \
+    x[b] ^= ARX_ROTL(x[a]+x[d], 7);  \
+    x[c] ^= ARX_ROTL(x[b]+x[a], 9);  \
+    x[d] ^= ARX_ROTL(x[c]+x[b], 13); \
+    x[a] ^= ARX_ROTL(x[d]+x[c], 18);
+
+#define CHACHA_QR(a, b, c, d) \
+    ARX_QUARTER(ARX_ROTL, x[a], x[b], x[c], x[d], 0, 0, 16, 12, 8, 7)
+
+ARX_TARGET_CLONES
+void snufflePermuteLanes(SnuffleVariant variant, uint32_t state[16][SNUFFLE_LANES]) {
+    arx_lanes_t x[16];
+    memcpy(x, state, sizeof(x));
+
+    if (variant == SnuffleVariant::Salsa20) {
+        for (unsigned i=0; i<20; i+=2) {
+            SALSA_QR(0, 4, 8, 12)
+            SALSA_QR(5, 9, 13, 1)
+            SALSA_QR(10, 14, 2, 6)
+            SALSA_QR(15, 3, 7, 11)
+            SALSA_QR(0, 1, 2, 3)
+            SALSA_QR(5, 6, 7, 4)
+            SALSA_QR(10, 11, 8, 9)
+            SALSA_QR(15, 12, 13, 14)
+        }
+    } else {
+        for (unsigned i=0; i<20; i+=2) {
+            CHACHA_QR(0, 4, 8, 12)
+            CHACHA_QR(1, 5, 9, 13)
+            CHACHA_QR(2, 6, 10, 14)
+            CHACHA_QR(3, 7, 11, 15)
+            CHACHA_QR(0, 5, 10, 15)
+            CHACHA_QR(1, 6, 11, 12)
+            CHACHA_QR(2, 7, 8, 13)
+            CHACHA_QR(3, 4, 9, 14)
+        }
+    }
+
+    memcpy(state, x, sizeof(x));
+}
+
+#undef SALSA_QR
+#undef CHACHA_QR
+
+void snuffleBlocksLanes(SnuffleVariant variant, const uint32_t in[16][SNUFFLE_LANES], uint8_t* out) {
+    uint32_t x[16][SNUFFLE_LANES];
+    memcpy(x, in, sizeof(x));
+
+    snufflePermuteLanes(variant, x);
+
+    // feed forward and transpose from word major to one block after the other
+    for (unsigned lane=0; lane<SNUFFLE_LANES; lane++) {
+        uint8_t* block = out + 64*lane;
+        for (unsigned w=0; w<16; w++) {
+            uint32_t word = x[w][lane] + in[w][lane];
+            block[4*w]   = word;
+            block[4*w+1] = word >> 8;
+            block[4*w+2] = word >> 16;
+            block[4*w+3] = word >> 24;
+        }
+    }
+}
+
+void snuffleKeystreamBlocks(SnuffleVariant variant, const uint32_t state[16], uint8_t* out, size_t nblocks) {
+    const unsigned ci = snuffleCounterIndex(variant);
+    uint64_t counter = ((uint64_t) state[ci+1] << 32) | state[ci];
+
+    uint32_t x[16][SNUFFLE_LANES];
+    for (unsigned w=0; w<16; w++)
+        for (unsigned lane=0; lane<SNUFFLE_LANES; lane++)
+            x[w][lane] = state[w];
+
+    for (; nblocks >= SNUFFLE_LANES; nblocks -= SNUFFLE_LANES) {
+        for (unsigned lane=0; lane<SNUFFLE_LANES; lane++, counter++) {
+            x[ci][lane]   = (uint32_t) counter;
+            x[ci+1][lane] = (uint32_t) (counter >> 32);
+        }
+        snuffleBlocksLanes(variant, x, out);
+        out += 64*SNUFFLE_LANES;
+    }
+
+    // less than SNUFFLE_LANES blocks left, not worth a full lane pass
+    uint32_t tail[16];
+    memcpy(tail, state, sizeof(tail));
+    for (; nblocks; nblocks--, counter++, out += 64) {
+        tail[ci]   = (uint32_t) counter;
+        tail[ci+1] = (uint32_t) (counter >> 32);
+        snuffleBlock(variant, tail, out);
+    }
+}
+
+// state words taking the 16 byte input and the ones forming the subkey, as in XSalsa20 / XChacha20
+static const unsigned HSALSA_INPUT = 6, HCHACHA_INPUT = 12;
+static const unsigned HSALSA_OUTPUT[8] = {0, 5, 10, 15, 6, 7, 8, 9};
+static const unsigned HCHACHA_OUTPUT[8] = {0, 1, 2, 3, 12, 13, 14, 15};
+
+// below this many inputs the scalar block function (minus the feed forward) beats a lane pass
+static const size_t HASH_KEYS_MIN_LANES = 3;
+
+static uint32_t load32(const uint8_t* p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static void store32(uint8_t* p, uint32_t word) {
+    p[0] = word;
+    p[1] = word >> 8;
+    p[2] = word >> 16;
+    p[3] = word >> 24;
+}
+
+void snuffleHashKeys(const SnuffleKeyContext& key, const uint8_t* inputs, uint8_t* out, size_t n) {
+    const bool salsa = key.variant == SnuffleVariant::Salsa20;
+    const unsigned in_word = salsa ? HSALSA_INPUT : HCHACHA_INPUT;
+    const unsigned* out_words = salsa ? HSALSA_OUTPUT : HCHACHA_OUTPUT;
+
+    for (size_t done=0; done < n;) {
+        const size_t lanes = min<size_t>(n - done, SNUFFLE_LANES);
+        if (lanes < HASH_KEYS_MIN_LANES) {
+            uint32_t state[16];
+            uint8_t block[64];
+            memcpy(state, key.matrix, sizeof(state));
+            for (unsigned j=0; j<4; j++)
+                state[in_word + j] = load32(inputs + 16*done + 4*j);
+            snuffleBlock(key.variant, state, block);
+            for (unsigned j=0; j<8; j++)
+                store32(out + 32*done + 4*j, load32(block + 4*out_words[j]) - state[out_words[j]]);
+            done++;
+            continue;
+        }
+
+        uint32_t x[16][SNUFFLE_LANES];
+        for (unsigned w=0; w<16; w++)
+            for (unsigned lane=0; lane<SNUFFLE_LANES; lane++)
+                x[w][lane] = key.matrix[w];
+        for (unsigned lane=0; lane<lanes; lane++)
+            for (unsigned j=0; j<4; j++)
+                x[in_word + j][lane] = load32(inputs + 16*(done + lane) + 4*j);
+        snufflePermuteLanes(key.variant, x);
+        for (unsigned lane=0; lane<lanes; lane++)
+            for (unsigned j=0; j<8; j++)
+                store32(out + 32*(done + lane) + 4*j, x[out_words[j]][lane]);
+        done += lanes;
+    }
+}
+
+// output = input ^ stream, cloned so the loop gets vectorized for AVX2 as well
+ARX_TARGET_CLONES
+static void xorBytes(const uint8_t* input, const uint8_t* stream, uint8_t* output, size_t len) {
+    for (size_t i=0; i<len; i++)
+        output[i] = input[i] ^ stream[i];
+}
+
+void snuffleKeystream(const SnuffleKeyContext& key, const uint8_t nonce[8], uint64_t counter, uint8_t* out, size_t nblocks) {
+    uint32_t state[16];
+    snuffleInitState(state, key, nonce, counter);
+    snuffleKeystreamBlocks(key.variant, state, out, nblocks);
+}
+
+void snuffleXorKeystream(const SnuffleKeyContext& key, const uint8_t nonce[8], uint64_t counter,
+                         const uint8_t* input, uint8_t* output, size_t len) {
+    const unsigned ci = snuffleCounterIndex(key.variant);
+    uint32_t state[16];
+    snuffleInitState(state, key, nonce, counter);
+    uint8_t stream[64*SNUFFLE_LANES];
+
+    for (size_t pos=0; pos < len; pos += sizeof(stream), counter += SNUFFLE_LANES) {
+        const size_t n = min(len - pos, sizeof(stream));
+        state[ci]   = (uint32_t) counter;
+        state[ci+1] = (uint32_t) (counter >> 32);
+        snuffleKeystreamBlocks(key.variant, state, stream, (n + 63) / 64);
+        xorBytes(input + pos, stream, output + pos, n);
+    }
+}
+
+void snuffleXorKeystreamAt(const SnuffleKeyContext& key, const uint8_t nonce[8], uint64_t offset,
+                           const uint8_t* input, uint8_t* output, size_t len) {
+    uint64_t counter = offset / 64;
+    const size_t skip = offset % 64;
+
+    // rest of the block offset points into
+    if (skip && len) {
+        uint32_t state[16];
+        uint8_t block[64];
+        snuffleInitState(state, key, nonce, counter++);
+        snuffleBlock(key.variant, state, block);
+        const size_t n = min(len, 64 - skip);
+        xorBytes(input, block + skip, output, n);
+        input += n;
+        output += n;
+        len -= n;
+    }
+    snuffleXorKeystream(key, nonce, counter, input, output, len);
+}
+
+/*  input is walked in FANOUT_CHUNK sized pieces that stay in L1 while the keystream of all
+    recipients is xored in, so memory only sees every input byte once */
+static const size_t FANOUT_CHUNK = 4096;
+
+void snuffleFanOut(const SnuffleKeyContext* keys, const uint8_t* nonces, size_t nr_recipients, uint64_t counter,
+                   const uint8_t* input, uint8_t* const* outputs, size_t len) {
+    if (nr_recipients == 0 || len == 0) return;
+
+    const SnuffleVariant variant = keys[0].variant;
+    const unsigned ci = snuffleCounterIndex(variant);
+    for (size_t r=1; r<nr_recipients; r++)
+        if (keys[r].variant != variant)
+            throw invalid_argument("all fan-out keys have to be for the same cipher");
+
+    vector<uint32_t> states(16 * nr_recipients);
+    for (size_t r=0; r<nr_recipients; r++)
+        snuffleInitState(&states[16*r], keys[r], nonces + 8*r, 0);
+
+    // lanes take (recipient, block) pairs, recipient after recipient, so every lane does useful
+    // work whatever the number of recipients. A lane keeps its recipient's words across passes
+    // until another recipient moves in, most passes only set the counters
+    uint32_t x[16][SNUFFLE_LANES];
+    size_t lane_recipient[SNUFFLE_LANES], lane_pos[SNUFFLE_LANES];
+    for (unsigned lane=0; lane<SNUFFLE_LANES; lane++)
+        lane_recipient[lane] = SIZE_MAX;
+    uint8_t stream[64*SNUFFLE_LANES];
+
+    for (size_t chunk=0; chunk < len; chunk += FANOUT_CHUNK) {
+        const size_t chunk_end = min(len, chunk + FANOUT_CHUNK);
+        size_t r = 0, pos = chunk;
+
+        while (r < nr_recipients) {
+            unsigned nr_lanes = 0;
+            for (; nr_lanes < SNUFFLE_LANES && r < nr_recipients; nr_lanes++) {
+                if (lane_recipient[nr_lanes] != r) {
+                    for (unsigned w=0; w<16; w++)
+                        x[w][nr_lanes] = states[16*r + w];
+                    lane_recipient[nr_lanes] = r;
+                }
+                const uint64_t block_counter = counter + pos/64;
+                x[ci][nr_lanes]   = (uint32_t) block_counter;
+                x[ci+1][nr_lanes] = (uint32_t) (block_counter >> 32);
+                lane_pos[nr_lanes] = pos;
+                pos += 64;
+                if (pos >= chunk_end) {
+                    pos = chunk;
+                    r++;
+                }
+            }
+
+            // only the last pass of the input can come up short: scalar blocks as in snuffleKeystreamBlocks()
+            if (nr_lanes < SNUFFLE_LANES)
+                for (unsigned lane=0; lane<nr_lanes; lane++) {
+                    uint32_t state[16];
+                    for (unsigned w=0; w<16; w++)
+                        state[w] = x[w][lane];
+                    snuffleBlock(variant, state, stream + 64*lane);
+                }
+            else
+                snuffleBlocksLanes(variant, x, stream);
+
+            // one xor per run of lanes holding consecutive blocks of a recipient
+            for (unsigned lane=0, end; lane<nr_lanes; lane = end) {
+                for (end = lane+1; end < nr_lanes && lane_recipient[end] == lane_recipient[lane]
+                                   && lane_pos[end] == lane_pos[end-1] + 64; end++) {}
+                const size_t p = lane_pos[lane];
+                xorBytes(input + p, stream + 64*lane, outputs[lane_recipient[lane]] + p,
+                         min<size_t>(64*(end - lane), len - p));
+            }
+        }
+    }
+}
+
+// lanes not added to since the last flush compute stale states, their output is dropped
+void SnuffleLaneQueue::flush() {
+    if (_n == 0)
+        return;
+    snuffleBlocksLanes(_variant, _x, _stream);
+    for (unsigned lane=0; lane<_n; lane++)
+        xorBytes(_in[lane], _stream + 64*lane, _out[lane], _len[lane]);
+    _n = 0;
+}
+
+void snuffleXorCrc32c(const SnuffleKeyContext& key, const uint8_t nonce[8], uint64_t counter,
+                      const uint8_t* input, uint8_t* output, size_t len, uint32_t* input_crc, uint32_t* output_crc) {
+    const unsigned ci = snuffleCounterIndex(key.variant);
+    uint32_t state[16];
+    snuffleInitState(state, key, nonce, counter);
+    uint8_t stream[64*SNUFFLE_LANES];
+
+    for (size_t pos=0; pos < len; pos += sizeof(stream), counter += SNUFFLE_LANES) {
+        const size_t n = min(len - pos, sizeof(stream));
+        state[ci]   = (uint32_t) counter;
+        state[ci+1] = (uint32_t) (counter >> 32);
+        snuffleKeystreamBlocks(key.variant, state, stream, (n + 63) / 64);
+        crc32cXor(input + pos, stream, output + pos, n, input_crc, output_crc);
+    }
+}
+
+const char* snuffleKernelName() {
+#if ARX_HAVE_TARGET_CLONES
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return "avx2";
+#endif
+    return "generic";
+}
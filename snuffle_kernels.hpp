@@ -0,0 +1,112 @@
+#ifndef SNUFFLE_KERNELS_HPP
+#define SNUFFLE_KERNELS_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "snuffle_core.hpp"
+
+/*  Multi block kernels for Salsa20 and Chacha20
+
+    The lane engine processes SNUFFLE_LANES independent states side by side. States are stored
+    word major (x[word][lane]), so each step of a quarter round is one vector operation over all
+    lanes. Lanes don't have to share anything: consecutive counters of one stream, different
+    nonces or different keys all work the same.
+
+    The kernels are compiled for AVX2 and for the generic target (SSE2 on x86-64),
+    the dynamic loader picks the best one for the CPU at startup.
+*/
+
+#define SNUFFLE_LANES 8
+
+//  20 rounds on every lane in place, without adding the input state (used by HSalsa20/HChacha20 style functions)
+void snufflePermuteLanes(SnuffleVariant variant, uint32_t x[16][SNUFFLE_LANES]);
+
+//  one block of keystream per lane, block of lane i is written to out + 64*i
+void snuffleBlocksLanes(SnuffleVariant variant, const uint32_t in[16][SNUFFLE_LANES], uint8_t* out);
+
+/*  nblocks consecutive blocks of keystream into out, starting at the counter in state
+    (64 bit counter, wraps around like SnuffleStreamCipher::incrementCounter()) */
+void snuffleKeystreamBlocks(SnuffleVariant variant, const uint32_t state[16], uint8_t* out, size_t nblocks);
+
+/*  HSalsa20 / HChacha20 (the subkey step of XSalsa20 / XChacha20): the 32 byte subkey of key and
+    each 16 byte input, input i at inputs + 16*i, subkey i to out + 32*i. Inputs take the nonce and
+    counter words of the state, the output words are the ones XSalsa20 / XChacha20 use.
+    Up to SNUFFLE_LANES inputs per lane pass, one or two through the scalar block function */
+void snuffleHashKeys(const SnuffleKeyContext& key, const uint8_t* inputs, uint8_t* out, size_t n);
+
+/*  Stateless keystream by position: key, nonce and position are all parameters and nothing is
+    kept between calls, so threads (or machines) can each compute any region of a stream without
+    sharing or cloning a cipher object. The lane kernels do the work, as selected at load time. */
+
+//  nblocks blocks of keystream for key and nonce, from block counter on, into out
+void snuffleKeystream(const SnuffleKeyContext& key, const uint8_t nonce[8], uint64_t counter, uint8_t* out, size_t nblocks);
+
+//  output = input ^ keystream from block counter on, input == output works
+void snuffleXorKeystream(const SnuffleKeyContext& key, const uint8_t nonce[8], uint64_t counter,
+                         const uint8_t* input, uint8_t* output, size_t len);
+
+//  the same from any byte offset of the stream on, not only block boundaries
+void snuffleXorKeystreamAt(const SnuffleKeyContext& key, const uint8_t nonce[8], uint64_t offset,
+                           const uint8_t* input, uint8_t* output, size_t len);
+
+/*  fan-out: encrypt one input for nr_recipients recipients, each with its own key and nonce
+    (nonce of recipient r at nonces + 8*r), all starting at block counter
+    output of recipient r goes to outputs[r]. Input is read from memory once: each cache resident chunk
+    is xored with the keystream of all recipients, SNUFFLE_LANES (recipient, block) pairs per lane pass,
+    so a few recipients fill the lanes with consecutive blocks as snuffleXorKeystream() does.
+    All keys need the same variant, throws std::invalid_argument otherwise */
+void snuffleFanOut(const SnuffleKeyContext* keys, const uint8_t* nonces, size_t nr_recipients, uint64_t counter,
+                   const uint8_t* input, uint8_t* const* outputs, size_t len);
+
+/*  Lane batches of single blocks from unrelated states (packets, short messages): add() queues
+    output = input ^ one keystream block, every SNUFFLE_LANES queued blocks go through one lane
+    pass, flush() runs what is left. The xor of a block is only done once its pass ran, buffers
+    have to stay around until flush() returned */
+class SnuffleLaneQueue {
+    SnuffleVariant _variant;
+    unsigned _ci;
+    uint32_t _x[16][SNUFFLE_LANES];
+    uint8_t _stream[64*SNUFFLE_LANES];
+    const uint8_t* _in[SNUFFLE_LANES];
+    uint8_t* _out[SNUFFLE_LANES];
+    size_t _len[SNUFFLE_LANES];
+    unsigned _n = 0;
+
+public:
+
+    explicit SnuffleLaneQueue(SnuffleVariant variant) : _variant(variant), _ci(snuffleCounterIndex(variant)) {}
+
+    //  len (up to 64) bytes with block counter of state, input == output works
+    void add(const uint32_t state[16], uint64_t counter, const uint8_t* input, uint8_t* output, size_t len) {
+        for (unsigned w=0; w<16; w++)
+            _x[w][_n] = state[w];
+        _x[_ci][_n] = (uint32_t) counter;
+        _x[_ci+1][_n] = (uint32_t) (counter >> 32);
+        _in[_n] = input;
+        _out[_n] = output;
+        _len[_n] = len;
+        if (++_n == SNUFFLE_LANES)
+            flush();
+    }
+
+    //  all blocks of len bytes, from block counter first on
+    void addData(const uint32_t state[16], uint64_t first, const uint8_t* input, uint8_t* output, size_t len) {
+        for (size_t pos=0; pos < len; pos += 64)
+            add(state, first + pos/64, input + pos, output + pos, len - pos < 64 ? len - pos : 64);
+    }
+
+    void flush();
+};
+
+/*  bulk encrypt with checksums: output = input ^ keystream starting at block counter, and in the
+    same pass the CRC32C (crc32c.hpp) of input and/or output, running values, nullptr to skip one.
+    Keystream is generated SNUFFLE_LANES blocks at a time into L1 and fused with the loads, stores
+    and CRC updates, so the data is traversed once instead of encrypt + checksum pass */
+void snuffleXorCrc32c(const SnuffleKeyContext& key, const uint8_t nonce[8], uint64_t counter,
+                      const uint8_t* input, uint8_t* output, size_t len, uint32_t* input_crc, uint32_t* output_crc);
+
+// name of the kernel the loader selected, for diagnostics
+const char* snuffleKernelName();
+
+#endif // SNUFFLE_KERNELS_HPP
@@ -0,0 +1,451 @@
+#include <cstring> // memcpy
+#include <cerrno>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <algorithm>
+#include <stdexcept> // std::runtime_error
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "stream_aead.hpp"
+#include "byte_io.hpp"
+#include "lz.hpp"
+#include "poly1305.hpp"
+#include "pipeline.hpp"
+#include "pipeline_telemetry.hpp"
+#include "snuffle_kernels.hpp"
+#include "worker_pool.hpp"
+
+using namespace std;
+
+static const char STREAM_MAGIC[4] = {'S', 'S', 'T', 'R'};
+static const uint8_t STREAM_VERSION = 1, STREAM_VERSION_COMPRESSED = 2;
+
+// compressed streams: frame length prefix, its last segment bit, payload methods
+static const size_t FRAME_PREFIX_LEN = 4;
+static const uint32_t FRAME_LAST = 1u << 31;
+static const uint8_t METHOD_STORED = 0, METHOD_LZ = 1;
+
+static const char* TRUNCATED = "sealed stream truncated";
+
+void streamEncodeHeader(const StreamHeader& header, uint8_t out[STREAM_HEADER_LEN]) {
+    memset(out, 0, STREAM_HEADER_LEN);
+    memcpy(out, STREAM_MAGIC, 4);
+    out[4] = header.compressed ? STREAM_VERSION_COMPRESSED : STREAM_VERSION;
+    out[5] = (uint8_t) header.variant;
+    putLE(out+8, header.segment_size, 4);
+    memcpy(out+12, header.salt, STREAM_SALT_LEN);
+}
+
+StreamHeader streamDecodeHeader(const uint8_t in[STREAM_HEADER_LEN]) {
+    if (memcmp(in, STREAM_MAGIC, 4) != 0)
+        throw runtime_error("not a sealed stream");
+    if ((in[4] != STREAM_VERSION && in[4] != STREAM_VERSION_COMPRESSED) || in[5] > (uint8_t) SnuffleVariant::Chacha20)
+        throw runtime_error("unsupported stream version or cipher");
+    // streamOpen() authenticates the header as re-encoded, so bytes it drops must not carry anything
+    if (in[6] != 0 || in[7] != 0)
+        throw runtime_error("reserved bytes of the stream header not 0");
+
+    StreamHeader header;
+    header.variant = (SnuffleVariant) in[5];
+    header.compressed = in[4] == STREAM_VERSION_COMPRESSED;
+    header.segment_size = getLE(in+8, 4);
+    memcpy(header.salt, in+12, STREAM_SALT_LEN);
+    if (header.segment_size == 0 || header.segment_size > STREAM_MAX_SEGMENT_SIZE)
+        throw runtime_error("invalid segment size in stream header");
+    return header;
+}
+
+SnuffleKeyContext streamSubkey(const SnuffleKeyContext& key, const uint8_t salt[STREAM_SALT_LEN]) {
+    uint8_t subkey[32];
+    snuffleHashKeys(key, salt, subkey, 1);
+    SnuffleKeyContext ctx;
+    snuffleInitKey(ctx, key.variant, subkey, sizeof(subkey));
+    memset(subkey, 0, sizeof(subkey));
+    return ctx;
+}
+
+void streamSegmentNonce(uint8_t out[8], uint64_t base, uint64_t index, bool last) {
+    putLE(out, base ^ (index << 1 | (last ? 1 : 0)), 8);
+}
+
+// Poly1305 over aad and ciphertext as in RFC 8439, key from block 0
+static void segmentTag(const SnuffleKeyContext& key, const uint8_t nonce[8], const uint8_t* aad, size_t aad_len,
+                       const uint8_t* ciphertext, size_t len, uint8_t tag[STREAM_TAG_LEN]) {
+    uint32_t state[16];
+    uint8_t block0[64];
+    snuffleInitState(state, key, nonce, 0);
+    snuffleBlock(key.variant, state, block0);
+
+    static const uint8_t zeros[16] = {0};
+    uint8_t lengths[16];
+    putLE(lengths, aad_len, 8);
+    putLE(lengths+8, len, 8);
+
+    Poly1305 mac(block0);
+    mac.update(aad, aad_len);
+    mac.update(zeros, (16 - aad_len % 16) % 16);
+    mac.update(ciphertext, len);
+    mac.update(zeros, (16 - len % 16) % 16);
+    mac.update(lengths, sizeof(lengths));
+    mac.final(tag);
+}
+
+void streamSealSegment(const SnuffleKeyContext& key, const uint8_t nonce[8], const uint8_t* aad, size_t aad_len,
+                       uint8_t* buf, size_t len, uint8_t tag[STREAM_TAG_LEN]) {
+    snuffleXorKeystream(key, nonce, 1, buf, buf, len);
+    segmentTag(key, nonce, aad, aad_len, buf, len, tag);
+}
+
+bool streamOpenSegment(const SnuffleKeyContext& key, const uint8_t nonce[8], const uint8_t* aad, size_t aad_len,
+                       uint8_t* buf, size_t len, const uint8_t tag[STREAM_TAG_LEN]) {
+    uint8_t expected[STREAM_TAG_LEN];
+    segmentTag(key, nonce, aad, aad_len, buf, len, expected);
+    if (!poly1305Equal(expected, tag))
+        return false;
+    snuffleXorKeystream(key, nonce, 1, buf, buf, len);
+    return true;
+}
+
+// telemetry stages of the frame steps, unused without telemetry
+struct FrameStages {
+    PipelineTelemetry* telemetry = nullptr;
+    unsigned compress = 0, encrypt = 0, mac = 0;
+
+    FrameStages() {}
+    FrameStages(PipelineTelemetry* t, WorkerPool& pool, bool sealing) : telemetry(t) {
+        if (!telemetry)
+            return;
+        compress = telemetry->stage(sealing ? "compress" : "decompress", pool.size());
+        encrypt = telemetry->stage(sealing ? "encrypt" : "decrypt", pool.size());
+        mac = telemetry->stage("mac", pool.size());
+    }
+};
+
+static size_t maxFrameLen(const StreamHeader& header) {
+    return FRAME_PREFIX_LEN + 1 + header.segment_size + STREAM_TAG_LEN;
+}
+
+/*  segment number nr of len bytes in buf as a frame, in place. scratch takes up to len bytes of
+    compressed data. returns the frame length */
+static size_t sealFrame(const SnuffleKeyContext& key, const uint8_t* aad, uint64_t nr,
+                        bool last, uint8_t* buf, size_t len, uint8_t* scratch, const FrameStages& stages) {
+    uint8_t* payload = buf + FRAME_PREFIX_LEN;
+    size_t packed;
+    {
+        PipelineTelemetry::Timer timer(stages.telemetry, stages.compress, len);
+        packed = len > 1 ? lzCompress(buf, len, scratch, len - 1) : 0;
+    }
+    if (packed) {
+        payload[0] = METHOD_LZ;
+        memcpy(payload + 1, scratch, packed);
+    } else {
+        memmove(payload + 1, buf, len);
+        payload[0] = METHOD_STORED;
+        packed = len;
+    }
+    const size_t payload_len = 1 + packed;
+    putLE(buf, payload_len | (last ? FRAME_LAST : 0), FRAME_PREFIX_LEN);
+
+    uint8_t nonce[8];
+    streamSegmentNonce(nonce, 0, nr, last);
+    {
+        PipelineTelemetry::Timer timer(stages.telemetry, stages.encrypt, payload_len);
+        snuffleXorKeystream(key, nonce, 1, payload, payload, payload_len);
+    }
+    PipelineTelemetry::Timer timer(stages.telemetry, stages.mac, payload_len);
+    segmentTag(key, nonce, aad, STREAM_HEADER_LEN, payload, payload_len, payload + payload_len);
+    return FRAME_PREFIX_LEN + payload_len + STREAM_TAG_LEN;
+}
+
+/*  authenticate and decrypt the frame of segment nr (frame_len bytes in frame, changed in place),
+    its plaintext to out (segment size bytes, not overlapping frame). returns the plaintext length */
+static size_t openFrame(const SnuffleKeyContext& key, const StreamHeader& header, const uint8_t* aad, uint64_t nr,
+                        uint8_t* frame, size_t frame_len, uint8_t* out, const FrameStages& stages) {
+    const uint32_t prefix = getLE(frame, FRAME_PREFIX_LEN);
+    const bool last = prefix & FRAME_LAST;
+    const size_t payload_len = prefix & ~FRAME_LAST;
+    uint8_t* payload = frame + FRAME_PREFIX_LEN;
+    if (payload_len == 0 || FRAME_PREFIX_LEN + payload_len + STREAM_TAG_LEN != frame_len)
+        throw runtime_error("invalid frame length in segment " + to_string(nr));
+
+    uint8_t nonce[8], expected[STREAM_TAG_LEN];
+    streamSegmentNonce(nonce, 0, nr, last);
+    {
+        PipelineTelemetry::Timer timer(stages.telemetry, stages.mac, payload_len);
+        segmentTag(key, nonce, aad, STREAM_HEADER_LEN, payload, payload_len, expected);
+    }
+    if (!poly1305Equal(expected, payload + payload_len))
+        throw runtime_error("segment " + to_string(nr) + " failed authentication"
+                            + (last ? " (stream truncated or modified)" : ""));
+    {
+        PipelineTelemetry::Timer timer(stages.telemetry, stages.encrypt, payload_len);
+        snuffleXorKeystream(key, nonce, 1, payload, payload, payload_len);
+    }
+
+    // authenticated, so a bad method or size is a bug on the sealing side rather than an attack
+    size_t len;
+    if (payload[0] == METHOD_STORED) {
+        len = payload_len - 1;
+        if (len > header.segment_size)
+            throw runtime_error("segment " + to_string(nr) + " too large");
+        memcpy(out, payload + 1, len);
+    } else if (payload[0] == METHOD_LZ) {
+        PipelineTelemetry::Timer timer(stages.telemetry, stages.compress, payload_len - 1);
+        len = lzDecompress(payload + 1, payload_len - 1, out, header.segment_size);
+    } else
+        throw runtime_error("segment " + to_string(nr) + " has unknown compression method " + to_string(payload[0]));
+    if (last ? len > header.segment_size : len != header.segment_size)
+        throw runtime_error("segment " + to_string(nr) + " has the wrong size");
+    return len;
+}
+
+/*  frames through the pipeline, the raw segment in front of each buffer and room for the
+    compressed one behind the largest frame. Then the index of the frame lengths */
+static void sealCompressed(int in_fd, int out_fd, const SnuffleKeyContext& key, const StreamHeader& header,
+                           const uint8_t* aad, WorkerPool& pool, PipelineTelemetry* telemetry) {
+    const FrameStages stages(telemetry, pool, true);
+    const size_t scratch_offset = maxFrameLen(header);
+    mutex m;
+    vector<uint32_t> frame_lens;
+    uint64_t size = 0;
+
+    runPipeline(in_fd, out_fd, header.segment_size, scratch_offset + header.segment_size, pool,
+                [&](uint64_t nr, bool last, uint8_t* buf, size_t len) {
+        size_t frame_len = sealFrame(key, aad, nr, last, buf, len, buf + scratch_offset, stages);
+        lock_guard<mutex> lock(m);
+        if (frame_lens.size() <= nr)
+            frame_lens.resize(nr + 1);
+        frame_lens[nr] = frame_len;
+        size += len;
+        return frame_len;
+    }, telemetry);
+
+    vector<uint8_t> index(8 + 4*frame_lens.size() + STREAM_TAG_LEN + 8);
+    putLE(index.data(), size, 8);
+    for (size_t i=0; i<frame_lens.size(); i++)
+        putLE(&index[8 + 4*i], frame_lens[i], 4);
+    const size_t index_len = 8 + 4*frame_lens.size();
+    uint8_t nonce[8];
+    streamSegmentNonce(nonce, 0, frame_lens.size(), false);
+    streamSealSegment(key, nonce, aad, STREAM_HEADER_LEN, index.data(), index_len, &index[index_len]);
+    putLE(&index[index_len + STREAM_TAG_LEN], index_len, 8);
+    writeAll(out_fd, index.data(), index.size());
+}
+
+static void openCompressed(int in_fd, int out_fd, const SnuffleKeyContext& key, const StreamHeader& header,
+                           const uint8_t* aad, WorkerPool& pool, PipelineTelemetry* telemetry) {
+    const FrameStages stages(telemetry, pool, false);
+    const size_t scratch_offset = maxFrameLen(header);
+    const uint64_t max_payload = 1 + header.segment_size;
+
+    runFramedPipeline(in_fd, out_fd, FRAME_PREFIX_LEN, [&](const uint8_t* prefix, bool& last) {
+        uint32_t value = getLE(prefix, FRAME_PREFIX_LEN);
+        last = value & FRAME_LAST;
+        uint64_t payload_len = value & ~FRAME_LAST;
+        if (payload_len == 0 || payload_len > max_payload)
+            throw runtime_error("invalid frame length " + to_string(payload_len) + " in sealed stream");
+        return payload_len + STREAM_TAG_LEN;
+    }, scratch_offset + header.segment_size, pool, [&](uint64_t nr, bool, uint8_t* buf, size_t len) {
+        size_t plain_len = openFrame(key, header, aad, nr, buf, len, buf + scratch_offset, stages);
+        memcpy(buf, buf + scratch_offset, plain_len);
+        return plain_len;
+    }, telemetry);
+}
+
+void streamSeal(int in_fd, int out_fd, const SnuffleKeyContext& long_term_key, const StreamHeader& header, WorkerPool& pool,
+                PipelineTelemetry* telemetry) {
+    if (long_term_key.variant != header.variant)
+        throw invalid_argument("key and stream header are for different ciphers");
+
+    const SnuffleKeyContext key = streamSubkey(long_term_key, header.salt);
+    uint8_t aad[STREAM_HEADER_LEN];
+    streamEncodeHeader(header, aad);
+    writeAll(out_fd, aad, sizeof(aad));
+    if (header.compressed) {
+        sealCompressed(in_fd, out_fd, key, header, aad, pool, telemetry);
+        return;
+    }
+
+    unsigned encrypt_stage = 0, mac_stage = 0;
+    if (telemetry) {
+        encrypt_stage = telemetry->stage("encrypt", pool.size());
+        mac_stage = telemetry->stage("mac", pool.size());
+    }
+
+    // streamSealSegment() in two timed steps
+    runPipeline(in_fd, out_fd, header.segment_size, header.segment_size + STREAM_TAG_LEN, pool,
+                [&](uint64_t index, bool last, uint8_t* buf, size_t len) {
+        uint8_t nonce[8];
+        streamSegmentNonce(nonce, 0, index, last);
+        {
+            PipelineTelemetry::Timer timer(telemetry, encrypt_stage, len);
+            snuffleXorKeystream(key, nonce, 1, buf, buf, len);
+        }
+        PipelineTelemetry::Timer timer(telemetry, mac_stage, len);
+        segmentTag(key, nonce, aad, sizeof(aad), buf, len, buf + len);
+        return len + STREAM_TAG_LEN;
+    }, telemetry);
+}
+
+StreamHeader streamReadHeader(int in_fd) {
+    uint8_t raw[STREAM_HEADER_LEN];
+    if (readFull(in_fd, raw, sizeof(raw)) != sizeof(raw))
+        throw runtime_error("input too short for a sealed stream");
+    return streamDecodeHeader(raw);
+}
+
+void streamOpen(int in_fd, int out_fd, const SnuffleKeyContext& long_term_key, const StreamHeader& header, WorkerPool& pool,
+                PipelineTelemetry* telemetry) {
+    if (long_term_key.variant != header.variant)
+        throw invalid_argument("key and stream header are for different ciphers");
+
+    const SnuffleKeyContext key = streamSubkey(long_term_key, header.salt);
+    uint8_t aad[STREAM_HEADER_LEN];
+    streamEncodeHeader(header, aad);
+    if (header.compressed) {
+        openCompressed(in_fd, out_fd, key, header, aad, pool, telemetry);
+        return;
+    }
+
+    unsigned encrypt_stage = 0, mac_stage = 0;
+    if (telemetry) {
+        encrypt_stage = telemetry->stage("decrypt", pool.size());
+        mac_stage = telemetry->stage("mac", pool.size());
+    }
+
+    runPipeline(in_fd, out_fd, header.segment_size + STREAM_TAG_LEN, header.segment_size + STREAM_TAG_LEN, pool,
+                [&](uint64_t index, bool last, uint8_t* buf, size_t len) {
+        if (len < STREAM_TAG_LEN)
+            throw runtime_error("stream truncated in segment " + to_string(index));
+        len -= STREAM_TAG_LEN;
+
+        // streamOpenSegment() in two timed steps
+        uint8_t nonce[8], expected[STREAM_TAG_LEN];
+        streamSegmentNonce(nonce, 0, index, last);
+        {
+            PipelineTelemetry::Timer timer(telemetry, mac_stage, len);
+            segmentTag(key, nonce, aad, sizeof(aad), buf, len, expected);
+        }
+        if (!poly1305Equal(expected, buf + len))
+            throw runtime_error("segment " + to_string(index) + " failed authentication"
+                                + (last ? " (stream truncated or modified)" : ""));
+        PipelineTelemetry::Timer timer(telemetry, encrypt_stage, len);
+        snuffleXorKeystream(key, nonce, 1, buf, buf, len);
+        return len;
+    }, telemetry);
+}
+
+SealedStreamReader::SealedStreamReader(const string& path, const SnuffleKeyContext& key) {
+    _fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (_fd < 0)
+        throw runtime_error("could not open " + path + ": " + strerror(errno));
+    try {
+        struct stat st;
+        if (fstat(_fd, &st) != 0)
+            throw runtime_error("could not stat " + path + ": " + strerror(errno));
+        const uint64_t file_size = st.st_size;
+        if (file_size < STREAM_HEADER_LEN)
+            throw runtime_error(path + " is too short for a sealed stream");
+        preadAll(_fd, _aad, sizeof(_aad), 0, TRUNCATED);
+        _header = streamDecodeHeader(_aad);
+        if (key.variant != _header.variant)
+            throw invalid_argument("key and stream header are for different ciphers");
+        _key = streamSubkey(key, _header.salt);
+
+        if (_header.compressed) {
+            readIndex(file_size);
+            _frame.resize(maxFrameLen(_header));
+        } else {
+            // every segment segment size + tag, the last one shorter but with its tag
+            const uint64_t body = file_size - STREAM_HEADER_LEN, frame_len = _header.segment_size + STREAM_TAG_LEN;
+            _nrSegments = (body + frame_len - 1) / frame_len;
+            if (_nrSegments == 0 || body - (_nrSegments - 1) * frame_len < STREAM_TAG_LEN)
+                throw runtime_error(path + ": sealed stream truncated");
+            _size = body - _nrSegments * STREAM_TAG_LEN;
+        }
+        _segment.resize(_header.segment_size + STREAM_TAG_LEN);
+    } catch (...) {
+        close(_fd);
+        throw;
+    }
+}
+
+SealedStreamReader::~SealedStreamReader() {
+    close(_fd);
+}
+
+void SealedStreamReader::readIndex(uint64_t file_size) {
+    const size_t trailer_len = STREAM_TAG_LEN + 8;
+    if (file_size < STREAM_HEADER_LEN + trailer_len)
+        throw runtime_error("compressed stream truncated before its index");
+    uint8_t raw_len[8];
+    preadAll(_fd, raw_len, 8, file_size - 8, TRUNCATED);
+    const uint64_t index_len = getLE(raw_len, 8);
+    if (index_len < 8 + 4 || (index_len - 8) % 4 != 0 || index_len > file_size - STREAM_HEADER_LEN - trailer_len)
+        throw runtime_error("compressed stream truncated or index length invalid");
+
+    const uint64_t index_offset = file_size - trailer_len - index_len;
+    vector<uint8_t> index(index_len + STREAM_TAG_LEN);
+    preadAll(_fd, index.data(), index.size(), index_offset, TRUNCATED);
+    _nrSegments = (index_len - 8) / 4;
+    uint8_t nonce[8];
+    streamSegmentNonce(nonce, 0, _nrSegments, false);
+    if (!streamOpenSegment(_key, nonce, _aad, sizeof(_aad), index.data(), index_len, &index[index_len]))
+        throw runtime_error("stream index failed authentication");
+
+    _size = getLE(index.data(), 8);
+    const uint64_t segment_size = _header.segment_size;
+    if (_size > _nrSegments * segment_size || (_nrSegments > 1 && _size <= (_nrSegments - 1) * segment_size))
+        throw runtime_error("stream index size does not match its segments");
+    _frameOffsets.resize(_nrSegments + 1);
+    _frameOffsets[0] = STREAM_HEADER_LEN;
+    for (uint64_t i=0; i<_nrSegments; i++) {
+        uint64_t frame_len = getLE(&index[8 + 4*i], 4);
+        if (frame_len < FRAME_PREFIX_LEN + 1 + STREAM_TAG_LEN || frame_len > maxFrameLen(_header))
+            throw runtime_error("stream index has an invalid frame length");
+        _frameOffsets[i+1] = _frameOffsets[i] + frame_len;
+    }
+    if (_frameOffsets.back() != index_offset)
+        throw runtime_error("stream index does not match the file");
+}
+
+void SealedStreamReader::loadSegment(uint64_t nr) {
+    if (nr == _segmentNr)
+        return;
+    _segmentNr = UINT64_MAX;
+    const bool last = nr + 1 == _nrSegments;
+
+    if (_header.compressed) {
+        const size_t frame_len = _frameOffsets[nr+1] - _frameOffsets[nr];
+        preadAll(_fd, _frame.data(), frame_len, _frameOffsets[nr], TRUNCATED);
+        if (bool(getLE(_frame.data(), FRAME_PREFIX_LEN) & FRAME_LAST) != last)
+            throw runtime_error("segment " + to_string(nr) + " is in the wrong place");
+        _segmentLen = openFrame(_key, _header, _aad, nr, _frame.data(), frame_len, _segment.data(), FrameStages());
+    } else {
+        const uint64_t frame_len = _header.segment_size + STREAM_TAG_LEN;
+        _segmentLen = last ? _size - nr * _header.segment_size : _header.segment_size;
+        preadAll(_fd, _segment.data(), _segmentLen + STREAM_TAG_LEN, STREAM_HEADER_LEN + nr * frame_len, TRUNCATED);
+        uint8_t nonce[8];
+        streamSegmentNonce(nonce, 0, nr, last);
+        if (!streamOpenSegment(_key, nonce, _aad, sizeof(_aad), _segment.data(), _segmentLen, _segment.data() + _segmentLen))
+            throw runtime_error("segment " + to_string(nr) + " failed authentication"
+                                + (last ? " (stream truncated or modified)" : ""));
+    }
+    _segmentNr = nr;
+}
+
+size_t SealedStreamReader::read(uint64_t offset, uint8_t* buf, size_t len) {
+    size_t done = 0;
+    while (done < len && offset + done < _size) {
+        const uint64_t pos = offset + done;
+        loadSegment(pos / _header.segment_size);
+        const size_t in_segment = pos % _header.segment_size;
+        const size_t n = min<uint64_t>(len - done, _segmentLen - in_segment);
+        memcpy(buf + done, _segment.data() + in_segment, n);
+        done += n;
+    }
+    return done;
+}
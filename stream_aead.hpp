@@ -0,0 +1,142 @@
+#ifndef STREAM_AEAD_HPP
+#define STREAM_AEAD_HPP
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "snuffle_core.hpp"
+
+class WorkerPool;
+class PipelineTelemetry;
+
+/*  Online authenticated encryption of streams (STREAM construction) for pipes
+
+    The plaintext is cut into segments of a fixed size, every segment is encrypted and
+    authenticated on its own with Salsa20/Chacha20 + Poly1305 under its own nonce:
+
+        nonce(i) = i << 1 | last                       (64 bit little endian)
+
+    so segments can't be reordered, dropped, or the stream cut at a segment boundary without
+    the last segment failing to verify. Every stream has a key of its own, derived from the long
+    term key and a random 16 byte salt in the header with HSalsa20/HChacha20 (the XSalsa20/XChacha20
+    construction, snuffleHashKeys()): nonces only have to be unique within a stream. Per key the
+    limit is the salt collision bound: up to 2^48 streams the chance of two sharing a subkey stays
+    below 2^-32. Per stream the limit is 2^63 segments. Nothing has to be buffered beyond a few segments,
+    both directions run through the pipeline of pipeline.hpp.
+
+    Per segment (like ChaCha20-Poly1305, RFC 8439, with the 64 bit nonce of this library):
+    Poly1305 key = first 32 bytes of keystream block 0, data is xored with the keystream from
+    block 1 on, tag = Poly1305(header | pad16 | ciphertext | pad16 | len(header) | len(ciphertext)).
+    The stream header is authenticated as associated data of every segment.
+
+    Format:  header: "SSTR" | version u8 | variant u8 | 0 u16 | segment size u32 | salt [16]
+             segments: ciphertext [segment size] | tag [16], the last one shorter (maybe empty)
+
+    Compressed streams (version 2): every segment is LZ compressed (lz.hpp) on the worker pool
+    before it is sealed, or stored if that doesn't make it smaller. Segments still hold segment
+    size bytes of plaintext (the last one up to that), but their sealed size varies, so each is
+    framed with its length, and an index of the frame lengths follows the last one for random
+    access (SealedStreamReader). The index is sealed with the nonce of segment number n, not last,
+    for n segments; opening a stream sequentially stops after the last segment and ignores it.
+
+             frames: length u32 (bit 31 set for the last segment, the rest the payload length) |
+                     sealed payload: method u8 (0 stored, 1 LZ) | data | tag [16]
+             index: sealed plaintext size u64 | frame length u32 (prefix and tag included) per segment |
+                    tag [16] | index length u64 (without its tag)
+*/
+
+static const uint32_t STREAM_DEFAULT_SEGMENT_SIZE = 64 * 1024;
+static const uint32_t STREAM_MAX_SEGMENT_SIZE = 16 * 1024 * 1024;
+static const size_t STREAM_HEADER_LEN = 28;
+static const size_t STREAM_SALT_LEN = 16;
+static const size_t STREAM_TAG_LEN = 16;
+
+struct StreamHeader {
+    SnuffleVariant variant;
+    uint32_t segment_size;
+    uint8_t salt[STREAM_SALT_LEN];  // pick at random for every stream
+    bool compressed = false;        // version 2
+};
+
+void streamEncodeHeader(const StreamHeader& header, uint8_t out[STREAM_HEADER_LEN]);
+
+//  throws std::runtime_error if in isn't a stream header this version understands
+StreamHeader streamDecodeHeader(const uint8_t in[STREAM_HEADER_LEN]);
+
+//  key of the stream with salt (HSalsa20/HChacha20 of key and salt), what segments are sealed with
+SnuffleKeyContext streamSubkey(const SnuffleKeyContext& key, const uint8_t salt[STREAM_SALT_LEN]);
+
+//  nonce of segment index, last set for the final segment, base xored in (0 for streams)
+void streamSegmentNonce(uint8_t out[8], uint64_t base, uint64_t index, bool last);
+
+//  encrypt len bytes of buf in place and compute their tag
+void streamSealSegment(const SnuffleKeyContext& key, const uint8_t nonce[8], const uint8_t* aad, size_t aad_len,
+                       uint8_t* buf, size_t len, uint8_t tag[STREAM_TAG_LEN]);
+
+//  verify tag, then decrypt buf in place. false (buf unchanged) if the tag doesn't match
+bool streamOpenSegment(const SnuffleKeyContext& key, const uint8_t nonce[8], const uint8_t* aad, size_t aad_len,
+                       uint8_t* buf, size_t len, const uint8_t tag[STREAM_TAG_LEN]);
+
+/*  read plaintext from in_fd until end of input, write the sealed stream to out_fd
+    key is the long term key, the stream subkey is derived from it. key.variant and header.variant have to match. throws std::runtime_error on I/O errors
+    telemetry (optional) gets the pipeline stages plus "encrypt" ("decrypt" when opening) and "mac",
+    and "compress" ("decompress") for compressed streams */
+void streamSeal(int in_fd, int out_fd, const SnuffleKeyContext& key, const StreamHeader& header, WorkerPool& pool,
+                PipelineTelemetry* telemetry = nullptr);
+
+//  read and decode the header of a sealed stream from in_fd (first step of opening one)
+StreamHeader streamReadHeader(int in_fd);
+
+/*  decrypt the segments following the header on in_fd to out_fd
+    throws std::runtime_error on I/O errors, a segment failing authentication or a truncated
+    stream. Segments before a bad one have already been written when that happens: the output
+    is only to be trusted once streamOpen() returned normally. telemetry as for streamSeal() */
+void streamOpen(int in_fd, int out_fd, const SnuffleKeyContext& key, const StreamHeader& header, WorkerPool& pool,
+                PipelineTelemetry* telemetry = nullptr);
+
+/*  Random access to a sealed stream in a file: read() opens only the segments a byte range
+    touches. Segments of compressed streams are found through the index, those of plain ones
+    by their position. The last segment opened is kept, small sequential reads open each once.
+    Not thread safe */
+class SealedStreamReader {
+
+public:
+
+    /*  open path and (compressed streams) read and authenticate the index
+        throws std::runtime_error if it can't be read, isn't a sealed stream, is truncated or the
+        index fails authentication; std::invalid_argument if key is for the other cipher */
+    SealedStreamReader(const std::string& path, const SnuffleKeyContext& key);
+    ~SealedStreamReader();
+
+    SealedStreamReader(const SealedStreamReader&) = delete;
+    SealedStreamReader& operator=(const SealedStreamReader&) = delete;
+
+    const StreamHeader& header() const { return _header; }
+
+    //  plaintext bytes in the stream
+    uint64_t size() const { return _size; }
+
+    /*  up to len bytes of plaintext at offset into buf, returns the number of bytes (less at the end)
+        throws std::runtime_error on read errors and segments failing authentication */
+    size_t read(uint64_t offset, uint8_t* buf, size_t len);
+
+private:
+
+    int _fd = -1;
+    SnuffleKeyContext _key;             // subkey of the stream
+    StreamHeader _header;
+    uint8_t _aad[STREAM_HEADER_LEN];
+    uint64_t _size = 0;
+    uint64_t _nrSegments = 0;
+    std::vector<uint64_t> _frameOffsets;  // compressed: where frame i starts, one past the last for the end
+    std::vector<uint8_t> _frame, _segment;
+    uint64_t _segmentNr = UINT64_MAX;     // held in _segment
+    size_t _segmentLen = 0;
+
+    void readIndex(uint64_t file_size);
+    void loadSegment(uint64_t nr);
+};
+
+#endif // STREAM_AEAD_HPP
@@ -0,0 +1,200 @@
+#include <atomic>
+#include <memory>
+#include <stdexcept> // std::invalid_argument
+
+#include "worker_pool.hpp"
+
+using namespace std;
+
+WorkerPool::WorkerPool(unsigned nr_threads) {
+    if (nr_threads == 0)
+        nr_threads = max(1u, thread::hardware_concurrency());
+
+    _bulkThreads = max(1u, nr_threads - 1);
+    for (unsigned i=0; i<nr_threads; i++)
+        _threads.emplace_back(&WorkerPool::workerLoop, this);
+}
+
+// finishes all queued tasks and bulk jobs before the threads are joined
+WorkerPool::~WorkerPool() {
+    {
+        lock_guard<mutex> lock(_mutex);
+        _stop = true;
+    }
+    _cv.notify_all();
+    for (auto& t : _threads)
+        t.join();
+}
+
+static uint64_t nsSince(chrono::steady_clock::time_point start) {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+}
+
+// latency tasks first, then bulk slices as far as the thread limit and bandwidth cap allow
+void WorkerPool::workerLoop() {
+    unique_lock<mutex> lock(_mutex);
+    for (;;) {
+        if (!_tasks.empty()) {
+            function<void()> task = move(_tasks.front());
+            _tasks.pop_front();
+            lock.unlock();
+            auto start = chrono::steady_clock::now();
+            task();
+            _busyNs.fetch_add(nsSince(start), memory_order_relaxed);
+            lock.lock();
+            continue;
+        }
+
+        if (!_bulkJobs.empty() && _bulkRunning < _bulkThreads) {
+            if (_bulkBandwidth == 0 || chrono::steady_clock::now() >= _bulkNext)
+                runBulkSlice(lock);
+            else
+                _cv.wait_until(lock, _bulkNext);
+            continue;
+        }
+
+        if (_stop && _bulkJobs.empty())
+            return;
+        _cv.wait(lock);
+    }
+}
+
+// hand out the next slice of the first bulk job and run it, called and returns with lock held
+void WorkerPool::runBulkSlice(unique_lock<mutex>& lock) {
+    shared_ptr<BulkJob> job = _bulkJobs.front();
+    const uint64_t offset = job->next;
+    const size_t n = min<uint64_t>(job->slice, job->len - offset);
+    job->next += n;
+    if (job->next == job->len)
+        _bulkJobs.pop_front();
+    job->running++;
+    _bulkRunning++;
+
+    if (_bulkBandwidth) {
+        auto now = chrono::steady_clock::now();
+        _bulkNext = max(_bulkNext, now) + chrono::nanoseconds(n * 1000000000 / _bulkBandwidth);
+    }
+
+    lock.unlock();
+    auto start = chrono::steady_clock::now();
+    exception_ptr error;
+    try {
+        job->fn(offset, n);
+    } catch (...) {
+        error = current_exception();
+    }
+    uint64_t busy = nsSince(start);
+    _busyNs.fetch_add(busy, memory_order_relaxed);
+    _bulkBusyNs.fetch_add(busy, memory_order_relaxed);
+    lock.lock();
+
+    _bulkRunning--;
+    job->running--;
+    if (error && !job->error) {
+        // no more slices of this job
+        job->error = error;
+        if (job->next != job->len) {
+            job->next = job->len;
+            for (auto it = _bulkJobs.begin(); it != _bulkJobs.end(); ++it)
+                if (*it == job) {
+                    _bulkJobs.erase(it);
+                    break;
+                }
+        }
+    }
+    if (job->running == 0 && job->next == job->len) {
+        if (job->error)
+            job->done.set_exception(job->error);
+        else
+            job->done.set_value();
+    }
+    // a bulk thread slot is free again
+    _cv.notify_one();
+}
+
+future<void> WorkerPool::submit(function<void()> task) {
+    auto packaged = make_shared<packaged_task<void()>>(move(task));
+    future<void> result = packaged->get_future();
+    {
+        lock_guard<mutex> lock(_mutex);
+        _tasks.emplace_back([packaged] { (*packaged)(); });
+    }
+    _cv.notify_one();
+    return result;
+}
+
+future<void> WorkerPool::submitBulk(uint64_t len, function<void(uint64_t, size_t)> fn, size_t slice_bytes) {
+    if (slice_bytes == 0 || slice_bytes % 64)
+        throw invalid_argument("bulk slices have to be a non zero multiple of 64 bytes");
+
+    auto job = make_shared<BulkJob>();
+    job->len = len;
+    job->slice = slice_bytes;
+    job->fn = move(fn);
+    future<void> result = job->done.get_future();
+    if (len == 0) {
+        job->done.set_value();
+        return result;
+    }
+    {
+        lock_guard<mutex> lock(_mutex);
+        _bulkJobs.push_back(job);
+    }
+    _cv.notify_all();
+    return result;
+}
+
+void WorkerPool::setBulkBandwidth(uint64_t bytes_per_second) {
+    {
+        lock_guard<mutex> lock(_mutex);
+        _bulkBandwidth = bytes_per_second;
+        _bulkNext = chrono::steady_clock::now();
+    }
+    _cv.notify_all();
+}
+
+void WorkerPool::setBulkThreads(unsigned nr_threads) {
+    {
+        lock_guard<mutex> lock(_mutex);
+        _bulkThreads = max(1u, nr_threads);
+    }
+    _cv.notify_all();
+}
+
+/*  indices are handed out through a shared counter, so uneven work per index balances itself
+    the calling thread takes part instead of just waiting */
+void WorkerPool::parallelFor(size_t n, const function<void(size_t)>& fn) {
+    if (n == 0) return;
+
+    // an exception stops handing out further indices
+    atomic<size_t> next(0);
+    auto work = [&] {
+        try {
+            for (size_t i; (i = next.fetch_add(1)) < n;)
+                fn(i);
+        } catch (...) {
+            next = n;
+            throw;
+        }
+    };
+
+    vector<future<void>> helpers;
+    for (size_t i=1; i<min<size_t>(n, size()+1); i++)
+        helpers.push_back(submit(work));
+
+    exception_ptr error;
+    try {
+        work();
+    } catch (...) {
+        error = current_exception();
+    }
+    for (auto& h : helpers) {
+        try {
+            h.get();
+        } catch (...) {
+            if (!error) error = current_exception();
+        }
+    }
+    if (error)
+        rethrow_exception(error);
+}
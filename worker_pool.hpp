@@ -0,0 +1,98 @@
+#ifndef WORKER_POOL_HPP
+#define WORKER_POOL_HPP
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+/*  Fixed size pool of worker threads running submitted tasks in FIFO order
+
+    Used for everything that splits keystream generation or hashing over several cores.
+    Tasks must not throw across the pool, submit() transports exceptions through the future.
+
+    Two priority classes: submit() and parallelFor() are latency work, submitBulk() is bulk work
+    (backups, rekeying whole files). A bulk job is cut into slices of a byte range that start on
+    block boundaries, so each slice is an independent counter range. Workers only take a slice
+    when no latency task is queued, so latency work waits for at most one slice. Bulk slices
+    run on at most bulkThreads() workers, by default all but one, keeping a worker free for latency
+    work. setBulkBandwidth() caps the bytes per second handed out to bulk slices.
+*/
+class WorkerPool {
+
+    struct BulkJob {
+        uint64_t len;
+        size_t slice;
+        uint64_t next = 0;     // first byte not handed out yet
+        unsigned running = 0;  // slices being run
+        std::function<void(uint64_t, size_t)> fn;
+        std::promise<void> done;
+        std::exception_ptr error;
+    };
+
+    std::vector<std::thread> _threads;
+    std::deque<std::function<void()>> _tasks;
+    std::deque<std::shared_ptr<BulkJob>> _bulkJobs;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    bool _stop = false;
+
+    unsigned _bulkThreads;
+    unsigned _bulkRunning = 0;
+    uint64_t _bulkBandwidth = 0;
+    std::chrono::steady_clock::time_point _bulkNext;  // the bandwidth cap allows the next slice from then on
+
+    std::atomic<uint64_t> _busyNs{0}, _bulkBusyNs{0};
+
+    void workerLoop();
+    void runBulkSlice(std::unique_lock<std::mutex>& lock);
+
+public:
+
+    //  nr_threads == 0 -> one thread per hardware thread
+    explicit WorkerPool(unsigned nr_threads = 0);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    unsigned size() const { return _threads.size(); }
+
+    //  run task on some worker, the future becomes ready when it is done
+    std::future<void> submit(std::function<void()> task);
+
+    static const size_t DEFAULT_BULK_SLICE = 64 * 1024;
+
+    /*  bulk job over len bytes: fn(offset, n) for consecutive slices of slice_bytes, run whenever
+        no latency work is waiting. The future becomes ready when all slices are done, with the
+        first exception thrown by fn (no further slices get started after it)
+        throws std::invalid_argument if slice_bytes isn't a non zero multiple of 64 */
+    std::future<void> submitBulk(uint64_t len, std::function<void(uint64_t offset, size_t n)> fn,
+                                 size_t slice_bytes = DEFAULT_BULK_SLICE);
+
+    //  bytes per second handed out to bulk slices, 0 (the default) for no limit
+    void setBulkBandwidth(uint64_t bytes_per_second);
+
+    //  workers that may run bulk slices at the same time (at least one)
+    void setBulkThreads(unsigned nr_threads);
+    unsigned bulkThreads() const { return _bulkThreads; }
+
+    /*  time the workers spent running tasks (including bulk slices) and bulk slices alone, in ns
+        summed over the workers: over an interval, busyNs() / (interval * size()) is the utilization */
+    uint64_t busyNs() const { return _busyNs.load(std::memory_order_relaxed); }
+    uint64_t bulkBusyNs() const { return _bulkBusyNs.load(std::memory_order_relaxed); }
+
+    /*  call fn(i) for i in [0, n) on the workers and the calling thread, return when all are done
+        rethrows the first exception thrown by fn */
+    void parallelFor(size_t n, const std::function<void(size_t)>& fn);
+};
+
+#endif // WORKER_POOL_HPP